@@ -5,6 +5,7 @@
 # FUSE_INCLUDE_DIRS - fuse include directories
 # FUSE_LIBRARIES    - libraries need to use fuse
 # FUSE_MOUNT_VERSION - major version reported by fusermount
+# FUSE_VERSION_MAJOR, FUSE_VERSION_MINOR - version of the found headers
 #
 # and the following imported target
 # FUSE::FUSE
@@ -18,6 +19,21 @@ find_path(FUSE_INCLUDE_DIR
         HINTS ${FUSE_ROOT} ${PC_fuse_INCLUDEDIR} ${PC_fuse_INCLUDE_DIRS}
         PATH_SUFFIXES include include/osxfuse)
 
+# Version of the headers, newer releases of libfuse 3 define it in libfuse_config.h
+foreach(FUSE_HEADER fuse_common.h fuse/fuse_common.h libfuse_config.h fuse3/libfuse_config.h)
+    if(FUSE_INCLUDE_DIR AND EXISTS "${FUSE_INCLUDE_DIR}/${FUSE_HEADER}")
+        file(STRINGS "${FUSE_INCLUDE_DIR}/${FUSE_HEADER}" FUSE_VERSION_LINES
+                REGEX "^#define[ \t]+FUSE_M(AJ|IN)OR_VERSION[ \t]+[0-9]+")
+        foreach(FUSE_VERSION_LINE ${FUSE_VERSION_LINES})
+            if(FUSE_VERSION_LINE MATCHES "FUSE_MAJOR_VERSION[ \t]+([0-9]+)")
+                set(FUSE_VERSION_MAJOR ${CMAKE_MATCH_1})
+            elseif(FUSE_VERSION_LINE MATCHES "FUSE_MINOR_VERSION[ \t]+([0-9]+)")
+                set(FUSE_VERSION_MINOR ${CMAKE_MATCH_1})
+            endif()
+        endforeach()
+    endif()
+endforeach()
+
 if(MacOSX)
     find_library(FUSE_LIBRARY
             NAMES osxfuse
@@ -0,0 +1,111 @@
+#ifndef SRC_ATTR_CACHE_H
+#define SRC_ATTR_CACHE_H
+
+#include <sys/stat.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+#include "common/metrics.h"
+
+/**
+ * @brief Sharded cache of lstat() results of backing files
+ *
+ * Paths are stored the way the VFS sees them. Besides attributes of existing files, the cache also remembers that a
+ * path does not exist, as the decorators probe for many sidecar files which are usually missing.
+ *
+ * Entries expire after a configured time, but every operation of the VFS which changes a file has to invalidate it
+ * explicitly. A lookup which misses returns a generation which has to be passed to store(), so that attributes read
+ * while the file was being changed are never cached.
+ */
+class AttrCache {
+public:
+    enum class Result {
+        /// Nothing is known about the path
+        MISS,
+        /// The path exists, its attributes were copied out
+        HIT,
+        /// The path is known not to exist
+        NEGATIVE,
+    };
+
+    /// Creates a cache, zero ttl or capacity disables it
+    AttrCache(std::chrono::nanoseconds ttl, size_t capacity);
+
+    /// Changes the limits of the cache and drops all entries
+    void configure(std::chrono::nanoseconds ttl, size_t capacity);
+
+    AttrCache(const AttrCache &) = delete;
+    AttrCache &operator=(const AttrCache &) = delete;
+
+    /// Whether the cache stores anything at all
+    [[nodiscard]] bool enabled() const {
+        return ttl.load(std::memory_order_relaxed) > 0 && shard_capacity.load(std::memory_order_relaxed) > 0;
+    }
+
+    /// Looks up a path, on a miss generation is set to the value expected by store()
+    Result lookup(std::string_view pathname, struct stat *st, uint64_t &generation);
+
+    /// Remembers attributes of a path, nullptr remembers that the path does not exist
+    void store(std::string_view pathname, const struct stat *st, uint64_t generation);
+
+    /// Forgets a single path
+    void invalidate(std::string_view pathname);
+
+    /// Forgets a path and everything below it
+    void invalidate_tree(std::string_view pathname);
+
+    /// Forgets everything
+    void clear();
+
+    /// Number of cached entries
+    [[nodiscard]] size_t size() const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr size_t SHARD_COUNT = 16;
+
+    struct Entry {
+        bool exists;
+        struct stat st;
+        Clock::time_point expires;
+    };
+
+    struct Shard {
+        mutable std::mutex mutex;
+        /// Ordered with a transparent comparator, so that lookups by string_view do not allocate
+        std::map<std::string, Entry, std::less<>> entries;
+
+        /// Bumped by every invalidation of the shard
+        uint64_t generation = 0;
+    };
+
+    /// Strips leading slashes, so that "/a" and "a" share an entry
+    static std::string_view normalize(std::string_view pathname);
+
+    Shard &shard_of(std::string_view key);
+
+    /// Makes room for a new entry in a full shard, the shard has to be locked
+    void evict(Shard &shard, size_t capacity, Clock::time_point now) const;
+
+    /// Lifetime of an entry in nanoseconds
+    std::atomic<int64_t> ttl;
+    std::atomic<size_t> shard_capacity;
+    std::array<Shard, SHARD_COUNT> shards;
+
+    Metrics::Counter &hits;
+    Metrics::Counter &negative_hits;
+    Metrics::Counter &misses;
+    Metrics::Counter &invalidations;
+};
+
+#endif  // SRC_ATTR_CACHE_H
@@ -0,0 +1,56 @@
+#ifndef SRC_BACKEND_HELPERS_H
+#define SRC_BACKEND_HELPERS_H
+
+#include <fcntl.h>
+
+#include <ctime>
+#include <mutex>
+
+/// Small helpers shared by the storage backends
+namespace BackendHelpers {
+
+/// Whether open flags allow writing
+inline bool is_writable(int flags) {
+    return (flags & O_ACCMODE) != O_RDONLY;
+}
+
+inline bool same_time(const struct timespec &a, const struct timespec &b) {
+    return a.tv_sec == b.tv_sec && a.tv_nsec == b.tv_nsec;
+}
+
+/// Current wall clock time, as stored in file attributes
+inline struct timespec now() {
+    struct timespec ts {};
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts;
+}
+
+/// Locks the stripes of two paths, which may be the same stripe, without risking a deadlock
+class PairLock {
+public:
+    PairLock(std::mutex &first, std::mutex &second) : first(first), second(&first == &second ? nullptr : &second) {
+        if (this->second == nullptr) {
+            first.lock();
+        } else {
+            std::lock(first, second);
+        }
+    }
+
+    ~PairLock() {
+        first.unlock();
+        if (second != nullptr) {
+            second->unlock();
+        }
+    }
+
+    PairLock(const PairLock &) = delete;
+    PairLock &operator=(const PairLock &) = delete;
+
+private:
+    std::mutex &first;
+    std::mutex *second;
+};
+
+}  // namespace BackendHelpers
+
+#endif  // SRC_BACKEND_HELPERS_H
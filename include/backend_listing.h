@@ -0,0 +1,67 @@
+#ifndef SRC_BACKEND_LISTING_H
+#define SRC_BACKEND_LISTING_H
+
+#include <sys/stat.h>
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+#include "dir_handle.h"
+#include "storage_backend.h"
+
+/**
+ * @brief Open directory holding a snapshot of its entries taken by opendir()
+ *
+ * For backends which put listings together from several stores, or from a store and an index of their own. The
+ * entries are collected once and readdir() is served from the snapshot, looking up attributes only for the entries
+ * whose attributes are wanted. The offset of an entry is the index of the one after it.
+ */
+class SnapshotListing : public DirHandle {
+public:
+    struct Item {
+        std::string name;
+
+        /// Attributes seen when the snapshot was taken, at least the file type when it is known without a lookup
+        struct stat st;
+    };
+
+    /// Collects the entries of directories of several stores, skipping names seen in an earlier one
+    class Collector : public StorageBackend::DirFiller {
+    public:
+        /// @param hidden Name left out of listings of the root
+        explicit Collector(SnapshotListing &listing, std::string_view hidden = {});
+
+        bool wants_attributes(std::string_view name) override;
+        int add(std::string_view name, const struct stat *st, off_t next, bool attributes) override;
+
+    private:
+        SnapshotListing &listing;
+        const std::string hidden;
+        std::unordered_set<std::string> seen;
+    };
+
+    explicit SnapshotListing(std::string_view path);
+
+    /// Adds an entry of which only the file type is known, 0 if not even that
+    void add(std::string name, mode_t type);
+
+    /// Passes the entries from an offset on to a filler, entries removed since the snapshot are skipped
+    int read(StorageBackend &backend, off_t offset, StorageBackend::DirFiller &filler) const;
+
+    const std::string path;
+    std::vector<Item> items;
+};
+
+/// Directory stream of an inner store together with the path it lists, for backends which adjust its entries
+class InnerListing : public DirHandle {
+public:
+    InnerListing(std::unique_ptr<DirHandle> inner, std::string_view path);
+
+    std::unique_ptr<DirHandle> inner;
+    const std::string path;
+};
+
+#endif  // SRC_BACKEND_LISTING_H
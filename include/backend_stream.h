@@ -0,0 +1,80 @@
+#ifndef SRC_BACKEND_STREAM_H
+#define SRC_BACKEND_STREAM_H
+
+#include <functional>
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+#include "storage_backend.h"
+
+/**
+ * @brief Buffered sequential access to a file opened through a StorageBackend
+ */
+class BackendStreamBuf : public std::streambuf {
+public:
+    static constexpr size_t BUFFER_SIZE = 64 * 1024;
+
+    /// Opens a file with open() flags, is_open() tells whether it succeeded
+    BackendStreamBuf(std::shared_ptr<StorageBackend> backend, const std::string &path, int flags);
+    ~BackendStreamBuf() override;
+
+    [[nodiscard]] bool is_open() const {
+        return handle != nullptr;
+    }
+
+    /// Writes out buffered data and closes the file, returns false if anything failed
+    bool close();
+
+protected:
+    int_type underflow() override;
+    int_type overflow(int_type c) override;
+    int sync() override;
+
+private:
+    std::shared_ptr<StorageBackend> backend;
+    std::unique_ptr<FileHandle> handle;
+    std::vector<char> buffer;
+
+    /// Offset in the file where the buffer starts
+    off_t position = 0;
+};
+
+/// Input stream reading a file of a StorageBackend
+class BackendIstream : public std::istream {
+public:
+    BackendIstream(std::shared_ptr<StorageBackend> backend, const std::string &path);
+
+    [[nodiscard]] bool is_open() const {
+        return buf.is_open();
+    }
+
+    void close();
+
+private:
+    BackendStreamBuf buf;
+};
+
+/// Output stream writing a file of a StorageBackend, the file is created or truncated unless appending
+class BackendOstream : public std::ostream {
+public:
+    /// on_close is called once the written data reached the backend
+    BackendOstream(std::shared_ptr<StorageBackend> backend, const std::string &path, std::ios_base::openmode mode,
+                   std::function<void()> on_close = {});
+    ~BackendOstream() override;
+
+    [[nodiscard]] bool is_open() const {
+        return buf.is_open();
+    }
+
+    void close();
+
+private:
+    BackendStreamBuf buf;
+    std::function<void()> on_close;
+};
+
+#endif  // SRC_BACKEND_STREAM_H
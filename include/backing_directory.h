@@ -0,0 +1,107 @@
+#ifndef SRC_BACKING_DIRECTORY_H
+#define SRC_BACKING_DIRECTORY_H
+
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+/**
+ * @brief Pinned descriptor of the backing directory used for *at() syscalls
+ *
+ * Paths are resolved relative to an O_PATH descriptor opened once, so the kernel walks only the part of the path below
+ * the backing directory and renaming or swapping anything above it does not redirect I/O.
+ *
+ * Descriptors of parent directories can optionally be cached as well. The cache assumes that the backing directory is
+ * modified only through the VFS. Cached descriptors are opened following symbolic links, so the VFS has to call
+ * invalidate() whenever a name that may be a directory or a symbolic link is renamed, removed or created.
+ */
+class BackingDirectory {
+public:
+    /// Owned directory descriptor, closed when the last user releases it
+    class Descriptor {
+    public:
+        explicit Descriptor(int fd) : fd_(fd) {}
+        ~Descriptor();
+
+        Descriptor(const Descriptor &) = delete;
+        Descriptor &operator=(const Descriptor &) = delete;
+
+        [[nodiscard]] int fd() const {
+            return fd_;
+        }
+
+    private:
+        int fd_;
+    };
+
+    /// A path split into a directory descriptor and a name relative to it
+    class Location {
+    public:
+        Location(std::shared_ptr<const Descriptor> directory, std::string_view name);
+
+        [[nodiscard]] int dirfd() const {
+            return directory->fd();
+        }
+
+        [[nodiscard]] const char *name() const {
+            return overflow.empty() ? buffer : overflow.c_str();
+        }
+
+    private:
+        std::shared_ptr<const Descriptor> directory;
+        char buffer[PATH_MAX];
+
+        /// Holds names which do not fit into the buffer, the kernel rejects them with ENAMETOOLONG
+        std::string overflow;
+    };
+
+    /// Opens the backing directory, throws if it cannot be opened
+    explicit BackingDirectory(const std::string &path);
+
+    BackingDirectory(const BackingDirectory &) = delete;
+    BackingDirectory &operator=(const BackingDirectory &) = delete;
+
+    /// Descriptor of the backing directory itself
+    [[nodiscard]] int root_fd() const {
+        return root->fd();
+    }
+
+    /// Resolves a VFS path, the root itself resolves to "."
+    [[nodiscard]] Location resolve(std::string_view pathname) const;
+
+    /// Sets how many parent directory descriptors are kept open, 0 disables the cache
+    void set_cache_capacity(size_t capacity);
+
+    /// Drops cached descriptors of a directory and of everything below it
+    void invalidate(std::string_view directory);
+
+    /// Number of parent directory descriptors currently cached
+    [[nodiscard]] size_t cached() const;
+
+private:
+    /// Returns a cached or freshly opened descriptor of a directory relative to the root, nullptr on failure
+    std::shared_ptr<const Descriptor> parent(std::string_view directory) const;
+
+    struct CacheEntry {
+        std::shared_ptr<const Descriptor> descriptor;
+        std::list<std::string>::iterator position;
+    };
+
+    std::shared_ptr<const Descriptor> root;
+
+    mutable std::mutex cache_mutex;
+    size_t capacity = 0;
+    uint64_t generation = 0;
+
+    /// Cached paths, most recently used first, keys of the map point into them
+    mutable std::list<std::string> recency;
+    mutable std::unordered_map<std::string_view, CacheEntry> cache;
+};
+
+#endif  // SRC_BACKING_DIRECTORY_H
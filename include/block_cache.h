@@ -0,0 +1,133 @@
+#ifndef SRC_BLOCK_CACHE_H
+#define SRC_BLOCK_CACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "common/metrics.h"
+
+/**
+ * @brief Bounded cache of file blocks with ARC replacement, split into independently locked shards
+ *
+ * Each shard runs the Adaptive Replacement Cache of Megiddo and Modha: blocks seen once and blocks seen again are kept
+ * in separate LRU lists, and the recently evicted keys of both are remembered without their data. A miss on a
+ * remembered key shifts space towards the list it was evicted from, so a scan of a large file cannot push out the
+ * blocks which are read over and over.
+ *
+ * Blocks are immutable once inserted and shared with readers, so a block stays valid for a reader even if it is
+ * evicted or replaced meanwhile.
+ */
+class BlockCache {
+public:
+    using Block = std::vector<char>;
+
+    /// Block of a file, files are numbered by the user of the cache
+    struct Key {
+        uint64_t file;
+        uint64_t index;
+
+        bool operator==(const Key &other) const {
+            return file == other.file && index == other.index;
+        }
+    };
+
+    struct Statistics {
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t evictions;
+
+        /// Bytes of the cached blocks and the most they may take
+        uint64_t bytes;
+        uint64_t capacity;
+
+        [[nodiscard]] double hit_ratio() const {
+            return hits + misses == 0 ? 0.0 : static_cast<double>(hits) / static_cast<double>(hits + misses);
+        }
+    };
+
+    /**
+     * @param capacity Bytes of blocks the cache holds at most
+     * @param block_size Size of a full block, blocks at the end of a file may be shorter
+     * @param shards Number of independently locked parts, each holds an equal share of the capacity
+     */
+    BlockCache(size_t capacity, size_t block_size, size_t shards);
+
+    BlockCache(const BlockCache &) = delete;
+    BlockCache &operator=(const BlockCache &) = delete;
+
+    [[nodiscard]] size_t block_size() const {
+        return block_size_;
+    }
+
+    /// Returns a cached block or nullptr, counting a hit or a miss
+    std::shared_ptr<const Block> find(const Key &key);
+
+    /// Caches a block, replacing a cached block under the same key
+    void insert(const Key &key, std::shared_ptr<const Block> block);
+
+    /// Drops a block if it is cached
+    void erase(const Key &key);
+
+    [[nodiscard]] Statistics statistics() const;
+
+private:
+    struct KeyHash {
+        size_t operator()(const Key &key) const {
+            return std::hash<uint64_t>()(key.file * 0x9e3779b97f4a7c15ULL ^ key.index);
+        }
+    };
+
+    /// Lists of ARC, T1 and T2 hold cached blocks, B1 and B2 the keys recently evicted from them
+    enum List : uint8_t { T1, T2, B1, B2 };
+
+    struct Entry {
+        List list;
+        std::list<Key>::iterator position;
+        std::shared_ptr<const Block> block;
+    };
+
+    struct Shard {
+        std::mutex mutex;
+
+        /// Most recently used key first
+        std::list<Key> lists[4];
+        std::unordered_map<Key, Entry, KeyHash> entries;
+
+        /// Target size of T1, adapted by misses on keys in B1 and B2
+        size_t target = 0;
+        uint64_t bytes = 0;
+
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t evictions = 0;
+    };
+
+    Shard &shard_of(const Key &key);
+
+    /// Moves an entry to the front of a list
+    static void move(Shard &shard, Entry &entry, List list);
+
+    /// Evicts the least recently used block of T1 or T2 to make room, keeping its key in B1 or B2
+    void replace(Shard &shard, bool in_b2);
+
+    /// Forgets the least recently used key of a list, with its block if it is cached
+    static void drop_last(Shard &shard, List list);
+
+    const size_t block_size_;
+
+    /// Blocks per shard
+    const size_t shard_capacity;
+
+    std::vector<std::unique_ptr<Shard>> shards;
+
+    Metrics::Counter &hit_counter;
+    Metrics::Counter &miss_counter;
+    Metrics::Counter &eviction_counter;
+};
+
+#endif  // SRC_BLOCK_CACHE_H
@@ -0,0 +1,142 @@
+#ifndef SRC_CACHED_BACKEND_H
+#define SRC_CACHED_BACKEND_H
+
+#include <sys/stat.h>
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "block_cache.h"
+#include "storage_backend.h"
+
+/**
+ * @brief Backend keeping recently and frequently read blocks of files in memory
+ *
+ * Meant for stores where a read costs more than a copy, like the chunked and packed backends which assemble files from
+ * other files, several backing directories or a slow capacity tier. Reads are split into blocks of a fixed size which
+ * are served from a BlockCache and fetched whole from the inner store on a miss.
+ *
+ * Blocks belong to files rather than paths, so renames keep them and hard links share them. Writes and truncations
+ * through this backend drop the blocks they touch. Changes made to the inner store behind its back are noticed when the
+ * file is opened next, by its size and modification time: the blocks are dropped then and handles opened before read
+ * from the store directly.
+ */
+class CachedBackend : public StorageBackend {
+public:
+    /// Size of the blocks unless another one is given
+    static constexpr size_t DEFAULT_BLOCK_SIZE = 64 << 10;
+
+    /// Number of independently locked parts of the cache
+    static constexpr size_t SHARDS = 16;
+
+    /**
+     * @param inner Store holding the files
+     * @param capacity Bytes of blocks kept in memory at most
+     */
+    CachedBackend(std::shared_ptr<StorageBackend> inner, size_t capacity, size_t block_size = DEFAULT_BLOCK_SIZE);
+
+    CachedBackend(const CachedBackend &) = delete;
+    CachedBackend &operator=(const CachedBackend &) = delete;
+
+    /// Hits, misses and memory use of the cache
+    [[nodiscard]] BlockCache::Statistics statistics() const;
+
+    int open(std::string_view path, int flags, mode_t mode, std::unique_ptr<FileHandle> &handle) override;
+    ssize_t pread(FileHandle &handle, void *buf, size_t count, off_t offset) override;
+    ssize_t pwrite(FileHandle &handle, const void *buf, size_t count, off_t offset) override;
+    int ftruncate(FileHandle &handle, off_t length) override;
+    int fsync(FileHandle &handle, bool datasync) override;
+    int release(FileHandle &handle) override;
+    int fstat(FileHandle &handle, struct stat *st) override;
+    int prefetch(FileHandle &handle, off_t offset, size_t length) override;
+    int truncate(std::string_view path, off_t length) override;
+    int copy(std::string_view source, std::string_view destination) override;
+
+    int stat(std::string_view path, struct stat *st, bool follow) override;
+    int utimens(std::string_view path, const struct timespec tv[2]) override;
+    int chmod(std::string_view path, mode_t mode) override;
+    int chown(std::string_view path, uid_t uid, gid_t gid) override;
+    int statfs(struct statvfs *stbuf) override;
+
+    int mknod(std::string_view path, mode_t mode, dev_t dev) override;
+    int rename(std::string_view oldpath, std::string_view newpath, unsigned int flags) override;
+    int link(std::string_view oldpath, std::string_view newpath) override;
+    int unlink(std::string_view path) override;
+    int symlink(std::string_view target, std::string_view linkpath) override;
+    int readlink(std::string_view path, char *buf, size_t size) override;
+
+    int mkdir(std::string_view path, mode_t mode) override;
+    int rmdir(std::string_view path) override;
+    int list(std::string_view path, std::vector<std::string> &names) override;
+    int list_sidecars(std::string_view directory, std::string_view name, std::vector<std::string> &names) override;
+    [[nodiscard]] bool separates_sidecars() const override;
+    int opendir(std::string_view path, std::unique_ptr<DirHandle> &handle) override;
+    int readdir(DirHandle &handle, off_t offset, DirFiller &filler) override;
+
+    int syncfs() override;
+
+    /// Always false, reads have to pass through the cache
+    [[nodiscard]] bool allows_splice() const override;
+
+private:
+    struct Cached;
+
+    /// What the cache knows about a file of the inner store, shared by all handles of the file
+    struct Record {
+        /// Bumped when the file was changed behind the cache, handles opened before no longer use the cache
+        std::atomic<uint64_t> version{0};
+
+        /// Number of the file in the block cache, replaced to drop all its blocks at once
+        std::atomic<uint64_t> id{0};
+
+        /// Bumped by every change, so a block fetched during a change is not kept
+        std::atomic<uint64_t> generation{0};
+
+        std::mutex mutex;
+
+        /// Size and modification time when the file was last opened
+        off_t size = 0;
+        struct timespec mtime {};
+
+        /// Whether the file was changed through the cache since, which leaves the time above outdated
+        bool changed = false;
+    };
+
+    /// Record of an opened file, dropping its blocks if the file changed since it was last opened
+    std::shared_ptr<Record> track(const struct stat &st, bool truncated, uint64_t &version);
+
+    /// Record of a file if one is kept
+    std::shared_ptr<Record> find_record(const struct stat &st);
+
+    /// Record of the file a handle was opened on, or nullptr
+    static Record *record_of(FileHandle &handle);
+
+    /// Record of a handle if the handle may read through the cache
+    static Record *usable(FileHandle &handle);
+
+    /// Drops the blocks overlapping a range written through the cache
+    void written(Record &record, off_t offset, size_t count);
+
+    /// Drops the blocks of a file beyond a new length
+    void truncated(Record &record, off_t length);
+
+    /// Reads a whole block from the inner store, returns its length or -errno
+    ssize_t fetch(FileHandle &handle, BlockCache::Block &block, uint64_t index);
+
+    std::shared_ptr<StorageBackend> inner;
+    BlockCache cache;
+
+    /// Records without open handles kept at most, beyond that they are forgotten and their blocks age out
+    const size_t max_records;
+
+    std::mutex records_mutex;
+    std::map<std::pair<dev_t, ino_t>, std::shared_ptr<Record>> records;
+    std::atomic<uint64_t> next_id{0};
+};
+
+#endif  // SRC_CACHED_BACKEND_H
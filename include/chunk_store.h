@@ -0,0 +1,128 @@
+#ifndef SRC_CHUNK_STORE_H
+#define SRC_CHUNK_STORE_H
+
+#include <sys/types.h>
+
+#include <array>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief Chunks of file data stored once per distinct content
+ *
+ * Every chunk is a file named after the BLAKE2b hash of its content, fanned out over 256 subdirectories. Chunks are
+ * reference counted by the manifests using them and pinned by open readers, a chunk is deleted once neither is left.
+ *
+ * Reference counts are kept in memory and saved when the store is closed. A store which was not closed cleanly starts
+ * without counts, they then have to be rebuilt from all manifests with add_reference() before sweep() deletes the
+ * chunks nothing refers to.
+ */
+class ChunkStore {
+public:
+    static constexpr size_t HASH_SIZE = 32;
+    using Hash = std::array<unsigned char, HASH_SIZE>;
+
+    /// A file as a sequence of chunks
+    struct Manifest {
+        struct Piece {
+            Hash hash;
+            uint32_t length;
+        };
+
+        uint64_t size = 0;
+        std::vector<Piece> pieces;
+
+        /// Encodes the manifest as the content of a file
+        [[nodiscard]] std::string serialize() const;
+
+        /// Decodes a manifest, returns false if data is not one
+        bool parse(const std::string &data);
+
+        /// Size of a manifest file stored in its first bytes, returns false if data is not a manifest
+        static bool parse_size(const char *data, size_t length, uint64_t &size);
+
+        /// Bytes at the start of a manifest file which parse_size() needs
+        static constexpr size_t HEADER_SIZE = 16;
+    };
+
+    /// Opens or creates a store in a directory, throws if it cannot be used
+    explicit ChunkStore(const std::string &directory);
+    ~ChunkStore();
+
+    ChunkStore(const ChunkStore &) = delete;
+    ChunkStore &operator=(const ChunkStore &) = delete;
+
+    /// Whether the reference counts were loaded, otherwise they have to be rebuilt before sweep()
+    [[nodiscard]] bool counts_loaded() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return loaded;
+    }
+
+    /// Stores a chunk unless an identical one exists and adds a reference to it, returns 0 or -errno
+    int put(const char *data, size_t length, Hash &hash);
+
+    /// Adds a reference to a stored chunk
+    void add_reference(const Hash &hash);
+
+    /// Drops a reference, the chunk is deleted once it is neither referenced nor pinned
+    void release(const Hash &hash);
+
+    /// Keeps a chunk readable while a file using it is open
+    void pin(const Hash &hash);
+    void unpin(const Hash &hash);
+
+    /// Reads from a chunk, returns the byte count or -errno
+    ssize_t read(const Hash &hash, void *buf, size_t count, off_t offset) const;
+
+    /// Asks the kernel to read a range of a chunk ahead, returns 0 or -errno
+    int prefetch(const Hash &hash, off_t offset, size_t count) const;
+
+    /// Makes all stored chunks durable, returns 0 or -errno
+    int sync();
+
+    /// Deletes chunk files which are not referenced once the counts are complete, returns how many were deleted
+    size_t sweep();
+
+    /// Number of distinct chunks and their total size
+    void usage(size_t &chunks, uint64_t &bytes) const;
+
+    [[nodiscard]] std::string path(const Hash &hash) const;
+
+private:
+    struct HashKey {
+        size_t operator()(const Hash &hash) const;
+    };
+
+    struct Chunk {
+        uint32_t references = 0;
+        uint32_t pins = 0;
+        uint32_t length = 0;
+    };
+
+    /// Deletes a chunk without references or pins, the lock has to be held
+    void drop(std::unordered_map<Hash, Chunk, HashKey>::iterator it);
+
+    void load_counts();
+    void save_counts();
+
+    const std::string directory;
+
+    /// Descriptor of the store directory for syncfs()
+    int fd;
+
+    mutable std::mutex mutex;
+
+    /// Whether the counts are complete, protected by the lock
+    bool loaded = false;
+
+    std::unordered_map<Hash, Chunk, HashKey> chunks;
+    uint64_t bytes = 0;
+
+    /// Names temporary files of chunks being written
+    uint64_t next_temp = 0;
+};
+
+#endif  // SRC_CHUNK_STORE_H
@@ -0,0 +1,210 @@
+#ifndef SRC_CHUNKED_BACKEND_H
+#define SRC_CHUNKED_BACKEND_H
+
+#include <sys/stat.h>
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "chunk_store.h"
+#include "chunker.h"
+#include "storage_backend.h"
+
+/**
+ * @brief Backend storing file data as deduplicated content-defined chunks
+ *
+ * Directories, links and the names of files stay in another backend. Once the last writer of a regular file closes it,
+ * a background thread splits its data into chunks with a rolling hash and stores each chunk once in a ChunkStore. The
+ * file itself is then replaced by a manifest listing its chunks, which is marked by the sticky bit so attribute lookups
+ * tell chunked files apart without reading them. Copies of chunked files, which is how versions are made, only write a
+ * new manifest sharing all chunks, copies of plain files are chunked in the background like written files.
+ *
+ * A file stays plain until the chunks of its manifest were synced, so chunking never makes data less durable than the
+ * durability mode promised for the plain file. Opening a chunked file for writing, truncating or linking it turns it
+ * back into a plain file, readers keep reading the chunks they opened.
+ *
+ * The chunk directory lives in the root of the inner store under CHUNK_DIRECTORY and is hidden from the VFS.
+ */
+class ChunkedBackend : public StorageBackend {
+public:
+    /// Name of the directory in the root of the store holding the chunks
+    static constexpr const char *CHUNK_DIRECTORY = ".chunks";
+
+    /// Number of locks serializing chunking with other operations on the same path
+    static constexpr size_t PATH_LOCKS = 64;
+
+    /// Manifests waiting for their chunks to be synced before the sync is forced
+    static constexpr size_t MAX_PENDING = 256;
+
+    /// Files waiting to be chunked at most, files closed beyond that stay plain until they are written again
+    static constexpr size_t MAX_QUEUED = 4096;
+
+    /**
+     * @param inner Store keeping directories, links and the plain files and manifests
+     * @param chunk_directory Host directory holding the chunks, usually CHUNK_DIRECTORY in the root of inner
+     * @param average_chunk Average chunk size, files smaller than a quarter of it are not chunked
+     */
+    ChunkedBackend(std::shared_ptr<StorageBackend> inner, const std::string &chunk_directory, size_t average_chunk);
+    ~ChunkedBackend() override;
+
+    ChunkedBackend(const ChunkedBackend &) = delete;
+    ChunkedBackend &operator=(const ChunkedBackend &) = delete;
+
+    [[nodiscard]] ChunkStore &chunks() {
+        return *store;
+    }
+
+    /// Chunks the files queued so far and installs the manifests of files chunked since the last sync
+    int settle();
+
+    int open(std::string_view path, int flags, mode_t mode, std::unique_ptr<FileHandle> &handle) override;
+    ssize_t pread(FileHandle &handle, void *buf, size_t count, off_t offset) override;
+    ssize_t pwrite(FileHandle &handle, const void *buf, size_t count, off_t offset) override;
+    int ftruncate(FileHandle &handle, off_t length) override;
+    int fsync(FileHandle &handle, bool datasync) override;
+    int release(FileHandle &handle) override;
+    int fstat(FileHandle &handle, struct stat *st) override;
+    int prefetch(FileHandle &handle, off_t offset, size_t length) override;
+    int truncate(std::string_view path, off_t length) override;
+    int copy(std::string_view source, std::string_view destination) override;
+
+    int stat(std::string_view path, struct stat *st, bool follow) override;
+    int utimens(std::string_view path, const struct timespec tv[2]) override;
+    int chmod(std::string_view path, mode_t mode) override;
+    int chown(std::string_view path, uid_t uid, gid_t gid) override;
+    int statfs(struct statvfs *stbuf) override;
+
+    int mknod(std::string_view path, mode_t mode, dev_t dev) override;
+    int rename(std::string_view oldpath, std::string_view newpath, unsigned int flags) override;
+    int link(std::string_view oldpath, std::string_view newpath) override;
+    int unlink(std::string_view path) override;
+    int symlink(std::string_view target, std::string_view linkpath) override;
+    int readlink(std::string_view path, char *buf, size_t size) override;
+
+    int mkdir(std::string_view path, mode_t mode) override;
+    int rmdir(std::string_view path) override;
+    int list(std::string_view path, std::vector<std::string> &names) override;
+    int opendir(std::string_view path, std::unique_ptr<DirHandle> &handle) override;
+    int readdir(DirHandle &handle, off_t offset, DirFiller &filler) override;
+
+    int syncfs() override;
+
+    [[nodiscard]] bool allows_splice() const override;
+
+private:
+    class ChunkedHandle;
+    class Filler;
+    struct Writer;
+
+    /// A manifest written next to the store, installed over its file once its chunks are durable
+    struct Pending {
+        std::string staging;
+        ino_t ino;
+        struct timespec ctime;
+        ChunkStore::Manifest manifest;
+    };
+
+    static bool is_chunked(const struct stat &st) {
+        return S_ISREG(st.st_mode) && (st.st_mode & S_ISVTX) != 0;
+    }
+
+    /// Whether a path is the chunk directory or inside it
+    static bool hidden(std::string_view path);
+
+    std::mutex &path_lock(std::string_view path);
+
+    /// Turns attributes of a manifest into those of the file it describes
+    void fix_attributes(std::string_view path, struct stat *st);
+
+    /// Reads the manifest stored at a path, returns 0 or -errno
+    int load_manifest(std::string_view path, ChunkStore::Manifest &manifest);
+
+    /// Writes a manifest to a new staging file, returns 0 or -errno
+    int write_manifest(const ChunkStore::Manifest &manifest, const struct stat &attributes, std::string &staging);
+
+    /// Splits the data of a plain file into stored chunks, returns 0 or -errno
+    int split(std::string_view path, ChunkStore::Manifest &manifest);
+
+    /// Drops the references of a manifest
+    void release_manifest(const ChunkStore::Manifest &manifest);
+
+    /// Chunks a plain file, ino guards against it being replaced since it was written or is 0
+    void chunk(const std::string &path, ino_t ino);
+
+    /// Queues a plain file for chunking in the background, ino as for chunk()
+    void enqueue(std::string_view path, ino_t ino);
+
+    /// Chunks the files queued so far
+    void chunk_queued();
+
+    /// Installs the manifests waiting for their chunks to be synced
+    int install_pending();
+
+    /// Chunks queued files until the backend is destroyed
+    void chunking_loop();
+
+    /// Turns a chunked file back into a plain one, with empty content when truncate is set, returns 0 or -errno
+    int expand(std::string_view path, bool truncate);
+
+    /// Drops the manifest about to replace a file which changes again, the path lock has to be held
+    void cancel_pending(std::string_view path);
+
+    /// Whether a file has writable handles open
+    bool being_written(ino_t ino);
+
+    /// Moves the names of files being written to where a rename put them
+    void renamed(std::string_view oldpath, std::string_view newpath, bool exchange);
+
+    /// Rebuilds the reference counts of a store which was not closed cleanly
+    void rebuild(const std::string &directory);
+
+    std::shared_ptr<StorageBackend> inner;
+    std::unique_ptr<ChunkStore> store;
+    Chunker chunker;
+
+    /// Path of the staging directory in the inner store
+    std::string staging_directory;
+    std::atomic<uint64_t> next_staging{0};
+
+    std::array<std::mutex, PATH_LOCKS> path_locks;
+
+    /// Open writable handles of a file and the name it is queued under once they are closed
+    struct Written {
+        size_t handles = 0;
+        std::string path;
+    };
+
+    /// Files with writable handles keyed by inode number, so that they stay found across renames
+    std::mutex writers_mutex;
+    std::unordered_map<ino_t, Written> writers;
+
+    std::mutex pending_mutex;
+    std::map<std::string, Pending, std::less<>> pending;
+
+    /// Serializes chunking runs and installs, so that a sync waits for the files the thread is busy with
+    std::mutex chunking_mutex;
+
+    /// Sizes of chunked files keyed by the inode number of their manifest, valid while its ctime is unchanged
+    struct CachedSize {
+        struct timespec ctime;
+        uint64_t size;
+    };
+    std::mutex sizes_mutex;
+    std::unordered_map<ino_t, CachedSize> sizes;
+
+    std::mutex thread_mutex;
+    std::condition_variable wakeup;
+    std::map<std::string, ino_t, std::less<>> queued;
+    bool stopping = false;
+    std::thread chunking;
+};
+
+#endif  // SRC_CHUNKED_BACKEND_H
@@ -0,0 +1,44 @@
+#ifndef SRC_CHUNKER_H
+#define SRC_CHUNKER_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @brief Content-defined chunking with a gear rolling hash
+ *
+ * A boundary is placed where the hash of the bytes before it has all bits of a mask cleared, so boundaries depend on
+ * the surrounding content only. Inserting or removing bytes shifts the chunks around the change and leaves all others
+ * identical, which is what lets similar files share chunks.
+ */
+class Chunker {
+public:
+    /// Chunks are between a quarter and four times the average size apart from the last one of a file
+    explicit Chunker(size_t average_size);
+
+    [[nodiscard]] size_t min_size() const {
+        return min;
+    }
+
+    [[nodiscard]] size_t max_size() const {
+        return max;
+    }
+
+    /**
+     * @brief Finds the length of the chunk starting at data
+     *
+     * @param last Whether the data runs up to the end of the file
+     * @return Length of the chunk or 0 if more data is needed to find its end
+     */
+    [[nodiscard]] size_t cut(const char *data, size_t length, bool last) const;
+
+private:
+    static const std::array<uint64_t, 256> &gear();
+
+    size_t min;
+    size_t max;
+    uint64_t mask;
+};
+
+#endif  // SRC_CHUNKER_H
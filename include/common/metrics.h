@@ -0,0 +1,39 @@
+#ifndef SRC_METRICS_H
+#define SRC_METRICS_H
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief Process wide registry of named counters
+ *
+ * Counters are created on first use and live until the process exits, so components can keep a reference to them and
+ * increment it without any lookup.
+ */
+class Metrics {
+public:
+    using Counter = std::atomic<uint64_t>;
+
+    /// Returns a counter registered under a given name
+    static Counter &counter(const std::string &name);
+
+    /// Returns the current values of all counters sorted by name
+    static std::vector<std::pair<std::string, uint64_t>> snapshot();
+
+    /// Logs the values of all non-zero counters with info level
+    static void log();
+
+private:
+    static Metrics &instance();
+
+    std::mutex mutex;
+    std::map<std::string, std::unique_ptr<Counter>> counters;
+};
+
+#endif  // SRC_METRICS_H
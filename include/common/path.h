@@ -3,6 +3,8 @@
 
 #include <algorithm>
 #include <filesystem>
+#include <string>
+#include <string_view>
 
 /**
  * @brief Custom lightweight class to handle paths with implicit conversion to std::string
@@ -27,6 +29,18 @@ public:
     /// @brief Returns basename as a string
     [[nodiscard]] static std::string string_basename(const std::string& path);
 
+    /// @brief Returns basename as a view into the given path
+    [[nodiscard]] static std::string_view view_basename(std::string_view path);
+
+    /// @brief Returns path to parent directory as a view into the given path, "/" for entries of the root
+    [[nodiscard]] static std::string_view view_parent(std::string_view path);
+
+    /// @brief Appends a name to a directory path with exactly one slash between them
+    [[nodiscard]] static std::string join(std::string_view directory, std::string_view name);
+
+    /// @brief Whether a path names the root directory
+    [[nodiscard]] static bool is_root(std::string_view path);
+
     /// @brief Explicitly converts to std::string
     [[nodiscard]] std::string to_string() const;
 
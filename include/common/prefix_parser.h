@@ -2,6 +2,7 @@
 #define SRC_PREFIX_PARSER_H
 
 #include <string>
+#include <string_view>
 #include <vector>
 
 #include "path.h"
@@ -34,12 +35,12 @@ public:
      * @brief Returns whether a path contains a prefix
      * @example contains_prefix("#ENCRYPTION-1#/home/user/file.txt", "ENCRYPTION") -> true
      */
-    static bool contains_prefix(const std::string& path, const std::string& module_name);
+    static bool contains_prefix(std::string_view path, std::string_view module_name);
 
     /**
      * @brief Returns whether a path is prefixed with anything
      */
-    static bool is_prefixed(const std::string& path);
+    static bool is_prefixed(std::string_view path);
 
     /**
      * @brief Returns the path without the prefix
@@ -1,61 +1,130 @@
 #ifndef SRC_CUSTOM_VFS_H
 #define SRC_CUSTOM_VFS_H
 
+#include <atomic>
+#include <chrono>
+#include <memory>
 #include <string>
+#include <string_view>
 #include <vector>
 
+#include "attr_cache.h"
+#include "backend_stream.h"
+#include "dir_listing_cache.h"
 #include "common/path.h"
+#include "file_handle.h"
 #include "fuse_wrapper.h"
+#include "io_engine.h"
+#include "read_ahead.h"
+#include "storage_backend.h"
 
-/// A custom virtual filesystem based on storing files into a backing folder
+/// A custom virtual filesystem storing files through a StorageBackend, by default into a backing folder
 class CustomVfs : public FuseWrapper {
 public:
+    /// Connection tuning requested from the kernel, zero limits keep the values proposed by the kernel
+    struct ConnectionSettings {
+        unsigned int max_write = 0;
+        unsigned int max_readahead = 0;
+        unsigned int max_background = 0;
+        unsigned int congestion_threshold = 0;
+        bool async_read = true;
+        bool writeback_cache = false;
+    };
+
+    /// When data written to backing files is made durable
+    enum class Durability {
+        /// Never, fsync() returns right away and durability is left to the backing filesystem
+        NONE,
+        /// On fsync() of a file, honouring datasync
+        FSYNC,
+        /// On fsync() of a file, concurrent requests share one sync of the whole storage backend
+        GROUP,
+        /// On fsync() and on every close() of a file, like earlier versions did
+        CLOSE,
+    };
+
     /// Create a new CustomVfs instance prepared with proper path to mount and backing folder
     explicit CustomVfs(const std::string &path, const std::string &backing = "");
 
-    void init() override;
+    /// Create a new CustomVfs instance mounted at a path and storing files in a given backend
+    CustomVfs(const std::string &path, std::shared_ptr<StorageBackend> backend);
+
+    /// Finds the backing directory of a VFS mounted at path, creating it if needed, and returns its absolute path
+    static std::string backing_directory(const std::string &backing, const std::string &path);
+
+    /// Sets the connection tuning applied in init()
+    void set_connection_settings(const ConnectionSettings &settings);
+
+    /// Sets how many descriptors of parent directories in the backing directory are kept open, 0 disables the cache.
+    /// Only the backing directory backend keeps descriptors.
+    void set_parent_cache_size(size_t capacity);
+
+    /// Sets how long and how many attributes of backing files are cached, zero ttl disables the cache
+    void set_attr_cache(std::chrono::nanoseconds ttl, size_t capacity);
+
+    /// Sets how many bytes listings of backing directories may take, 0 disables the cache
+    void set_dir_cache_size(size_t memory_limit);
+
+    /// Sets how many bytes are prefetched ahead of sequential readers of a file, 0 disables prefetching
+    void set_read_ahead(size_t max_window);
+
+    /// Sets when written data is made durable
+    void set_durability(Durability mode);
+
+    /// Replaces the engine doing I/O on backing files, has to be called before the instance is decorated. Only the
+    /// backing directory backend does I/O through an engine.
+    void set_io_engine(std::shared_ptr<IoEngine> engine);
+
+    void init(connection &conn) override;
+    void negotiated(const connection &conn) override;
     void destroy() override;
 
     // Files
-    int mknod(const std::string &pathname, mode_t mode, dev_t dev) override;
-    int read(const std::string &pathname, char *buf, size_t count, off_t offset, struct fuse_file_info *fi) override;
-    int write(const std::string &pathname, const char *buf, size_t count, off_t offset,
+    int mknod(std::string_view pathname, mode_t mode, dev_t dev) override;
+    int read(std::string_view pathname, char *buf, size_t count, off_t offset, struct fuse_file_info *fi) override;
+    int write(std::string_view pathname, const char *buf, size_t count, off_t offset,
               struct fuse_file_info *fi) override;
-    int truncate(const std::string &pathname, off_t length) override;
-    int rename(const std::string &oldpath, const std::string &newpath, unsigned int flags) override;
-    int getattr(const std::string &pathname, struct stat *st) override;
-    int statfs(const std::string &pathname, struct statvfs *stbuf) override;
-    int utimens(const std::string &pathname, const struct timespec tv[2]) override;
-    int chmod(const std::string &pathname, mode_t mode) override;
-    int open(const std::string &pathname, struct fuse_file_info *fi) override;
-    int release(const std::string &pathname, struct fuse_file_info *fi) override;
-    int flush(const std::string &pathname, struct fuse_file_info *fi) override;
-    int chown(const std::string &pathname, uid_t uid, gid_t gid) override;
+    int read_buf(std::string_view pathname, struct fuse_bufvec **bufp, size_t size, off_t off,
+                 struct fuse_file_info *fi) override;
+    int write_buf(std::string_view pathname, struct fuse_bufvec *buf, off_t off, struct fuse_file_info *fi) override;
+    int truncate(std::string_view pathname, off_t length) override;
+    int ftruncate(std::string_view pathname, off_t length, struct fuse_file_info *fi) override;
+    int rename(std::string_view oldpath, std::string_view newpath, unsigned int flags) override;
+    int getattr(std::string_view pathname, struct stat *st) override;
+    int statfs(std::string_view pathname, struct statvfs *stbuf) override;
+    int utimens(std::string_view pathname, const struct timespec tv[2]) override;
+    int chmod(std::string_view pathname, mode_t mode) override;
+    int open(std::string_view pathname, struct fuse_file_info *fi) override;
+    int create(std::string_view pathname, mode_t mode, struct fuse_file_info *fi) override;
+    int release(std::string_view pathname, struct fuse_file_info *fi) override;
+    int flush(std::string_view pathname, struct fuse_file_info *fi) override;
+    int fsync(std::string_view pathname, int datasync, struct fuse_file_info *fi) override;
+    int chown(std::string_view pathname, uid_t uid, gid_t gid) override;
 
     // Links
-    int symlink(const std::string &target, const std::string &linkpath) override;
-    int readlink(const std::string &pathname, char *buf, size_t size) override;
-    int link(const std::string &oldpath, const std::string &newpath) override;
-    int unlink(const std::string &pathname) override;
+    int symlink(std::string_view target, std::string_view linkpath) override;
+    int readlink(std::string_view pathname, char *buf, size_t size) override;
+    int link(std::string_view oldpath, std::string_view newpath) override;
+    int unlink(std::string_view pathname) override;
 
     // Directories
-    int mkdir(const std::string &pathname, mode_t mode) override;
-    int rmdir(const std::string &pathname) override;
-    int readdir(const std::string &pathname, off_t off, struct fuse_file_info *fi, readdir_flags flags) override;
-    virtual int fill_dir(const std::string &name, const struct stat *stbuf, off_t off,
+    int mkdir(std::string_view pathname, mode_t mode) override;
+    int rmdir(std::string_view pathname) override;
+    int readdir(std::string_view pathname, off_t off, struct fuse_file_info *fi, readdir_flags flags) override;
+    virtual int fill_dir(std::string_view name, const struct stat *stbuf, off_t off,
                          FuseWrapper::fill_dir_flags flags);
-    int opendir(const std::string &pathname, struct fuse_file_info *fi) override;
-    int releasedir(const std::string &pathname, struct fuse_file_info *fi) override;
+    int opendir(std::string_view pathname, struct fuse_file_info *fi) override;
+    int releasedir(std::string_view pathname, struct fuse_file_info *fi) override;
 
     // Misc
 
     /// Returns a file stream for writing
-    [[nodiscard]] std::unique_ptr<std::ofstream> get_ofstream(const std::string &path,
-                                                              std::ios_base::openmode mode) const;
+    [[nodiscard]] std::unique_ptr<BackendOstream> get_ofstream(const std::string &path,
+                                                               std::ios_base::openmode mode) const;
 
     /// Returns a file stream for reading
-    [[nodiscard]] std::unique_ptr<std::ifstream> get_ifstream(const std::string &path,
-                                                              std::ios_base::openmode mode) const;
+    [[nodiscard]] std::unique_ptr<BackendIstream> get_ifstream(const std::string &path,
+                                                               std::ios_base::openmode mode) const;
 
     /// Returns a list of files (file-paths) which are related to a given file
     [[nodiscard]] virtual std::vector<std::string> get_related_files(const std::string &pathname) const;
@@ -66,6 +135,10 @@ public:
     /// Returns a names of files in a directory
     [[nodiscard]] virtual std::vector<std::string> subfiles(const std::string &pathname) const;
 
+    /// Returns names of prefixed files in a directory which decorate a given name
+    [[nodiscard]] std::vector<std::string> prefixed_subfiles(const std::string &pathname,
+                                                             const std::string &name) const;
+
     /// Checks whether a path is a directory
     [[nodiscard]] bool is_directory(const std::string &pathname) const;
 
@@ -73,27 +146,54 @@ public:
     [[nodiscard]] bool exists(const std::string &pathname) const;
 
 private:
-    /// Converts a path to its real path in the backing directory
-    [[nodiscard]] std::string to_backing(const std::string &pathname) const;
+    /// lstat() of a backing file served from the attribute cache when possible, returns 0 or -errno
+    int stat_backing(std::string_view pathname, struct stat *st) const;
+
+    /// Adapts the flags of a file being opened to the writeback cache, if it is enabled
+    void adjust_open_flags(struct fuse_file_info *fi) const;
+
+    /// Drops cached attributes of a file whose data or metadata changed
+    void changed(std::string_view pathname) const;
+
+    /// Drops cached attributes of a file which was created or removed, together with those of its parent
+    void entry_changed(std::string_view pathname) const;
+
+    /// Stat of the parent directory of a path, taken before an entry is created or removed there
+    [[nodiscard]] struct stat listing_stamp(std::string_view pathname) const;
+
+    /// Records a file created (present) or removed by the VFS in the cached listing of its parent, before is the
+    /// listing_stamp() taken before the change
+    void listing_changed(std::string_view pathname, bool present, const struct stat &before) const;
 
     /// Finds which backing directory could be used
     [[nodiscard]] static Path initial_backing_path(const std::string &backing, const std::string &vfs_name);
 
-    /// Wraps a POSIX call and returns the result or -errno
-    template <typename Func, typename... Args>
-    static int posix_call_result(Func operation, Args... args) {
-        int result = operation(args...);
-        if (result < 0) {
-            return -errno;
-        }
-        return result;
-    }
+    /// Creates the mount point if it does not exist yet
+    static void prepare_mount_path(const std::string &path);
+
+    /// Store of the files, shared by decorators which copy the instance
+    std::shared_ptr<StorageBackend> backend;
 
-    /// Directory which is used for storing data
-    Path backing_dir;
+    /// Attributes of backing files, shared by decorators which copy the instance
+    std::shared_ptr<AttrCache> attr_cache;
+
+    /// Listings of backing directories, shared by decorators which copy the instance
+    std::shared_ptr<DirListingCache> dir_cache;
+
+    /// Prefetching for sequential readers, shared by decorators which copy the instance
+    std::shared_ptr<ReadAhead> read_ahead;
+
+    /// When written data is made durable, shared by decorators which copy the instance
+    std::shared_ptr<std::atomic<Durability>> durability;
 
     /// Directory where the filesystem is mounted
     const Path mount_path;
+
+    /// Connection tuning applied in init()
+    ConnectionSettings connection_settings;
+
+    /// Whether the kernel caches writes, known once the connection is negotiated
+    bool writeback_cache = false;
 };
 
 #endif
@@ -0,0 +1,62 @@
+#ifndef SRC_DIR_HANDLE_H
+#define SRC_DIR_HANDLE_H
+
+#include <dirent.h>
+#include <sys/types.h>
+
+#include <memory>
+#include <mutex>
+
+struct fuse_file_info;
+
+/**
+ * @brief State of a single open directory stored in fuse_file_info::fh
+ *
+ * The directory stream stays open between readdir() calls, so a listing is resumed by seeking to the telldir() cookie
+ * handed out with the last entry instead of rescanning the directory. Storage backends which do not list directories
+ * through a stream derive their handles from this class and pass a null stream.
+ */
+class DirHandle {
+public:
+    explicit DirHandle(DIR *dir);
+    virtual ~DirHandle();
+
+    DirHandle(const DirHandle &) = delete;
+    DirHandle &operator=(const DirHandle &) = delete;
+
+    /// Directory stream, has to be used under the lock
+    [[nodiscard]] DIR *dir() const {
+        return dir_;
+    }
+
+    /// Descriptor of the directory for *at() calls
+    [[nodiscard]] int fd() const;
+
+    /// Moves the stream to a cookie returned by a previous readdir(), 0 means the beginning
+    void seek(off_t offset);
+
+    /// Records the cookie the stream is positioned at, -1 forces the next seek()
+    void set_position(off_t offset) {
+        position = offset;
+    }
+
+    /// Serializes use of the stream
+    std::mutex lock;
+
+    /// Passes ownership of a handle to fuse_file_info
+    static void attach(struct fuse_file_info *fi, std::unique_ptr<DirHandle> handle);
+
+    /// Returns the handle stored in fuse_file_info or nullptr
+    static DirHandle *from(const struct fuse_file_info *fi);
+
+    /// Takes the ownership of a handle back from fuse_file_info
+    static std::unique_ptr<DirHandle> detach(struct fuse_file_info *fi);
+
+private:
+    DIR *dir_;
+
+    /// Cookie of the next entry the stream returns, -1 if unknown
+    off_t position = 0;
+};
+
+#endif  // SRC_DIR_HANDLE_H
@@ -0,0 +1,146 @@
+#ifndef SRC_DIR_LISTING_CACHE_H
+#define SRC_DIR_LISTING_CACHE_H
+
+#include <sys/stat.h>
+
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "common/metrics.h"
+
+/**
+ * @brief Memory bounded cache of names in backing directories
+ *
+ * A listing is valid as long as the inode, mtime and ctime of its directory stay the same, so changes made behind the
+ * VFS are noticed with the granularity of the timestamps of the backing filesystem. Changes made by the VFS itself are
+ * applied to the cached listing directly, so large directories are not read again after every file created in them.
+ *
+ * Names of a listing are interned in an arena. Prefixed names are also indexed by the name they decorate, so that the
+ * sidecar files of a single file can be found without going through the whole directory.
+ */
+class DirListingCache {
+public:
+    /// Creates a cache which may use up to memory_limit bytes, 0 disables it
+    explicit DirListingCache(size_t memory_limit);
+
+    DirListingCache(const DirListingCache &) = delete;
+    DirListingCache &operator=(const DirListingCache &) = delete;
+
+    /// Changes the memory limit, listings over the limit are dropped
+    void set_memory_limit(size_t memory_limit);
+
+    /// Whether the cache stores anything at all
+    [[nodiscard]] bool enabled() const;
+
+    /// Copies the names in a directory, returns false if there is no listing matching the stat of the directory
+    bool names(std::string_view directory, const struct stat &st, std::vector<std::string> &names);
+
+    /// Copies the prefixed names in a directory which decorate a given name, returns false like names()
+    bool prefixed(std::string_view directory, const struct stat &st, std::string_view name,
+                  std::vector<std::string> &names);
+
+    /// Stores a listing read from the disk, st has to be taken before the directory was read
+    void store(std::string_view directory, const struct stat &st, const std::vector<std::string> &names);
+
+    /// Adds a name created by the VFS to a cached listing. before and after are the stat of the directory taken before
+    /// and after the change, a listing which did not match before missed other changes and is dropped instead.
+    void added(std::string_view directory, std::string_view name, const struct stat &before,
+               const struct stat &after);
+
+    /// Removes a name deleted by the VFS from a cached listing, before and after are used like in added()
+    void removed(std::string_view directory, std::string_view name, const struct stat &before,
+                 const struct stat &after);
+
+    /// Drops listings of a directory and of everything below it
+    void invalidate_tree(std::string_view directory);
+
+    /// Estimated memory used by all listings
+    [[nodiscard]] size_t memory() const;
+
+    /// Number of cached listings
+    [[nodiscard]] size_t size() const;
+
+private:
+    /// Append-only storage of names, names never move once interned
+    class NameArena {
+    public:
+        std::string_view intern(std::string_view name);
+
+        /// Bytes allocated by the arena
+        [[nodiscard]] size_t capacity() const {
+            return blocks.size() * BLOCK_SIZE;
+        }
+
+    private:
+        static constexpr size_t BLOCK_SIZE = 16384;
+
+        std::vector<std::unique_ptr<char[]>> blocks;
+        size_t used = BLOCK_SIZE;
+    };
+
+    struct Listing {
+        ino_t ino = 0;
+        dev_t dev = 0;
+        struct timespec mtime {};
+        struct timespec ctime {};
+
+        NameArena arena;
+        std::unordered_set<std::string_view> names;
+
+        /// Prefixed names keyed by the name they decorate
+        std::unordered_map<std::string_view, std::vector<std::string_view>> prefixed;
+
+        /// Bytes of removed names still held by the arena
+        size_t dead_bytes = 0;
+
+        /// Estimated memory of the listing, kept in sync with DirListingCache::total_memory
+        size_t memory = 0;
+
+        std::list<std::string>::iterator position;
+
+        [[nodiscard]] bool matches(const struct stat &st) const;
+        void stamp(const struct stat &st);
+        void insert(std::string_view name);
+        void erase(std::string_view name);
+
+        /// Moves all names into a fresh arena once removed names take more than half of it
+        void compact();
+
+        [[nodiscard]] size_t estimate() const;
+    };
+
+    /// Strips leading slashes, so that "/a" and "a" share a listing
+    static std::string_view normalize(std::string_view directory);
+
+    /// Returns the listing if it matches the stat and marks it as recently used, the cache has to be locked
+    Listing *find(std::string_view directory, const struct stat &st);
+
+    /// Recomputes the memory of a changed listing and evicts listings over the limit, the cache has to be locked
+    void account(Listing &listing);
+
+    /// Drops the least recently used listings until the cache fits into the limit, the cache has to be locked
+    void shrink();
+
+    void erase(std::unordered_map<std::string_view, std::unique_ptr<Listing>>::iterator it);
+
+    mutable std::mutex mutex;
+    size_t memory_limit;
+    size_t total_memory = 0;
+
+    /// Directories from the most recently used, they own the keys of listings
+    std::list<std::string> recency;
+    std::unordered_map<std::string_view, std::unique_ptr<Listing>> listings;
+
+    Metrics::Counter &hits;
+    Metrics::Counter &misses;
+    Metrics::Counter &updates;
+};
+
+#endif  // SRC_DIR_LISTING_CACHE_H
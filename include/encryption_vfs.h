@@ -20,11 +20,13 @@ class EncryptionVfs : public VfsDecorator {
 public:
     explicit EncryptionVfs(CustomVfs &wrapped_vfs);
 
-    int write(const std::string &pathname, const char *buf, size_t count, off_t offset,
+    int write(std::string_view pathname, const char *buf, size_t count, off_t offset,
               struct fuse_file_info *fi) override;
+    int write_buf(std::string_view pathname, struct fuse_bufvec *buf, off_t off, struct fuse_file_info *fi) override;
 
-    int open(const std::string &pathname, struct fuse_file_info *fi) override;
-    int release(const std::string &pathname, struct fuse_file_info *fi) override;
+    int open(std::string_view pathname, struct fuse_file_info *fi) override;
+    int create(std::string_view pathname, mode_t mode, struct fuse_file_info *fi) override;
+    int release(std::string_view pathname, struct fuse_file_info *fi) override;
 
 private:
     /// Prefix for the encrypted files used by PrefixParser
@@ -43,14 +45,14 @@ private:
 
     std::vector<std::string> prepare_files(const std::string &filename, bool with_related);
 
-    std::pair<std::unique_ptr<std::ifstream>, std::unique_ptr<std::ofstream>> prepare_streams(
+    std::pair<std::unique_ptr<BackendIstream>, std::unique_ptr<BackendOstream>> prepare_streams(
         const std::string &input_file, const std::string &output_file);
 
     /// Handles encryption hooks - returns whether it was successful
     bool handle_hook(const std::string &path, const std::string &content);
 
     /// Checks whether the path is a hook
-    [[nodiscard]] bool is_hook(const std::string &basicString);
+    [[nodiscard]] bool is_hook(std::string_view pathname) const;
 
     bool handle_single_arg(const std::string &non_prefixed, const std::string &arg, const std::string &content);
     bool handle_double_arg(const std::string &non_prefixed, const std::string &arg, const std::string &key_path_arg);
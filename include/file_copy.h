@@ -0,0 +1,45 @@
+#ifndef SRC_FILE_COPY_H
+#define SRC_FILE_COPY_H
+
+#include <sys/types.h>
+
+/**
+ * @brief Copies data between backing files with as little work as the filesystem allows
+ *
+ * A reflink is tried first, which shares all extents on filesystems with copy on write. Otherwise only the data
+ * segments of the source are copied, in the kernel when possible, so holes of sparse files stay holes.
+ */
+class FileCopy {
+public:
+    /// How the data was copied
+    enum class Strategy {
+        /// Extents are shared through FICLONE
+        REFLINK,
+        /// Data segments were copied by copy_file_range()
+        COPY_RANGE,
+        /// Data segments were copied through a user space buffer
+        READ_WRITE,
+    };
+
+    /**
+     * @brief Copies the whole content of one descriptor into another
+     *
+     * The destination has to be empty. Counters of the used strategy are updated in Metrics.
+     *
+     * @param in descriptor opened for reading
+     * @param out descriptor opened for writing
+     * @param size size of the source
+     * @param strategy set to the used strategy when not nullptr
+     * @return 0 on success, -errno on failure
+     */
+    static int copy(int in, int out, off_t size, Strategy *strategy = nullptr);
+
+private:
+    /// Copies a single data segment, falls back to read_write when copy_file_range() is not usable
+    static int copy_segment(int in, int out, off_t offset, off_t length, Strategy &strategy);
+
+    /// Copies a single data segment through a buffer
+    static int read_write(int in, int out, off_t offset, off_t length);
+};
+
+#endif  // SRC_FILE_COPY_H
@@ -0,0 +1,101 @@
+#ifndef SRC_FILE_HANDLE_H
+#define SRC_FILE_HANDLE_H
+
+#include <memory>
+#include <mutex>
+#include <typeindex>
+#include <unordered_map>
+
+struct fuse_file_info;
+
+/**
+ * @brief State of a single open file stored in fuse_file_info::fh
+ *
+ * The handle owns the backing file descriptor for the whole lifetime of the open file, so reads, writes and syncs never
+ * have to resolve the backing path again. Decorators can attach their own per-handle data through state(). Storage
+ * backends which do not keep files in descriptors derive their handles from this class and leave the descriptor at -1.
+ */
+class FileHandle {
+public:
+    /// Base class for data attached to a handle by decorators
+    struct State {
+        virtual ~State() = default;
+    };
+
+    FileHandle(int fd, int flags);
+    virtual ~FileHandle();
+
+    FileHandle(const FileHandle &) = delete;
+    FileHandle &operator=(const FileHandle &) = delete;
+
+    /// Backing file descriptor
+    [[nodiscard]] int fd() const {
+        return fd_;
+    }
+
+    /// Flags the file was opened with
+    [[nodiscard]] int flags() const {
+        return flags_;
+    }
+
+    /// Whether data may be moved between the kernel and the backing descriptor without passing through the decorators
+    [[nodiscard]] bool passthrough() const {
+        return passthrough_;
+    }
+
+    /// Lets a decorator which needs to see the data of this handle opt out of the zero-copy path
+    void set_passthrough(bool enabled) {
+        passthrough_ = enabled;
+    }
+
+    /// Slot of the descriptor in the I/O engine or -1 if it is not registered
+    [[nodiscard]] int io_slot() const {
+        return io_slot_;
+    }
+
+    void set_io_slot(int slot) {
+        io_slot_ = slot;
+    }
+
+    /// Closes the backing file descriptor and returns 0 or -errno
+    int close();
+
+    /// Returns data of a given type attached to the handle, it is created on first use
+    template <typename T>
+    T &state() {
+        std::lock_guard<std::mutex> lock(state_mutex);
+        auto &slot = states[std::type_index(typeid(T))];
+        if (!slot) {
+            slot = std::make_unique<T>();
+        }
+        return static_cast<T &>(*slot);
+    }
+
+    /// Returns data of a given type attached to the handle or nullptr if there is none
+    template <typename T>
+    T *find_state() {
+        std::lock_guard<std::mutex> lock(state_mutex);
+        auto it = states.find(std::type_index(typeid(T)));
+        return it == states.end() ? nullptr : static_cast<T *>(it->second.get());
+    }
+
+    /// Passes ownership of a handle to fuse_file_info
+    static void attach(struct fuse_file_info *fi, std::unique_ptr<FileHandle> handle);
+
+    /// Returns the handle stored in fuse_file_info or nullptr
+    static FileHandle *from(const struct fuse_file_info *fi);
+
+    /// Takes the ownership of a handle back from fuse_file_info
+    static std::unique_ptr<FileHandle> detach(struct fuse_file_info *fi);
+
+private:
+    int fd_;
+    const int flags_;
+    bool passthrough_ = true;
+    int io_slot_ = -1;
+
+    std::mutex state_mutex;
+    std::unordered_map<std::type_index, std::unique_ptr<State>> states;
+};
+
+#endif  // SRC_FILE_HANDLE_H
@@ -0,0 +1,60 @@
+#ifndef SRC_GROUP_COMMIT_H
+#define SRC_GROUP_COMMIT_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <mutex>
+
+#include "common/metrics.h"
+
+/**
+ * @brief Merges concurrent sync requests into a single syncfs() of the backing filesystem
+ *
+ * A request is satisfied by the first syncfs() which starts after the request was made. While one thread is in the
+ * kernel, all requests arriving in the meantime wait and are then served by one more syncfs() issued by one of them.
+ */
+class GroupCommit {
+public:
+    /// Opens the directory dirfd refers to, syncfs() does not accept O_PATH descriptors
+    explicit GroupCommit(int dirfd);
+    ~GroupCommit();
+
+    GroupCommit(const GroupCommit &) = delete;
+    GroupCommit &operator=(const GroupCommit &) = delete;
+
+    /// Returns once everything written before the call is durable, 0 or -errno
+    int sync();
+
+private:
+    int fd;
+
+    std::mutex mutex;
+    std::condition_variable finished;
+
+    /// Number of requests made so far
+    uint64_t requested = 0;
+
+    /// All requests up to this number are durable
+    uint64_t completed = 0;
+
+    bool running = false;
+
+    /// A failed syncfs() and the requests it covered
+    struct Failure {
+        uint64_t first;
+
+        /// Covered requests which have not returned yet
+        uint64_t waiting;
+
+        int error;
+    };
+
+    /// Failed syncfs() calls by the last request they covered, dropped once every covered request has returned
+    std::map<uint64_t, Failure> failures;
+
+    Metrics::Counter &requests;
+    Metrics::Counter &syncs;
+};
+
+#endif  // SRC_GROUP_COMMIT_H
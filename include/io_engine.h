@@ -0,0 +1,57 @@
+#ifndef SRC_IO_ENGINE_H
+#define SRC_IO_ENGINE_H
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <cstddef>
+
+#include "file_handle.h"
+
+/**
+ * @brief Performs the data and attribute I/O of CustomVfs on backing files
+ *
+ * All functions return the result of the matching syscall or -errno.
+ */
+class IoEngine {
+public:
+    virtual ~IoEngine() = default;
+
+    /// Reads from an open file
+    virtual ssize_t pread(const FileHandle &handle, void *buf, size_t count, off_t offset) = 0;
+
+    /// Writes to an open file
+    virtual ssize_t pwrite(const FileHandle &handle, const void *buf, size_t count, off_t offset) = 0;
+
+    /// Flushes an open file to the disk, only its data when datasync is set
+    virtual int fsync(const FileHandle &handle, bool datasync) = 0;
+
+    /// Fetches attributes of a file relative to a directory descriptor, flags are those of fstatat()
+    virtual int stat(int dirfd, const char *name, struct stat *st, int flags) = 0;
+
+    /// Lets the engine prepare for I/O on a newly opened file, returns a slot stored in the handle or -1
+    virtual int register_file(int fd) {
+        return -1;
+    }
+
+    /// Releases a slot returned by register_file() before the file is closed
+    virtual void unregister_file(int slot) {}
+
+    /// Whether libfuse may move data between the kernel and backing descriptors itself, bypassing the engine
+    [[nodiscard]] virtual bool allows_splice() const {
+        return true;
+    }
+};
+
+/**
+ * @brief Engine doing plain blocking syscalls on the calling thread
+ */
+class SyncIoEngine : public IoEngine {
+public:
+    ssize_t pread(const FileHandle &handle, void *buf, size_t count, off_t offset) override;
+    ssize_t pwrite(const FileHandle &handle, const void *buf, size_t count, off_t offset) override;
+    int fsync(const FileHandle &handle, bool datasync) override;
+    int stat(int dirfd, const char *name, struct stat *st, int flags) override;
+};
+
+#endif  // SRC_IO_ENGINE_H
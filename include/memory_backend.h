@@ -0,0 +1,152 @@
+#ifndef SRC_MEMORY_BACKEND_H
+#define SRC_MEMORY_BACKEND_H
+
+#include <sys/stat.h>
+
+#include <array>
+#include <atomic>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <vector>
+
+#include "storage_backend.h"
+
+/**
+ * @brief Backend keeping all files in memory, nothing is ever written to the disk
+ *
+ * Data of a file is held in non-overlapping extents, so sparse files only take the memory of their written ranges and
+ * sequentially written files end up in few large extents.
+ *
+ * The namespace is protected by a single reader-writer lock, which lookups take shared. Data and attributes of files
+ * are protected by a fixed set of locks picked by the inode number, so I/O on open files never touches the namespace
+ * lock and files using different stripes are read and written in parallel.
+ *
+ * Permissions are not checked, everything is accessed with the rights of the process.
+ */
+class MemoryBackend : public StorageBackend {
+public:
+    /// Upper bound of the size of a single extent
+    static constexpr size_t MAX_EXTENT = 1 << 20;
+
+    /// Number of locks protecting data and attributes of files
+    static constexpr size_t STRIPES = 64;
+
+    MemoryBackend();
+
+    MemoryBackend(const MemoryBackend &) = delete;
+    MemoryBackend &operator=(const MemoryBackend &) = delete;
+
+    int open(std::string_view path, int flags, mode_t mode, std::unique_ptr<FileHandle> &handle) override;
+    ssize_t pread(FileHandle &handle, void *buf, size_t count, off_t offset) override;
+    ssize_t pwrite(FileHandle &handle, const void *buf, size_t count, off_t offset) override;
+    int ftruncate(FileHandle &handle, off_t length) override;
+    int fsync(FileHandle &handle, bool datasync) override;
+    int release(FileHandle &handle) override;
+    int fstat(FileHandle &handle, struct stat *st) override;
+    int truncate(std::string_view path, off_t length) override;
+    int copy(std::string_view source, std::string_view destination) override;
+
+    int stat(std::string_view path, struct stat *st, bool follow) override;
+    int utimens(std::string_view path, const struct timespec tv[2]) override;
+    int chmod(std::string_view path, mode_t mode) override;
+    int chown(std::string_view path, uid_t uid, gid_t gid) override;
+    int statfs(struct statvfs *stbuf) override;
+
+    int mknod(std::string_view path, mode_t mode, dev_t dev) override;
+    int rename(std::string_view oldpath, std::string_view newpath, unsigned int flags) override;
+    int link(std::string_view oldpath, std::string_view newpath) override;
+    int unlink(std::string_view path) override;
+    int symlink(std::string_view target, std::string_view linkpath) override;
+    int readlink(std::string_view path, char *buf, size_t size) override;
+
+    int mkdir(std::string_view path, mode_t mode) override;
+    int rmdir(std::string_view path) override;
+    int list(std::string_view path, std::vector<std::string> &names) override;
+    int opendir(std::string_view path, std::unique_ptr<DirHandle> &handle) override;
+    int readdir(DirHandle &handle, off_t offset, DirFiller &filler) override;
+
+    int syncfs() override;
+
+    /// Bytes of file data held in memory
+    [[nodiscard]] size_t memory_usage() const {
+        return usage.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct Inode {
+        Inode(ino_t ino, mode_t mode, std::atomic<size_t> &usage);
+        ~Inode();
+
+        /// File type bits of the mode, they never change
+        const mode_t type;
+
+        /// Attributes, st_mode is kept complete
+        struct stat attr {};
+
+        /// Data of a regular file keyed by the offset of each extent
+        std::map<off_t, std::vector<char>> extents;
+
+        /// Bytes held by extents
+        size_t allocated = 0;
+
+        /// Target of a symbolic link, set once when the link is created
+        std::string target;
+
+        /// Entries of a directory, protected by the namespace lock
+        std::map<std::string, std::shared_ptr<Inode>, std::less<>> entries;
+
+        std::atomic<size_t> &usage;
+    };
+
+    class Handle;
+    class Listing;
+
+    /// Lock of data and attributes of an inode
+    std::mutex &stripe(const Inode &inode) const;
+
+    /// Finds the inode at a path relative to a directory, the namespace lock has to be held
+    int resolve(const std::shared_ptr<Inode> &start, std::string_view path, bool follow, std::shared_ptr<Inode> &inode,
+                int depth = 0) const;
+
+    /// Finds the directory containing a path and the last component of the path
+    int resolve_parent(std::string_view path, std::shared_ptr<Inode> &parent, std::string &name) const;
+
+    /// Creates a new inode, it is not linked anywhere yet
+    std::shared_ptr<Inode> make_inode(mode_t mode);
+
+    /// Links an inode under a name into a directory whose stripe is not locked
+    void insert_entry(Inode &parent, const std::string &name, std::shared_ptr<Inode> inode);
+
+    /// Unlinks an entry from a directory whose stripe is not locked
+    void erase_entry(Inode &parent, const std::string &name);
+
+    /// Adds to the link count of an inode and updates its change time
+    void add_links(Inode &inode, int links);
+
+    /// Reads data of a regular file, its stripe has to be locked
+    static ssize_t read_data(const Inode &inode, char *buf, size_t count, off_t offset);
+
+    /// Writes data of a regular file, its stripe has to be locked
+    static void write_data(Inode &inode, const char *data, size_t count, off_t offset);
+
+    /// Changes the size of a regular file, its stripe has to be locked
+    static void truncate_data(Inode &inode, off_t length);
+
+    /// Updates st_blocks and the memory usage after extents of an inode changed
+    static void account(Inode &inode, size_t allocated);
+
+    static struct timespec now();
+
+    mutable std::shared_mutex tree;
+    mutable std::array<std::mutex, STRIPES> stripes;
+
+    std::atomic<size_t> usage{0};
+    std::atomic<ino_t> next_ino{1};
+    std::shared_ptr<Inode> root;
+};
+
+#endif  // SRC_MEMORY_BACKEND_H
@@ -0,0 +1,152 @@
+#ifndef SRC_MULTI_BACKEND_H
+#define SRC_MULTI_BACKEND_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "common/metrics.h"
+#include "storage_backend.h"
+
+/**
+ * @brief Backend spreading files over several devices, usually backing directories on different disks
+ *
+ * Directories, symbolic links and special files exist on every device. The placement decides where file data goes:
+ *
+ * - HASH stores every file whole on one device, picked by a hash of the path it was created at. Files keep their device
+ *   when they are renamed, so lookups try the device of the current path first and then the others.
+ * - STRIPE splits every file into stripes which go round-robin over all devices, every device holds a part file with
+ *   its stripes back to back. The size of the file follows from the sizes of its parts.
+ * - MIRROR stores every file on all devices. Writes go to all of them, reads to the one with the fewest requests in
+ *   flight.
+ *
+ * The set of devices and the placement have to stay the same for the lifetime of the stored files. Reads and writes are
+ * counted per device, in Metrics under "devices.<index>." and by statistics().
+ */
+class MultiBackend : public StorageBackend {
+public:
+    enum class Placement { HASH, STRIPE, MIRROR };
+
+    /// Queue statistics of one device
+    struct DeviceStatistics {
+        /// Requests currently waiting for the device
+        uint64_t in_flight;
+
+        uint64_t reads;
+        uint64_t read_bytes;
+        uint64_t writes;
+        uint64_t write_bytes;
+        uint64_t syncs;
+
+        /// Time spent in requests summed over all of them, divided by wall time it is the average queue depth
+        uint64_t busy_ns;
+    };
+
+    /**
+     * @param devices Stores of the devices, at least one, the first one also answers attribute lookups
+     * @param placement Where file data is stored
+     * @param stripe_size Bytes of a stripe with STRIPE placement
+     */
+    MultiBackend(std::vector<std::shared_ptr<StorageBackend>> devices, Placement placement, size_t stripe_size);
+
+    MultiBackend(const MultiBackend &) = delete;
+    MultiBackend &operator=(const MultiBackend &) = delete;
+
+    [[nodiscard]] std::vector<DeviceStatistics> statistics() const;
+
+    int open(std::string_view path, int flags, mode_t mode, std::unique_ptr<FileHandle> &handle) override;
+    ssize_t pread(FileHandle &handle, void *buf, size_t count, off_t offset) override;
+    ssize_t pwrite(FileHandle &handle, const void *buf, size_t count, off_t offset) override;
+    int ftruncate(FileHandle &handle, off_t length) override;
+    int fsync(FileHandle &handle, bool datasync) override;
+    int release(FileHandle &handle) override;
+    int fstat(FileHandle &handle, struct stat *st) override;
+    int prefetch(FileHandle &handle, off_t offset, size_t length) override;
+    int truncate(std::string_view path, off_t length) override;
+    int copy(std::string_view source, std::string_view destination) override;
+
+    int stat(std::string_view path, struct stat *st, bool follow) override;
+    int utimens(std::string_view path, const struct timespec tv[2]) override;
+    int chmod(std::string_view path, mode_t mode) override;
+    int chown(std::string_view path, uid_t uid, gid_t gid) override;
+    int statfs(struct statvfs *stbuf) override;
+
+    int mknod(std::string_view path, mode_t mode, dev_t dev) override;
+    int rename(std::string_view oldpath, std::string_view newpath, unsigned int flags) override;
+    int link(std::string_view oldpath, std::string_view newpath) override;
+    int unlink(std::string_view path) override;
+    int symlink(std::string_view target, std::string_view linkpath) override;
+    int readlink(std::string_view path, char *buf, size_t size) override;
+
+    int mkdir(std::string_view path, mode_t mode) override;
+    int rmdir(std::string_view path) override;
+    int list(std::string_view path, std::vector<std::string> &names) override;
+    int opendir(std::string_view path, std::unique_ptr<DirHandle> &handle) override;
+    int readdir(DirHandle &handle, off_t offset, DirFiller &filler) override;
+
+    int syncfs() override;
+
+private:
+    struct Device {
+        Device(std::shared_ptr<StorageBackend> backend, size_t index);
+
+        std::shared_ptr<StorageBackend> backend;
+        std::atomic<uint64_t> in_flight{0};
+
+        Metrics::Counter &reads;
+        Metrics::Counter &read_bytes;
+        Metrics::Counter &writes;
+        Metrics::Counter &write_bytes;
+        Metrics::Counter &syncs;
+        Metrics::Counter &busy_ns;
+    };
+
+    class MultiHandle;
+    class Listing;
+
+    /// Device a new file is placed on with HASH placement, and the first one looked at for an existing one
+    [[nodiscard]] size_t home(std::string_view path) const;
+
+    /// Runs a request on a device and counts it with its transferred bytes, if any, in the statistics of the device
+    static ssize_t request(Device &device, Metrics::Counter &operations, Metrics::Counter *bytes,
+                           const std::function<ssize_t()> &operation);
+
+    /// Runs an operation on the first device and, if it succeeds, on all others, returns the result of the first
+    int replicate(const std::function<int(StorageBackend &)> &operation);
+
+    /**
+     * Runs an operation on every device, for entries which may be missing on some of them. Returns the first error
+     * other than -ENOENT, -ENOENT if the entry is missing everywhere, or 0.
+     */
+    int each(const std::function<int(StorageBackend &)> &operation);
+
+    /// Which devices hold an entry, without following symbolic links
+    [[nodiscard]] std::vector<bool> presence(std::string_view path) const;
+
+    /// Whether any device holds an entry
+    [[nodiscard]] bool exists(std::string_view path) const;
+
+    /// Bytes of a striped file of a given size which are stored on a device
+    [[nodiscard]] uint64_t part_size(uint64_t size, size_t device) const;
+
+    /// Size of a striped file of which a device stores a given number of bytes, the largest over all parts counts
+    [[nodiscard]] uint64_t striped_size(uint64_t part, size_t device) const;
+
+    /// Size of an open striped file
+    int striped_size(MultiHandle &handle, uint64_t &size);
+
+    ssize_t read_striped(MultiHandle &handle, char *buf, size_t count, off_t offset);
+    ssize_t write_striped(MultiHandle &handle, const char *buf, size_t count, off_t offset);
+
+    std::vector<std::unique_ptr<Device>> devices;
+    const Placement placement;
+    const size_t stripe_size;
+
+    /// Breaks ties between equally busy mirrors
+    std::atomic<uint64_t> next_mirror{0};
+};
+
+#endif  // SRC_MULTI_BACKEND_H
@@ -0,0 +1,206 @@
+#ifndef SRC_PACK_STORE_H
+#define SRC_PACK_STORE_H
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Small files packed together into large append-only files
+ *
+ * Data of every file is appended to the current pack, which is sealed and replaced by a new one once it grows past
+ * the pack size. Files are never modified in place, replacing or removing one leaves dead space in its pack.
+ *
+ * The index maps paths to their location and attributes. It is kept in memory, grouped by directory so listings only
+ * touch their own entries, and persisted as an append-only log of changes which is replayed on start and rewritten
+ * once it holds mostly outdated records.
+ *
+ * A background thread compacts sealed packs whose dead space passed the compaction ratio by moving their live files
+ * to the current pack and deleting them. Packs stay readable through handles obtained before they were deleted.
+ */
+class PackStore {
+public:
+    struct Settings {
+        /// Size at which the current pack is sealed
+        size_t pack_size = 64 << 20;
+
+        /// Share of dead bytes at which a sealed pack gets compacted
+        double compact_ratio = 0.5;
+
+        /// Time between compaction runs
+        std::chrono::milliseconds compact_interval = std::chrono::seconds(10);
+    };
+
+    /// Location and attributes of a packed file
+    struct Entry {
+        uint32_t pack = 0;
+        uint64_t offset = 0;
+        uint32_t length = 0;
+        mode_t mode = S_IFREG | 0644;
+        uid_t uid = 0;
+        gid_t gid = 0;
+        struct timespec atime {};
+        struct timespec mtime {};
+        struct timespec ctime {};
+
+        /// Inode number handed out for the file, stable while it stays packed
+        ino_t ino = 0;
+
+        /// Attributes of the file as stat() would report them
+        void fill(struct stat *st) const;
+    };
+
+    /// A single pack file, kept open while anything still reads from it
+    class Pack {
+    public:
+        Pack(uint32_t id, int fd, uint64_t size);
+        ~Pack();
+
+        Pack(const Pack &) = delete;
+        Pack &operator=(const Pack &) = delete;
+
+        /// Reads a packed file, returns the byte count or -errno
+        [[nodiscard]] ssize_t read(const Entry &entry, void *buf, size_t count, off_t offset) const;
+
+        /// Asks the kernel to read a range of a packed file ahead, returns 0 or -errno
+        int prefetch(const Entry &entry, off_t offset, size_t count) const;
+
+        const uint32_t id;
+        const int fd;
+
+    private:
+        friend class PackStore;
+
+        /// Bytes appended so far, protected by the append lock
+        uint64_t size;
+
+        /// Bytes of files still referring to the pack, protected by the index lock
+        uint64_t live = 0;
+    };
+
+    /// Opens or creates a store in a directory, throws if it cannot be used
+    PackStore(const std::string &directory, const Settings &settings);
+    explicit PackStore(const std::string &directory);
+    ~PackStore();
+
+    PackStore(const PackStore &) = delete;
+    PackStore &operator=(const PackStore &) = delete;
+
+    /// Looks up a packed file, pack is set to the pack holding its data
+    bool find(std::string_view path, Entry &entry, std::shared_ptr<Pack> &pack) const;
+
+    bool contains(std::string_view path) const;
+
+    /// Appends data of a file and points the path at it, replacing any previous entry, returns 0 or -errno
+    int put(std::string_view path, const char *data, size_t length, const Entry &attributes);
+
+    /// Changes attributes of a packed file, returns false if it is not packed
+    bool update(std::string_view path, const std::function<void(Entry &)> &change);
+
+    /// Drops a packed file, returns false if it is not packed
+    bool remove(std::string_view path);
+
+    /// Moves a packed file to a new path, replacing a packed file there
+    bool rename(std::string_view oldpath, std::string_view newpath);
+
+    /// Swaps two packed files
+    bool exchange(std::string_view first, std::string_view second);
+
+    /// Moves all packed files below a directory to a new directory, or swaps those of two directories
+    void move_tree(std::string_view from, std::string_view to, bool exchange);
+
+    /// Appends names of the packed files directly inside a directory
+    void names(std::string_view directory, std::vector<std::string> &names) const;
+
+    /// Whether any packed file is directly inside a directory
+    bool has_entries(std::string_view directory) const;
+
+    /// Makes packed data and the index durable, returns 0 or -errno
+    int sync();
+
+    /// Compacts sealed packs over the compaction ratio, returns the number of bytes reclaimed
+    uint64_t compact();
+
+    /// Total and dead bytes over all packs
+    void usage(uint64_t &total, uint64_t &dead) const;
+
+private:
+    using Directory = std::map<std::string, Entry, std::less<>>;
+
+    enum Record : uint8_t { PUT = 1, DEL = 2 };
+
+    /// Splits a path into the key of its directory and its name
+    static void split(std::string_view path, std::string_view &directory, std::string_view &name);
+
+    /// Key of a directory, its path without trailing slashes
+    static std::string_view directory_key(std::string_view path);
+
+    /// Finds an entry, the index lock has to be held
+    const Entry *lookup(std::string_view path) const;
+
+    /// Inserts or replaces an entry and logs it, the index lock has to be held exclusively
+    void insert(std::string_view path, const Entry &entry);
+
+    /// Removes an entry and logs it, the index lock has to be held exclusively
+    bool erase(std::string_view path);
+
+    /// Writes data to the current pack, starting a new one when it is full, returns 0 or -errno
+    int append(const char *data, size_t length, uint32_t &pack, uint64_t &offset);
+
+    /// Opens a pack file, creating it when create is set
+    std::shared_ptr<Pack> open_pack(uint32_t id, bool create) const;
+
+    std::string pack_path(uint32_t id) const;
+
+    /// Replays the index log
+    void load();
+
+    void log(Record type, std::string_view path, const Entry *entry);
+
+    /// Replaces the index log by a snapshot of the index, the index lock has to be held exclusively
+    void rewrite_log();
+
+    /// Moves live files out of a pack and deletes it once it is empty
+    uint64_t compact_pack(const std::shared_ptr<Pack> &pack);
+
+    /// Runs on the compaction thread
+    void compaction_loop();
+
+    const std::string directory;
+    const Settings settings;
+
+    /// Protects directories, the live bytes of packs and the index log
+    mutable std::shared_mutex index_mutex;
+    std::map<std::string, Directory, std::less<>> directories;
+    std::map<uint32_t, std::shared_ptr<Pack>> packs;
+    int log_fd = -1;
+    size_t log_records = 0;
+    size_t entry_count = 0;
+    ino_t next_ino = 1;
+
+    /// Serializes appends to the current pack, taken before the index lock
+    mutable std::mutex append_mutex;
+    std::shared_ptr<Pack> current;
+
+    /// Serializes compaction runs
+    std::mutex compact_mutex;
+
+    std::mutex thread_mutex;
+    std::condition_variable wakeup;
+    bool stopping = false;
+    std::thread compactor;
+};
+
+#endif  // SRC_PACK_STORE_H
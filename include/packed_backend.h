@@ -0,0 +1,145 @@
+#ifndef SRC_PACKED_BACKEND_H
+#define SRC_PACKED_BACKEND_H
+
+#include <sys/stat.h>
+
+#include <array>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "pack_store.h"
+#include "storage_backend.h"
+
+/**
+ * @brief Backend packing small files into a PackStore and keeping larger ones in another backend
+ *
+ * A regular file is packed once its last writer closes it while it is at most the threshold in size, and small files
+ * are copied straight into the current pack. Packed files are served from the index for lookups and listings and read
+ * from their pack. Opening one for writing, truncating or linking it first turns it back into a plain file.
+ *
+ * The plain copy of a packed file is only removed after the pack was synced, so packing never makes data less durable
+ * than the durability mode promised for the plain file. Until then the packed copy shadows it, and anything removing or
+ * moving a packed file removes a plain copy left at its path as well.
+ *
+ * The pack directory lives in the root of the inner store under PACK_DIRECTORY and is hidden from the VFS.
+ */
+class PackedBackend : public StorageBackend {
+public:
+    /// Name of the directory in the root of the store holding the packs
+    static constexpr const char *PACK_DIRECTORY = ".packs";
+
+    /// Number of locks serializing packing with other operations on the same path
+    static constexpr size_t PATH_LOCKS = 64;
+
+    /// Packed files whose plain copies wait for a sync before the sync is forced
+    static constexpr size_t MAX_PENDING = 1024;
+
+    /// Symbolic links followed to reach a packed file, like MAXSYMLINKS of Linux
+    static constexpr int MAX_SYMLINK_DEPTH = 40;
+
+    /**
+     * @param inner Store keeping plain files and directories
+     * @param pack_directory Host directory holding the packs, usually PACK_DIRECTORY in the root of inner
+     * @param threshold Largest file size which is packed
+     */
+    PackedBackend(std::shared_ptr<StorageBackend> inner, const std::string &pack_directory, size_t threshold,
+                  const PackStore::Settings &settings = {});
+    ~PackedBackend() override;
+
+    PackedBackend(const PackedBackend &) = delete;
+    PackedBackend &operator=(const PackedBackend &) = delete;
+
+    [[nodiscard]] PackStore &packs() {
+        return *store;
+    }
+
+    int open(std::string_view path, int flags, mode_t mode, std::unique_ptr<FileHandle> &handle) override;
+    ssize_t pread(FileHandle &handle, void *buf, size_t count, off_t offset) override;
+    ssize_t pwrite(FileHandle &handle, const void *buf, size_t count, off_t offset) override;
+    int ftruncate(FileHandle &handle, off_t length) override;
+    int fsync(FileHandle &handle, bool datasync) override;
+    int release(FileHandle &handle) override;
+    int fstat(FileHandle &handle, struct stat *st) override;
+    int prefetch(FileHandle &handle, off_t offset, size_t length) override;
+    int truncate(std::string_view path, off_t length) override;
+    int copy(std::string_view source, std::string_view destination) override;
+
+    int stat(std::string_view path, struct stat *st, bool follow) override;
+    int utimens(std::string_view path, const struct timespec tv[2]) override;
+    int chmod(std::string_view path, mode_t mode) override;
+    int chown(std::string_view path, uid_t uid, gid_t gid) override;
+    int statfs(struct statvfs *stbuf) override;
+
+    int mknod(std::string_view path, mode_t mode, dev_t dev) override;
+    int rename(std::string_view oldpath, std::string_view newpath, unsigned int flags) override;
+    int link(std::string_view oldpath, std::string_view newpath) override;
+    int unlink(std::string_view path) override;
+    int symlink(std::string_view target, std::string_view linkpath) override;
+    int readlink(std::string_view path, char *buf, size_t size) override;
+
+    int mkdir(std::string_view path, mode_t mode) override;
+    int rmdir(std::string_view path) override;
+    int list(std::string_view path, std::vector<std::string> &names) override;
+    int opendir(std::string_view path, std::unique_ptr<DirHandle> &handle) override;
+    int readdir(DirHandle &handle, off_t offset, DirFiller &filler) override;
+
+    int syncfs() override;
+
+    [[nodiscard]] bool allows_splice() const override;
+
+private:
+    class PackedHandle;
+    struct Writer;
+
+    /// Whether a path is the pack directory or inside it
+    static bool hidden(std::string_view path);
+
+    std::mutex &path_lock(std::string_view path);
+
+    /// Follows relative symbolic links dangling in the inner store, returns the packed file they lead to or ""
+    std::string packed_target(std::string_view path);
+
+    int open_path(std::string_view path, int flags, mode_t mode, std::unique_ptr<FileHandle> &handle);
+
+    /// Checks that the directory a new file would be created in exists, returns 0 or -errno
+    int check_parent(std::string_view path);
+
+    /// Reads a plain file of at most the threshold in size, returns 0 or -errno
+    int read_plain(std::string_view path, std::vector<char> &data);
+
+    /// Packs a small plain file, ino guards against it being replaced since it was written or is 0
+    void pack(std::string_view path, ino_t ino);
+
+    /// Turns a packed file back into a plain one, with empty content when truncate is set, returns 0 or -errno
+    int unpack(std::string_view path, bool truncate);
+
+    /// Syncs the packs and removes the plain copies of files packed since the last sync
+    int settle();
+
+    /// settle() for callers already holding the namespace lock
+    int settle_locked();
+
+    std::shared_ptr<StorageBackend> inner;
+    std::unique_ptr<PackStore> store;
+    const size_t threshold;
+
+    /// Taken exclusively by renames and removals of directories, which move or drop packed files in bulk
+    std::shared_mutex namespace_mutex;
+
+    std::array<std::mutex, PATH_LOCKS> path_locks;
+
+    /// Number of open writable handles per path
+    std::mutex writers_mutex;
+    std::unordered_map<std::string, size_t> writers;
+
+    /// Plain copies of packed files keyed by path with their inode numbers, removed once the packs are synced
+    std::mutex pending_mutex;
+    std::map<std::string, ino_t, std::less<>> pending;
+};
+
+#endif  // SRC_PACKED_BACKEND_H
@@ -0,0 +1,77 @@
+#ifndef SRC_POSIX_BACKEND_H
+#define SRC_POSIX_BACKEND_H
+
+#include <memory>
+#include <string>
+
+#include "backing_directory.h"
+#include "group_commit.h"
+#include "io_engine.h"
+#include "storage_backend.h"
+
+/**
+ * @brief Backend keeping files in a directory of the host filesystem
+ *
+ * Every path is resolved relative to the pinned backing directory with *at() syscalls. Data and attribute I/O of open
+ * files goes through an IoEngine, syncs of the whole store are merged by a GroupCommit.
+ */
+class PosixBackend : public StorageBackend {
+public:
+    /// Opens an existing backing directory, throws if it cannot be opened
+    explicit PosixBackend(const std::string &path);
+
+    /// Sets how many descriptors of parent directories are kept open, 0 disables the cache
+    void set_parent_cache_size(size_t capacity);
+
+    /// Replaces the engine doing I/O on backing files, has to be called before any file is opened
+    void set_io_engine(std::shared_ptr<IoEngine> engine);
+
+    int open(std::string_view path, int flags, mode_t mode, std::unique_ptr<FileHandle> &handle) override;
+    ssize_t pread(FileHandle &handle, void *buf, size_t count, off_t offset) override;
+    ssize_t pwrite(FileHandle &handle, const void *buf, size_t count, off_t offset) override;
+    int ftruncate(FileHandle &handle, off_t length) override;
+    int fsync(FileHandle &handle, bool datasync) override;
+    int release(FileHandle &handle) override;
+    int truncate(std::string_view path, off_t length) override;
+    int copy(std::string_view source, std::string_view destination) override;
+
+    int stat(std::string_view path, struct stat *st, bool follow) override;
+    int utimens(std::string_view path, const struct timespec tv[2]) override;
+    int chmod(std::string_view path, mode_t mode) override;
+    int chown(std::string_view path, uid_t uid, gid_t gid) override;
+    int statfs(struct statvfs *stbuf) override;
+
+    int mknod(std::string_view path, mode_t mode, dev_t dev) override;
+    int rename(std::string_view oldpath, std::string_view newpath, unsigned int flags) override;
+    int link(std::string_view oldpath, std::string_view newpath) override;
+    int unlink(std::string_view path) override;
+    int symlink(std::string_view target, std::string_view linkpath) override;
+    int readlink(std::string_view path, char *buf, size_t size) override;
+
+    int mkdir(std::string_view path, mode_t mode) override;
+    int rmdir(std::string_view path) override;
+    int list(std::string_view path, std::vector<std::string> &names) override;
+    int opendir(std::string_view path, std::unique_ptr<DirHandle> &handle) override;
+    int readdir(DirHandle &handle, off_t offset, DirFiller &filler) override;
+
+    int syncfs() override;
+
+    [[nodiscard]] bool allows_splice() const override;
+
+private:
+    /// Wraps a POSIX call and returns the result or -errno
+    template <typename Func, typename... Args>
+    static int posix_call_result(Func operation, Args... args) {
+        int result = operation(args...);
+        if (result < 0) {
+            return -errno;
+        }
+        return result;
+    }
+
+    BackingDirectory root;
+    std::shared_ptr<IoEngine> io;
+    GroupCommit group_commit;
+};
+
+#endif  // SRC_POSIX_BACKEND_H
@@ -0,0 +1,71 @@
+#ifndef SRC_READ_AHEAD_H
+#define SRC_READ_AHEAD_H
+
+#include <sys/types.h>
+
+#include <cstddef>
+#include <mutex>
+
+#include "common/metrics.h"
+#include "file_handle.h"
+#include "storage_backend.h"
+
+/**
+ * @brief Prefetches backing files ahead of sequential readers
+ *
+ * Every open file tracks where its next read is expected. A read starting there grows the window of the file, which is
+ * then handed to the backend with StorageBackend::prefetch() ahead of the reader, so the backing storage is read in the
+ * background while the reader is still busy with the previous data. A read anywhere else halves the window and stops
+ * prefetching until the stream is sequential again.
+ *
+ * The kernel readahead of the mounted filesystem is capped by max_readahead of the connection, the window here is not.
+ */
+class ReadAhead {
+public:
+    /// Range of a backing file to be prefetched, empty when length is 0
+    struct Range {
+        off_t offset = 0;
+        size_t length = 0;
+    };
+
+    /// Access pattern of one open file
+    struct Stream : FileHandle::State {
+        std::mutex mutex;
+
+        /// Offset where the next sequential read starts, -1 before the first read
+        off_t next = -1;
+
+        /// Everything before this offset was already prefetched
+        off_t prefetched = 0;
+
+        /// Bytes prefetched ahead of the reader
+        size_t window = 0;
+    };
+
+    /// Window of a stream once it turns sequential
+    static constexpr size_t MIN_WINDOW = 128 * 1024;
+
+    /// max_window caps the window of every stream, 0 disables prefetching
+    explicit ReadAhead(size_t max_window = 0);
+
+    void set_max_window(size_t max_window);
+
+    [[nodiscard]] bool enabled() const {
+        return max_window > 0;
+    }
+
+    /// Records a read of count bytes at offset and returns what should be prefetched next
+    Range plan(Stream &stream, off_t offset, size_t count);
+
+    /// Records a read on a handle and asks the backend to prefetch the next part of a sequential stream
+    void advise(StorageBackend &backend, FileHandle &handle, off_t offset, size_t count);
+
+private:
+    size_t max_window;
+
+    Metrics::Counter &sequential;
+    Metrics::Counter &random;
+    Metrics::Counter &bytes;
+};
+
+#endif  // SRC_READ_AHEAD_H
@@ -0,0 +1,150 @@
+#ifndef SRC_SIDECAR_BACKEND_H
+#define SRC_SIDECAR_BACKEND_H
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "storage_backend.h"
+
+/**
+ * @brief Backend keeping sidecar files in a sharded metadata tree instead of next to the files they decorate
+ *
+ * Sidecars are the prefixed names like "#VERSION-1#name" which the decorators use for versions, keys and markers.
+ * Left next to their files, a flat directory of many files holds several times as many backing entries, and every
+ * listing of it has to skip them. This backend moves them out of the way: the sidecars of the entries of a directory
+ * live in METADATA_DIRECTORY/<shard>/<hash of the directory path>/<bucket>/, where the bucket is picked by the name
+ * they decorate. Directories of the VFS then hold only what users see, and the sidecars of one file are found by
+ * listing a single bucket.
+ *
+ * The metadata of a directory follows it when it is renamed and is deleted with it, a rename interrupted by a crash is
+ * finished when the store is opened next. Sidecars already stored next to their files are moved into the tree when the
+ * layout is first used on a store.
+ *
+ * The metadata directory lives in the root of the inner store and is hidden from the VFS.
+ */
+class SidecarBackend : public StorageBackend {
+public:
+    /// Name of the directory in the root of the store holding the sidecars
+    static constexpr const char *METADATA_DIRECTORY = ".sidecars";
+
+    /// Number of buckets the sidecars of one directory are spread over
+    static constexpr unsigned int BUCKETS = 64;
+
+    /// @param inner Store keeping the files, directories and the metadata tree
+    explicit SidecarBackend(std::shared_ptr<StorageBackend> inner);
+
+    SidecarBackend(const SidecarBackend &) = delete;
+    SidecarBackend &operator=(const SidecarBackend &) = delete;
+
+    /// Path in the inner store where an entry of the VFS is kept
+    [[nodiscard]] std::string locate(std::string_view path) const;
+
+    int open(std::string_view path, int flags, mode_t mode, std::unique_ptr<FileHandle> &handle) override;
+    ssize_t pread(FileHandle &handle, void *buf, size_t count, off_t offset) override;
+    ssize_t pwrite(FileHandle &handle, const void *buf, size_t count, off_t offset) override;
+    int ftruncate(FileHandle &handle, off_t length) override;
+    int fsync(FileHandle &handle, bool datasync) override;
+    int release(FileHandle &handle) override;
+    int fstat(FileHandle &handle, struct stat *st) override;
+    int prefetch(FileHandle &handle, off_t offset, size_t length) override;
+    int truncate(std::string_view path, off_t length) override;
+    int copy(std::string_view source, std::string_view destination) override;
+
+    int stat(std::string_view path, struct stat *st, bool follow) override;
+    int utimens(std::string_view path, const struct timespec tv[2]) override;
+    int chmod(std::string_view path, mode_t mode) override;
+    int chown(std::string_view path, uid_t uid, gid_t gid) override;
+    int statfs(struct statvfs *stbuf) override;
+
+    int mknod(std::string_view path, mode_t mode, dev_t dev) override;
+    int rename(std::string_view oldpath, std::string_view newpath, unsigned int flags) override;
+    int link(std::string_view oldpath, std::string_view newpath) override;
+    int unlink(std::string_view path) override;
+    int symlink(std::string_view target, std::string_view linkpath) override;
+    int readlink(std::string_view path, char *buf, size_t size) override;
+
+    int mkdir(std::string_view path, mode_t mode) override;
+    int rmdir(std::string_view path) override;
+    int list(std::string_view path, std::vector<std::string> &names) override;
+    int list_sidecars(std::string_view directory, std::string_view name, std::vector<std::string> &names) override;
+    [[nodiscard]] bool separates_sidecars() const override {
+        return true;
+    }
+    int opendir(std::string_view path, std::unique_ptr<DirHandle> &handle) override;
+    int readdir(DirHandle &handle, off_t offset, DirFiller &filler) override;
+
+    int syncfs() override;
+
+    [[nodiscard]] bool allows_splice() const override;
+
+private:
+    class Filler;
+
+    /// Whether a path is the metadata directory or inside it
+    static bool hidden(std::string_view path);
+
+    /// Directory of the metadata tree holding the sidecars of the entries of a directory
+    static std::string metadata_directory(std::string_view directory);
+
+    /// Bucket directory holding the sidecars of one entry of a directory
+    static std::string bucket_directory(std::string_view directory, std::string_view name);
+
+    /**
+     * Runs an operation creating a path. If a sidecar cannot be created because its bucket is missing, the bucket is
+     * created as long as the directory of the sidecar exists and the operation is retried. The namespace lock has to be
+     * held.
+     */
+    int create(std::string_view path, const std::function<int()> &operation);
+
+    /// Creates the bucket directory of a sidecar path, returns 0 or -errno
+    int prepare(std::string_view path);
+
+    /// Deletes a directory of the inner store with everything in it
+    void remove_tree(const std::string &path);
+
+    /// Adds the directories below a directory to a list, as paths relative to it
+    void subdirectories(const std::string &directory, const std::string &relative, std::vector<std::string> &found);
+
+    /// Metadata directories to move, each from a source to a destination
+    using Moves = std::vector<std::pair<std::string, std::string>>;
+
+    /**
+     * Moves metadata directories to new places, destinations may be sources of other moves. The moves are recorded in
+     * an intent file in the staging directory first, so that a crash leaves enough behind to finish them.
+     */
+    void move_metadata(const Moves &moves);
+
+    /// Writes the moves of a rename to an intent file and syncs it, returns 0 or -errno
+    int write_intent(const std::string &intent, const Moves &moves);
+
+    /// Reads the moves recorded in an intent file, returns 0 or -errno
+    int read_intent(const std::string &intent, Moves &moves);
+
+    /// Parks the sources of moves in the staging directory, an empty directory stands in for a missing source
+    void park(const std::string &base, const Moves &moves);
+
+    /// Replaces the destinations of moves by the directories parked for them
+    void place(const std::string &base, const Moves &moves);
+
+    /// Finishes the moves recorded in the staging directory by an earlier run and deletes anything else left there
+    void recover();
+
+    /// Moves sidecars stored next to their files into the metadata tree, returns how many were moved
+    size_t migrate(const std::string &directory);
+
+    std::shared_ptr<StorageBackend> inner;
+
+    /// Taken exclusively by renames and removals of directories, which move or drop the metadata of their subtrees
+    std::shared_mutex namespace_mutex;
+
+    /// Path of the directory in the inner store where metadata directories are parked while they are moved
+    const std::string staging_directory;
+    std::atomic<uint64_t> next_staging{0};
+};
+
+#endif  // SRC_SIDECAR_BACKEND_H
@@ -0,0 +1,149 @@
+#ifndef SRC_STORAGE_BACKEND_H
+#define SRC_STORAGE_BACKEND_H
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <sys/types.h>
+
+#include <cerrno>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "common/prefix_parser.h"
+#include "dir_handle.h"
+#include "file_handle.h"
+
+/**
+ * @brief Store holding the files of a CustomVfs
+ *
+ * Paths are those of the VFS, relative to the root of the store. All functions return 0, a byte count or -errno, like
+ * the syscalls they are named after. Symbolic links are never followed unless stated otherwise.
+ *
+ * Open files and directories are represented by handles created by the backend, which may derive its own handle types
+ * from FileHandle and DirHandle. Handles are only ever passed back to the backend which created them.
+ */
+class StorageBackend {
+public:
+    /// Receives the entries of a directory listed by readdir()
+    class DirFiller {
+    public:
+        virtual ~DirFiller() = default;
+
+        /// Whether full attributes of an entry are needed, otherwise only its inode number and type are filled in
+        virtual bool wants_attributes(std::string_view name) = 0;
+
+        /// Adds an entry, next is the offset the listing continues from, returns 1 when no more entries fit
+        virtual int add(std::string_view name, const struct stat *st, off_t next, bool attributes) = 0;
+    };
+
+    virtual ~StorageBackend() = default;
+
+    // Files
+
+    /// Opens a file with open() flags, creating it with mode when O_CREAT is set
+    virtual int open(std::string_view path, int flags, mode_t mode, std::unique_ptr<FileHandle> &handle) = 0;
+
+    virtual ssize_t pread(FileHandle &handle, void *buf, size_t count, off_t offset) = 0;
+    virtual ssize_t pwrite(FileHandle &handle, const void *buf, size_t count, off_t offset) = 0;
+    virtual int ftruncate(FileHandle &handle, off_t length) = 0;
+
+    /// Makes the data of an open file durable, only its data when datasync is set
+    virtual int fsync(FileHandle &handle, bool datasync) = 0;
+
+    /// Closes an open file, the handle is destroyed afterwards
+    virtual int release(FileHandle &handle) = 0;
+
+    /// Reads the attributes of an open file, by default those of its descriptor
+    virtual int fstat(FileHandle &handle, struct stat *st) {
+        if (handle.fd() < 0) {
+            return -EBADF;
+        }
+        return ::fstat(handle.fd(), st) == 0 ? 0 : -errno;
+    }
+
+    /**
+     * Starts reading a range of an open file in the background, ahead of a sequential reader. Only a hint, by default
+     * passed on to the kernel for handles with a descriptor. Returns -EOPNOTSUPP when there is nothing to prefetch.
+     */
+    virtual int prefetch(FileHandle &handle, off_t offset, size_t length) {
+        if (handle.fd() < 0) {
+            return -EOPNOTSUPP;
+        }
+        return -::posix_fadvise(handle.fd(), offset, static_cast<off_t>(length), POSIX_FADV_WILLNEED);
+    }
+
+    virtual int truncate(std::string_view path, off_t length) = 0;
+
+    /// Copies a file with its data and mode to a new file, nothing is left behind when the copy fails
+    virtual int copy(std::string_view source, std::string_view destination) = 0;
+
+    // Attributes
+
+    /// Fetches attributes of a file, follow resolves a symbolic link to its target
+    virtual int stat(std::string_view path, struct stat *st, bool follow) = 0;
+
+    virtual int utimens(std::string_view path, const struct timespec tv[2]) = 0;
+    virtual int chmod(std::string_view path, mode_t mode) = 0;
+    virtual int chown(std::string_view path, uid_t uid, gid_t gid) = 0;
+    virtual int statfs(struct statvfs *stbuf) = 0;
+
+    // Names
+
+    virtual int mknod(std::string_view path, mode_t mode, dev_t dev) = 0;
+
+    /// Renames a file, flags are those of renameat2()
+    virtual int rename(std::string_view oldpath, std::string_view newpath, unsigned int flags) = 0;
+
+    virtual int link(std::string_view oldpath, std::string_view newpath) = 0;
+    virtual int unlink(std::string_view path) = 0;
+    virtual int symlink(std::string_view target, std::string_view linkpath) = 0;
+    virtual int readlink(std::string_view path, char *buf, size_t size) = 0;
+
+    // Directories
+
+    virtual int mkdir(std::string_view path, mode_t mode) = 0;
+    virtual int rmdir(std::string_view path) = 0;
+
+    /// Reads names in a directory, skipping "." and ".."
+    virtual int list(std::string_view path, std::vector<std::string> &names) = 0;
+
+    /**
+     * Reads the names of the sidecars of an entry in a directory, the prefixed names like "#VERSION-1#name" which
+     * decorate it. By default they are found by listing the directory.
+     */
+    virtual int list_sidecars(std::string_view directory, std::string_view name, std::vector<std::string> &names) {
+        std::vector<std::string> entries;
+        int res = list(directory, entries);
+        for (auto &entry : entries) {
+            if (PrefixParser::is_prefixed(entry) && PrefixParser::get_nonprefixed(entry) == name) {
+                names.push_back(std::move(entry));
+            }
+        }
+        return res;
+    }
+
+    /// Whether sidecars are kept apart from the entries they decorate, so that list() and readdir() omit them
+    [[nodiscard]] virtual bool separates_sidecars() const {
+        return false;
+    }
+
+    virtual int opendir(std::string_view path, std::unique_ptr<DirHandle> &handle) = 0;
+
+    /// Passes entries starting at an offset handed out with an earlier entry to filler, 0 is the beginning
+    virtual int readdir(DirHandle &handle, off_t offset, DirFiller &filler) = 0;
+
+    // Whole store
+
+    /// Makes everything written to the store durable
+    virtual int syncfs() = 0;
+
+    /// Whether libfuse may splice data between the kernel and the descriptors of handles, bypassing the backend
+    [[nodiscard]] virtual bool allows_splice() const {
+        return false;
+    }
+};
+
+#endif  // SRC_STORAGE_BACKEND_H
@@ -0,0 +1,235 @@
+#ifndef SRC_TIERED_BACKEND_H
+#define SRC_TIERED_BACKEND_H
+
+#include <sys/stat.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "common/metrics.h"
+#include "storage_backend.h"
+
+/**
+ * @brief Backend keeping hot files on a fast store and moving cold ones to a larger, slower store
+ *
+ * New files are created on the fast tier and directories, symbolic links and special files always live there, symbolic
+ * links are copied to the capacity tier as well so that they lead to the same files on both tiers. A background thread
+ * moves regular files to the capacity tier once they were not accessed for a while, and versions right away, since
+ * version history is rarely read. Files on the capacity tier which are opened often are queued and moved back.
+ * Rewriting a file on the capacity tier with O_TRUNC creates it on the fast tier again.
+ *
+ * Migrations copy a file to a staging file on the other tier at a limited rate, without holding any lock. Only the
+ * switch to the copy locks the path, and it is skipped if the file changed, is open for writing or has other links.
+ * The copy is synced before the original is removed.
+ *
+ * The access heat is kept in memory, after a restart files count as accessed when they were last read or written.
+ */
+class TieredBackend : public StorageBackend {
+public:
+    /// Name of the directory in the root of both tiers holding files being migrated
+    static constexpr const char *STAGING_DIRECTORY = ".tiering";
+
+    /// Number of locks serializing migrations with other operations on the same path
+    static constexpr size_t PATH_LOCKS = 64;
+
+    /// Files queued for promotion at most, accesses beyond that are not queued until the queue drains
+    static constexpr size_t MAX_QUEUED = 1024;
+
+    /// Bytes copied at once by a migration
+    static constexpr size_t COPY_BUFFER = 1 << 20;
+
+    enum Tier { FAST = 0, CAPACITY = 1 };
+
+    struct Settings {
+        /// Time without accesses after which a file on the fast tier is moved to the capacity tier
+        std::chrono::seconds cold_after{std::chrono::hours(24)};
+
+        /// Opens of a file on the capacity tier within cold_after which move it back to the fast tier
+        unsigned int promote_after = 3;
+
+        /// Bytes per second copied by migrations at most, 0 for no limit
+        uint64_t rate = 32 << 20;
+
+        /// Time between scans of the fast tier for cold files
+        std::chrono::milliseconds scan_interval{std::chrono::minutes(10)};
+
+        /// Paths which stay on the fast tier with everything below them
+        std::vector<std::string> pinned;
+    };
+
+    /**
+     * @param fast Store for new and hot files, holding all directories
+     * @param capacity Store for cold files and versions
+     */
+    TieredBackend(std::shared_ptr<StorageBackend> fast, std::shared_ptr<StorageBackend> capacity,
+                  const Settings &settings);
+    TieredBackend(std::shared_ptr<StorageBackend> fast, std::shared_ptr<StorageBackend> capacity);
+    ~TieredBackend() override;
+
+    TieredBackend(const TieredBackend &) = delete;
+    TieredBackend &operator=(const TieredBackend &) = delete;
+
+    /// Tier holding an entry, returns 0 or -errno
+    int tier(std::string_view path, Tier &tier);
+
+    /**
+     * Moves files queued for promotion to the fast tier and cold files to the capacity tier, like the background
+     * thread does every scan interval. Returns the number of files moved.
+     */
+    size_t migrate();
+
+    int open(std::string_view path, int flags, mode_t mode, std::unique_ptr<FileHandle> &handle) override;
+    ssize_t pread(FileHandle &handle, void *buf, size_t count, off_t offset) override;
+    ssize_t pwrite(FileHandle &handle, const void *buf, size_t count, off_t offset) override;
+    int ftruncate(FileHandle &handle, off_t length) override;
+    int fsync(FileHandle &handle, bool datasync) override;
+    int release(FileHandle &handle) override;
+    int fstat(FileHandle &handle, struct stat *st) override;
+    int prefetch(FileHandle &handle, off_t offset, size_t length) override;
+    int truncate(std::string_view path, off_t length) override;
+    int copy(std::string_view source, std::string_view destination) override;
+
+    int stat(std::string_view path, struct stat *st, bool follow) override;
+    int utimens(std::string_view path, const struct timespec tv[2]) override;
+    int chmod(std::string_view path, mode_t mode) override;
+    int chown(std::string_view path, uid_t uid, gid_t gid) override;
+    int statfs(struct statvfs *stbuf) override;
+
+    int mknod(std::string_view path, mode_t mode, dev_t dev) override;
+    int rename(std::string_view oldpath, std::string_view newpath, unsigned int flags) override;
+    int link(std::string_view oldpath, std::string_view newpath) override;
+    int unlink(std::string_view path) override;
+    int symlink(std::string_view target, std::string_view linkpath) override;
+    int readlink(std::string_view path, char *buf, size_t size) override;
+
+    int mkdir(std::string_view path, mode_t mode) override;
+    int rmdir(std::string_view path) override;
+    int list(std::string_view path, std::vector<std::string> &names) override;
+    int opendir(std::string_view path, std::unique_ptr<DirHandle> &handle) override;
+    int readdir(DirHandle &handle, off_t offset, DirFiller &filler) override;
+
+    int syncfs() override;
+
+    [[nodiscard]] bool allows_splice() const override;
+
+private:
+    struct Residence;
+
+    /// Opens of a file within cold_after and the last one
+    struct Heat {
+        std::chrono::system_clock::time_point last;
+        unsigned int accesses = 0;
+    };
+
+    /// Pace of the copies of one migration run
+    struct Budget {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        uint64_t bytes = 0;
+    };
+
+    /// Whether a path is the staging directory or inside it
+    static bool hidden(std::string_view path);
+
+    /// Whether a path is a version kept by VersioningVfs
+    static bool is_version(std::string_view path);
+
+    std::mutex &path_lock(std::string_view path);
+
+    [[nodiscard]] bool pinned(std::string_view path) const;
+
+    /// Tier which a handle was opened on
+    static Tier residence(FileHandle &handle);
+
+    /// Tier holding an entry with its attributes, the fast tier if it is on both, returns 0 or -errno
+    int locate(std::string_view path, Tier &tier, struct stat *st, bool follow);
+
+    /// Whether an entry exists on the capacity tier, without following symbolic links
+    bool on_capacity(std::string_view path);
+
+    /**
+     * Creates the missing parent directories and symbolic links of a path on the capacity tier like on the fast tier
+     * @param durable Whether the created entries have to survive a crash before the call returns
+     */
+    int prepare_parents(std::string_view path, bool durable = false);
+
+    /// Makes the entries of a directory of a tier durable, without syncing the rest of the tier
+    int sync_directory(Tier tier, std::string_view path);
+
+    /// Copies a symbolic link of the fast tier to the capacity tier, where the files it leads to may be
+    void replicate_link(const std::string &path);
+
+    /// Moves the heat of a path and of everything below it to a new path, or swaps the heat of two paths
+    void move_heat(std::string_view from, std::string_view to, bool exchange);
+
+    /// Removes a file while no directory listing is being collected, so it never seems missing from both tiers
+    int drop(Tier tier, std::string_view path);
+
+    /// Counts an open of a file and queues it for promotion when it is hot
+    void record_access(const std::string &path, Tier tier);
+
+    /// Whether a file on the fast tier was not accessed for cold_after
+    bool is_cold(const std::string &path, const struct stat &st);
+
+    /// Waits until copying more bytes keeps to the rate limit, returns false when the backend shuts down
+    bool throttle(Budget &budget, size_t bytes);
+
+    /// Copies a file to the other tier and switches to the copy if the file did not change meanwhile
+    bool move(const std::string &path, Tier from, const struct stat &st, Budget &budget);
+
+    /// Copies the data and attributes of a file to a staging file of the other tier, returns 0 or -errno
+    int stage(const std::string &path, Tier from, const struct stat &st, const std::string &staging, Budget &budget);
+
+    size_t promote_queued(Budget &budget);
+    size_t demote_cold(const std::string &directory, Budget &budget);
+
+    /// Removes staging files left behind by a crash
+    void clean_staging();
+
+    /// Runs on the migration thread
+    void migration_loop();
+
+    std::array<std::shared_ptr<StorageBackend>, 2> tiers;
+    const Settings settings;
+
+    /// Taken exclusively by renames and removals of directories, which change entries on both tiers at once
+    std::shared_mutex namespace_mutex;
+
+    std::array<std::mutex, PATH_LOCKS> path_locks;
+
+    /// Taken exclusively when a file is removed from one tier after it was put on the other one
+    std::shared_mutex listing_mutex;
+
+    /// Number of open writable handles per tier and inode number
+    std::mutex writers_mutex;
+    std::map<std::pair<Tier, ino_t>, size_t> writers;
+
+    std::mutex heat_mutex;
+    std::map<std::string, Heat, std::less<>> heat;
+
+    /// Serializes migration runs
+    std::mutex migration_mutex;
+    std::atomic<uint64_t> next_staging{0};
+
+    Metrics::Counter &promoted;
+    Metrics::Counter &demoted;
+    Metrics::Counter &migrated_bytes;
+
+    std::mutex thread_mutex;
+    std::condition_variable wakeup;
+    std::set<std::string> promotions;
+    bool stopping = false;
+    std::thread migrator;
+};
+
+#endif  // SRC_TIERED_BACKEND_H
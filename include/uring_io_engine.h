@@ -0,0 +1,135 @@
+#ifndef SRC_URING_IO_ENGINE_H
+#define SRC_URING_IO_ENGINE_H
+
+#include <linux/io_uring.h>
+#include <sys/uio.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "common/metrics.h"
+#include "io_engine.h"
+
+/**
+ * @brief Engine submitting the I/O of all FUSE workers to a single io_uring
+ *
+ * Requests are queued by the calling threads and submitted together by whichever thread comes first, so concurrent
+ * requests share io_uring_enter() calls. A dedicated thread reaps completions and wakes the waiting workers, so the
+ * number of requests in flight is bounded by the queue depth rather than by the number of FUSE threads.
+ *
+ * Open files are registered with the ring, and small reads and writes go through a pool of registered buffers. Both
+ * are optional, the engine falls back to plain descriptors and caller buffers when they are unavailable.
+ *
+ * The ring is set up with raw syscalls, so liburing is not needed.
+ */
+class UringIoEngine : public IoEngine {
+public:
+    struct Settings {
+        /// Number of submission queue entries, the maximum number of requests in flight
+        unsigned int queue_depth = 256;
+
+        /// Number of slots for registered files, 0 disables registration
+        unsigned int registered_files = 1024;
+
+        /// Number of registered buffers, 0 disables them
+        unsigned int fixed_buffers = 64;
+
+        /// Size of a single registered buffer
+        size_t fixed_buffer_size = 128 * 1024;
+    };
+
+    /// Sets up the ring, throws if io_uring is not available
+    explicit UringIoEngine(const Settings &settings);
+    ~UringIoEngine() override;
+
+    UringIoEngine(const UringIoEngine &) = delete;
+    UringIoEngine &operator=(const UringIoEngine &) = delete;
+
+    ssize_t pread(const FileHandle &handle, void *buf, size_t count, off_t offset) override;
+    ssize_t pwrite(const FileHandle &handle, const void *buf, size_t count, off_t offset) override;
+    int fsync(const FileHandle &handle, bool datasync) override;
+    int stat(int dirfd, const char *name, struct stat *st, int flags) override;
+
+    int register_file(int fd) override;
+    void unregister_file(int slot) override;
+
+    /// Data has to pass through the ring, splicing would do blocking I/O on the FUSE threads again
+    [[nodiscard]] bool allows_splice() const override {
+        return false;
+    }
+
+private:
+    struct Request;
+
+    /// Fills and submits one entry, then waits for its completion
+    int64_t execute(struct io_uring_sqe entry);
+
+    /// Copies an entry into the submission queue, waits while the queue depth is exhausted
+    void enqueue(const struct io_uring_sqe &entry);
+
+    /// Submits all queued entries unless another thread is already doing it
+    void submit();
+
+    /// Runs on the completion thread
+    void reap();
+
+    /// Points an entry to a handle, through its registered slot when it has one
+    static void set_file(struct io_uring_sqe &entry, const FileHandle &handle);
+
+    /// Takes a registered buffer or returns -1 if all are in use
+    int acquire_buffer();
+    void release_buffer(int index);
+
+    int ring_fd = -1;
+    struct io_uring_params params {};
+
+    void *sq_ring = nullptr;
+    size_t sq_ring_size = 0;
+    void *cq_ring = nullptr;
+    size_t cq_ring_size = 0;
+    struct io_uring_sqe *sqes = nullptr;
+    size_t sqes_size = 0;
+
+    std::atomic<uint32_t> *sq_head = nullptr;
+    std::atomic<uint32_t> *sq_tail = nullptr;
+    uint32_t sq_mask = 0;
+    uint32_t *sq_array = nullptr;
+
+    std::atomic<uint32_t> *cq_head = nullptr;
+    std::atomic<uint32_t> *cq_tail = nullptr;
+    uint32_t cq_mask = 0;
+    struct io_uring_cqe *cqes = nullptr;
+
+    std::mutex sq_mutex;
+    std::condition_variable sq_space;
+
+    /// Entries queued in the ring but not yet passed to io_uring_enter()
+    uint32_t unsubmitted = 0;
+    bool submitting = false;
+
+    /// Requests submitted and not yet completed, never more than the queue depth
+    uint32_t in_flight = 0;
+
+    std::mutex files_mutex;
+    std::vector<int> free_slots;
+
+    std::mutex buffers_mutex;
+    std::vector<int> free_buffers;
+    char *buffer_memory = nullptr;
+    size_t buffer_memory_size = 0;
+    size_t buffer_size = 0;
+
+    std::atomic<bool> stopping{false};
+    std::thread reaper;
+
+    Metrics::Counter &submit_calls;
+    Metrics::Counter &submitted;
+    Metrics::Counter &fixed_buffer_ops;
+};
+
+#endif  // SRC_URING_IO_ENGINE_H
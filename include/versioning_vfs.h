@@ -1,6 +1,8 @@
 #ifndef SRC_VERSIONING_VFS_H
 #define SRC_VERSIONING_VFS_H
 
+#include <functional>
+
 #include "common/config.h"
 #include "vfs_decorator.h"
 
@@ -14,12 +16,18 @@ class VersioningVfs : public VfsDecorator {
 public:
     explicit VersioningVfs(CustomVfs &wrapped_vfs) : VfsDecorator(wrapped_vfs) {}
 
+    // Vetoes the writeback cache, versions have to be taken per write() call
+    void init(connection &conn) override;
+
     // Creates a copy of the file with the version number (version file) and handles hooks
-    int write(const std::string &pathname, const char *buf, size_t count, off_t offset,
+    int write(std::string_view pathname, const char *buf, size_t count, off_t offset,
               struct fuse_file_info *fi) override;
 
+    // Same as write, the data itself is passed down without being copied
+    int write_buf(std::string_view pathname, struct fuse_bufvec *buf, off_t off, struct fuse_file_info *fi) override;
+
     // Hides files for versioning
-    int fill_dir(const std::string &name, const struct stat *stbuf, off_t off,
+    int fill_dir(std::string_view name, const struct stat *stbuf, off_t off,
                  FuseWrapper::fill_dir_flags flags) override;
 
     // Hides files for versioning
@@ -38,6 +46,9 @@ private:
     /// @brief Checks whether path corresponds to a version file
     [[nodiscard]] bool is_version_file(const std::string &pathname) const;
 
+    /// @brief Runs a write operation on the wrapped VFS and stores the resulting version
+    int versioned_write(const std::string &pathname, const std::function<int()> &write_operation);
+
     /// @brief Get maximum version for non-prefix path
     [[nodiscard]] int get_max_version(const std::string &pathname);
 
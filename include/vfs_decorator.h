@@ -15,6 +15,16 @@ class VfsDecorator : public CustomVfs {
 public:
     explicit VfsDecorator(CustomVfs &wrapped_vfs) : CustomVfs(wrapped_vfs), wrapped_vfs(wrapped_vfs) {}
 
+    /// Connection settings are owned by the innermost VFS, decorators only add their vetoes on top
+    void init(connection &conn) override {
+        get_wrapped().init(conn);
+    }
+
+    /// Only the innermost VFS opens files, so it is the one which has to know the outcome
+    void negotiated(const connection &conn) override {
+        get_wrapped().negotiated(conn);
+    }
+
 protected:
     [[nodiscard]] CustomVfs &get_wrapped() {
         return wrapped_vfs;
@@ -0,0 +1,114 @@
+#ifndef SRC_WRITE_BACK_VFS_H
+#define SRC_WRITE_BACK_VFS_H
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "common/metrics.h"
+#include "file_handle.h"
+#include "vfs_decorator.h"
+
+/**
+ * VFS decorator that coalesces small writes of an open file
+ *
+ * Meant to be the outermost decorator, so that the decorators below see a few large writes instead of many small
+ * ones. Every open file gets a buffer of a fixed size. A write which continues or overlaps the buffered extent is
+ * merged into it, any other write or a full buffer flushes the buffer to the wrapped VFS first. Writes at least as
+ * large as the buffer, writes to prefixed files and writes to files opened with O_APPEND are never buffered.
+ *
+ * Durability: a successful write() only means that the data is in the memory of the VFS. It reaches the wrapped VFS
+ * on close (flush), fsync, release, when the buffer fills up, and before any read, truncate or rename touching the
+ * buffered range of the same path, through any handle. If the VFS process dies before that, the data is lost. An error
+ * of a deferred write is reported by the next write, flush or fsync of the handle. getattr() reports the size including
+ * buffered data.
+ */
+class WriteBackVfs : public VfsDecorator {
+public:
+    /// Wraps a VFS with buffers of buffer_size bytes, 0 forwards every write right away
+    WriteBackVfs(CustomVfs &wrapped_vfs, size_t buffer_size);
+
+    // Attach a buffer to the new handle
+    int open(std::string_view pathname, struct fuse_file_info *fi) override;
+    int create(std::string_view pathname, mode_t mode, struct fuse_file_info *fi) override;
+
+    // Buffer small writes
+    int write(std::string_view pathname, const char *buf, size_t count, off_t offset,
+              struct fuse_file_info *fi) override;
+    int write_buf(std::string_view pathname, struct fuse_bufvec *buf, off_t off, struct fuse_file_info *fi) override;
+
+    // Flush buffered data which overlaps the read range
+    int read(std::string_view pathname, char *buf, size_t count, off_t offset, struct fuse_file_info *fi) override;
+    int read_buf(std::string_view pathname, struct fuse_bufvec **bufp, size_t size, off_t off,
+                 struct fuse_file_info *fi) override;
+
+    // Report the size including buffered data
+    int getattr(std::string_view pathname, struct stat *st) override;
+
+    // Flush all buffered data of the path first
+    int truncate(std::string_view pathname, off_t length) override;
+    int ftruncate(std::string_view pathname, off_t length, struct fuse_file_info *fi) override;
+    int rename(std::string_view oldpath, std::string_view newpath, unsigned int flags) override;
+
+    // Flush the buffer of the handle first
+    int flush(std::string_view pathname, struct fuse_file_info *fi) override;
+    int fsync(std::string_view pathname, int datasync, struct fuse_file_info *fi) override;
+    int release(std::string_view pathname, struct fuse_file_info *fi) override;
+
+private:
+    /// Write buffer of a single open file
+    struct Buffer : FileHandle::State {
+        std::mutex lock;
+
+        /// Path the file was opened with, kept up to date by rename()
+        std::string path;
+
+        /// Copy of the file info of the handle, so that other handles can flush the buffer
+        struct fuse_file_info file_info {};
+
+        /// Offset of the first buffered byte
+        off_t offset = 0;
+        std::vector<char> data;
+
+        /// Error of a deferred write, reported by the next operation on the handle
+        int error = 0;
+
+        /// Renames flushing the buffer without holding buffers_mutex, guarded by buffers_mutex
+        size_t renames = 0;
+    };
+
+    /// Returns the buffer of a handle or nullptr if writes of the handle are not buffered
+    static Buffer *buffer_of(struct fuse_file_info *fi);
+
+    /// Attaches a buffer to a freshly opened handle
+    void attach(std::string_view pathname, struct fuse_file_info *fi);
+
+    /// Writes out buffered data, the buffer has to be locked
+    int flush_locked(Buffer &buffer);
+
+    /// Flushes and reports the pending error of a handle
+    int flush_handle(struct fuse_file_info *fi);
+
+    /// Flushes buffers of a path which overlap a range, length -1 means up to the end of the file
+    void flush_path(std::string_view pathname, off_t offset, off_t length);
+
+    const size_t buffer_size;
+
+    /// Open buffers by path, guarded by buffers_mutex
+    std::mutex buffers_mutex;
+    std::unordered_map<std::string, std::vector<Buffer *>> buffers;
+
+    /// Signalled when renames are done flushing buffers, release() waits for them
+    std::condition_variable renamed;
+
+    /// Number of buffers holding data, lets reads skip the lookup by path
+    std::atomic<size_t> dirty{0};
+
+    Metrics::Counter &buffered_writes;
+    Metrics::Counter &flushed_writes;
+};
+
+#endif  // SRC_WRITE_BACK_VFS_H
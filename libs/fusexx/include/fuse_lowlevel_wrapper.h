@@ -0,0 +1,115 @@
+#ifndef FUSE_LOWLEVEL_WRAPPER_H
+#define FUSE_LOWLEVEL_WRAPPER_H
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "fuse_wrapper.h"
+
+/** Inode based front end for a FuseWrapper
+ *
+ * Serves the filesystem through the low-level libfuse API instead of
+ * fuse_main().  The kernel refers to files by node ids, so the full
+ * path of a node is built only once, when the node is looked up, and
+ * every later request just maps the node id back to that path.
+ *
+ * Node ids are never reused.  A node stays in the table until the
+ * kernel forgets all of its lookups, renames update the paths of the
+ * whole moved subtree.  Hard links created through the filesystem
+ * share the node of their source, which keeps working under any of
+ * its names.
+ *
+ * readdir() implementations have to pass non-zero offsets to
+ * fill_dir(), as the low-level API does not buffer whole directories.
+ */
+class FuseLowlevelWrapper {
+public:
+    explicit FuseLowlevelWrapper(FuseWrapper &fs);
+    ~FuseLowlevelWrapper();
+
+    FuseLowlevelWrapper(const FuseLowlevelWrapper &) = delete;
+    FuseLowlevelWrapper &operator=(const FuseLowlevelWrapper &) = delete;
+
+    /** Main function of the low-level front end.
+     *
+     * Parses the same command line as FuseWrapper::main(), mounts the
+     * filesystem and runs the session loop configured by the loop
+     * member of the filesystem until it is unmounted.
+     *
+     * @param argc the argument counter passed to the main() function
+     * @param argv the argument vector passed to the main() function
+     * @return 0 on success, nonzero on failure
+     */
+    int main(int argc, char *argv[]);
+
+    /** Seconds for which the kernel may cache names */
+    double entry_timeout = 1.0;
+
+    /** Seconds for which the kernel may cache attributes */
+    double attr_timeout = 1.0;
+
+    /** Seconds for which the kernel may cache that a name does not exist */
+    double negative_timeout = 0.0;
+
+private:
+    struct Inode {
+        /** Full path of the node within the filesystem */
+        std::shared_ptr<const std::string> path;
+
+        /** Number of lookups the kernel holds */
+        uint64_t nlookup = 0;
+
+        /** Whether a rename has to move descendants too */
+        bool is_directory = false;
+
+        /** Further names of a hard linked file, path is used while it exists */
+        std::vector<std::string> aliases;
+    };
+
+    /** Returns path of a node or nullptr if the node is not known */
+    std::shared_ptr<const std::string> path_of(uint64_t ino);
+
+    /** Returns path of a child of a node or nullptr if the parent is not known */
+    std::shared_ptr<const std::string> child_path(uint64_t parent, const char *name);
+
+    /** Registers one kernel lookup of a path and returns its node id */
+    uint64_t remember(const std::shared_ptr<const std::string> &path, bool is_directory);
+
+    /** Registers one kernel lookup of a node under a new hard link and returns its node id */
+    uint64_t remember_link(uint64_t ino, const std::shared_ptr<const std::string> &path, bool is_directory);
+
+    /** Drops nlookup kernel lookups of a node */
+    void forget(uint64_t ino, uint64_t nlookup);
+
+    /** Detaches the node currently placed at a path, it keeps living until forgotten */
+    void unmap(const std::string &path);
+
+    /** Moves a node and all of its descendants to a new path, or swaps them with those at the new path */
+    void move(const std::string &oldpath, const std::string &newpath, bool exchange);
+
+    /** Detaches the name of a node at a path, inodes_mutex has to be held */
+    void unmap_locked(const std::string &path);
+
+    /** Removes the nodes at and below a path from by_path, returning them with their paths relative to it */
+    std::vector<std::pair<std::string, uint64_t>> take_subtree(const std::string &path);
+
+    /** Maps a node under a new name in place of an old one, inodes_mutex has to be held */
+    void rename_node(uint64_t ino, const std::string &from, const std::string &to);
+
+    FuseWrapper &fs;
+
+    std::mutex inodes_mutex;
+    std::unordered_map<uint64_t, Inode> inodes;
+    std::unordered_map<std::string, uint64_t> by_path;
+    uint64_t next_ino;
+
+    class detail;
+    friend class detail;
+};
+
+#endif
@@ -1,6 +1,7 @@
 #ifndef FUSE_WRAPPER_H
 #define FUSE_WRAPPER_H
 
+// The build defines the newest API level of libfuse 3 it finds, see libs/CMakeLists.txt
 #ifndef FUSE_USE_VERSION
 #define FUSE_USE_VERSION 30
 #endif
@@ -12,6 +13,7 @@
 #include <cstddef>
 #include <cstdint>
 #include <string>
+#include <string_view>
 
 class FuseWrapper {
 public:
@@ -25,7 +27,8 @@ public:
      *   - passes relevant mount options to fuse_mount()
      *   - installs signal handlers for INT, HUP, TERM and PIPE
      *   - registers an exit handler to unmount the filesystem on program exit
-     *   - calls either the single-threaded or the multi-threaded event loop
+     *   - calls either the single-threaded or the multi-threaded event loop,
+     *     as configured by the loop member
      *
      * @param argc the argument counter passed to the main() function
      * @param argv the argument vector passed to the main() function
@@ -45,13 +48,31 @@ public:
     /** Umask of the calling process (introduced in version 2.8) */
     mode_t umask = 022;
 
+    /** Settings of the event loop started by main() */
+    struct loop_config {
+        /** Serve requests from a pool of worker threads, -s on the command line overrides it */
+        bool multithreaded = true;
+
+        /** Give each worker its own /dev/fuse descriptor (version 3 and newer) */
+        bool clone_fd = false;
+
+        /** Maximum number of idle worker threads kept around (version 3 and newer) */
+        unsigned int max_idle_threads = 10;
+
+        /** Maximum number of worker threads, 0 keeps the libfuse default (FUSE_USE_VERSION 312 and newer) */
+        unsigned int max_threads = 0;
+    };
+
+    /** Event loop settings, have to be set before main() is called */
+    loop_config loop;
+
     /** Get file attributes.
      *
      * Similar to stat().  The 'st_dev' and 'st_blksize' fields are
      * ignored.	 The 'st_ino' field is ignored except if the 'use_ino'
      * mount option is given.  Return -ENOENT if the file does not exist.
      */
-    virtual int getattr(const std::string &pathname, struct stat *buf);
+    virtual int getattr(std::string_view pathname, struct stat *buf);
 
     /** Read the target of a symbolic link
      *
@@ -61,7 +82,7 @@ public:
      * buffer, it should be truncated.	The return value should be 0
      * for success.
      */
-    virtual int readlink(const std::string &pathname, char *buffer, size_t size);
+    virtual int readlink(std::string_view pathname, char *buffer, size_t size);
 
     /**
      * Readdir flags, passed to readdir()
@@ -84,7 +105,7 @@ public:
      * passes non-zero offset to fill_dir.  When the buffer is full
      * (or an error happens), fill_dir will return '1'.
      */
-    virtual int readdir(const std::string &pathname, off_t off, struct fuse_file_info *fi, readdir_flags flags);
+    virtual int readdir(std::string_view pathname, off_t off, struct fuse_file_info *fi, readdir_flags flags);
 
     enum fill_dir_flags {
         /**
@@ -107,16 +128,26 @@ public:
      * @param flags fill flags
      * @return 1 if buffer is full, zero otherwise
      */
-    static int fill_dir(const std::string &name, const struct stat *stbuf, off_t off = 0,
+    static int fill_dir(std::string_view name, const struct stat *stbuf, off_t off = 0,
                         fill_dir_flags flags = (fill_dir_flags)0);
 
+    /** Redirects fill_dir() calls made by the current thread
+     *
+     * Used by front ends other than the high-level libfuse API to
+     * collect the entries produced by readdir().
+     *
+     * @param handle opaque pointer passed back to the filler
+     * @param filler function receiving the entries
+     */
+    static void set_dir_filler(void *handle, fuse_fill_dir_t filler);
+
     /** Create a file node
      *
      * This is called for creation of all non-directory, non-symlink
      * nodes.  If the filesystem defines a create() method, then for
      * regular files that will be called instead.
      */
-    virtual int mknod(const std::string &pathname, mode_t mode, dev_t dev);
+    virtual int mknod(std::string_view pathname, mode_t mode, dev_t dev);
 
     /** Create a directory
      *
@@ -124,31 +155,39 @@ public:
      * bits set, i.e. S_ISDIR(mode) can be false.  To obtain the
      * correct directory type bits use  mode|S_IFDIR
      * */
-    virtual int mkdir(const std::string &pathname, mode_t mode);
+    virtual int mkdir(std::string_view pathname, mode_t mode);
 
     /** Remove a file */
-    virtual int unlink(const std::string &pathname);
+    virtual int unlink(std::string_view pathname);
 
     /** Remove a directory */
-    virtual int rmdir(const std::string &pathname);
+    virtual int rmdir(std::string_view pathname);
 
     /** Create a symbolic link */
-    virtual int symlink(const std::string &target, const std::string &linkpath);
+    virtual int symlink(std::string_view target, std::string_view linkpath);
 
     /** Rename a file */
-    virtual int rename(const std::string &oldpath, const std::string &newpath, unsigned int flags);
+    virtual int rename(std::string_view oldpath, std::string_view newpath, unsigned int flags);
 
     /** Create a hard link to a file */
-    virtual int link(const std::string &oldpath, const std::string &newpath);
+    virtual int link(std::string_view oldpath, std::string_view newpath);
 
     /** Change the permission bits of a file */
-    virtual int chmod(const std::string &pathname, mode_t mode);
+    virtual int chmod(std::string_view pathname, mode_t mode);
 
     /** Change the owner and group of a file */
-    virtual int chown(const std::string &pathname, uid_t uid, gid_t gid);
+    virtual int chown(std::string_view pathname, uid_t uid, gid_t gid);
 
     /** Change the size of a file */
-    virtual int truncate(const std::string &path, off_t length);
+    virtual int truncate(std::string_view path, off_t length);
+
+    /** Change the size of an open file
+     *
+     * This method is called instead of the truncate() method if the
+     * truncation was invoked from an ftruncate() system call.  The
+     * default implementation falls back to truncate().
+     */
+    virtual int ftruncate(std::string_view path, off_t length, struct fuse_file_info *fi);
 
     /** File open operation
      *
@@ -165,7 +204,7 @@ public:
      * filehandle in the fuse_file_info structure, which will be
      * passed to all file operations.
      */
-    virtual int open(const std::string &pathname, struct fuse_file_info *fi);
+    virtual int open(std::string_view pathname, struct fuse_file_info *fi);
 
     /** Read data from an open file
      *
@@ -176,7 +215,7 @@ public:
      * value of the read system call will reflect the return value of
      * this operation.
      */
-    virtual int read(const std::string &pathname, char *buf, size_t count, off_t offset, struct fuse_file_info *fi);
+    virtual int read(std::string_view pathname, char *buf, size_t count, off_t offset, struct fuse_file_info *fi);
 
     /** Write data to an open file
      *
@@ -184,14 +223,14 @@ public:
      * except on error.	 An exception to this is when the 'direct_io'
      * mount option is specified (see read operation).
      */
-    virtual int write(const std::string &pathname, const char *buf, size_t count, off_t offset,
+    virtual int write(std::string_view pathname, const char *buf, size_t count, off_t offset,
                       struct fuse_file_info *fi);
 
     /** Get file system statistics
      *
      * The 'f_frsize', 'f_favail', 'f_fsid' and 'f_flag' fields are ignored
      */
-    virtual int statfs(const std::string &path, struct statvfs *buf);
+    virtual int statfs(std::string_view path, struct statvfs *buf);
 
     /** Possibly flush cached data
      *
@@ -214,7 +253,7 @@ public:
      * Filesystems shouldn't assume that flush will always be called
      * after some writes, or that if will be called at all.
      */
-    virtual int flush(const std::string &pathname, struct fuse_file_info *fi);
+    virtual int flush(std::string_view pathname, struct fuse_file_info *fi);
 
     /** Release an open file
      *
@@ -228,27 +267,27 @@ public:
      * release will mean, that no more reads/writes will happen on the
      * file.  The return value of release is ignored.
      */
-    virtual int release(const std::string &pathname, struct fuse_file_info *fi);
+    virtual int release(std::string_view pathname, struct fuse_file_info *fi);
 
     /** Synchronize file contents
      *
      * If the datasync parameter is non-zero, then only the user data
      * should be flushed, not the meta data.
      */
-    virtual int fsync(const std::string &pathname, int datasync, struct fuse_file_info *fi);
+    virtual int fsync(std::string_view pathname, int datasync, struct fuse_file_info *fi);
 
     /** Set extended attributes */
-    virtual int setxattr(const std::string &path, const std::string &name, const std::string &value, size_t size,
+    virtual int setxattr(std::string_view path, std::string_view name, std::string_view value, size_t size,
                          int flags);
 
     /** Get extended attributes */
-    virtual int getxattr(const std::string &path, const std::string &name, char *value, size_t size);
+    virtual int getxattr(std::string_view path, std::string_view name, char *value, size_t size);
 
     /** List extended attributes */
-    virtual int listxattr(const std::string &path, char *list, size_t size);
+    virtual int listxattr(std::string_view path, char *list, size_t size);
 
     /** Remove extended attributes */
-    virtual int removexattr(const std::string &path, const std::string &name);
+    virtual int removexattr(std::string_view path, std::string_view name);
 
     /** Open directory
      *
@@ -258,23 +297,104 @@ public:
      * filehandle in the fuse_file_info structure, which will be
      * passed to readdir, closedir and fsyncdir.
      */
-    virtual int opendir(const std::string &name, struct fuse_file_info *fi);
+    virtual int opendir(std::string_view name, struct fuse_file_info *fi);
 
     /** Release directory
      */
-    virtual int releasedir(const std::string &pathname, struct fuse_file_info *fi);
+    virtual int releasedir(std::string_view pathname, struct fuse_file_info *fi);
 
     /** Synchronize directory contents
      *
      * If the datasync parameter is non-zero, then only the user data
      * should be flushed, not the meta data
      */
-    virtual int fsyncdir(const std::string &pathname, int datasync, struct fuse_file_info *fi);
+    virtual int fsyncdir(std::string_view pathname, int datasync, struct fuse_file_info *fi);
+
+    /**
+     * Capabilities of the connection which can be negotiated in init()
+     */
+    enum capability : uint32_t {
+        CAP_ASYNC_READ = (1 << 0),
+        CAP_ATOMIC_O_TRUNC = (1 << 1),
+        CAP_BIG_WRITES = (1 << 2),
+        CAP_SPLICE_WRITE = (1 << 3),
+        CAP_SPLICE_MOVE = (1 << 4),
+        CAP_SPLICE_READ = (1 << 5),
+        CAP_WRITEBACK_CACHE = (1 << 6),
+        CAP_PARALLEL_DIROPS = (1 << 7),
+    };
+
+    /** Connection parameters negotiated with the kernel
+     *
+     * A layer may want() a capability or veto() it.  A capability is
+     * enabled only if the kernel offers it, somebody wants it and
+     * nobody vetoes it, so a veto always wins regardless of the order
+     * in which the layers run.  Capabilities unknown to the running
+     * libfuse version are never offered.
+     *
+     * The numeric limits start at the values proposed by libfuse and
+     * the kernel, libfuse clamps them to what the connection supports.
+     */
+    class connection {
+    public:
+        explicit connection(const struct fuse_conn_info *conn);
+
+        /** Whether the kernel offers a capability */
+        [[nodiscard]] bool capable(capability cap) const {
+            return (capable_ & cap) != 0;
+        }
+
+        /** Requests a capability */
+        void want(capability cap) {
+            wanted_ |= cap;
+        }
+
+        /** Prevents a capability from being enabled */
+        void veto(capability cap) {
+            vetoed_ |= cap;
+        }
+
+        /** Whether a capability ends up enabled */
+        [[nodiscard]] bool enabled(capability cap) const {
+            return capable(cap) && (wanted_ & cap) != 0 && (vetoed_ & cap) == 0;
+        }
+
+        /** Writes the negotiated parameters back to libfuse */
+        void apply(struct fuse_conn_info *conn) const;
+
+        /** Maximum size of a single write request */
+        unsigned int max_write;
+
+        /** Maximum readahead in bytes */
+        unsigned int max_readahead;
+
+        /** Maximum number of pending background requests */
+        unsigned int max_background;
+
+        /** Number of background requests at which the kernel considers the filesystem congested */
+        unsigned int congestion_threshold;
+
+    private:
+        uint32_t capable_ = 0;
+        uint32_t wanted_ = 0;
+        uint32_t vetoed_ = 0;
+    };
 
     /**
      * Initialize filesystem
+     *
+     * The default implementation wants the splice capabilities used by
+     * read_buf() and write_buf().
      */
-    virtual void init();
+    virtual void init(connection &conn);
+
+    /**
+     * Called once the capabilities are negotiated
+     *
+     * Runs right after init(), with the capabilities which end up
+     * enabled. The default implementation does nothing.
+     */
+    virtual void negotiated(const connection &conn);
 
     /**
      * Clean up filesystem
@@ -292,7 +412,7 @@ public:
      *
      * This method is not called under Linux kernel versions 2.4.x
      */
-    virtual int access(const std::string &pathname, int mode);
+    virtual int access(std::string_view pathname, int mode);
 
     /**
      * Create and open a file
@@ -304,7 +424,7 @@ public:
      * versions earlier than 2.6.15, the mknod() and open() methods
      * will be called instead.
      */
-    virtual int create(const std::string &pathname, mode_t mode, struct fuse_file_info *fi);
+    virtual int create(std::string_view pathname, mode_t mode, struct fuse_file_info *fi);
 
     /**
      * Perform POSIX file locking operation
@@ -336,7 +456,7 @@ public:
      * allow file locking to work locally.  Hence it is only
      * interesting for network filesystems and similar.
      */
-    virtual int lock(const std::string &pathname, struct fuse_file_info *fi, int cmd, struct flock *lock);
+    virtual int lock(std::string_view pathname, struct fuse_file_info *fi, int cmd, struct flock *lock);
 
     /**
      * Change the access and modification times of a file with
@@ -347,7 +467,7 @@ public:
      *
      * See the utimensat(2) man page for details.
      */
-    virtual int utimens(const std::string &pathname, const struct timespec tv[2]);
+    virtual int utimens(std::string_view pathname, const struct timespec tv[2]);
 
     /**
      * Map block index within file to block index within device
@@ -355,7 +475,7 @@ public:
      * Note: This makes sense only for block device backed filesystems
      * mounted with the 'blkdev' option
      */
-    virtual int bmap(const std::string &pathname, size_t blocksize, uint64_t *idx);
+    virtual int bmap(std::string_view pathname, size_t blocksize, uint64_t *idx);
 
     /**
      * Flag indicating that the filesystem can accept a NULL path
@@ -407,7 +527,7 @@ public:
      * If flags has FUSE_IOCTL_DIR then the fuse_file_info refers to a
      * directory file handle.
      */
-    virtual int ioctl(const std::string &pathname, int cmd, void *arg, struct fuse_file_info *fi, unsigned int flags,
+    virtual int ioctl(std::string_view pathname, int cmd, void *arg, struct fuse_file_info *fi, unsigned int flags,
                       void *data);
 
     /**
@@ -425,7 +545,7 @@ public:
      * The callee is responsible for destroying ph with
      * fuse_pollhandle_destroy() when no longer in use.
      */
-    virtual int poll(const std::string &pathname, struct fuse_file_info *fi, struct fuse_pollhandle *ph,
+    virtual int poll(std::string_view pathname, struct fuse_file_info *fi, struct fuse_pollhandle *ph,
                      unsigned *reventsp);
 
     /** Write contents of buffer to an open file
@@ -433,8 +553,11 @@ public:
      * Similar to the write() method, but data is supplied in a
      * generic buffer.  Use fuse_buf_copy() to transfer data to
      * the destination.
+     *
+     * The default implementation copies data which is still in a
+     * pipe into memory and passes it to write().
      */
-    virtual int write_buf(const std::string &pathname, struct fuse_bufvec *buf, off_t off, struct fuse_file_info *fi);
+    virtual int write_buf(std::string_view pathname, struct fuse_bufvec *buf, off_t off, struct fuse_file_info *fi);
 
     /** Store data from an open file in a buffer
      *
@@ -449,8 +572,11 @@ public:
      * location pointed to by bufp.  If the buffer contains memory
      * regions, they too must be allocated using malloc().  The
      * allocated memory will be freed by the caller.
+     *
+     * The default implementation allocates a memory buffer and fills
+     * it through read().
      */
-    virtual int read_buf(const std::string &pathname, struct fuse_bufvec **bufp, size_t size, off_t off,
+    virtual int read_buf(std::string_view pathname, struct fuse_bufvec **bufp, size_t size, off_t off,
                          struct fuse_file_info *fi);
 
     /**
@@ -471,7 +597,7 @@ public:
      * allow file locking to work locally.  Hence it is only
      * interesting for network filesystems and similar.
      */
-    virtual int flock(const std::string &pathname, struct fuse_file_info *fi, int op);
+    virtual int flock(std::string_view pathname, struct fuse_file_info *fi, int op);
 
     /**
      * Allocates space for an open file
@@ -481,7 +607,7 @@ public:
      * request to specified range is guaranteed not to fail because of lack
      * of space on the file system media.
      */
-    virtual int fallocate(const std::string &pathname, int mode, off_t offset, off_t len, struct fuse_file_info *fi);
+    virtual int fallocate(std::string_view pathname, int mode, off_t offset, off_t len, struct fuse_file_info *fi);
 
 private:
     static struct fuse_operations ops;
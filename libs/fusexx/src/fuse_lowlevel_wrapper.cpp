@@ -0,0 +1,934 @@
+#include <fuse_lowlevel_wrapper.h>
+
+#if FUSE_VERSION < 30
+#include <fuse/fuse_lowlevel.h>
+#else
+#include <fuse_lowlevel.h>
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#ifndef RENAME_EXCHANGE
+#define RENAME_EXCHANGE (1 << 1)
+#endif
+
+class FuseLowlevelWrapper::detail {
+public:
+    detail() = delete;
+
+    static FuseLowlevelWrapper &wrapper(fuse_req_t req) {
+        auto *self = static_cast<FuseLowlevelWrapper *>(fuse_req_userdata(req));
+
+        if (self->fs.pid == 0) {
+            const struct fuse_ctx *ctx = fuse_req_ctx(req);
+            self->fs.uid = ctx->uid;
+            self->fs.gid = ctx->gid;
+            self->fs.pid = ctx->pid;
+#if FUSE_VERSION >= 28
+            self->fs.umask = ctx->umask;
+#endif
+        }
+        return *self;
+    }
+
+    /** Looks up path of a node, replies with an error if the node is unknown */
+    static std::shared_ptr<const std::string> resolve(fuse_req_t req, fuse_ino_t ino) {
+        auto path = wrapper(req).path_of(ino);
+        if (path == nullptr) {
+            fuse_reply_err(req, ESTALE);
+        }
+        return path;
+    }
+
+    /** Looks up path of a child of a node, replies with an error if the parent is unknown */
+    static std::shared_ptr<const std::string> resolve(fuse_req_t req, fuse_ino_t parent, const char *name) {
+        auto path = wrapper(req).child_path(parent, name);
+        if (path == nullptr) {
+            fuse_reply_err(req, ESTALE);
+        }
+        return path;
+    }
+
+    /** Fills an entry for a freshly looked up or created path and registers the lookup */
+    static int make_entry(FuseLowlevelWrapper &self, const std::shared_ptr<const std::string> &path,
+                          struct fuse_entry_param &entry) {
+        int res = self.fs.getattr(*path, &entry.attr);
+        if (res < 0) {
+            return res;
+        }
+
+        entry.ino = self.remember(path, S_ISDIR(entry.attr.st_mode));
+        entry.generation = 0;
+        entry.attr_timeout = self.attr_timeout;
+        entry.entry_timeout = self.entry_timeout;
+        return 0;
+    }
+
+    static void reply_entry(fuse_req_t req, const std::shared_ptr<const std::string> &path, int res) {
+        auto &self = wrapper(req);
+
+        struct fuse_entry_param entry {};
+        if (res == 0) {
+            res = make_entry(self, path, entry);
+        }
+
+        if (res < 0) {
+            fuse_reply_err(req, -res);
+            return;
+        }
+
+        if (fuse_reply_entry(req, &entry) != 0) {
+            self.forget(entry.ino, 1);
+        }
+    }
+
+    static void reply_result(fuse_req_t req, int res) {
+        fuse_reply_err(req, res < 0 ? -res : 0);
+    }
+
+    static void init(void *userdata, struct fuse_conn_info *conn) {
+        auto *self = static_cast<FuseLowlevelWrapper *>(userdata);
+
+        FuseWrapper::connection connection(conn);
+        self->fs.init(connection);
+        self->fs.negotiated(connection);
+        connection.apply(conn);
+    }
+
+    static void destroy(void *userdata) {
+        auto *self = static_cast<FuseLowlevelWrapper *>(userdata);
+        self->fs.destroy();
+    }
+
+    static void lookup(fuse_req_t req, fuse_ino_t parent, const char *name) {
+        auto &self = wrapper(req);
+        auto path = resolve(req, parent, name);
+        if (path == nullptr) {
+            return;
+        }
+
+        struct fuse_entry_param entry {};
+        int res = make_entry(self, path, entry);
+
+        if (res == -ENOENT && self.negative_timeout > 0) {
+            entry = {};
+            entry.entry_timeout = self.negative_timeout;
+            fuse_reply_entry(req, &entry);
+            return;
+        }
+
+        if (res < 0) {
+            fuse_reply_err(req, -res);
+            return;
+        }
+
+        if (fuse_reply_entry(req, &entry) != 0) {
+            self.forget(entry.ino, 1);
+        }
+    }
+
+    static void forget(fuse_req_t req, fuse_ino_t ino, unsigned long nlookup) {
+        wrapper(req).forget(ino, nlookup);
+        fuse_reply_none(req);
+    }
+
+#if FUSE_VERSION >= 29
+    static void forget_multi(fuse_req_t req, size_t count, struct fuse_forget_data *forgets) {
+        auto &self = wrapper(req);
+        for (size_t i = 0; i < count; ++i) {
+            self.forget(forgets[i].ino, forgets[i].nlookup);
+        }
+        fuse_reply_none(req);
+    }
+#endif
+
+    static void getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *) {
+        auto &self = wrapper(req);
+        auto path = resolve(req, ino);
+        if (path == nullptr) {
+            return;
+        }
+
+        struct stat st {};
+        int res = self.fs.getattr(*path, &st);
+        if (res < 0) {
+            fuse_reply_err(req, -res);
+            return;
+        }
+        fuse_reply_attr(req, &st, self.attr_timeout);
+    }
+
+    static struct timespec requested_time(int to_set, int set_flag, int now_flag, const struct timespec &time) {
+        if (to_set & now_flag) {
+            return {0, UTIME_NOW};
+        }
+        if (to_set & set_flag) {
+            return time;
+        }
+        return {0, UTIME_OMIT};
+    }
+
+    static void setattr(fuse_req_t req, fuse_ino_t ino, struct stat *attr, int to_set, struct fuse_file_info *fi) {
+        auto &self = wrapper(req);
+        auto path = resolve(req, ino);
+        if (path == nullptr) {
+            return;
+        }
+
+        int res = 0;
+        if (to_set & FUSE_SET_ATTR_MODE) {
+            res = self.fs.chmod(*path, attr->st_mode);
+        }
+        if (res == 0 && (to_set & (FUSE_SET_ATTR_UID | FUSE_SET_ATTR_GID))) {
+            uid_t uid = (to_set & FUSE_SET_ATTR_UID) ? attr->st_uid : static_cast<uid_t>(-1);
+            gid_t gid = (to_set & FUSE_SET_ATTR_GID) ? attr->st_gid : static_cast<gid_t>(-1);
+            res = self.fs.chown(*path, uid, gid);
+        }
+        if (res == 0 && (to_set & FUSE_SET_ATTR_SIZE)) {
+            res = fi != nullptr ? self.fs.ftruncate(*path, attr->st_size, fi) : self.fs.truncate(*path, attr->st_size);
+        }
+        if (res == 0 && (to_set & (FUSE_SET_ATTR_ATIME | FUSE_SET_ATTR_MTIME))) {
+            const struct timespec tv[2] = {
+                requested_time(to_set, FUSE_SET_ATTR_ATIME, FUSE_SET_ATTR_ATIME_NOW, attr->st_atim),
+                requested_time(to_set, FUSE_SET_ATTR_MTIME, FUSE_SET_ATTR_MTIME_NOW, attr->st_mtim),
+            };
+            res = self.fs.utimens(*path, tv);
+        }
+
+        struct stat st {};
+        if (res == 0) {
+            res = self.fs.getattr(*path, &st);
+        }
+
+        if (res < 0) {
+            fuse_reply_err(req, -res);
+            return;
+        }
+        fuse_reply_attr(req, &st, self.attr_timeout);
+    }
+
+    static void readlink(fuse_req_t req, fuse_ino_t ino) {
+        auto &self = wrapper(req);
+        auto path = resolve(req, ino);
+        if (path == nullptr) {
+            return;
+        }
+
+        char target[PATH_MAX + 1] = {};
+        int res = self.fs.readlink(*path, target, sizeof(target) - 1);
+        if (res < 0) {
+            fuse_reply_err(req, -res);
+            return;
+        }
+        fuse_reply_readlink(req, target);
+    }
+
+    static void mknod(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode, dev_t rdev) {
+        auto path = resolve(req, parent, name);
+        if (path != nullptr) {
+            reply_entry(req, path, wrapper(req).fs.mknod(*path, mode, rdev));
+        }
+    }
+
+    static void mkdir(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode) {
+        auto path = resolve(req, parent, name);
+        if (path != nullptr) {
+            reply_entry(req, path, wrapper(req).fs.mkdir(*path, mode));
+        }
+    }
+
+    static void symlink(fuse_req_t req, const char *target, fuse_ino_t parent, const char *name) {
+        auto path = resolve(req, parent, name);
+        if (path != nullptr) {
+            reply_entry(req, path, wrapper(req).fs.symlink(target, *path));
+        }
+    }
+
+    static void link(fuse_req_t req, fuse_ino_t ino, fuse_ino_t newparent, const char *newname) {
+        auto &self = wrapper(req);
+        auto oldpath = resolve(req, ino);
+        if (oldpath == nullptr) {
+            return;
+        }
+        auto newpath = resolve(req, newparent, newname);
+        if (newpath == nullptr) {
+            return;
+        }
+
+        struct fuse_entry_param entry {};
+        int res = self.fs.link(*oldpath, *newpath);
+        if (res == 0) {
+            res = self.fs.getattr(*newpath, &entry.attr);
+        }
+        if (res < 0) {
+            fuse_reply_err(req, -res);
+            return;
+        }
+
+        // The new name has to be the same inode to the kernel, not a second node
+        entry.ino = self.remember_link(ino, newpath, S_ISDIR(entry.attr.st_mode));
+        entry.generation = 0;
+        entry.attr_timeout = self.attr_timeout;
+        entry.entry_timeout = self.entry_timeout;
+        if (fuse_reply_entry(req, &entry) != 0) {
+            self.forget(entry.ino, 1);
+        }
+    }
+
+    static void unlink(fuse_req_t req, fuse_ino_t parent, const char *name) {
+        auto &self = wrapper(req);
+        auto path = resolve(req, parent, name);
+        if (path == nullptr) {
+            return;
+        }
+
+        int res = self.fs.unlink(*path);
+        if (res == 0) {
+            self.unmap(*path);
+        }
+        reply_result(req, res);
+    }
+
+    static void rmdir(fuse_req_t req, fuse_ino_t parent, const char *name) {
+        auto &self = wrapper(req);
+        auto path = resolve(req, parent, name);
+        if (path == nullptr) {
+            return;
+        }
+
+        int res = self.fs.rmdir(*path);
+        if (res == 0) {
+            self.unmap(*path);
+        }
+        reply_result(req, res);
+    }
+
+    static void rename(fuse_req_t req, fuse_ino_t parent, const char *name, fuse_ino_t newparent, const char *newname,
+                       unsigned int flags) {
+        auto &self = wrapper(req);
+        auto oldpath = resolve(req, parent, name);
+        if (oldpath == nullptr) {
+            return;
+        }
+        auto newpath = resolve(req, newparent, newname);
+        if (newpath == nullptr) {
+            return;
+        }
+
+        int res = self.fs.rename(*oldpath, *newpath, flags);
+        if (res == 0) {
+            self.move(*oldpath, *newpath, (flags & RENAME_EXCHANGE) != 0);
+        }
+        reply_result(req, res);
+    }
+
+#if FUSE_VERSION < 30
+    static void rename(fuse_req_t req, fuse_ino_t parent, const char *name, fuse_ino_t newparent,
+                       const char *newname) {
+        rename(req, parent, name, newparent, newname, 0);
+    }
+#endif
+
+    static void open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
+        auto &self = wrapper(req);
+        auto path = resolve(req, ino);
+        if (path == nullptr) {
+            return;
+        }
+
+        int res = self.fs.open(*path, fi);
+        if (res < 0) {
+            fuse_reply_err(req, -res);
+            return;
+        }
+
+        if (fuse_reply_open(req, fi) != 0) {
+            self.fs.release(*path, fi);
+        }
+    }
+
+    static void create(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode, struct fuse_file_info *fi) {
+        auto &self = wrapper(req);
+        auto path = resolve(req, parent, name);
+        if (path == nullptr) {
+            return;
+        }
+
+        int res = self.fs.create(*path, mode, fi);
+        if (res == -ENOSYS) {
+            res = self.fs.mknod(*path, (mode & ~S_IFMT) | S_IFREG, 0);
+            if (res == 0) {
+                res = self.fs.open(*path, fi);
+            }
+        }
+        if (res < 0) {
+            fuse_reply_err(req, -res);
+            return;
+        }
+
+        struct fuse_entry_param entry {};
+        res = make_entry(self, path, entry);
+        if (res < 0) {
+            self.fs.release(*path, fi);
+            fuse_reply_err(req, -res);
+            return;
+        }
+
+        if (fuse_reply_create(req, &entry, fi) != 0) {
+            self.fs.release(*path, fi);
+            self.forget(entry.ino, 1);
+        }
+    }
+
+    static void free_buf(struct fuse_bufvec *bufvec) {
+        for (size_t i = 0; i < bufvec->count; ++i) {
+            if (!(bufvec->buf[i].flags & FUSE_BUF_IS_FD)) {
+                free(bufvec->buf[i].mem);
+            }
+        }
+        free(bufvec);
+    }
+
+    static void read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info *fi) {
+        auto &self = wrapper(req);
+        auto path = resolve(req, ino);
+        if (path == nullptr) {
+            return;
+        }
+
+        struct fuse_bufvec *bufvec = nullptr;
+        int res = self.fs.read_buf(*path, &bufvec, size, off, fi);
+        if (res < 0) {
+            fuse_reply_err(req, -res);
+            return;
+        }
+
+        fuse_reply_data(req, bufvec, FUSE_BUF_SPLICE_MOVE);
+        free_buf(bufvec);
+    }
+
+    static void write(fuse_req_t req, fuse_ino_t ino, const char *buf, size_t size, off_t off,
+                      struct fuse_file_info *fi) {
+        auto &self = wrapper(req);
+        auto path = resolve(req, ino);
+        if (path == nullptr) {
+            return;
+        }
+
+        int res = self.fs.write(*path, buf, size, off, fi);
+        if (res < 0) {
+            fuse_reply_err(req, -res);
+            return;
+        }
+        fuse_reply_write(req, res);
+    }
+
+    static void write_buf(fuse_req_t req, fuse_ino_t ino, struct fuse_bufvec *bufvec, off_t off,
+                          struct fuse_file_info *fi) {
+        auto &self = wrapper(req);
+        auto path = resolve(req, ino);
+        if (path == nullptr) {
+            return;
+        }
+
+        int res = self.fs.write_buf(*path, bufvec, off, fi);
+        if (res < 0) {
+            fuse_reply_err(req, -res);
+            return;
+        }
+        fuse_reply_write(req, res);
+    }
+
+    static void flush(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
+        auto path = resolve(req, ino);
+        if (path != nullptr) {
+            reply_result(req, wrapper(req).fs.flush(*path, fi));
+        }
+    }
+
+    static void release(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
+        auto path = resolve(req, ino);
+        if (path != nullptr) {
+            wrapper(req).fs.release(*path, fi);
+            fuse_reply_err(req, 0);
+        }
+    }
+
+    static void fsync(fuse_req_t req, fuse_ino_t ino, int datasync, struct fuse_file_info *fi) {
+        auto path = resolve(req, ino);
+        if (path != nullptr) {
+            reply_result(req, wrapper(req).fs.fsync(*path, datasync, fi));
+        }
+    }
+
+    static void opendir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
+        auto &self = wrapper(req);
+        auto path = resolve(req, ino);
+        if (path == nullptr) {
+            return;
+        }
+
+        int res = self.fs.opendir(*path, fi);
+        if (res < 0) {
+            fuse_reply_err(req, -res);
+            return;
+        }
+
+        if (fuse_reply_open(req, fi) != 0) {
+            self.fs.releasedir(*path, fi);
+        }
+    }
+
+    /** Reply buffer filled by readdir() through fill_dir() */
+    struct DirBuffer {
+        fuse_req_t req;
+        fuse_ino_t ino;
+        std::vector<char> data;
+        size_t used;
+    };
+
+#if FUSE_VERSION < 30
+    static int add_entry(void *handle, const char *name, const struct stat *stbuf, off_t off) {
+#else
+    static int add_entry(void *handle, const char *name, const struct stat *stbuf, off_t off,
+                         enum fuse_fill_dir_flags) {
+#endif
+        auto *dir = static_cast<DirBuffer *>(handle);
+
+        struct stat st {};
+        if (stbuf != nullptr) {
+            st = *stbuf;
+        }
+
+        size_t remaining = dir->data.size() - dir->used;
+        size_t entry_size = fuse_add_direntry(dir->req, dir->data.data() + dir->used, remaining, name, &st, off);
+        if (entry_size > remaining) {
+            return 1;
+        }
+
+        dir->used += entry_size;
+        return 0;
+    }
+
+#if FUSE_VERSION >= 30
+    /** Adds an entry together with its attributes, each entry with valid attributes counts as a lookup */
+    static int add_entry_plus(void *handle, const char *name, const struct stat *stbuf, off_t off,
+                              enum fuse_fill_dir_flags flags) {
+        auto *dir = static_cast<DirBuffer *>(handle);
+        auto &self = wrapper(dir->req);
+
+        struct fuse_entry_param entry {};
+        if (stbuf != nullptr) {
+            entry.attr = *stbuf;
+        }
+
+        bool is_dot = strcmp(name, ".") == 0 || strcmp(name, "..") == 0;
+        if ((flags & FUSE_FILL_DIR_PLUS) && stbuf != nullptr && !is_dot) {
+            auto path = self.child_path(dir->ino, name);
+            if (path != nullptr) {
+                entry.ino = self.remember(path, S_ISDIR(stbuf->st_mode));
+                entry.attr_timeout = self.attr_timeout;
+                entry.entry_timeout = self.entry_timeout;
+            }
+        }
+
+        size_t remaining = dir->data.size() - dir->used;
+        size_t entry_size =
+            fuse_add_direntry_plus(dir->req, dir->data.data() + dir->used, remaining, name, &entry, off);
+        if (entry_size > remaining) {
+            if (entry.ino != 0) {
+                self.forget(entry.ino, 1);
+            }
+            return 1;
+        }
+
+        dir->used += entry_size;
+        return 0;
+    }
+#endif
+
+    static void list(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info *fi,
+                     FuseWrapper::readdir_flags flags, fuse_fill_dir_t filler) {
+        auto &self = wrapper(req);
+        auto path = resolve(req, ino);
+        if (path == nullptr) {
+            return;
+        }
+
+        DirBuffer dir{req, ino, std::vector<char>(size), 0};
+        FuseWrapper::set_dir_filler(&dir, filler);
+
+        int res = self.fs.readdir(*path, off, fi, flags);
+        if (res < 0) {
+            fuse_reply_err(req, -res);
+            return;
+        }
+        fuse_reply_buf(req, dir.data.data(), dir.used);
+    }
+
+    static void readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info *fi) {
+        list(req, ino, size, off, fi, static_cast<FuseWrapper::readdir_flags>(0), add_entry);
+    }
+
+#if FUSE_VERSION >= 30
+    static void readdirplus(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info *fi) {
+        list(req, ino, size, off, fi, FuseWrapper::READDIR_PLUS, add_entry_plus);
+    }
+#endif
+
+    static void releasedir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
+        auto path = resolve(req, ino);
+        if (path != nullptr) {
+            wrapper(req).fs.releasedir(*path, fi);
+            fuse_reply_err(req, 0);
+        }
+    }
+
+    static void fsyncdir(fuse_req_t req, fuse_ino_t ino, int datasync, struct fuse_file_info *fi) {
+        auto path = resolve(req, ino);
+        if (path != nullptr) {
+            reply_result(req, wrapper(req).fs.fsyncdir(*path, datasync, fi));
+        }
+    }
+
+    static void statfs(fuse_req_t req, fuse_ino_t ino) {
+        auto &self = wrapper(req);
+        auto path = resolve(req, ino);
+        if (path == nullptr) {
+            return;
+        }
+
+        struct statvfs st {};
+        int res = self.fs.statfs(*path, &st);
+        if (res < 0) {
+            fuse_reply_err(req, -res);
+            return;
+        }
+        fuse_reply_statfs(req, &st);
+    }
+
+    static void access(fuse_req_t req, fuse_ino_t ino, int mask) {
+        auto path = resolve(req, ino);
+        if (path != nullptr) {
+            reply_result(req, wrapper(req).fs.access(*path, mask));
+        }
+    }
+
+    static struct fuse_lowlevel_ops operations() {
+        struct fuse_lowlevel_ops ops {};
+
+        ops.init = init;
+        ops.destroy = destroy;
+        ops.lookup = lookup;
+        ops.forget = forget;
+#if FUSE_VERSION >= 29
+        ops.forget_multi = forget_multi;
+#endif
+        ops.getattr = getattr;
+        ops.setattr = setattr;
+        ops.readlink = readlink;
+        ops.mknod = mknod;
+        ops.mkdir = mkdir;
+        ops.unlink = unlink;
+        ops.rmdir = rmdir;
+        ops.symlink = symlink;
+        ops.rename = rename;
+        ops.link = link;
+        ops.open = open;
+        ops.create = create;
+        ops.read = read;
+        ops.write = write;
+        ops.write_buf = write_buf;
+        ops.flush = flush;
+        ops.release = release;
+        ops.fsync = fsync;
+        ops.opendir = opendir;
+        ops.readdir = readdir;
+#if FUSE_VERSION >= 30
+        ops.readdirplus = readdirplus;
+#endif
+        ops.releasedir = releasedir;
+        ops.fsyncdir = fsyncdir;
+        ops.statfs = statfs;
+        ops.access = access;
+
+        return ops;
+    }
+};
+
+FuseLowlevelWrapper::FuseLowlevelWrapper(FuseWrapper &fs) : fs(fs), next_ino(FUSE_ROOT_ID + 1) {
+    auto root = std::make_shared<const std::string>("/");
+    inodes[FUSE_ROOT_ID] = Inode{root, 1, true};
+    by_path[*root] = FUSE_ROOT_ID;
+}
+
+FuseLowlevelWrapper::~FuseLowlevelWrapper() = default;
+
+std::shared_ptr<const std::string> FuseLowlevelWrapper::path_of(uint64_t ino) {
+    std::lock_guard<std::mutex> lock(inodes_mutex);
+
+    auto it = inodes.find(ino);
+    return it == inodes.end() ? nullptr : it->second.path;
+}
+
+std::shared_ptr<const std::string> FuseLowlevelWrapper::child_path(uint64_t parent, const char *name) {
+    auto parent_path = path_of(parent);
+    if (parent_path == nullptr) {
+        return nullptr;
+    }
+
+    std::string path;
+    path.reserve(parent_path->size() + strlen(name) + 1);
+    if (*parent_path != "/") {
+        path += *parent_path;
+    }
+    path += '/';
+    path += name;
+
+    return std::make_shared<const std::string>(std::move(path));
+}
+
+uint64_t FuseLowlevelWrapper::remember(const std::shared_ptr<const std::string> &path, bool is_directory) {
+    std::lock_guard<std::mutex> lock(inodes_mutex);
+
+    auto it = by_path.find(*path);
+    if (it != by_path.end()) {
+        Inode &inode = inodes[it->second];
+        inode.nlookup++;
+        inode.is_directory = is_directory;
+        return it->second;
+    }
+
+    uint64_t ino = next_ino++;
+    inodes[ino] = Inode{path, 1, is_directory};
+    by_path[*path] = ino;
+
+    return ino;
+}
+
+uint64_t FuseLowlevelWrapper::remember_link(uint64_t ino, const std::shared_ptr<const std::string> &path,
+                                            bool is_directory) {
+    {
+        std::lock_guard<std::mutex> lock(inodes_mutex);
+
+        auto it = inodes.find(ino);
+        if (it != inodes.end()) {
+            unmap_locked(*path);
+            it->second.nlookup++;
+            it->second.aliases.push_back(*path);
+            by_path[*path] = ino;
+            return ino;
+        }
+    }
+
+    // The source node was forgotten meanwhile, the new name gets a node of its own
+    return remember(path, is_directory);
+}
+
+void FuseLowlevelWrapper::forget(uint64_t ino, uint64_t nlookup) {
+    if (ino == FUSE_ROOT_ID) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(inodes_mutex);
+
+    auto it = inodes.find(ino);
+    if (it == inodes.end()) {
+        return;
+    }
+
+    Inode &inode = it->second;
+    inode.nlookup = inode.nlookup > nlookup ? inode.nlookup - nlookup : 0;
+    if (inode.nlookup > 0) {
+        return;
+    }
+
+    auto unmap_name = [&](const std::string &path) {
+        auto mapped = by_path.find(path);
+        if (mapped != by_path.end() && mapped->second == ino) {
+            by_path.erase(mapped);
+        }
+    };
+    unmap_name(*inode.path);
+    for (const auto &alias : inode.aliases) {
+        unmap_name(alias);
+    }
+    inodes.erase(it);
+}
+
+void FuseLowlevelWrapper::unmap(const std::string &path) {
+    std::lock_guard<std::mutex> lock(inodes_mutex);
+    unmap_locked(path);
+}
+
+void FuseLowlevelWrapper::unmap_locked(const std::string &path) {
+    auto mapped = by_path.find(path);
+    if (mapped == by_path.end()) {
+        return;
+    }
+
+    uint64_t ino = mapped->second;
+    by_path.erase(mapped);
+
+    auto it = inodes.find(ino);
+    if (it == inodes.end()) {
+        return;
+    }
+
+    // A hard linked file stays reachable under one of its other names
+    Inode &inode = it->second;
+    if (*inode.path == path && !inode.aliases.empty()) {
+        inode.path = std::make_shared<const std::string>(std::move(inode.aliases.back()));
+        inode.aliases.pop_back();
+    } else {
+        auto alias = std::find(inode.aliases.begin(), inode.aliases.end(), path);
+        if (alias != inode.aliases.end()) {
+            inode.aliases.erase(alias);
+        }
+    }
+}
+
+std::vector<std::pair<std::string, uint64_t>> FuseLowlevelWrapper::take_subtree(const std::string &path) {
+    std::vector<std::pair<std::string, uint64_t>> taken;
+
+    auto top = by_path.find(path);
+    if (top == by_path.end()) {
+        return taken;
+    }
+
+    uint64_t top_ino = top->second;
+    taken.emplace_back("", top_ino);
+    by_path.erase(top);
+
+    auto it = inodes.find(top_ino);
+    if (it == inodes.end() || !it->second.is_directory) {
+        return taken;
+    }
+
+    // Descendants keep their node ids, only the cached paths change
+    std::string prefix = path + "/";
+    for (auto entry = by_path.begin(); entry != by_path.end();) {
+        if (entry->first.compare(0, prefix.size(), prefix) == 0) {
+            taken.emplace_back(entry->first.substr(path.size()), entry->second);
+            entry = by_path.erase(entry);
+        } else {
+            ++entry;
+        }
+    }
+    return taken;
+}
+
+void FuseLowlevelWrapper::rename_node(uint64_t ino, const std::string &from, const std::string &to) {
+    auto it = inodes.find(ino);
+    if (it == inodes.end()) {
+        return;
+    }
+
+    Inode &inode = it->second;
+    if (*inode.path == from) {
+        inode.path = std::make_shared<const std::string>(to);
+    } else {
+        std::replace(inode.aliases.begin(), inode.aliases.end(), from, to);
+    }
+    by_path[to] = ino;
+}
+
+void FuseLowlevelWrapper::move(const std::string &oldpath, const std::string &newpath, bool exchange) {
+    std::lock_guard<std::mutex> lock(inodes_mutex);
+
+    auto moved = take_subtree(oldpath);
+    std::vector<std::pair<std::string, uint64_t>> swapped;
+    if (exchange) {
+        swapped = take_subtree(newpath);
+    } else {
+        unmap_locked(newpath);
+    }
+
+    for (const auto &[suffix, ino] : moved) {
+        rename_node(ino, oldpath + suffix, newpath + suffix);
+    }
+    for (const auto &[suffix, ino] : swapped) {
+        rename_node(ino, newpath + suffix, oldpath + suffix);
+    }
+}
+
+int FuseLowlevelWrapper::main(int argc, char *argv[]) {
+    static const struct fuse_lowlevel_ops ops = detail::operations();
+    struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+    int err = -1;
+
+#if FUSE_VERSION < 30
+    char *mountpoint = nullptr;
+    int multithreaded = 0;
+    int foreground = 0;
+
+    if (fuse_parse_cmdline(&args, &mountpoint, &multithreaded, &foreground) != -1) {
+        struct fuse_chan *chan = fuse_mount(mountpoint, &args);
+        if (chan != nullptr) {
+            struct fuse_session *session = fuse_lowlevel_new(&args, &ops, sizeof(ops), this);
+            if (session != nullptr) {
+                if (fuse_set_signal_handlers(session) != -1) {
+                    fuse_session_add_chan(session, chan);
+                    if (fuse_daemonize(foreground) != -1) {
+                        err = multithreaded && fs.loop.multithreaded ? fuse_session_loop_mt(session)
+                                                                     : fuse_session_loop(session);
+                    }
+                    fuse_remove_signal_handlers(session);
+                    fuse_session_remove_chan(chan);
+                }
+                fuse_session_destroy(session);
+            }
+            fuse_unmount(mountpoint, chan);
+        }
+        free(mountpoint);
+    }
+#else  // FUSE_VERSION >= 30
+    struct fuse_cmdline_opts opts {};
+
+    if (fuse_parse_cmdline(&args, &opts) == 0 && opts.mountpoint != nullptr) {
+        struct fuse_session *session = fuse_session_new(&args, &ops, sizeof(ops), this);
+        if (session != nullptr) {
+            if (fuse_set_signal_handlers(session) == 0) {
+                if (fuse_session_mount(session, opts.mountpoint) == 0) {
+                    fuse_daemonize(opts.foreground);
+                    if (opts.singlethread || !fs.loop.multithreaded) {
+                        err = fuse_session_loop(session);
+                    } else {
+#if FUSE_USE_VERSION < 32
+                        // Older API levels map the loop to a variant which takes only the clone_fd flag
+                        err = fuse_session_loop_mt(session, opts.clone_fd || fs.loop.clone_fd);
+#elif FUSE_USE_VERSION < 312
+                        struct fuse_loop_config config {};
+                        config.clone_fd = opts.clone_fd || fs.loop.clone_fd;
+                        config.max_idle_threads = fs.loop.max_idle_threads;
+                        err = fuse_session_loop_mt(session, &config);
+#else
+                        struct fuse_loop_config *config = fuse_loop_cfg_create();
+                        fuse_loop_cfg_set_clone_fd(config, opts.clone_fd || fs.loop.clone_fd);
+                        fuse_loop_cfg_set_idle_threads(config, fs.loop.max_idle_threads);
+                        if (fs.loop.max_threads > 0) {
+                            fuse_loop_cfg_set_max_threads(config, fs.loop.max_threads);
+                        }
+                        err = fuse_session_loop_mt(session, config);
+                        fuse_loop_cfg_destroy(config);
+#endif
+                    }
+                    fuse_session_unmount(session);
+                }
+                fuse_remove_signal_handlers(session);
+            }
+            fuse_session_destroy(session);
+        }
+    }
+    free(opts.mountpoint);
+#endif
+
+    fuse_opt_free_args(&args);
+    return err ? 1 : 0;
+}
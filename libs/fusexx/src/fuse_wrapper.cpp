@@ -1,7 +1,9 @@
 #include <fuse_wrapper.h>
 
 #include <cerrno>
+#include <climits>
 #include <cstdlib>
+#include <vector>
 
 #if defined(_WIN32) || defined(_WIN64)
 #define thread_local _declspec(thread)
@@ -85,6 +87,10 @@ public:
     static int truncate(const char *path, off_t length) {
         return fuse().truncate(path, length);
     }
+
+    static int ftruncate(const char *path, off_t length, struct fuse_file_info *fi) {
+        return fuse().ftruncate(path, length, fi);
+    }
 #else  // FUSE_VERSION >= 30
     static int chmod(const char *pathname, mode_t mode, struct fuse_file_info *fi) {
 #warning chmod fuse_file_info unimplemented
@@ -97,8 +103,9 @@ public:
         return fuse().chown(pathname, uid, gid);
     }
     static int truncate(const char *path, off_t length, struct fuse_file_info *fi) {
-#warning truncate fuse_file_info unimplemented
-        (void)fi;
+        if (fi != nullptr) {
+            return fuse().ftruncate(path, length, fi);
+        }
         return fuse().truncate(path, length);
     }
 #endif
@@ -131,7 +138,7 @@ public:
     }
 
     static int setxattr(const char *path, const char *name, const char *value, size_t size, int flags) {
-        return fuse().setxattr(path, name, value, size, flags);
+        return fuse().setxattr(path, name, std::string_view(value, size), size, flags);
     }
 
     static int getxattr(const char *path, const char *name, char *value, size_t size) {
@@ -153,13 +160,22 @@ public:
         return fuse().opendir(opendir, fi);
     }
 
+#if FUSE_VERSION < 30
     static int readdir(const char *pathname, void *buf, fuse_fill_dir_t fillerDir, off_t off,
                        struct fuse_file_info *fi) {
-        int flags = 0;
         detail::filler_handle = buf;
         detail::filler = fillerDir;
-        return fuse().readdir(pathname, off, fi, static_cast<FuseWrapper::readdir_flags>(flags));
+        return fuse().readdir(pathname, off, fi, static_cast<FuseWrapper::readdir_flags>(0));
+    }
+#else  // FUSE_VERSION >= 30
+    static int readdir(const char *pathname, void *buf, fuse_fill_dir_t fillerDir, off_t off,
+                       struct fuse_file_info *fi, enum fuse_readdir_flags flags) {
+        detail::filler_handle = buf;
+        detail::filler = fillerDir;
+        int wanted = (flags & FUSE_READDIR_PLUS) ? FuseWrapper::READDIR_PLUS : 0;
+        return fuse().readdir(pathname, off, fi, static_cast<FuseWrapper::readdir_flags>(wanted));
     }
+#endif
 
     static int releasedir(const char *pathname, struct fuse_file_info *fi) {
         return fuse().releasedir(pathname, fi);
@@ -174,9 +190,13 @@ public:
         } cfg;
 
         class FuseWrapper *fuseptr = &fuse();
-        (void)conn;
         (void)cfg;
-        fuseptr->init();
+
+        FuseWrapper::connection connection(conn);
+        fuseptr->init(connection);
+        fuseptr->negotiated(connection);
+        connection.apply(conn);
+
         return fuseptr;
     }
     static void destroy(void *private_data) {
@@ -250,142 +270,243 @@ public:
 thread_local void *FuseWrapper::detail::filler_handle;
 thread_local fuse_fill_dir_t FuseWrapper::detail::filler;
 
-int FuseWrapper::getattr(const std::string &, struct stat *) {
+int FuseWrapper::getattr(std::string_view, struct stat *) {
     return -ENOSYS;
 }
-int FuseWrapper::readlink(const std::string &, char *, size_t) {
+int FuseWrapper::readlink(std::string_view, char *, size_t) {
     return -ENOSYS;
 }
-int FuseWrapper::mknod(const std::string &, mode_t, dev_t) {
+int FuseWrapper::mknod(std::string_view, mode_t, dev_t) {
     return -ENOSYS;
 }
-int FuseWrapper::mkdir(const std::string &, mode_t) {
+int FuseWrapper::mkdir(std::string_view, mode_t) {
     return -ENOSYS;
 }
-int FuseWrapper::unlink(const std::string &) {
+int FuseWrapper::unlink(std::string_view) {
     return -ENOSYS;
 }
-int FuseWrapper::rmdir(const std::string &) {
+int FuseWrapper::rmdir(std::string_view) {
     return -ENOSYS;
 }
-int FuseWrapper::symlink(const std::string &, const std::string &) {
+int FuseWrapper::symlink(std::string_view, std::string_view) {
     return -ENOSYS;
 }
-int FuseWrapper::rename(const std::string &, const std::string &, unsigned int) {
+int FuseWrapper::rename(std::string_view, std::string_view, unsigned int) {
     return -ENOSYS;
 }
-int FuseWrapper::link(const std::string &, const std::string &) {
+int FuseWrapper::link(std::string_view, std::string_view) {
     return -ENOSYS;
 }
-int FuseWrapper::chmod(const std::string &, mode_t) {
+int FuseWrapper::chmod(std::string_view, mode_t) {
     return -ENOSYS;
 }
-int FuseWrapper::chown(const std::string &, uid_t, gid_t) {
+int FuseWrapper::chown(std::string_view, uid_t, gid_t) {
     return -ENOSYS;
 }
-int FuseWrapper::truncate(const std::string &, off_t) {
+int FuseWrapper::truncate(std::string_view, off_t) {
     return -ENOSYS;
 }
-int FuseWrapper::open(const std::string &, struct fuse_file_info *) {
+int FuseWrapper::ftruncate(std::string_view path, off_t length, struct fuse_file_info *) {
+    return truncate(path, length);
+}
+int FuseWrapper::open(std::string_view, struct fuse_file_info *) {
     return 0;
 }
-int FuseWrapper::read(const std::string &, char *, size_t, off_t, struct fuse_file_info *) {
+int FuseWrapper::read(std::string_view, char *, size_t, off_t, struct fuse_file_info *) {
     return -ENOSYS;
 }
-int FuseWrapper::write(const std::string &, const char *, size_t, off_t, struct fuse_file_info *) {
+int FuseWrapper::write(std::string_view, const char *, size_t, off_t, struct fuse_file_info *) {
     return -ENOSYS;
 }
-int FuseWrapper::statfs(const std::string &, struct statvfs *) {
+int FuseWrapper::statfs(std::string_view, struct statvfs *) {
     return 0;
 }
-int FuseWrapper::flush(const std::string &, struct fuse_file_info *) {
+int FuseWrapper::flush(std::string_view, struct fuse_file_info *) {
     return -ENOSYS;
 }
-int FuseWrapper::release(const std::string &, struct fuse_file_info *) {
+int FuseWrapper::release(std::string_view, struct fuse_file_info *) {
     return 0;
 }
-int FuseWrapper::fsync(const std::string &, int, struct fuse_file_info *) {
+int FuseWrapper::fsync(std::string_view, int, struct fuse_file_info *) {
     return -ENOSYS;
 }
-int FuseWrapper::setxattr(const std::string &, const std::string &, const std::string &, size_t, int) {
+int FuseWrapper::setxattr(std::string_view, std::string_view, std::string_view, size_t, int) {
     return -ENOSYS;
 }
-int FuseWrapper::getxattr(const std::string &, const std::string &, char *, size_t) {
+int FuseWrapper::getxattr(std::string_view, std::string_view, char *, size_t) {
     return -ENOSYS;
 }
 
-int FuseWrapper::listxattr(const std::string &, char *, size_t) {
+int FuseWrapper::listxattr(std::string_view, char *, size_t) {
     return -ENOSYS;
 }
-int FuseWrapper::removexattr(const std::string &, const std::string &) {
+int FuseWrapper::removexattr(std::string_view, std::string_view) {
     return -ENOSYS;
 }
-int FuseWrapper::opendir(const std::string &, struct fuse_file_info *) {
+int FuseWrapper::opendir(std::string_view, struct fuse_file_info *) {
     return 0;
 }
-int FuseWrapper::readdir(const std::string &, off_t, struct fuse_file_info *, FuseWrapper::readdir_flags) {
+int FuseWrapper::readdir(std::string_view, off_t, struct fuse_file_info *, FuseWrapper::readdir_flags) {
     return -ENOSYS;
 }
 
-int FuseWrapper::fill_dir(const std::string &name, const struct stat *stbuf, off_t off,
+int FuseWrapper::fill_dir(std::string_view name, const struct stat *stbuf, off_t off,
                           [[maybe_unused]] FuseWrapper::fill_dir_flags flags) {
+    // Entry names are at most NAME_MAX long, so the terminated copy fits on the stack, longer ones cannot be listed
+    char terminated[NAME_MAX + 1];
+    if (name.size() > NAME_MAX) {
+        return 0;
+    }
+    name.copy(terminated, name.size());
+    terminated[name.size()] = '\0';
+
 #if FUSE_VERSION < 30
-    return detail::filler(detail::filler_handle, name.c_str(), stbuf, off);
+    return detail::filler(detail::filler_handle, terminated, stbuf, off);
 #else  // FUSE_VERSION >= 30
-    return detail::filler(detail::filler_handle, name.c_str(), stbuf, off, (::fuse_fill_dir_flags)flags);
+    return detail::filler(detail::filler_handle, terminated, stbuf, off, (::fuse_fill_dir_flags)flags);
 #endif
 }
 
-int FuseWrapper::releasedir(const std::string &, struct fuse_file_info *) {
+void FuseWrapper::set_dir_filler(void *handle, fuse_fill_dir_t filler) {
+    detail::filler_handle = handle;
+    detail::filler = filler;
+}
+
+int FuseWrapper::releasedir(std::string_view, struct fuse_file_info *) {
     return 0;
 }
-int FuseWrapper::fsyncdir(const std::string &, int, struct fuse_file_info *) {
+int FuseWrapper::fsyncdir(std::string_view, int, struct fuse_file_info *) {
     return -ENOSYS;
 }
-void FuseWrapper::init() {}
+namespace {
+
+struct capability_mapping {
+    FuseWrapper::capability cap;
+    unsigned int native;
+};
+
+const capability_mapping capabilities[] = {
+    {FuseWrapper::CAP_ASYNC_READ, FUSE_CAP_ASYNC_READ},
+    {FuseWrapper::CAP_ATOMIC_O_TRUNC, FUSE_CAP_ATOMIC_O_TRUNC},
+#ifdef FUSE_CAP_BIG_WRITES
+    {FuseWrapper::CAP_BIG_WRITES, FUSE_CAP_BIG_WRITES},
+#endif
+    {FuseWrapper::CAP_SPLICE_WRITE, FUSE_CAP_SPLICE_WRITE},
+    {FuseWrapper::CAP_SPLICE_MOVE, FUSE_CAP_SPLICE_MOVE},
+    {FuseWrapper::CAP_SPLICE_READ, FUSE_CAP_SPLICE_READ},
+#ifdef FUSE_CAP_WRITEBACK_CACHE
+    {FuseWrapper::CAP_WRITEBACK_CACHE, FUSE_CAP_WRITEBACK_CACHE},
+#endif
+#ifdef FUSE_CAP_PARALLEL_DIROPS
+    {FuseWrapper::CAP_PARALLEL_DIROPS, FUSE_CAP_PARALLEL_DIROPS},
+#endif
+};
+
+}  // namespace
+
+FuseWrapper::connection::connection(const struct fuse_conn_info *conn)
+    : max_write(conn->max_write),
+      max_readahead(conn->max_readahead),
+      max_background(conn->max_background),
+      congestion_threshold(conn->congestion_threshold) {
+    for (const auto &mapping : capabilities) {
+        if (conn->capable & mapping.native) {
+            capable_ |= mapping.cap;
+        }
+        if (conn->want & mapping.native) {
+            wanted_ |= mapping.cap;
+        }
+    }
+#if FUSE_VERSION < 30
+    if (conn->async_read) {
+        wanted_ |= CAP_ASYNC_READ;
+    }
+#endif
+}
+
+void FuseWrapper::connection::apply(struct fuse_conn_info *conn) const {
+    for (const auto &mapping : capabilities) {
+        if (enabled(mapping.cap)) {
+            conn->want |= mapping.native;
+        } else {
+            conn->want &= ~mapping.native;
+        }
+    }
+#if FUSE_VERSION < 30
+    conn->async_read = enabled(CAP_ASYNC_READ) ? 1 : 0;
+#endif
+
+    conn->max_write = max_write;
+    conn->max_readahead = max_readahead;
+    conn->max_background = max_background;
+    conn->congestion_threshold = congestion_threshold;
+}
+
+void FuseWrapper::init(connection &conn) {
+    // SPLICE_WRITE lets read replies be spliced into /dev/fuse, SPLICE_READ lets incoming write data be spliced out of
+    // it and SPLICE_MOVE allows moving the pages instead of copying them
+    conn.want(CAP_SPLICE_WRITE);
+    conn.want(CAP_SPLICE_MOVE);
+    conn.want(CAP_SPLICE_READ);
+}
+void FuseWrapper::negotiated(const connection &) {}
 void FuseWrapper::destroy() {}
 
 #if FUSE_VERSION >= 25
-int FuseWrapper::access(const std::string &, int) {
+int FuseWrapper::access(std::string_view, int) {
     return -ENOSYS;
 }
-int FuseWrapper::create(const std::string &, mode_t, struct fuse_file_info *) {
+int FuseWrapper::create(std::string_view, mode_t, struct fuse_file_info *) {
     return -ENOSYS;
 }
 #endif  // FUSE_VERSION >= 25
 
 #if FUSE_VERSION >= 26
-int FuseWrapper::lock(const std::string &, struct fuse_file_info *, int, struct flock *) {
+int FuseWrapper::lock(std::string_view, struct fuse_file_info *, int, struct flock *) {
     return -ENOSYS;
 }
-int FuseWrapper::utimens(const std::string &, const struct timespec[2]) {
+int FuseWrapper::utimens(std::string_view, const struct timespec[2]) {
     return -ENOSYS;
 }
-int FuseWrapper::bmap(const std::string &, size_t, uint64_t *) {
+int FuseWrapper::bmap(std::string_view, size_t, uint64_t *) {
     return -ENOSYS;
 }
-int FuseWrapper::ioctl(const std::string &, int, void *, struct fuse_file_info *, unsigned int, void *) {
+int FuseWrapper::ioctl(std::string_view, int, void *, struct fuse_file_info *, unsigned int, void *) {
     return -ENOSYS;
 }
-int FuseWrapper::poll(const std::string &, struct fuse_file_info *, struct fuse_pollhandle *, unsigned *) {
+int FuseWrapper::poll(std::string_view, struct fuse_file_info *, struct fuse_pollhandle *, unsigned *) {
     return -ENOSYS;
 }
 
-int FuseWrapper::write_buf(const std::string &pathname, struct fuse_bufvec *bufvec, off_t off,
+int FuseWrapper::write_buf(std::string_view pathname, struct fuse_bufvec *bufvec, off_t off,
                            struct fuse_file_info *fi) {
-    int total = 0;
+    size_t size = fuse_buf_size(bufvec);
+    std::vector<char> memory;
 
-    for (size_t idx = 0; idx < bufvec->count; ++idx) {
-        struct fuse_buf &buf = bufvec->buf[idx];
+    // Data still waiting in a pipe is pulled into memory first, so that write() can see it
+    for (size_t idx = bufvec->idx; idx < bufvec->count; ++idx) {
+        if (bufvec->buf[idx].flags & FUSE_BUF_IS_FD) {
+            memory.resize(size);
 
-        if (buf.flags & FUSE_BUF_IS_FD) {
-            return -ENOSYS;
+            struct fuse_bufvec dst = FUSE_BUFVEC_INIT(size);
+            dst.buf[0].mem = memory.data();
+
+            ssize_t copied = fuse_buf_copy(&dst, bufvec, static_cast<enum fuse_buf_copy_flags>(0));
+            if (copied < 0) {
+                return static_cast<int>(copied);
+            }
+
+            memory.resize(copied);
+            break;
         }
+    }
 
+    int total = 0;
+    auto write_all = [&](const char *data, size_t length) {
         size_t bufoff = 0;
-        while (bufoff < buf.size) {
-            int subsize = static_cast<int>(buf.size - bufoff);
-            int subtotal = write(pathname, static_cast<char *>(buf.mem) + bufoff, subsize, off, fi);
+        while (bufoff < length) {
+            int subsize = static_cast<int>(length - bufoff);
+            int subtotal = write(pathname, data + bufoff, subsize, off, fi);
             if (subtotal < 0) {
                 return subtotal;
             }
@@ -395,32 +516,59 @@ int FuseWrapper::write_buf(const std::string &pathname, struct fuse_bufvec *bufv
             total += subtotal;
 
             if (subtotal < subsize) {
-                return total;
+                return 1;
             }
         }
+        return 0;
+    };
+
+    if (!memory.empty()) {
+        int res = write_all(memory.data(), memory.size());
+        return res < 0 ? res : total;
+    }
+
+    for (size_t idx = 0; idx < bufvec->count; ++idx) {
+        struct fuse_buf &buf = bufvec->buf[idx];
+
+        int res = write_all(static_cast<char *>(buf.mem), buf.size);
+        if (res != 0) {
+            return res < 0 ? res : total;
+        }
     }
     return total;
 }
 
-int FuseWrapper::read_buf(const std::string &pathname, struct fuse_bufvec **bufp, size_t size, off_t off,
+int FuseWrapper::read_buf(std::string_view pathname, struct fuse_bufvec **bufp, size_t size, off_t off,
                           struct fuse_file_info *fi) {
-    *bufp = static_cast<struct fuse_bufvec *>(malloc(sizeof(**bufp)));
-    auto &bufvec = **bufp;
+    auto *bufvec = static_cast<struct fuse_bufvec *>(malloc(sizeof(struct fuse_bufvec)));
+    if (bufvec == nullptr) {
+        return -ENOMEM;
+    }
 
-    bufvec = FUSE_BUFVEC_INIT(size);
-    bufvec.buf[0].mem = malloc(size);
-    ssize_t amount = read(pathname, static_cast<char *>(bufvec.buf[0].mem), size, off, fi);
+    *bufvec = FUSE_BUFVEC_INIT(size);
+    bufvec->buf[0].mem = malloc(size);
+    if (bufvec->buf[0].mem == nullptr) {
+        free(bufvec);
+        return -ENOMEM;
+    }
+
+    int amount = read(pathname, static_cast<char *>(bufvec->buf[0].mem), size, off, fi);
+    if (amount < 0) {
+        free(bufvec->buf[0].mem);
+        free(bufvec);
+        return amount;
+    }
 
-    bufvec.buf[0].size = amount;
-    bufvec.off = amount;
+    bufvec->buf[0].size = amount;
+    *bufp = bufvec;
 
-    return static_cast<int>(amount);
+    return 0;
 }
 
-int FuseWrapper::flock(const std::string &, struct fuse_file_info *, int) {
+int FuseWrapper::flock(std::string_view, struct fuse_file_info *, int) {
     return -ENOSYS;
 }
-int FuseWrapper::fallocate(const std::string &, int, off_t, off_t, struct fuse_file_info *) {
+int FuseWrapper::fallocate(std::string_view, int, off_t, off_t, struct fuse_file_info *) {
     return -ENOSYS;
 }
 #endif  // FUSE_VERSION >= 26
@@ -477,7 +625,7 @@ struct fuse_operations FuseWrapper::ops = {
     .access = FuseWrapper::detail::access,
     .create = FuseWrapper::detail::create,
 #if FUSE_VERSION < 30
-    .ftruncate = nullptr,
+    .ftruncate = FuseWrapper::detail::ftruncate,
     .fgetattr = nullptr,
 #endif
 #endif
@@ -500,15 +648,79 @@ struct fuse_operations FuseWrapper::ops = {
 
     .ioctl = FuseWrapper::detail::ioctl,
     .poll = FuseWrapper::detail::poll,
-    .write_buf = nullptr,  // fuse::detail::write_buf,
-    .read_buf = nullptr,   // fuse::detail::read_buf,
+    .write_buf = FuseWrapper::detail::write_buf,
+    .read_buf = FuseWrapper::detail::read_buf,
     .flock = FuseWrapper::detail::flock,
     .fallocate = FuseWrapper::detail::fallocate,
 #endif
 };
 
 int FuseWrapper::main(int argc, char *argv[]) {
-    return fuse_main(argc, argv, &ops, this);
+#if FUSE_VERSION < 30
+    char *mountpoint = nullptr;
+    int multithreaded = 0;
+
+    struct fuse *fuse = fuse_setup(argc, argv, &ops, sizeof(ops), &mountpoint, &multithreaded, this);
+    if (fuse == nullptr) {
+        return 1;
+    }
+
+    int res = multithreaded && loop.multithreaded ? fuse_loop_mt(fuse) : fuse_loop(fuse);
+
+    fuse_teardown(fuse, mountpoint);
+    return res == -1 ? 1 : 0;
+#else  // FUSE_VERSION >= 30
+    struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+    struct fuse_cmdline_opts opts {};
+
+    if (fuse_parse_cmdline(&args, &opts) != 0) {
+        return 1;
+    }
+    if (opts.show_help || opts.show_version || opts.mountpoint == nullptr) {
+        free(opts.mountpoint);
+        fuse_opt_free_args(&args);
+        return fuse_main(argc, argv, &ops, this);
+    }
+
+    int res = 1;
+    struct fuse *fuse = fuse_new(&args, &ops, sizeof(ops), this);
+    if (fuse != nullptr) {
+        if (fuse_mount(fuse, opts.mountpoint) == 0) {
+            struct fuse_session *session = fuse_get_session(fuse);
+            if (fuse_daemonize(opts.foreground) == 0 && fuse_set_signal_handlers(session) == 0) {
+                if (opts.singlethread || !loop.multithreaded) {
+                    res = fuse_loop(fuse);
+                } else {
+#if FUSE_USE_VERSION < 32
+                    // Older API levels map fuse_loop_mt() to a variant which takes only the clone_fd flag
+                    res = fuse_loop_mt(fuse, opts.clone_fd || loop.clone_fd);
+#elif FUSE_USE_VERSION < 312
+                    struct fuse_loop_config config {};
+                    config.clone_fd = opts.clone_fd || loop.clone_fd;
+                    config.max_idle_threads = loop.max_idle_threads;
+                    res = fuse_loop_mt(fuse, &config);
+#else
+                    struct fuse_loop_config *config = fuse_loop_cfg_create();
+                    fuse_loop_cfg_set_clone_fd(config, opts.clone_fd || loop.clone_fd);
+                    fuse_loop_cfg_set_idle_threads(config, loop.max_idle_threads);
+                    if (loop.max_threads > 0) {
+                        fuse_loop_cfg_set_max_threads(config, loop.max_threads);
+                    }
+                    res = fuse_loop_mt(fuse, config);
+                    fuse_loop_cfg_destroy(config);
+#endif
+                }
+                fuse_remove_signal_handlers(session);
+            }
+            fuse_unmount(fuse);
+        }
+        fuse_destroy(fuse);
+    }
+
+    free(opts.mountpoint);
+    fuse_opt_free_args(&args);
+    return res ? 1 : 0;
+#endif
 }
 
 FuseWrapper::~FuseWrapper() = default;
@@ -0,0 +1,164 @@
+#include "attr_cache.h"
+
+#include <functional>
+
+AttrCache::AttrCache(std::chrono::nanoseconds ttl, size_t capacity)
+    : ttl(ttl.count()),
+      shard_capacity((capacity + SHARD_COUNT - 1) / SHARD_COUNT),
+      hits(Metrics::counter("attr_cache.hits")),
+      negative_hits(Metrics::counter("attr_cache.negative_hits")),
+      misses(Metrics::counter("attr_cache.misses")),
+      invalidations(Metrics::counter("attr_cache.invalidations")) {}
+
+void AttrCache::configure(std::chrono::nanoseconds new_ttl, size_t capacity) {
+    ttl.store(new_ttl.count(), std::memory_order_relaxed);
+    shard_capacity.store((capacity + SHARD_COUNT - 1) / SHARD_COUNT, std::memory_order_relaxed);
+    clear();
+}
+
+std::string_view AttrCache::normalize(std::string_view pathname) {
+    while (!pathname.empty() && pathname.front() == '/') {
+        pathname.remove_prefix(1);
+    }
+    return pathname;
+}
+
+AttrCache::Shard &AttrCache::shard_of(std::string_view key) {
+    return shards[std::hash<std::string_view>{}(key) % SHARD_COUNT];
+}
+
+AttrCache::Result AttrCache::lookup(std::string_view pathname, struct stat *st, uint64_t &generation) {
+    if (!enabled()) {
+        return Result::MISS;
+    }
+
+    std::string_view key = normalize(pathname);
+    Shard &shard = shard_of(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    generation = shard.generation;
+
+    auto it = shard.entries.find(key);
+    if (it == shard.entries.end() || it->second.expires <= Clock::now()) {
+        misses.fetch_add(1, std::memory_order_relaxed);
+        return Result::MISS;
+    }
+
+    if (!it->second.exists) {
+        negative_hits.fetch_add(1, std::memory_order_relaxed);
+        return Result::NEGATIVE;
+    }
+
+    hits.fetch_add(1, std::memory_order_relaxed);
+    if (st != nullptr) {
+        *st = it->second.st;
+    }
+    return Result::HIT;
+}
+
+void AttrCache::store(std::string_view pathname, const struct stat *st, uint64_t generation) {
+    if (!enabled()) {
+        return;
+    }
+
+    std::string_view key = normalize(pathname);
+    Shard &shard = shard_of(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    if (shard.generation != generation) {
+        return;
+    }
+
+    auto now = Clock::now();
+    Entry entry{st != nullptr, {}, now + std::chrono::nanoseconds(ttl.load(std::memory_order_relaxed))};
+    if (st != nullptr) {
+        entry.st = *st;
+    }
+
+    auto it = shard.entries.find(key);
+    if (it != shard.entries.end()) {
+        it->second = entry;
+        return;
+    }
+
+    size_t capacity = shard_capacity.load(std::memory_order_relaxed);
+    if (shard.entries.size() >= capacity) {
+        evict(shard, capacity, now);
+    }
+    shard.entries.emplace(key, entry);
+}
+
+void AttrCache::evict(Shard &shard, size_t capacity, Clock::time_point now) const {
+    for (auto it = shard.entries.begin(); it != shard.entries.end();) {
+        if (it->second.expires <= now) {
+            it = shard.entries.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    // Nothing expired, an arbitrary entry goes as the cache gives no ordering guarantees
+    if (!shard.entries.empty() && shard.entries.size() >= capacity) {
+        shard.entries.erase(shard.entries.begin());
+    }
+}
+
+void AttrCache::invalidate(std::string_view pathname) {
+    if (!enabled()) {
+        return;
+    }
+
+    std::string_view key = normalize(pathname);
+    Shard &shard = shard_of(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    shard.generation++;
+    auto it = shard.entries.find(key);
+    if (it != shard.entries.end()) {
+        shard.entries.erase(it);
+    }
+    invalidations.fetch_add(1, std::memory_order_relaxed);
+}
+
+void AttrCache::invalidate_tree(std::string_view pathname) {
+    if (!enabled()) {
+        return;
+    }
+
+    std::string_view key = normalize(pathname);
+    if (key.empty()) {
+        clear();
+        return;
+    }
+
+    // Descendants are spread over all shards
+    for (Shard &shard : shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.generation++;
+
+        for (auto it = shard.entries.begin(); it != shard.entries.end();) {
+            std::string_view cached = it->first;
+            bool below = cached.size() > key.size() && cached[key.size()] == '/';
+            if (cached.compare(0, key.size(), key) == 0 && (cached.size() == key.size() || below)) {
+                it = shard.entries.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+    invalidations.fetch_add(1, std::memory_order_relaxed);
+}
+
+void AttrCache::clear() {
+    for (Shard &shard : shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.generation++;
+        shard.entries.clear();
+    }
+}
+
+size_t AttrCache::size() const {
+    size_t total = 0;
+    for (const Shard &shard : shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        total += shard.entries.size();
+    }
+    return total;
+}
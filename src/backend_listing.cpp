@@ -0,0 +1,56 @@
+#include "backend_listing.h"
+
+#include <algorithm>
+
+#include "common/path.h"
+
+SnapshotListing::Collector::Collector(SnapshotListing &listing, std::string_view hidden)
+    : listing(listing), hidden(hidden) {}
+
+bool SnapshotListing::Collector::wants_attributes(std::string_view name) {
+    return false;
+}
+
+int SnapshotListing::Collector::add(std::string_view name, const struct stat *st, off_t next, bool attributes) {
+    if (!hidden.empty() && name == hidden && Path::is_root(listing.path)) {
+        return 0;
+    }
+    if (seen.emplace(name).second) {
+        listing.items.push_back({std::string(name), *st});
+    }
+    return 0;
+}
+
+SnapshotListing::SnapshotListing(std::string_view path) : DirHandle(nullptr), path(path) {}
+
+void SnapshotListing::add(std::string name, mode_t type) {
+    struct stat st {};
+    st.st_mode = type;
+    items.push_back({std::move(name), st});
+}
+
+int SnapshotListing::read(StorageBackend &backend, off_t offset, StorageBackend::DirFiller &filler) const {
+    for (auto index = static_cast<size_t>(std::max<off_t>(offset, 0)); index < items.size(); index++) {
+        const auto &item = items[index];
+
+        struct stat st = item.st;
+        bool attributes = filler.wants_attributes(item.name);
+        if (attributes) {
+            std::string entry = item.name == "."    ? path
+                                : item.name == ".." ? std::string(Path::view_parent(path))
+                                                    : Path::join(path, item.name);
+            if (backend.stat(entry, &st, false) < 0) {
+                // Removed since the listing was taken
+                continue;
+            }
+        }
+
+        if (filler.add(item.name, &st, static_cast<off_t>(index + 1), attributes) == 1) {
+            return 0;
+        }
+    }
+    return 0;
+}
+
+InnerListing::InnerListing(std::unique_ptr<DirHandle> inner, std::string_view path)
+    : DirHandle(nullptr), inner(std::move(inner)), path(path) {}
@@ -0,0 +1,123 @@
+#include "backend_stream.h"
+
+#include <fcntl.h>
+
+BackendStreamBuf::BackendStreamBuf(std::shared_ptr<StorageBackend> backend, const std::string &path, int flags)
+    : backend(std::move(backend)), buffer(BUFFER_SIZE) {
+    if (this->backend->open(path, flags, 0666, handle) < 0) {
+        handle.reset();
+    }
+    setp(buffer.data(), buffer.data() + buffer.size());
+}
+
+BackendStreamBuf::~BackendStreamBuf() {
+    close();
+}
+
+bool BackendStreamBuf::close() {
+    if (handle == nullptr) {
+        return false;
+    }
+
+    bool success = sync() == 0;
+    if (backend->release(*handle) < 0) {
+        success = false;
+    }
+    handle.reset();
+    return success;
+}
+
+BackendStreamBuf::int_type BackendStreamBuf::underflow() {
+    if (handle == nullptr) {
+        return traits_type::eof();
+    }
+
+    position += egptr() - eback();
+    ssize_t count = backend->pread(*handle, buffer.data(), buffer.size(), position);
+    if (count <= 0) {
+        setg(buffer.data(), buffer.data(), buffer.data());
+        return traits_type::eof();
+    }
+
+    setg(buffer.data(), buffer.data(), buffer.data() + count);
+    return traits_type::to_int_type(*gptr());
+}
+
+BackendStreamBuf::int_type BackendStreamBuf::overflow(int_type c) {
+    if (sync() != 0) {
+        return traits_type::eof();
+    }
+    if (!traits_type::eq_int_type(c, traits_type::eof())) {
+        *pptr() = traits_type::to_char_type(c);
+        pbump(1);
+    }
+    return traits_type::not_eof(c);
+}
+
+int BackendStreamBuf::sync() {
+    if (handle == nullptr) {
+        return pptr() == pbase() ? 0 : -1;
+    }
+
+    const char *data = pbase();
+    size_t remaining = pptr() - pbase();
+    while (remaining > 0) {
+        ssize_t written = backend->pwrite(*handle, data, remaining, position);
+        if (written <= 0) {
+            return -1;
+        }
+        data += written;
+        remaining -= written;
+        position += written;
+    }
+
+    setp(buffer.data(), buffer.data() + buffer.size());
+    return 0;
+}
+
+BackendIstream::BackendIstream(std::shared_ptr<StorageBackend> backend, const std::string &path)
+    : std::istream(nullptr), buf(std::move(backend), path, O_RDONLY) {
+    rdbuf(&buf);
+    if (!buf.is_open()) {
+        setstate(std::ios_base::failbit);
+    }
+}
+
+void BackendIstream::close() {
+    if (!buf.close()) {
+        setstate(std::ios_base::failbit);
+    }
+}
+
+namespace {
+
+int output_flags(std::ios_base::openmode mode) {
+    return O_WRONLY | O_CREAT | ((mode & std::ios_base::app) ? O_APPEND : O_TRUNC);
+}
+
+}  // namespace
+
+BackendOstream::BackendOstream(std::shared_ptr<StorageBackend> backend, const std::string &path,
+                               std::ios_base::openmode mode, std::function<void()> on_close)
+    : std::ostream(nullptr), buf(std::move(backend), path, output_flags(mode)), on_close(std::move(on_close)) {
+    rdbuf(&buf);
+    if (!buf.is_open()) {
+        setstate(std::ios_base::failbit);
+    }
+}
+
+BackendOstream::~BackendOstream() {
+    close();
+}
+
+void BackendOstream::close() {
+    if (!buf.is_open()) {
+        return;
+    }
+    if (!buf.close()) {
+        setstate(std::ios_base::failbit);
+    }
+    if (on_close) {
+        on_close();
+    }
+}
@@ -0,0 +1,132 @@
+#include "backing_directory.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+BackingDirectory::Descriptor::~Descriptor() {
+    if (fd_ >= 0) {
+        ::close(fd_);
+    }
+}
+
+BackingDirectory::Location::Location(std::shared_ptr<const Descriptor> directory, std::string_view name)
+    : directory(std::move(directory)) {
+    if (name.size() >= sizeof(buffer)) {
+        overflow.assign(name);
+        return;
+    }
+
+    *std::copy(name.begin(), name.end(), buffer) = '\0';
+}
+
+BackingDirectory::BackingDirectory(const std::string &path) {
+    int fd = ::open(path.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        throw std::runtime_error("Backing directory could not be opened: " + std::string(strerror(errno)));
+    }
+    root = std::make_shared<const Descriptor>(fd);
+}
+
+BackingDirectory::Location BackingDirectory::resolve(std::string_view pathname) const {
+    while (!pathname.empty() && pathname.front() == '/') {
+        pathname.remove_prefix(1);
+    }
+    if (pathname.empty()) {
+        return Location(root, ".");
+    }
+
+    auto slash = pathname.rfind('/');
+    if (slash != std::string_view::npos) {
+        if (auto directory = parent(pathname.substr(0, slash))) {
+            return Location(std::move(directory), pathname.substr(slash + 1));
+        }
+    }
+
+    return Location(root, pathname);
+}
+
+std::shared_ptr<const BackingDirectory::Descriptor> BackingDirectory::parent(std::string_view directory) const {
+    uint64_t opened_generation;
+    {
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        if (capacity == 0) {
+            return nullptr;
+        }
+
+        auto it = cache.find(directory);
+        if (it != cache.end()) {
+            recency.splice(recency.begin(), recency, it->second.position);
+            return it->second.descriptor;
+        }
+        opened_generation = generation;
+    }
+
+    // Opened without holding the lock, the generation tells whether an invalidation happened in the meantime
+    Location location(root, directory);
+    int fd = ::openat(root->fd(), location.name(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        return nullptr;
+    }
+    auto descriptor = std::make_shared<const Descriptor>(fd);
+
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    if (generation != opened_generation || capacity == 0 || cache.count(directory) > 0) {
+        return descriptor;
+    }
+
+    recency.emplace_front(directory);
+    cache.emplace(recency.front(), CacheEntry{descriptor, recency.begin()});
+
+    while (cache.size() > capacity) {
+        cache.erase(recency.back());
+        recency.pop_back();
+    }
+
+    return descriptor;
+}
+
+void BackingDirectory::set_cache_capacity(size_t new_capacity) {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    capacity = new_capacity;
+
+    while (cache.size() > capacity) {
+        cache.erase(recency.back());
+        recency.pop_back();
+    }
+}
+
+void BackingDirectory::invalidate(std::string_view directory) {
+    while (!directory.empty() && directory.front() == '/') {
+        directory.remove_prefix(1);
+    }
+
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    generation++;
+
+    if (directory.empty()) {
+        cache.clear();
+        recency.clear();
+        return;
+    }
+
+    for (auto it = recency.begin(); it != recency.end();) {
+        std::string_view cached = *it;
+        bool below = cached.size() > directory.size() && cached[directory.size()] == '/';
+        if (cached.compare(0, directory.size(), directory) == 0 && (cached.size() == directory.size() || below)) {
+            cache.erase(cached);
+            it = recency.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+size_t BackingDirectory::cached() const {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    return cache.size();
+}
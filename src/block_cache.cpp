@@ -0,0 +1,155 @@
+#include "block_cache.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+BlockCache::BlockCache(size_t capacity, size_t block_size, size_t shards)
+    : block_size_(block_size),
+      shard_capacity(std::max<size_t>(1, capacity / std::max<size_t>(block_size, 1) / std::max<size_t>(shards, 1))),
+      hit_counter(Metrics::counter("block_cache.hits")),
+      miss_counter(Metrics::counter("block_cache.misses")),
+      eviction_counter(Metrics::counter("block_cache.evictions")) {
+    if (block_size == 0 || shards == 0) {
+        throw std::runtime_error("Blocks and shards of the block cache cannot be empty");
+    }
+
+    for (size_t i = 0; i < shards; i++) {
+        this->shards.push_back(std::make_unique<Shard>());
+    }
+}
+
+BlockCache::Shard &BlockCache::shard_of(const Key &key) {
+    // The index varies fastest, so consecutive blocks of a file are spread over all shards
+    return *shards[KeyHash()(key) % shards.size()];
+}
+
+void BlockCache::move(Shard &shard, Entry &entry, List list) {
+    shard.lists[list].splice(shard.lists[list].begin(), shard.lists[entry.list], entry.position);
+    entry.list = list;
+}
+
+void BlockCache::drop_last(Shard &shard, List list) {
+    auto it = shard.entries.find(shard.lists[list].back());
+    if (it->second.block) {
+        shard.bytes -= it->second.block->size();
+    }
+    shard.lists[list].pop_back();
+    shard.entries.erase(it);
+}
+
+void BlockCache::replace(Shard &shard, bool in_b2) {
+    size_t t1 = shard.lists[T1].size();
+    List from = t1 > 0 && (t1 > shard.target || (in_b2 && t1 == shard.target)) ? T1 : T2;
+    if (shard.lists[from].empty()) {
+        return;
+    }
+
+    Entry &entry = shard.entries.find(shard.lists[from].back())->second;
+    shard.bytes -= entry.block->size();
+    entry.block.reset();
+    move(shard, entry, from == T1 ? B1 : B2);
+    shard.evictions++;
+    eviction_counter.fetch_add(1, std::memory_order_relaxed);
+}
+
+std::shared_ptr<const BlockCache::Block> BlockCache::find(const Key &key) {
+    Shard &shard = shard_of(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    auto it = shard.entries.find(key);
+    if (it == shard.entries.end() || !it->second.block) {
+        shard.misses++;
+        miss_counter.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    // A block used a second time moves to the frequently used list
+    move(shard, it->second, T2);
+    shard.hits++;
+    hit_counter.fetch_add(1, std::memory_order_relaxed);
+    return it->second.block;
+}
+
+void BlockCache::insert(const Key &key, std::shared_ptr<const Block> block) {
+    Shard &shard = shard_of(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    const size_t c = shard_capacity;
+
+    auto it = shard.entries.find(key);
+    if (it != shard.entries.end() && it->second.block) {
+        shard.bytes += block->size();
+        shard.bytes -= it->second.block->size();
+        it->second.block = std::move(block);
+        move(shard, it->second, T2);
+        return;
+    }
+
+    if (it != shard.entries.end()) {
+        // The key was evicted recently, so its list deserves more room
+        bool in_b2 = it->second.list == B2;
+        size_t b1 = shard.lists[B1].size();
+        size_t b2 = shard.lists[B2].size();
+        if (in_b2) {
+            shard.target -= std::min(shard.target, std::max<size_t>(1, b1 / b2));
+        } else {
+            shard.target = std::min(c, shard.target + std::max<size_t>(1, b2 / b1));
+        }
+        replace(shard, in_b2);
+
+        shard.bytes += block->size();
+        it->second.block = std::move(block);
+        move(shard, it->second, T2);
+        return;
+    }
+
+    size_t t1 = shard.lists[T1].size();
+    size_t l1 = t1 + shard.lists[B1].size();
+    size_t total = l1 + shard.lists[T2].size() + shard.lists[B2].size();
+    if (l1 >= c) {
+        if (t1 < c) {
+            drop_last(shard, B1);
+            replace(shard, false);
+        } else {
+            drop_last(shard, T1);
+            shard.evictions++;
+            eviction_counter.fetch_add(1, std::memory_order_relaxed);
+        }
+    } else if (total >= c) {
+        if (total >= 2 * c) {
+            drop_last(shard, B2);
+        }
+        replace(shard, false);
+    }
+
+    shard.lists[T1].push_front(key);
+    shard.bytes += block->size();
+    shard.entries.emplace(key, Entry{T1, shard.lists[T1].begin(), std::move(block)});
+}
+
+void BlockCache::erase(const Key &key) {
+    Shard &shard = shard_of(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    auto it = shard.entries.find(key);
+    if (it == shard.entries.end()) {
+        return;
+    }
+    if (it->second.block) {
+        shard.bytes -= it->second.block->size();
+    }
+    shard.lists[it->second.list].erase(it->second.position);
+    shard.entries.erase(it);
+}
+
+BlockCache::Statistics BlockCache::statistics() const {
+    Statistics statistics{};
+    statistics.capacity = static_cast<uint64_t>(shard_capacity) * block_size_ * shards.size();
+    for (const auto &shard : shards) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        statistics.hits += shard->hits;
+        statistics.misses += shard->misses;
+        statistics.evictions += shard->evictions;
+        statistics.bytes += shard->bytes;
+    }
+    return statistics;
+}
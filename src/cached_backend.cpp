@@ -0,0 +1,333 @@
+#include "cached_backend.h"
+
+#include <fcntl.h>
+
+#include <algorithm>
+#include <cstring>
+
+#include "backend_helpers.h"
+
+using BackendHelpers::same_time;
+
+namespace {
+
+/// Blocks dropped one by one by a write at most, larger writes drop all blocks of the file
+constexpr uint64_t MAX_DROPPED_BLOCKS = 256;
+
+}  // namespace
+
+/// Record of the file a handle was opened on and its version at the time
+struct CachedBackend::Cached : FileHandle::State {
+    std::shared_ptr<Record> record;
+    uint64_t version = 0;
+};
+
+CachedBackend::CachedBackend(std::shared_ptr<StorageBackend> inner, size_t capacity, size_t block_size)
+    : inner(std::move(inner)),
+      cache(capacity, block_size, SHARDS),
+      max_records(std::max<size_t>(1024, capacity / std::max<size_t>(block_size, 1))) {}
+
+BlockCache::Statistics CachedBackend::statistics() const {
+    return cache.statistics();
+}
+
+std::shared_ptr<CachedBackend::Record> CachedBackend::track(const struct stat &st, bool truncated,
+                                                            uint64_t &version) {
+    std::lock_guard<std::mutex> lock(records_mutex);
+    auto &record = records[{st.st_dev, st.st_ino}];
+    if (!record) {
+        if (records.size() > max_records) {
+            for (auto it = records.begin(); it != records.end();) {
+                it = it->second && it->second.use_count() == 1 ? records.erase(it) : std::next(it);
+            }
+        }
+
+        record = std::make_shared<Record>();
+        record->id = ++next_id;
+    } else {
+        std::lock_guard<std::mutex> record_lock(record->mutex);
+        // The change time moves with renames and attribute changes as well, which leave the data alone
+        bool same = record->size == st.st_size && same_time(record->mtime, st.st_mtim);
+        if (truncated) {
+            record->generation++;
+            record->id = ++next_id;
+        } else if (!same && !record->changed) {
+            // Changed behind the cache, or another file reusing the inode number
+            record->generation++;
+            record->version++;
+            record->id = ++next_id;
+        }
+    }
+
+    std::lock_guard<std::mutex> record_lock(record->mutex);
+    record->size = st.st_size;
+    record->mtime = st.st_mtim;
+    record->changed = false;
+    version = record->version;
+    return record;
+}
+
+std::shared_ptr<CachedBackend::Record> CachedBackend::find_record(const struct stat &st) {
+    std::lock_guard<std::mutex> lock(records_mutex);
+    auto it = records.find({st.st_dev, st.st_ino});
+    return it == records.end() ? nullptr : it->second;
+}
+
+CachedBackend::Record *CachedBackend::record_of(FileHandle &handle) {
+    auto *cached = handle.find_state<Cached>();
+    return cached == nullptr ? nullptr : cached->record.get();
+}
+
+CachedBackend::Record *CachedBackend::usable(FileHandle &handle) {
+    auto *cached = handle.find_state<Cached>();
+    if (cached == nullptr || cached->record->version != cached->version) {
+        return nullptr;
+    }
+    return cached->record.get();
+}
+
+void CachedBackend::written(Record &record, off_t offset, size_t count) {
+    const uint64_t block_size = cache.block_size();
+    std::lock_guard<std::mutex> lock(record.mutex);
+    record.generation++;
+    record.changed = true;
+
+    // The last block may have been cached short, so a write past the end of the file drops it as well
+    uint64_t first = std::min<uint64_t>(offset, record.size) / block_size;
+    uint64_t last = (offset + count - 1) / block_size;
+    if (last - first >= MAX_DROPPED_BLOCKS) {
+        record.id = ++next_id;
+    } else {
+        for (uint64_t index = first; index <= last; index++) {
+            cache.erase({record.id, index});
+        }
+    }
+    record.size = std::max<off_t>(record.size, offset + static_cast<off_t>(count));
+}
+
+void CachedBackend::truncated(Record &record, off_t length) {
+    std::lock_guard<std::mutex> lock(record.mutex);
+    record.generation++;
+    record.changed = true;
+    record.id = ++next_id;
+    record.size = length;
+}
+
+ssize_t CachedBackend::fetch(FileHandle &handle, BlockCache::Block &block, uint64_t index) {
+    size_t length = 0;
+    while (length < block.size()) {
+        ssize_t res = inner->pread(handle, block.data() + length, block.size() - length,
+                                   static_cast<off_t>(index * block.size() + length));
+        if (res < 0) {
+            return res;
+        }
+        if (res == 0) {
+            break;
+        }
+        length += res;
+    }
+    return static_cast<ssize_t>(length);
+}
+
+int CachedBackend::open(std::string_view path, int flags, mode_t mode, std::unique_ptr<FileHandle> &handle) {
+    int res = inner->open(path, flags, mode, handle);
+    if (res < 0) {
+        return res;
+    }
+
+    struct stat st {};
+    if (inner->fstat(*handle, &st) == 0 && S_ISREG(st.st_mode)) {
+        auto &cached = handle->state<Cached>();
+        cached.record = track(st, (flags & O_TRUNC) != 0, cached.version);
+    }
+    return 0;
+}
+
+ssize_t CachedBackend::pread(FileHandle &handle, void *buf, size_t count, off_t offset) {
+    Record *record = usable(handle);
+    if (record == nullptr || offset < 0) {
+        return inner->pread(handle, buf, count, offset);
+    }
+
+    const size_t block_size = cache.block_size();
+    auto *out = static_cast<char *>(buf);
+    size_t done = 0;
+    while (done < count) {
+        uint64_t position = offset + done;
+        size_t within = position % block_size;
+        BlockCache::Key key{record->id, position / block_size};
+
+        auto block = cache.find(key);
+        if (!block) {
+            uint64_t generation = record->generation;
+            auto fetched = std::make_shared<BlockCache::Block>(block_size);
+            ssize_t res = fetch(handle, *fetched, key.index);
+            if (res < 0) {
+                return done > 0 ? static_cast<ssize_t>(done) : res;
+            }
+            if (static_cast<size_t>(res) < block_size) {
+                fetched->resize(res);
+                fetched->shrink_to_fit();
+            }
+
+            // A write racing with the fetch may have dropped the block before it was inserted
+            if (res > 0) {
+                cache.insert(key, fetched);
+                if (record->generation != generation) {
+                    cache.erase(key);
+                }
+            }
+            block = std::move(fetched);
+        }
+
+        if (within >= block->size()) {
+            break;
+        }
+        size_t length = std::min(block->size() - within, count - done);
+        std::memcpy(out + done, block->data() + within, length);
+        done += length;
+        if (block->size() < block_size) {
+            break;
+        }
+    }
+    return static_cast<ssize_t>(done);
+}
+
+ssize_t CachedBackend::pwrite(FileHandle &handle, const void *buf, size_t count, off_t offset) {
+    ssize_t res = inner->pwrite(handle, buf, count, offset);
+
+    Record *record = record_of(handle);
+    if (res > 0 && record != nullptr) {
+        if ((handle.flags() & O_APPEND) || usable(handle) == nullptr) {
+            // The record may not know where the data went, handles which no longer read through the cache still
+            // drop the blocks read by newer ones
+            std::lock_guard<std::mutex> lock(record->mutex);
+            record->generation++;
+            record->changed = true;
+            record->id = ++next_id;
+        } else {
+            written(*record, offset, res);
+        }
+    }
+    return res;
+}
+
+int CachedBackend::ftruncate(FileHandle &handle, off_t length) {
+    int res = inner->ftruncate(handle, length);
+    Record *record = record_of(handle);
+    if (res == 0 && record != nullptr) {
+        truncated(*record, length);
+    }
+    return res;
+}
+
+int CachedBackend::fsync(FileHandle &handle, bool datasync) {
+    return inner->fsync(handle, datasync);
+}
+
+int CachedBackend::release(FileHandle &handle) {
+    return inner->release(handle);
+}
+
+int CachedBackend::fstat(FileHandle &handle, struct stat *st) {
+    return inner->fstat(handle, st);
+}
+
+int CachedBackend::prefetch(FileHandle &handle, off_t offset, size_t length) {
+    return inner->prefetch(handle, offset, length);
+}
+
+int CachedBackend::truncate(std::string_view path, off_t length) {
+    int res = inner->truncate(path, length);
+    struct stat st {};
+    if (res == 0 && inner->stat(path, &st, true) == 0) {
+        if (auto record = find_record(st)) {
+            truncated(*record, length);
+        }
+    }
+    return res;
+}
+
+int CachedBackend::copy(std::string_view source, std::string_view destination) {
+    return inner->copy(source, destination);
+}
+
+int CachedBackend::stat(std::string_view path, struct stat *st, bool follow) {
+    return inner->stat(path, st, follow);
+}
+
+int CachedBackend::utimens(std::string_view path, const struct timespec tv[2]) {
+    return inner->utimens(path, tv);
+}
+
+int CachedBackend::chmod(std::string_view path, mode_t mode) {
+    return inner->chmod(path, mode);
+}
+
+int CachedBackend::chown(std::string_view path, uid_t uid, gid_t gid) {
+    return inner->chown(path, uid, gid);
+}
+
+int CachedBackend::statfs(struct statvfs *stbuf) {
+    return inner->statfs(stbuf);
+}
+
+int CachedBackend::mknod(std::string_view path, mode_t mode, dev_t dev) {
+    return inner->mknod(path, mode, dev);
+}
+
+int CachedBackend::rename(std::string_view oldpath, std::string_view newpath, unsigned int flags) {
+    return inner->rename(oldpath, newpath, flags);
+}
+
+int CachedBackend::link(std::string_view oldpath, std::string_view newpath) {
+    return inner->link(oldpath, newpath);
+}
+
+int CachedBackend::unlink(std::string_view path) {
+    return inner->unlink(path);
+}
+
+int CachedBackend::symlink(std::string_view target, std::string_view linkpath) {
+    return inner->symlink(target, linkpath);
+}
+
+int CachedBackend::readlink(std::string_view path, char *buf, size_t size) {
+    return inner->readlink(path, buf, size);
+}
+
+int CachedBackend::mkdir(std::string_view path, mode_t mode) {
+    return inner->mkdir(path, mode);
+}
+
+int CachedBackend::rmdir(std::string_view path) {
+    return inner->rmdir(path);
+}
+
+int CachedBackend::list(std::string_view path, std::vector<std::string> &names) {
+    return inner->list(path, names);
+}
+
+int CachedBackend::list_sidecars(std::string_view directory, std::string_view name, std::vector<std::string> &names) {
+    return inner->list_sidecars(directory, name, names);
+}
+
+bool CachedBackend::separates_sidecars() const {
+    return inner->separates_sidecars();
+}
+
+int CachedBackend::opendir(std::string_view path, std::unique_ptr<DirHandle> &handle) {
+    return inner->opendir(path, handle);
+}
+
+int CachedBackend::readdir(DirHandle &handle, off_t offset, DirFiller &filler) {
+    return inner->readdir(handle, offset, filler);
+}
+
+int CachedBackend::syncfs() {
+    return inner->syncfs();
+}
+
+bool CachedBackend::allows_splice() const {
+    return false;
+}
@@ -0,0 +1,427 @@
+#include "chunk_store.h"
+
+#include <fcntl.h>
+#include <sodium.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+
+#include "common/logging.h"
+#include "common/metrics.h"
+
+namespace {
+
+constexpr char MANIFEST_MAGIC[8] = {'C', 'V', 'F', 'S', 'C', 'H', 'K', '1'};
+constexpr const char *COUNTS_NAME = "counts";
+constexpr const char *TEMP_NAME = "tmp";
+
+std::string to_hex(const unsigned char *data, size_t length) {
+    static const char digits[] = "0123456789abcdef";
+    std::string hex;
+    hex.reserve(length * 2);
+    for (size_t i = 0; i < length; i++) {
+        hex += digits[data[i] >> 4];
+        hex += digits[data[i] & 0xf];
+    }
+    return hex;
+}
+
+bool from_hex(const std::string &hex, ChunkStore::Hash &hash) {
+    if (hex.size() != hash.size() * 2) {
+        return false;
+    }
+    auto value = [](char c) {
+        if (c >= '0' && c <= '9') {
+            return c - '0';
+        }
+        if (c >= 'a' && c <= 'f') {
+            return c - 'a' + 10;
+        }
+        return -1;
+    };
+    for (size_t i = 0; i < hash.size(); i++) {
+        int high = value(hex[2 * i]);
+        int low = value(hex[2 * i + 1]);
+        if (high < 0 || low < 0) {
+            return false;
+        }
+        hash[i] = static_cast<unsigned char>(high << 4 | low);
+    }
+    return true;
+}
+
+bool write_all(int fd, const char *data, size_t length) {
+    while (length > 0) {
+        ssize_t written = ::write(fd, data, length);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += written;
+        length -= written;
+    }
+    return true;
+}
+
+template <typename T>
+void put_value(std::string &buffer, T value) {
+    buffer.append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+template <typename T>
+bool get_value(const char *data, size_t length, size_t &position, T &value) {
+    if (length - position < sizeof(value)) {
+        return false;
+    }
+    std::memcpy(&value, data + position, sizeof(value));
+    position += sizeof(value);
+    return true;
+}
+
+}  // namespace
+
+std::string ChunkStore::Manifest::serialize() const {
+    std::string data(MANIFEST_MAGIC, sizeof(MANIFEST_MAGIC));
+    put_value<uint64_t>(data, size);
+    put_value<uint32_t>(data, static_cast<uint32_t>(pieces.size()));
+    for (const auto &piece : pieces) {
+        data.append(reinterpret_cast<const char *>(piece.hash.data()), piece.hash.size());
+        put_value<uint32_t>(data, piece.length);
+    }
+    return data;
+}
+
+bool ChunkStore::Manifest::parse(const std::string &data) {
+    if (!parse_size(data.data(), data.size(), size)) {
+        return false;
+    }
+
+    size_t position = HEADER_SIZE;
+    uint32_t count = 0;
+    if (!get_value(data.data(), data.size(), position, count) ||
+        (data.size() - position) / (HASH_SIZE + sizeof(uint32_t)) < count) {
+        return false;
+    }
+
+    uint64_t total = 0;
+    pieces.resize(count);
+    for (auto &piece : pieces) {
+        std::memcpy(piece.hash.data(), data.data() + position, HASH_SIZE);
+        position += HASH_SIZE;
+        get_value(data.data(), data.size(), position, piece.length);
+        total += piece.length;
+    }
+    return total == size;
+}
+
+bool ChunkStore::Manifest::parse_size(const char *data, size_t length, uint64_t &size) {
+    size_t position = sizeof(MANIFEST_MAGIC);
+    return length >= HEADER_SIZE && std::memcmp(data, MANIFEST_MAGIC, sizeof(MANIFEST_MAGIC)) == 0 &&
+           get_value(data, length, position, size);
+}
+
+size_t ChunkStore::HashKey::operator()(const Hash &hash) const {
+    // The hash is uniformly distributed already
+    size_t key = 0;
+    std::memcpy(&key, hash.data(), sizeof(key));
+    return key;
+}
+
+ChunkStore::ChunkStore(const std::string &directory) : directory(directory) {
+#ifndef __aarch64__
+    if (sodium_init() == -1) {
+        throw std::runtime_error("Sodium failed to initialize");
+    }
+#endif
+
+    std::error_code error;
+    std::filesystem::remove_all(directory + "/" + TEMP_NAME, error);
+    std::filesystem::create_directories(directory + "/" + TEMP_NAME, error);
+    if (error) {
+        throw std::runtime_error("Chunk directory could not be created: " + error.message());
+    }
+
+    fd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        throw std::runtime_error("Chunk directory could not be opened: " + std::string(strerror(errno)));
+    }
+
+    load_counts();
+}
+
+ChunkStore::~ChunkStore() {
+    sync();
+    save_counts();
+    ::close(fd);
+}
+
+std::string ChunkStore::path(const Hash &hash) const {
+    std::string hex = to_hex(hash.data(), hash.size());
+    return directory + "/" + hex.substr(0, 2) + "/" + hex.substr(2);
+}
+
+int ChunkStore::put(const char *data, size_t length, Hash &hash) {
+    static Metrics::Counter &stored = Metrics::counter("chunks.stored_bytes");
+    static Metrics::Counter &deduplicated = Metrics::counter("chunks.deduplicated_bytes");
+
+    crypto_generichash(hash.data(), hash.size(), reinterpret_cast<const unsigned char *>(data), length, nullptr, 0);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    auto it = chunks.find(hash);
+    if (it != chunks.end()) {
+        it->second.references++;
+        deduplicated.fetch_add(length, std::memory_order_relaxed);
+        return 0;
+    }
+    std::string temp = directory + "/" + TEMP_NAME + "/" + std::to_string(next_temp++);
+    lock.unlock();
+
+    // Written under a temporary name, so a chunk file is either complete or missing
+    int out = ::open(temp.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (out < 0) {
+        return -errno;
+    }
+    bool written = write_all(out, data, length);
+    int error = errno;
+    ::close(out);
+    if (!written) {
+        ::unlink(temp.c_str());
+        return -error;
+    }
+
+    std::string target = path(hash);
+    lock.lock();
+    it = chunks.find(hash);
+    if (it != chunks.end()) {
+        // Stored by another thread meanwhile
+        ::unlink(temp.c_str());
+        it->second.references++;
+        deduplicated.fetch_add(length, std::memory_order_relaxed);
+        return 0;
+    }
+
+    ::mkdir(target.substr(0, target.rfind('/')).c_str(), 0700);
+    if (::rename(temp.c_str(), target.c_str()) != 0) {
+        error = errno;
+        ::unlink(temp.c_str());
+        return -error;
+    }
+
+    Chunk &chunk = chunks[hash];
+    chunk.references = 1;
+    chunk.length = static_cast<uint32_t>(length);
+    bytes += length;
+    stored.fetch_add(length, std::memory_order_relaxed);
+    return 0;
+}
+
+void ChunkStore::add_reference(const Hash &hash) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = chunks.find(hash);
+    if (it != chunks.end()) {
+        it->second.references++;
+        return;
+    }
+
+    struct stat st {};
+    if (::stat(path(hash).c_str(), &st) != 0) {
+        Logging::Warn("Chunk %s is missing", path(hash).c_str());
+        return;
+    }
+    Chunk &chunk = chunks[hash];
+    chunk.references = 1;
+    chunk.length = static_cast<uint32_t>(st.st_size);
+    bytes += st.st_size;
+}
+
+void ChunkStore::drop(std::unordered_map<Hash, Chunk, HashKey>::iterator it) {
+    ::unlink(path(it->first).c_str());
+    bytes -= it->second.length;
+    chunks.erase(it);
+}
+
+void ChunkStore::release(const Hash &hash) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = chunks.find(hash);
+    if (it == chunks.end() || it->second.references == 0) {
+        return;
+    }
+    if (--it->second.references == 0 && it->second.pins == 0) {
+        drop(it);
+    }
+}
+
+void ChunkStore::pin(const Hash &hash) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = chunks.find(hash);
+    if (it != chunks.end()) {
+        it->second.pins++;
+    }
+}
+
+void ChunkStore::unpin(const Hash &hash) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = chunks.find(hash);
+    if (it == chunks.end() || it->second.pins == 0) {
+        return;
+    }
+    if (--it->second.pins == 0 && it->second.references == 0) {
+        drop(it);
+    }
+}
+
+ssize_t ChunkStore::read(const Hash &hash, void *buf, size_t count, off_t offset) const {
+    int in = ::open(path(hash).c_str(), O_RDONLY | O_CLOEXEC);
+    if (in < 0) {
+        return -errno;
+    }
+
+    size_t done = 0;
+    while (done < count) {
+        ssize_t res = ::pread(in, static_cast<char *>(buf) + done, count - done, static_cast<off_t>(offset + done));
+        if (res < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            int error = errno;
+            ::close(in);
+            return -error;
+        }
+        if (res == 0) {
+            break;
+        }
+        done += res;
+    }
+    ::close(in);
+    return static_cast<ssize_t>(done);
+}
+
+int ChunkStore::prefetch(const Hash &hash, off_t offset, size_t count) const {
+    int in = ::open(path(hash).c_str(), O_RDONLY | O_CLOEXEC);
+    if (in < 0) {
+        return -errno;
+    }
+
+    // The advice outlives the descriptor, it applies to the page cache of the file
+    int res = ::posix_fadvise(in, offset, static_cast<off_t>(count), POSIX_FADV_WILLNEED);
+    ::close(in);
+    return -res;
+}
+
+int ChunkStore::sync() {
+    return ::syncfs(fd) == 0 ? 0 : -errno;
+}
+
+size_t ChunkStore::sweep() {
+    size_t deleted = 0;
+    std::error_code error;
+    for (const auto &subdirectory : std::filesystem::directory_iterator(directory, error)) {
+        std::string prefix = subdirectory.path().filename().string();
+        if (prefix.size() != 2 || !subdirectory.is_directory()) {
+            continue;
+        }
+        for (const auto &file : std::filesystem::directory_iterator(subdirectory.path(), error)) {
+            Hash hash{};
+            if (!from_hex(prefix + file.path().filename().string(), hash)) {
+                continue;
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = chunks.find(hash);
+            if (it == chunks.end()) {
+                ::unlink(file.path().c_str());
+                deleted++;
+            } else if (it->second.references == 0 && it->second.pins == 0) {
+                drop(it);
+                deleted++;
+            }
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    loaded = true;
+    return deleted;
+}
+
+void ChunkStore::usage(size_t &count, uint64_t &total) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    count = chunks.size();
+    total = bytes;
+}
+
+void ChunkStore::load_counts() {
+    std::string counts = directory + "/" + COUNTS_NAME;
+    int in = ::open(counts.c_str(), O_RDONLY | O_CLOEXEC);
+    if (in < 0) {
+        // A store without any chunk has nothing to rebuild
+        std::error_code error;
+        loaded = true;
+        for (const auto &entry : std::filesystem::directory_iterator(directory, error)) {
+            if (entry.path().filename().string().size() == 2) {
+                loaded = false;
+                break;
+            }
+        }
+        return;
+    }
+
+    std::string data;
+    char buffer[64 * 1024];
+    ssize_t count = 0;
+    while ((count = ::read(in, buffer, sizeof(buffer))) > 0) {
+        data.append(buffer, count);
+    }
+    ::close(in);
+
+    size_t position = 0;
+    while (data.size() - position >= HASH_SIZE + 2 * sizeof(uint32_t)) {
+        Hash hash{};
+        std::memcpy(hash.data(), data.data() + position, HASH_SIZE);
+        position += HASH_SIZE;
+        Chunk &chunk = chunks[hash];
+        get_value(data.data(), data.size(), position, chunk.references);
+        get_value(data.data(), data.size(), position, chunk.length);
+        bytes += chunk.length;
+    }
+
+    // Counts are only valid until the store changes, a crash has to rebuild them
+    ::unlink(counts.c_str());
+    ::fsync(fd);
+    loaded = true;
+}
+
+void ChunkStore::save_counts() {
+    std::string data;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!loaded) {
+            return;
+        }
+        data.reserve(chunks.size() * (HASH_SIZE + 2 * sizeof(uint32_t)));
+        for (const auto &[hash, chunk] : chunks) {
+            if (chunk.references == 0) {
+                continue;
+            }
+            data.append(reinterpret_cast<const char *>(hash.data()), hash.size());
+            put_value<uint32_t>(data, chunk.references);
+            put_value<uint32_t>(data, chunk.length);
+        }
+    }
+
+    std::string counts = directory + "/" + COUNTS_NAME;
+    std::string temp = counts + ".tmp";
+    int out = ::open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (out < 0 || !write_all(out, data.data(), data.size()) || ::fsync(out) != 0 ||
+        ::rename(temp.c_str(), counts.c_str()) != 0) {
+        Logging::Warn("Chunk reference counts could not be saved: %s", strerror(errno));
+    }
+    if (out >= 0) {
+        ::close(out);
+    }
+}
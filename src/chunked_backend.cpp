@@ -0,0 +1,1000 @@
+#include "chunked_backend.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <functional>
+
+#include "backend_helpers.h"
+#include "backend_listing.h"
+#include "common/logging.h"
+#include "common/metrics.h"
+#include "common/path.h"
+
+using BackendHelpers::now;
+using BackendHelpers::is_writable;
+using BackendHelpers::same_time;
+using BackendHelpers::PairLock;
+
+namespace {
+
+/// Symbolic links followed while resolving a path, like MAXSYMLINKS of Linux
+constexpr int MAX_SYMLINK_DEPTH = 40;
+
+}  // namespace
+
+/// Read-only handle of a chunked file, its chunks are pinned while it is open
+class ChunkedBackend::ChunkedHandle : public FileHandle {
+public:
+    ChunkedHandle(int flags, ChunkStore::Manifest manifest, const struct stat &attributes)
+        : FileHandle(-1, flags), manifest(std::move(manifest)), attributes(attributes) {
+        set_passthrough(false);
+        uint64_t offset = 0;
+        starts.reserve(this->manifest.pieces.size());
+        for (const auto &piece : this->manifest.pieces) {
+            starts.push_back(offset);
+            offset += piece.length;
+        }
+    }
+
+    const ChunkStore::Manifest manifest;
+
+    /// Attributes of the file when it was opened, it cannot change through the handle
+    const struct stat attributes;
+
+    /// Offset in the file where each piece starts
+    std::vector<uint64_t> starts;
+};
+
+/// Hides the chunk directory and reports chunked files with the attributes of their content
+class ChunkedBackend::Filler : public StorageBackend::DirFiller {
+public:
+    Filler(ChunkedBackend &backend, const std::string &path, DirFiller &wrapped)
+        : backend(backend), path(path), root(Path::is_root(path)), wrapped(wrapped) {}
+
+    bool wants_attributes(std::string_view name) override {
+        return wrapped.wants_attributes(name);
+    }
+
+    int add(std::string_view name, const struct stat *st, off_t next, bool attributes) override {
+        if (root && name == CHUNK_DIRECTORY) {
+            return 0;
+        }
+        if (!attributes || !is_chunked(*st)) {
+            return wrapped.add(name, st, next, attributes);
+        }
+
+        struct stat fixed = *st;
+        backend.fix_attributes(Path::join(path, name), &fixed);
+        return wrapped.add(name, &fixed, next, attributes);
+    }
+
+private:
+    ChunkedBackend &backend;
+    const std::string &path;
+    const bool root;
+    DirFiller &wrapped;
+};
+
+/// Attached to writable handles of plain files, which are queued for chunking once the last of them is closed
+struct ChunkedBackend::Writer : FileHandle::State {
+    ino_t ino = 0;
+};
+
+ChunkedBackend::ChunkedBackend(std::shared_ptr<StorageBackend> inner, const std::string &chunk_directory,
+                               size_t average_chunk)
+    : inner(std::move(inner)),
+      store(std::make_unique<ChunkStore>(chunk_directory)),
+      chunker(average_chunk),
+      staging_directory(std::string("/") + CHUNK_DIRECTORY + "/staging") {
+    this->inner->mkdir(std::string("/") + CHUNK_DIRECTORY, 0700);
+    this->inner->mkdir(staging_directory, 0700);
+
+    // Manifests left behind by a crash were never installed and hold no references
+    std::vector<std::string> leftovers;
+    this->inner->list(staging_directory, leftovers);
+    for (const auto &name : leftovers) {
+        this->inner->unlink(Path::join(staging_directory, name));
+    }
+
+    if (!store->counts_loaded()) {
+        Logging::Warn("Chunk store was not closed cleanly, rebuilding reference counts");
+        rebuild("/");
+        size_t deleted = store->sweep();
+        Logging::Info("Deleted %zu unreferenced chunks", deleted);
+    }
+
+    chunking = std::thread(&ChunkedBackend::chunking_loop, this);
+}
+
+ChunkedBackend::~ChunkedBackend() {
+    {
+        std::lock_guard<std::mutex> lock(thread_mutex);
+        stopping = true;
+    }
+    wakeup.notify_all();
+    chunking.join();
+    settle();
+}
+
+bool ChunkedBackend::hidden(std::string_view path) {
+    size_t start = path.find_first_not_of('/');
+    if (start == std::string_view::npos) {
+        return false;
+    }
+    std::string_view first = path.substr(start, path.find('/', start) - start);
+    return first == CHUNK_DIRECTORY;
+}
+
+std::mutex &ChunkedBackend::path_lock(std::string_view path) {
+    return path_locks[std::hash<std::string_view>()(path) % PATH_LOCKS];
+}
+
+void ChunkedBackend::rebuild(const std::string &directory) {
+    std::vector<std::string> names;
+    if (inner->list(directory, names) < 0) {
+        return;
+    }
+
+    for (const auto &name : names) {
+        std::string path = Path::join(directory, name);
+        struct stat st {};
+        if (hidden(path) || inner->stat(path, &st, false) < 0) {
+            continue;
+        }
+
+        if (S_ISDIR(st.st_mode)) {
+            rebuild(path);
+        } else if (is_chunked(st)) {
+            ChunkStore::Manifest manifest;
+            if (load_manifest(path, manifest) == 0) {
+                for (const auto &piece : manifest.pieces) {
+                    store->add_reference(piece.hash);
+                }
+            }
+        }
+    }
+}
+
+void ChunkedBackend::fix_attributes(std::string_view path, struct stat *st) {
+    if (!is_chunked(*st)) {
+        return;
+    }
+    st->st_mode &= ~S_ISVTX;
+
+    {
+        std::lock_guard<std::mutex> lock(sizes_mutex);
+        auto it = sizes.find(st->st_ino);
+        if (it != sizes.end() && same_time(it->second.ctime, st->st_ctim)) {
+            st->st_size = static_cast<off_t>(it->second.size);
+            st->st_blocks = (st->st_size + 511) / 512;
+            return;
+        }
+    }
+
+    std::unique_ptr<FileHandle> handle;
+    if (inner->open(path, O_RDONLY, 0, handle) < 0) {
+        return;
+    }
+    char header[ChunkStore::Manifest::HEADER_SIZE];
+    ssize_t count = inner->pread(*handle, header, sizeof(header), 0);
+    inner->release(*handle);
+
+    uint64_t size = 0;
+    if (count < 0 || !ChunkStore::Manifest::parse_size(header, static_cast<size_t>(count), size)) {
+        return;
+    }
+
+    st->st_size = static_cast<off_t>(size);
+    st->st_blocks = (st->st_size + 511) / 512;
+    std::lock_guard<std::mutex> lock(sizes_mutex);
+    sizes[st->st_ino] = {st->st_ctim, size};
+}
+
+int ChunkedBackend::load_manifest(std::string_view path, ChunkStore::Manifest &manifest) {
+    std::unique_ptr<FileHandle> handle;
+    int res = inner->open(path, O_RDONLY, 0, handle);
+    if (res < 0) {
+        return res;
+    }
+
+    std::string data;
+    char buffer[64 * 1024];
+    while (true) {
+        ssize_t count = inner->pread(*handle, buffer, sizeof(buffer), static_cast<off_t>(data.size()));
+        if (count < 0) {
+            res = static_cast<int>(count);
+            break;
+        }
+        if (count == 0) {
+            break;
+        }
+        data.append(buffer, count);
+    }
+    inner->release(*handle);
+
+    if (res < 0) {
+        return res;
+    }
+    if (!manifest.parse(data)) {
+        Logging::Error("Manifest of %s is damaged", std::string(path).c_str());
+        return -EIO;
+    }
+    return 0;
+}
+
+int ChunkedBackend::write_manifest(const ChunkStore::Manifest &manifest, const struct stat &attributes,
+                                   std::string &staging) {
+    staging = Path::join(staging_directory, std::to_string(next_staging.fetch_add(1)));
+
+    std::unique_ptr<FileHandle> handle;
+    int res = inner->open(staging, O_WRONLY | O_CREAT | O_EXCL, 0600, handle);
+    if (res < 0) {
+        return res;
+    }
+
+    std::string data = manifest.serialize();
+    for (size_t done = 0; done < data.size();) {
+        ssize_t count = inner->pwrite(*handle, data.data() + done, data.size() - done, static_cast<off_t>(done));
+        if (count < 0) {
+            res = static_cast<int>(count);
+            break;
+        }
+        done += count;
+    }
+    int closed = inner->release(*handle);
+    if (res == 0) {
+        res = closed;
+    }
+    if (res == 0) {
+        res = inner->chmod(staging, (attributes.st_mode & 07777) | S_ISVTX);
+    }
+    if (res < 0) {
+        inner->unlink(staging);
+        return res;
+    }
+
+    inner->chown(staging, attributes.st_uid, attributes.st_gid);
+    const struct timespec times[2] = {attributes.st_atim, attributes.st_mtim};
+    inner->utimens(staging, times);
+    return 0;
+}
+
+int ChunkedBackend::split(std::string_view path, ChunkStore::Manifest &manifest) {
+    std::unique_ptr<FileHandle> handle;
+    int res = inner->open(path, O_RDONLY, 0, handle);
+    if (res < 0) {
+        return res;
+    }
+
+    // Refilled whenever less than a maximal chunk is left, so every cut sees enough data to find its boundary
+    std::vector<char> buffer(std::max<size_t>(1 << 20, 2 * chunker.max_size()));
+    size_t start = 0;
+    size_t end = 0;
+    off_t offset = 0;
+    bool eof = false;
+    while (true) {
+        if (!eof && end - start < chunker.max_size()) {
+            std::memmove(buffer.data(), buffer.data() + start, end - start);
+            end -= start;
+            start = 0;
+            ssize_t count = inner->pread(*handle, buffer.data() + end, buffer.size() - end, offset);
+            if (count < 0) {
+                res = static_cast<int>(count);
+                break;
+            }
+            eof = count == 0;
+            end += count;
+            offset += count;
+            continue;
+        }
+        if (start == end) {
+            break;
+        }
+
+        size_t length = chunker.cut(buffer.data() + start, end - start, eof);
+        ChunkStore::Manifest::Piece piece{};
+        res = store->put(buffer.data() + start, length, piece.hash);
+        if (res < 0) {
+            break;
+        }
+        piece.length = static_cast<uint32_t>(length);
+        manifest.pieces.push_back(piece);
+        manifest.size += length;
+        start += length;
+    }
+    inner->release(*handle);
+
+    if (res < 0) {
+        release_manifest(manifest);
+        manifest = {};
+    }
+    return res;
+}
+
+void ChunkedBackend::release_manifest(const ChunkStore::Manifest &manifest) {
+    for (const auto &piece : manifest.pieces) {
+        store->release(piece.hash);
+    }
+}
+
+void ChunkedBackend::chunk(const std::string &path, ino_t ino) {
+    static Metrics::Counter &chunked_files = Metrics::counter("chunks.files_chunked");
+
+    struct stat st {};
+    if (inner->stat(path, &st, false) < 0 || !S_ISREG(st.st_mode) || is_chunked(st) || st.st_nlink != 1 ||
+        static_cast<size_t>(st.st_size) < chunker.min_size() || (ino != 0 && st.st_ino != ino)) {
+        return;
+    }
+
+    // Splitting runs without the path lock, a change meanwhile shows in the attributes checked below
+    ChunkStore::Manifest manifest;
+    if (split(path, manifest) < 0) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(path_lock(path));
+    std::string staging;
+    struct stat after {};
+    if (being_written(st.st_ino) || inner->stat(path, &after, false) < 0 || after.st_ino != st.st_ino ||
+        !same_time(after.st_ctim, st.st_ctim) || manifest.size != static_cast<uint64_t>(st.st_size) ||
+        write_manifest(manifest, st, staging) < 0) {
+        release_manifest(manifest);
+        return;
+    }
+
+    cancel_pending(path);
+    std::lock_guard<std::mutex> pending_lock(pending_mutex);
+    pending[path] = {staging, st.st_ino, st.st_ctim, std::move(manifest)};
+    chunked_files.fetch_add(1, std::memory_order_relaxed);
+}
+
+void ChunkedBackend::enqueue(std::string_view path, ino_t ino) {
+    std::lock_guard<std::mutex> lock(thread_mutex);
+    auto it = queued.find(path);
+    if (it != queued.end()) {
+        it->second = ino;
+    } else if (queued.size() < MAX_QUEUED) {
+        queued.emplace(path, ino);
+    } else {
+        return;
+    }
+    wakeup.notify_all();
+}
+
+void ChunkedBackend::chunk_queued() {
+    std::lock_guard<std::mutex> lock(chunking_mutex);
+    std::map<std::string, ino_t, std::less<>> batch;
+    {
+        std::lock_guard<std::mutex> thread_lock(thread_mutex);
+        batch.swap(queued);
+    }
+    for (const auto &[path, ino] : batch) {
+        chunk(path, ino);
+    }
+}
+
+void ChunkedBackend::chunking_loop() {
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(thread_mutex);
+            wakeup.wait(lock, [&]() { return stopping || !queued.empty(); });
+            if (stopping) {
+                return;
+            }
+        }
+        chunk_queued();
+
+        bool full = false;
+        {
+            std::lock_guard<std::mutex> lock(pending_mutex);
+            full = pending.size() >= MAX_PENDING;
+        }
+        if (full) {
+            install_pending();
+        }
+    }
+}
+
+void ChunkedBackend::cancel_pending(std::string_view path) {
+    Pending cancelled;
+    {
+        std::lock_guard<std::mutex> lock(pending_mutex);
+        auto it = pending.find(path);
+        if (it == pending.end()) {
+            return;
+        }
+        cancelled = std::move(it->second);
+        pending.erase(it);
+    }
+    inner->unlink(cancelled.staging);
+    release_manifest(cancelled.manifest);
+}
+
+int ChunkedBackend::settle() {
+    chunk_queued();
+    return install_pending();
+}
+
+int ChunkedBackend::install_pending() {
+    std::lock_guard<std::mutex> chunking_lock(chunking_mutex);
+    std::map<std::string, Pending, std::less<>> batch;
+    {
+        std::lock_guard<std::mutex> lock(pending_mutex);
+        batch.swap(pending);
+    }
+    if (batch.empty()) {
+        return 0;
+    }
+
+    // Chunks and manifests have to be durable before a manifest replaces the plain file
+    int res = store->sync();
+    if (res == 0) {
+        res = inner->syncfs();
+    }
+
+    for (auto &[path, waiting] : batch) {
+        std::lock_guard<std::mutex> lock(path_lock(path));
+
+        // Files changed since they were chunked keep their new content
+        struct stat st {};
+        bool unchanged = res == 0 && inner->stat(path, &st, false) == 0 && st.st_ino == waiting.ino &&
+                         same_time(st.st_ctim, waiting.ctime) && !being_written(st.st_ino);
+
+        if (unchanged && inner->rename(waiting.staging, path, 0) == 0) {
+            continue;
+        }
+        inner->unlink(waiting.staging);
+        release_manifest(waiting.manifest);
+    }
+    return res;
+}
+
+int ChunkedBackend::expand(std::string_view path, bool truncate) {
+    static Metrics::Counter &expanded_files = Metrics::counter("chunks.files_expanded");
+
+    struct stat st {};
+    int res = inner->stat(path, &st, false);
+    if (res < 0 || !is_chunked(st)) {
+        return res;
+    }
+
+    ChunkStore::Manifest manifest;
+    res = load_manifest(path, manifest);
+    if (res < 0) {
+        return res;
+    }
+
+    std::string staging = Path::join(staging_directory, std::to_string(next_staging.fetch_add(1)));
+    std::unique_ptr<FileHandle> handle;
+    res = inner->open(staging, O_WRONLY | O_CREAT | O_EXCL, 0600, handle);
+    if (res < 0) {
+        return res;
+    }
+
+    std::vector<char> buffer;
+    off_t offset = 0;
+    for (size_t i = 0; !truncate && res == 0 && i < manifest.pieces.size(); i++) {
+        const auto &piece = manifest.pieces[i];
+        buffer.resize(piece.length);
+        ssize_t count = store->read(piece.hash, buffer.data(), buffer.size(), 0);
+        if (count != static_cast<ssize_t>(piece.length)) {
+            res = count < 0 ? static_cast<int>(count) : -EIO;
+            break;
+        }
+        for (size_t done = 0; done < buffer.size();) {
+            ssize_t written = inner->pwrite(*handle, buffer.data() + done, buffer.size() - done, offset);
+            if (written < 0) {
+                res = static_cast<int>(written);
+                break;
+            }
+            done += written;
+            offset += written;
+        }
+    }
+    int closed = inner->release(*handle);
+    if (res == 0) {
+        res = closed;
+    }
+    if (res == 0) {
+        res = inner->chmod(staging, st.st_mode & 07777 & ~S_ISVTX);
+    }
+    if (res == 0) {
+        inner->chown(staging, st.st_uid, st.st_gid);
+        if (!truncate) {
+            const struct timespec times[2] = {st.st_atim, st.st_mtim};
+            inner->utimens(staging, times);
+        }
+        res = inner->rename(staging, path, 0);
+    }
+    if (res < 0) {
+        inner->unlink(staging);
+        return res;
+    }
+
+    release_manifest(manifest);
+    expanded_files.fetch_add(1, std::memory_order_relaxed);
+    return 0;
+}
+
+int ChunkedBackend::open(std::string_view path, int flags, mode_t mode, std::unique_ptr<FileHandle> &handle) {
+    if (hidden(path)) {
+        return (flags & O_CREAT) ? -EPERM : -ENOENT;
+    }
+
+    std::string current(path);
+    for (int depth = 0; depth < MAX_SYMLINK_DEPTH; depth++) {
+        std::unique_lock<std::mutex> lock(path_lock(current));
+
+        struct stat st {};
+        int res = inner->stat(current, &st, false);
+        if (res == 0 && S_ISLNK(st.st_mode) && !(flags & O_NOFOLLOW)) {
+            // Chunked targets have to be handled here, relative links are followed within the store
+            char target[PATH_MAX];
+            int length = inner->readlink(current, target, sizeof(target));
+            if (length > 0 && target[0] != '/') {
+                std::string relative = Path::join(Path::view_parent(current), std::string_view(target, length));
+                current = std::filesystem::path(relative).lexically_normal().string();
+                continue;
+            }
+        }
+
+        if (res == 0 && is_chunked(st)) {
+            if ((flags & O_CREAT) && (flags & O_EXCL)) {
+                return -EEXIST;
+            }
+            if (!is_writable(flags) && !(flags & O_TRUNC)) {
+                ChunkStore::Manifest manifest;
+                res = load_manifest(current, manifest);
+                if (res < 0) {
+                    return res;
+                }
+                for (const auto &piece : manifest.pieces) {
+                    store->pin(piece.hash);
+                }
+                fix_attributes(current, &st);
+                handle = std::make_unique<ChunkedHandle>(flags, std::move(manifest), st);
+                return 0;
+            }
+
+            res = expand(current, (flags & O_TRUNC) != 0);
+            if (res < 0) {
+                return res;
+            }
+        }
+
+        res = inner->open(current, flags, mode, handle);
+        struct stat opened {};
+        if (res == 0 && is_writable(flags) && inner->fstat(*handle, &opened) == 0) {
+            cancel_pending(current);
+            handle->state<Writer>().ino = opened.st_ino;
+            std::lock_guard<std::mutex> writers_lock(writers_mutex);
+            Written &written = writers[opened.st_ino];
+            written.handles++;
+            written.path = current;
+        }
+        return res;
+    }
+    return -ELOOP;
+}
+
+ssize_t ChunkedBackend::pread(FileHandle &handle, void *buf, size_t count, off_t offset) {
+    auto *chunked = dynamic_cast<ChunkedHandle *>(&handle);
+    if (chunked == nullptr) {
+        return inner->pread(handle, buf, count, offset);
+    }
+
+    if (offset < 0) {
+        return -EINVAL;
+    }
+    const auto &pieces = chunked->manifest.pieces;
+    const auto &starts = chunked->starts;
+    size_t index = std::upper_bound(starts.begin(), starts.end(), static_cast<uint64_t>(offset)) - starts.begin();
+
+    size_t done = 0;
+    for (; index > 0 && index <= pieces.size() && done < count; index++) {
+        const auto &piece = pieces[index - 1];
+        uint64_t position = offset + done - starts[index - 1];
+        if (position >= piece.length) {
+            break;
+        }
+        size_t length = std::min<uint64_t>(count - done, piece.length - position);
+        ssize_t res = store->read(piece.hash, static_cast<char *>(buf) + done, length, static_cast<off_t>(position));
+        if (res < 0) {
+            return done > 0 ? static_cast<ssize_t>(done) : res;
+        }
+        done += res;
+        if (static_cast<size_t>(res) < length) {
+            break;
+        }
+    }
+    return static_cast<ssize_t>(done);
+}
+
+ssize_t ChunkedBackend::pwrite(FileHandle &handle, const void *buf, size_t count, off_t offset) {
+    if (dynamic_cast<ChunkedHandle *>(&handle) != nullptr) {
+        return -EBADF;
+    }
+    return inner->pwrite(handle, buf, count, offset);
+}
+
+int ChunkedBackend::ftruncate(FileHandle &handle, off_t length) {
+    if (dynamic_cast<ChunkedHandle *>(&handle) != nullptr) {
+        return -EINVAL;
+    }
+    return inner->ftruncate(handle, length);
+}
+
+int ChunkedBackend::fsync(FileHandle &handle, bool datasync) {
+    // Chunks of a manifest are durable before it is installed
+    if (dynamic_cast<ChunkedHandle *>(&handle) != nullptr) {
+        return 0;
+    }
+    return inner->fsync(handle, datasync);
+}
+
+int ChunkedBackend::release(FileHandle &handle) {
+    if (auto *chunked = dynamic_cast<ChunkedHandle *>(&handle)) {
+        for (const auto &piece : chunked->manifest.pieces) {
+            store->unpin(piece.hash);
+        }
+        return 0;
+    }
+
+    Writer *writer = handle.find_state<Writer>();
+    int res = inner->release(handle);
+    if (writer == nullptr) {
+        return res;
+    }
+
+    // Renames since the open moved the entry to the current name of the file
+    std::string path;
+    {
+        std::lock_guard<std::mutex> writers_lock(writers_mutex);
+        auto it = writers.find(writer->ino);
+        if (it == writers.end() || --it->second.handles > 0) {
+            return res;
+        }
+        path = std::move(it->second.path);
+        writers.erase(it);
+    }
+
+    enqueue(path, writer->ino);
+    return res;
+}
+
+int ChunkedBackend::fstat(FileHandle &handle, struct stat *st) {
+    if (auto *chunked = dynamic_cast<ChunkedHandle *>(&handle)) {
+        *st = chunked->attributes;
+        return 0;
+    }
+    return inner->fstat(handle, st);
+}
+
+int ChunkedBackend::prefetch(FileHandle &handle, off_t offset, size_t length) {
+    auto *chunked = dynamic_cast<ChunkedHandle *>(&handle);
+    if (chunked == nullptr) {
+        return inner->prefetch(handle, offset, length);
+    }
+
+    if (offset < 0) {
+        return -EINVAL;
+    }
+    const auto &pieces = chunked->manifest.pieces;
+    const auto &starts = chunked->starts;
+    size_t index = std::upper_bound(starts.begin(), starts.end(), static_cast<uint64_t>(offset)) - starts.begin();
+
+    // Every chunk overlapping the range is a file of its own
+    size_t done = 0;
+    for (; index > 0 && index <= pieces.size() && done < length; index++) {
+        const auto &piece = pieces[index - 1];
+        uint64_t position = offset + done - starts[index - 1];
+        if (position >= piece.length) {
+            break;
+        }
+        size_t part = std::min<uint64_t>(length - done, piece.length - position);
+        int res = store->prefetch(piece.hash, static_cast<off_t>(position), part);
+        if (res < 0) {
+            return res;
+        }
+        done += part;
+    }
+    return 0;
+}
+
+int ChunkedBackend::truncate(std::string_view path, off_t length) {
+    if (hidden(path)) {
+        return -ENOENT;
+    }
+
+    std::lock_guard<std::mutex> lock(path_lock(path));
+    cancel_pending(path);
+    int res = expand(path, length == 0);
+    if (res == 0) {
+        res = inner->truncate(path, length);
+    }
+
+    struct stat st {};
+    if (res == 0 && inner->stat(path, &st, false) == 0 && !being_written(st.st_ino)) {
+        enqueue(path, st.st_ino);
+    }
+    return res;
+}
+
+int ChunkedBackend::copy(std::string_view source, std::string_view destination) {
+    static Metrics::Counter &shared_copies = Metrics::counter("chunks.shared_copies");
+
+    if (hidden(source)) {
+        return -ENOENT;
+    }
+    if (hidden(destination)) {
+        return -EPERM;
+    }
+
+    PairLock lock(path_lock(source), path_lock(destination));
+
+    struct stat st {};
+    int res = inner->stat(source, &st, true);
+    if (res < 0) {
+        return res;
+    }
+
+    // Plain files are copied as they are and chunked in the background, like files that were written
+    if (!is_chunked(st)) {
+        res = inner->copy(source, destination);
+        if (res == 0) {
+            enqueue(destination, 0);
+        }
+        return res;
+    }
+
+    // The copy is a second manifest sharing every chunk
+    ChunkStore::Manifest manifest;
+    res = load_manifest(source, manifest);
+    if (res < 0) {
+        return res;
+    }
+    for (const auto &piece : manifest.pieces) {
+        store->add_reference(piece.hash);
+    }
+
+    st.st_uid = ::geteuid();
+    st.st_gid = ::getegid();
+    st.st_atim = st.st_mtim = now();
+    std::string staging;
+    res = write_manifest(manifest, st, staging);
+    if (res == 0) {
+        res = inner->rename(staging, destination, RENAME_NOREPLACE);
+        if (res < 0) {
+            inner->unlink(staging);
+        }
+    }
+    if (res < 0) {
+        release_manifest(manifest);
+        return res;
+    }
+
+    shared_copies.fetch_add(1, std::memory_order_relaxed);
+    return 0;
+}
+
+int ChunkedBackend::stat(std::string_view path, struct stat *st, bool follow) {
+    if (hidden(path)) {
+        return -ENOENT;
+    }
+
+    int res = inner->stat(path, st, follow);
+    if (res == 0) {
+        fix_attributes(path, st);
+    }
+    return res;
+}
+
+int ChunkedBackend::utimens(std::string_view path, const struct timespec tv[2]) {
+    if (hidden(path)) {
+        return -ENOENT;
+    }
+    return inner->utimens(path, tv);
+}
+
+int ChunkedBackend::chmod(std::string_view path, mode_t mode) {
+    if (hidden(path)) {
+        return -ENOENT;
+    }
+
+    // The sticky bit of regular files is taken by the chunked marker
+    struct stat st {};
+    int res = inner->stat(path, &st, true);
+    if (res < 0) {
+        return res;
+    }
+    if (S_ISREG(st.st_mode)) {
+        mode = is_chunked(st) ? (mode | S_ISVTX) : (mode & ~S_ISVTX);
+    }
+    return inner->chmod(path, mode);
+}
+
+int ChunkedBackend::chown(std::string_view path, uid_t uid, gid_t gid) {
+    if (hidden(path)) {
+        return -ENOENT;
+    }
+    return inner->chown(path, uid, gid);
+}
+
+int ChunkedBackend::statfs(struct statvfs *stbuf) {
+    return inner->statfs(stbuf);
+}
+
+int ChunkedBackend::mknod(std::string_view path, mode_t mode, dev_t dev) {
+    if (hidden(path)) {
+        return -EPERM;
+    }
+    if (S_ISREG(mode)) {
+        mode &= ~S_ISVTX;
+    }
+    return inner->mknod(path, mode, dev);
+}
+
+int ChunkedBackend::rename(std::string_view oldpath, std::string_view newpath, unsigned int flags) {
+    if (hidden(oldpath)) {
+        return -ENOENT;
+    }
+    if (hidden(newpath)) {
+        return -EPERM;
+    }
+
+    PairLock lock(path_lock(oldpath), path_lock(newpath));
+
+    // A manifest replaced by the rename drops its references
+    ChunkStore::Manifest replaced;
+    struct stat st {};
+    bool replacing = !(flags & RENAME_EXCHANGE) && inner->stat(newpath, &st, false) == 0 && is_chunked(st) &&
+                     st.st_nlink == 1 && load_manifest(newpath, replaced) == 0;
+
+    int res = inner->rename(oldpath, newpath, flags);
+    if (res == 0 && replacing) {
+        release_manifest(replaced);
+    }
+    if (res == 0) {
+        renamed(oldpath, newpath, (flags & RENAME_EXCHANGE) != 0);
+    }
+    return res;
+}
+
+bool ChunkedBackend::being_written(ino_t ino) {
+    std::lock_guard<std::mutex> lock(writers_mutex);
+    return writers.find(ino) != writers.end();
+}
+
+void ChunkedBackend::renamed(std::string_view oldpath, std::string_view newpath, bool exchange) {
+    auto move = [](std::string &path, std::string_view from, std::string_view to) {
+        bool below = path.size() > from.size() && path[from.size()] == '/';
+        if (path.compare(0, from.size(), from) != 0 || (path.size() != from.size() && !below)) {
+            return false;
+        }
+        path.replace(0, from.size(), to);
+        return true;
+    };
+
+    std::lock_guard<std::mutex> lock(writers_mutex);
+    for (auto &[ino, written] : writers) {
+        if (!move(written.path, oldpath, newpath) && exchange) {
+            move(written.path, newpath, oldpath);
+        }
+    }
+}
+
+int ChunkedBackend::link(std::string_view oldpath, std::string_view newpath) {
+    if (hidden(oldpath)) {
+        return -ENOENT;
+    }
+    if (hidden(newpath)) {
+        return -EPERM;
+    }
+
+    // Chunked files have a single name, a second one needs the file to be plain
+    PairLock lock(path_lock(oldpath), path_lock(newpath));
+    cancel_pending(oldpath);
+    int res = expand(oldpath, false);
+    if (res < 0) {
+        return res;
+    }
+    return inner->link(oldpath, newpath);
+}
+
+int ChunkedBackend::unlink(std::string_view path) {
+    if (hidden(path)) {
+        return -ENOENT;
+    }
+
+    std::lock_guard<std::mutex> lock(path_lock(path));
+    cancel_pending(path);
+
+    ChunkStore::Manifest removed;
+    struct stat st {};
+    bool chunked = inner->stat(path, &st, false) == 0 && is_chunked(st) && load_manifest(path, removed) == 0;
+
+    int res = inner->unlink(path);
+    if (res == 0 && chunked) {
+        release_manifest(removed);
+    }
+    return res;
+}
+
+int ChunkedBackend::symlink(std::string_view target, std::string_view linkpath) {
+    if (hidden(linkpath)) {
+        return -EPERM;
+    }
+    return inner->symlink(target, linkpath);
+}
+
+int ChunkedBackend::readlink(std::string_view path, char *buf, size_t size) {
+    if (hidden(path)) {
+        return -ENOENT;
+    }
+    return inner->readlink(path, buf, size);
+}
+
+int ChunkedBackend::mkdir(std::string_view path, mode_t mode) {
+    if (hidden(path)) {
+        return -EPERM;
+    }
+    return inner->mkdir(path, mode);
+}
+
+int ChunkedBackend::rmdir(std::string_view path) {
+    if (hidden(path)) {
+        return -ENOENT;
+    }
+    return inner->rmdir(path);
+}
+
+int ChunkedBackend::list(std::string_view path, std::vector<std::string> &names) {
+    if (hidden(path)) {
+        return -ENOENT;
+    }
+
+    size_t first = names.size();
+    int res = inner->list(path, names);
+    if (res == 0 && Path::is_root(path)) {
+        names.erase(std::remove(names.begin() + static_cast<std::ptrdiff_t>(first), names.end(), CHUNK_DIRECTORY),
+                    names.end());
+    }
+    return res;
+}
+
+int ChunkedBackend::opendir(std::string_view path, std::unique_ptr<DirHandle> &handle) {
+    if (hidden(path)) {
+        return -ENOENT;
+    }
+
+    std::unique_ptr<DirHandle> wrapped;
+    int res = inner->opendir(path, wrapped);
+    if (res == 0) {
+        handle = std::make_unique<InnerListing>(std::move(wrapped), path);
+    }
+    return res;
+}
+
+int ChunkedBackend::readdir(DirHandle &handle, off_t offset, DirFiller &filler) {
+    auto &listing = static_cast<InnerListing &>(handle);
+    Filler wrapper(*this, listing.path, filler);
+    std::lock_guard<std::mutex> lock(listing.inner->lock);
+    return inner->readdir(*listing.inner, offset, wrapper);
+}
+
+int ChunkedBackend::syncfs() {
+    int res = settle();
+    int synced = inner->syncfs();
+    return res < 0 ? res : synced;
+}
+
+bool ChunkedBackend::allows_splice() const {
+    return inner->allows_splice();
+}
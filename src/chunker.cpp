@@ -0,0 +1,50 @@
+#include "chunker.h"
+
+#include <algorithm>
+
+Chunker::Chunker(size_t average_size) : min(std::max<size_t>(average_size / 4, 64)), max(average_size * 4), mask(0) {
+    // One mask bit per doubling of the average, taken from the top where the gear hash mixes best
+    int bits = 0;
+    while ((static_cast<size_t>(2) << bits) <= average_size) {
+        bits++;
+    }
+    mask = bits == 0 ? 0 : ~static_cast<uint64_t>(0) << (64 - bits);
+}
+
+const std::array<uint64_t, 256> &Chunker::gear() {
+    // Boundaries have to stay the same across runs, so the table comes from a fixed seed
+    static const std::array<uint64_t, 256> table = [] {
+        std::array<uint64_t, 256> values{};
+        uint64_t state = 0x9e3779b97f4a7c15ULL;
+        for (auto &value : values) {
+            state += 0x9e3779b97f4a7c15ULL;
+            uint64_t z = state;
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+            value = z ^ (z >> 31);
+        }
+        return values;
+    }();
+    return table;
+}
+
+size_t Chunker::cut(const char *data, size_t length, bool last) const {
+    if (length <= min) {
+        return last ? length : 0;
+    }
+
+    const auto &table = gear();
+    size_t end = std::min(length, max);
+    uint64_t hash = 0;
+    for (size_t i = min; i < end; i++) {
+        hash = (hash << 1) + table[static_cast<unsigned char>(data[i])];
+        if ((hash & mask) == 0) {
+            return i + 1;
+        }
+    }
+
+    if (end == max || last) {
+        return end;
+    }
+    return 0;
+}
@@ -0,0 +1,39 @@
+#include "common/metrics.h"
+
+#include "common/logging.h"
+
+Metrics &Metrics::instance() {
+    static Metrics metrics;
+    return metrics;
+}
+
+Metrics::Counter &Metrics::counter(const std::string &name) {
+    Metrics &metrics = instance();
+    std::lock_guard<std::mutex> lock(metrics.mutex);
+
+    auto &slot = metrics.counters[name];
+    if (!slot) {
+        slot = std::make_unique<Counter>(0);
+    }
+    return *slot;
+}
+
+std::vector<std::pair<std::string, uint64_t>> Metrics::snapshot() {
+    Metrics &metrics = instance();
+    std::lock_guard<std::mutex> lock(metrics.mutex);
+
+    std::vector<std::pair<std::string, uint64_t>> values;
+    values.reserve(metrics.counters.size());
+    for (const auto &[name, counter] : metrics.counters) {
+        values.emplace_back(name, counter->load(std::memory_order_relaxed));
+    }
+    return values;
+}
+
+void Metrics::log() {
+    for (const auto &[name, value] : snapshot()) {
+        if (value != 0) {
+            Logging::Info("%s: %llu", name.c_str(), static_cast<unsigned long long>(value));
+        }
+    }
+}
@@ -36,6 +36,32 @@ std::string Path::string_basename(const std::string& path) {
     return last_slash == std::string::npos ? path : path.substr(last_slash + 1);
 }
 
+std::string_view Path::view_basename(std::string_view path) {
+    auto last_slash = path.rfind('/');
+    return last_slash == std::string_view::npos ? path : path.substr(last_slash + 1);
+}
+
+std::string_view Path::view_parent(std::string_view path) {
+    while (!path.empty() && path.back() == '/') {
+        path.remove_suffix(1);
+    }
+    size_t slash = path.rfind('/');
+    return slash == std::string_view::npos ? std::string_view("/") : path.substr(0, std::max<size_t>(slash, 1));
+}
+
+std::string Path::join(std::string_view directory, std::string_view name) {
+    std::string path(directory);
+    if (path.empty() || path.back() != '/') {
+        path += '/';
+    }
+    path += name;
+    return path;
+}
+
+bool Path::is_root(std::string_view path) {
+    return path.find_first_not_of('/') == std::string_view::npos;
+}
+
 const char* Path::c_str() const {
     return path_.c_str();
 }
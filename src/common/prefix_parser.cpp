@@ -61,8 +61,8 @@ std::vector<std::string> PrefixParser::args_from_prefix(const std::string& prefi
     return args_vec;
 }
 
-bool PrefixParser::is_prefixed(const std::string& path) {
-    std::string base = Path::string_basename(path);
+bool PrefixParser::is_prefixed(std::string_view path) {
+    std::string_view base = Path::view_basename(path);
 
     std::size_t hash_count = std::count(base.begin(), base.end(), '#');
     std::size_t hyphen_count = std::count(base.begin(), base.end(), '-');
@@ -91,15 +91,20 @@ std::string PrefixParser::get_nonprefixed(const std::string& prefixed_path) {
     return result;
 }
 
-bool PrefixParser::contains_prefix(const std::string& path, const std::string& module_name) {
-    std::string base = Path::string_basename(path);
-
+bool PrefixParser::contains_prefix(std::string_view path, std::string_view module_name) {
     if (!is_prefixed(path)) {
         return false;
     }
 
-    std::string prefix_1 = "#" + module_name + "#";
-    std::string prefix_2 = "#" + module_name + "-";
+    // Looks for "#<module_name>#" or "#<module_name>-" without building the patterns
+    std::string_view base = Path::view_basename(path);
+    for (auto hash = base.find('#'); hash != std::string_view::npos; hash = base.find('#', hash + 1)) {
+        std::string_view rest = base.substr(hash + 1);
+        if (rest.size() > module_name.size() && rest.compare(0, module_name.size(), module_name) == 0 &&
+            (rest[module_name.size()] == '#' || rest[module_name.size()] == '-')) {
+            return true;
+        }
+    }
 
-    return base.find(prefix_1) != std::string::npos || base.find(prefix_2) != std::string::npos;
+    return false;
 }
@@ -1,21 +1,57 @@
 #include "custom_vfs.h"
 
-#include <dirent.h>
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/statvfs.h>
 #include <unistd.h>
 
 #include <cerrno>
+#include <cstdlib>
 #include <filesystem>
-#include <fstream>
 
 #include "common/config.h"
 #include "common/logging.h"
+#include "common/metrics.h"
 #include "common/path.h"
 #include "common/prefix_parser.h"
+#include "dir_handle.h"
+#include "posix_backend.h"
 
 CustomVfs::CustomVfs(const std::string &path, const std::string &backing) : mount_path(Path::to_absolute(path)) {
+    prepare_mount_path(path);
+
+    backend = std::make_shared<PosixBackend>(backing_directory(backing, path));
+    attr_cache = std::make_shared<AttrCache>(std::chrono::nanoseconds::zero(), 0);
+    dir_cache = std::make_shared<DirListingCache>(0);
+    read_ahead = std::make_shared<ReadAhead>();
+    durability = std::make_shared<std::atomic<Durability>>(Durability::FSYNC);
+}
+
+CustomVfs::CustomVfs(const std::string &path, std::shared_ptr<StorageBackend> backend)
+    : backend(std::move(backend)), mount_path(Path::to_absolute(path)) {
+    prepare_mount_path(path);
+
+    attr_cache = std::make_shared<AttrCache>(std::chrono::nanoseconds::zero(), 0);
+    dir_cache = std::make_shared<DirListingCache>(0);
+    read_ahead = std::make_shared<ReadAhead>();
+    durability = std::make_shared<std::atomic<Durability>>(Durability::FSYNC);
+}
+
+std::string CustomVfs::backing_directory(const std::string &backing, const std::string &path) {
+    std::string name = Path::string_basename(path);
+    Path backing_dir = initial_backing_path(backing, name);
+
+    if (!std::filesystem::exists(backing_dir.to_string())) {
+        Logging::Info("Creating backing directory %s", backing_dir.c_str());
+        if (!std::filesystem::create_directory(backing_dir.to_string())) {
+            Logging::Fatal("Mount path %s could not be created", path.c_str());
+            throw std::runtime_error("Backing directory could not be created");
+        }
+    }
+    return backing_dir.to_string();
+}
+
+void CustomVfs::prepare_mount_path(const std::string &path) {
     if (!std::filesystem::exists(path)) {
         Logging::Debug("Creating mount path %s", path.c_str());
         if (!std::filesystem::create_directory(path)) {
@@ -27,17 +63,6 @@ CustomVfs::CustomVfs(const std::string &path, const std::string &backing) : moun
             throw std::runtime_error("Mount point is not a directory");
         }
     }
-
-    std::string name = Path::string_basename(path);
-    backing_dir = initial_backing_path(backing, name);
-
-    if (!std::filesystem::exists(backing_dir.to_string())) {
-        Logging::Info("Creating backing directory %s", backing_dir.c_str());
-        if (!std::filesystem::create_directory(backing_dir.to_string())) {
-            Logging::Fatal("Mount path %s could not be created", path.c_str());
-            throw std::runtime_error("Backing directory could not be created");
-        }
-    }
 }
 
 Path CustomVfs::initial_backing_path(const std::string &backing, const std::string &vfs_name) {
@@ -56,163 +81,417 @@ Path CustomVfs::initial_backing_path(const std::string &backing, const std::stri
     return Path(Config::base.backing_location) / (Config::base.backing_prefix + vfs_name);
 }
 
-void CustomVfs::init() {
-    FuseWrapper::init();
+void CustomVfs::set_connection_settings(const ConnectionSettings &settings) {
+    connection_settings = settings;
+}
+
+void CustomVfs::set_parent_cache_size(size_t capacity) {
+    if (auto *posix = dynamic_cast<PosixBackend *>(backend.get())) {
+        posix->set_parent_cache_size(capacity);
+    }
+}
+
+void CustomVfs::set_attr_cache(std::chrono::nanoseconds ttl, size_t capacity) {
+    attr_cache->configure(ttl, capacity);
 }
 
-void CustomVfs::destroy() {}
+void CustomVfs::set_dir_cache_size(size_t memory_limit) {
+    dir_cache->set_memory_limit(memory_limit);
+}
+
+void CustomVfs::set_read_ahead(size_t max_window) {
+    read_ahead->set_max_window(max_window);
+}
 
-int CustomVfs::mknod(const std::string &pathname, mode_t mode, dev_t dev) {
-    return posix_call_result(::mknod, to_backing(pathname).c_str(), mode, dev);
+void CustomVfs::set_durability(Durability mode) {
+    durability->store(mode, std::memory_order_relaxed);
 }
 
-int CustomVfs::read(const std::string &pathname, char *buf, size_t count, off_t offset, struct fuse_file_info *fi) {
-    int fd = ::open(to_backing(pathname).c_str(), O_RDONLY);
-    if (fd < 0) {
-        return -errno;
+void CustomVfs::set_io_engine(std::shared_ptr<IoEngine> engine) {
+    if (auto *posix = dynamic_cast<PosixBackend *>(backend.get())) {
+        posix->set_io_engine(std::move(engine));
     }
-    int ret = static_cast<int>(::pread(fd, buf, count, offset));
-    ::close(fd);
-    return ret;
 }
 
-int CustomVfs::write(const std::string &pathname, const char *buf, size_t count, off_t offset,
+void CustomVfs::init(connection &conn) {
+    FuseWrapper::init(conn);
+
+    if (connection_settings.max_write > 0) {
+        conn.max_write = connection_settings.max_write;
+        conn.want(CAP_BIG_WRITES);
+    }
+    if (connection_settings.max_readahead > 0) {
+        conn.max_readahead = connection_settings.max_readahead;
+    }
+    if (connection_settings.max_background > 0) {
+        conn.max_background = connection_settings.max_background;
+    }
+    if (connection_settings.congestion_threshold > 0) {
+        conn.congestion_threshold = connection_settings.congestion_threshold;
+    }
+
+    if (connection_settings.async_read) {
+        conn.want(CAP_ASYNC_READ);
+    } else {
+        conn.veto(CAP_ASYNC_READ);
+    }
+
+    if (connection_settings.writeback_cache) {
+        if (!conn.capable(CAP_WRITEBACK_CACHE)) {
+            Logging::Warn("Writeback cache is not supported by the FUSE connection");
+        }
+        conn.want(CAP_WRITEBACK_CACHE);
+    }
+}
+
+void CustomVfs::negotiated(const connection &conn) {
+    writeback_cache = conn.enabled(CAP_WRITEBACK_CACHE);
+}
+
+void CustomVfs::destroy() {
+    Metrics::log();
+}
+
+int CustomVfs::mknod(std::string_view pathname, mode_t mode, dev_t dev) {
+    struct stat before = listing_stamp(pathname);
+    int res = backend->mknod(pathname, mode, dev);
+    entry_changed(pathname);
+    if (res == 0) {
+        listing_changed(pathname, true, before);
+    }
+    return res;
+}
+
+int CustomVfs::read(std::string_view pathname, char *buf, size_t count, off_t offset, struct fuse_file_info *fi) {
+    FileHandle *handle = FileHandle::from(fi);
+    if (handle == nullptr) {
+        return -EBADF;
+    }
+
+    read_ahead->advise(*backend, *handle, offset, count);
+    return static_cast<int>(backend->pread(*handle, buf, count, offset));
+}
+
+int CustomVfs::write(std::string_view pathname, const char *buf, size_t count, off_t offset,
                      struct fuse_file_info *fi) {
-    std::string real_path = to_backing(pathname);
-    int fd = ::open(real_path.c_str(), O_WRONLY);
-    if (fd < 0) {
-        return -errno;
+    FileHandle *handle = FileHandle::from(fi);
+    if (handle == nullptr) {
+        return -EBADF;
+    }
+
+    ssize_t ret = backend->pwrite(*handle, buf, count, offset);
+    if (ret < 0) {
+        return static_cast<int>(ret);
     }
-    int ret = static_cast<int>(::pwrite(fd, buf, count, offset));
-    ::close(fd);
-    return ret;
+
+    changed(pathname);
+    return static_cast<int>(ret);
 }
 
-int CustomVfs::truncate(const std::string &pathname, off_t length) {
-    return posix_call_result(::truncate, to_backing(pathname).c_str(), length);
+int CustomVfs::read_buf(std::string_view pathname, struct fuse_bufvec **bufp, size_t size, off_t off,
+                        struct fuse_file_info *fi) {
+    FileHandle *handle = FileHandle::from(fi);
+    if (handle == nullptr || !handle->passthrough() || !backend->allows_splice()) {
+        return FuseWrapper::read_buf(pathname, bufp, size, off, fi);
+    }
+
+    read_ahead->advise(*backend, *handle, off, size);
+
+    // Only the descriptor is handed over, libfuse splices the data straight from the backing file
+    auto *bufvec = static_cast<struct fuse_bufvec *>(malloc(sizeof(struct fuse_bufvec)));
+    if (bufvec == nullptr) {
+        return -ENOMEM;
+    }
+
+    *bufvec = FUSE_BUFVEC_INIT(size);
+    bufvec->buf[0].flags = static_cast<enum fuse_buf_flags>(FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK);
+    bufvec->buf[0].fd = handle->fd();
+    bufvec->buf[0].pos = off;
+
+    *bufp = bufvec;
+    return 0;
 }
 
-int CustomVfs::rename(const std::string &oldpath, const std::string &newpath, unsigned int flags) {
-    std::string old_real_path = to_backing(oldpath);
-    std::string new_real_path = to_backing(newpath);
-    return posix_call_result(::rename, old_real_path.c_str(), new_real_path.c_str());
+int CustomVfs::write_buf(std::string_view pathname, struct fuse_bufvec *buf, off_t off, struct fuse_file_info *fi) {
+    FileHandle *handle = FileHandle::from(fi);
+    if (handle == nullptr || !handle->passthrough() || !backend->allows_splice()) {
+        return FuseWrapper::write_buf(pathname, buf, off, fi);
+    }
+
+    struct fuse_bufvec dst = FUSE_BUFVEC_INIT(fuse_buf_size(buf));
+    dst.buf[0].flags = static_cast<enum fuse_buf_flags>(FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK);
+    dst.buf[0].fd = handle->fd();
+    dst.buf[0].pos = off;
+
+    ssize_t ret = fuse_buf_copy(&dst, buf, FUSE_BUF_SPLICE_NONBLOCK);
+    if (ret > 0) {
+        changed(pathname);
+    }
+    return static_cast<int>(ret);
+}
+
+int CustomVfs::truncate(std::string_view pathname, off_t length) {
+    int res = backend->truncate(pathname, length);
+    changed(pathname);
+    return res;
+}
+
+int CustomVfs::ftruncate(std::string_view pathname, off_t length, struct fuse_file_info *fi) {
+    FileHandle *handle = FileHandle::from(fi);
+    if (handle == nullptr) {
+        return truncate(pathname, length);
+    }
+
+    int res = backend->ftruncate(*handle, length);
+    changed(pathname);
+    return res;
+}
+
+int CustomVfs::rename(std::string_view oldpath, std::string_view newpath, unsigned int flags) {
+    struct stat old_before = listing_stamp(oldpath);
+    struct stat new_before = listing_stamp(newpath);
+    int res = backend->rename(oldpath, newpath, flags);
+
+    attr_cache->invalidate_tree(oldpath);
+    attr_cache->invalidate_tree(newpath);
+    entry_changed(oldpath);
+    entry_changed(newpath);
+
+    dir_cache->invalidate_tree(oldpath);
+    dir_cache->invalidate_tree(newpath);
+    if (res == 0) {
+        listing_changed(oldpath, (flags & RENAME_EXCHANGE) != 0, old_before);
+        listing_changed(newpath, true, new_before);
+    }
+    return res;
+}
+
+int CustomVfs::getattr(std::string_view pathname, struct stat *st) {
+    return stat_backing(pathname, st);
 }
 
-int CustomVfs::getattr(const std::string &pathname, struct stat *st) {
-    return posix_call_result(::lstat, to_backing(pathname).c_str(), st);
+int CustomVfs::statfs(std::string_view pathname, struct statvfs *stbuf) {
+    return backend->statfs(stbuf);
 }
 
-int CustomVfs::statfs(const std::string &pathname, struct statvfs *stbuf) {
-    return posix_call_result(::statvfs, to_backing(pathname).c_str(), stbuf);
+int CustomVfs::utimens(std::string_view pathname, const struct timespec tv[2]) {
+    int res = backend->utimens(pathname, tv);
+    changed(pathname);
+    return res;
 }
 
-int CustomVfs::utimens(const std::string &pathname, const struct timespec tv[2]) {
-    return posix_call_result(::utimensat, AT_FDCWD, to_backing(pathname).c_str(), tv, AT_SYMLINK_NOFOLLOW);
+int CustomVfs::chmod(std::string_view pathname, mode_t mode) {
+    int res = backend->chmod(pathname, mode);
+    changed(pathname);
+    return res;
 }
 
-int CustomVfs::chmod(const std::string &pathname, mode_t mode) {
-    return posix_call_result(::chmod, to_backing(pathname).c_str(), mode);
+int CustomVfs::chown(std::string_view pathname, uid_t uid, gid_t gid) {
+    int res = backend->chown(pathname, uid, gid);
+    changed(pathname);
+    return res;
 }
 
-int CustomVfs::chown(const std::string &pathname, uid_t uid, gid_t gid) {
-    return posix_call_result(::lchown, to_backing(pathname).c_str(), uid, gid);
+int CustomVfs::open(std::string_view pathname, struct fuse_file_info *fi) {
+    adjust_open_flags(fi);
+    struct stat before {};
+    if (fi->flags & O_CREAT) {
+        before = listing_stamp(pathname);
+    }
+    std::unique_ptr<FileHandle> handle;
+    int res = backend->open(pathname, fi->flags, 0, handle);
+    if (res < 0) {
+        return res;
+    }
+
+    if (fi->flags & (O_CREAT | O_TRUNC)) {
+        entry_changed(pathname);
+    }
+    if (fi->flags & O_CREAT) {
+        listing_changed(pathname, true, before);
+    }
+
+    FileHandle::attach(fi, std::move(handle));
+    return 0;
 }
 
-int CustomVfs::open(const std::string &pathname, struct fuse_file_info *fi) {
-    int fd = ::open(to_backing(pathname).c_str(), fi->flags);
-    if (fd < 0) {
-        return -errno;
+int CustomVfs::create(std::string_view pathname, mode_t mode, struct fuse_file_info *fi) {
+    adjust_open_flags(fi);
+    struct stat before = listing_stamp(pathname);
+    std::unique_ptr<FileHandle> handle;
+    int res = backend->open(pathname, fi->flags | O_CREAT, mode, handle);
+    if (res < 0) {
+        return res;
     }
-    fi->fh = fd;
+
+    entry_changed(pathname);
+    listing_changed(pathname, true, before);
+
+    FileHandle::attach(fi, std::move(handle));
     return 0;
 }
 
-int CustomVfs::symlink(const std::string &target, const std::string &linkpath) {
-    return posix_call_result(::symlink, target.c_str(), to_backing(linkpath).c_str());
+int CustomVfs::symlink(std::string_view target, std::string_view linkpath) {
+    struct stat before = listing_stamp(linkpath);
+    int res = backend->symlink(target, linkpath);
+    entry_changed(linkpath);
+    if (res == 0) {
+        listing_changed(linkpath, true, before);
+    }
+    return res;
 }
 
-int CustomVfs::readlink(const std::string &pathname, char *buf, size_t size) {
-    return posix_call_result(::readlink, to_backing(pathname).c_str(), buf, size);
+int CustomVfs::readlink(std::string_view pathname, char *buf, size_t size) {
+    return backend->readlink(pathname, buf, size);
 }
 
-int CustomVfs::link(const std::string &oldpath, const std::string &newpath) {
-    std::string old_real_path = to_backing(oldpath);
-    std::string new_real_path = to_backing(newpath);
-    return posix_call_result(::link, old_real_path.c_str(), new_real_path.c_str());
+int CustomVfs::link(std::string_view oldpath, std::string_view newpath) {
+    struct stat before = listing_stamp(newpath);
+    int res = backend->link(oldpath, newpath);
+
+    // The link count of the source changes as well
+    changed(oldpath);
+    entry_changed(newpath);
+    if (res == 0) {
+        listing_changed(newpath, true, before);
+    }
+    return res;
 }
 
-int CustomVfs::unlink(const std::string &pathname) {
-    return posix_call_result(::unlink, to_backing(pathname).c_str());
+int CustomVfs::unlink(std::string_view pathname) {
+    struct stat before = listing_stamp(pathname);
+    int res = backend->unlink(pathname);
+    entry_changed(pathname);
+    if (res == 0) {
+        listing_changed(pathname, false, before);
+    }
+    return res;
 }
 
-int CustomVfs::mkdir(const std::string &pathname, mode_t mode) {
-    return posix_call_result(::mkdir, to_backing(pathname).c_str(), mode);
+int CustomVfs::mkdir(std::string_view pathname, mode_t mode) {
+    struct stat before = listing_stamp(pathname);
+    int res = backend->mkdir(pathname, mode);
+    entry_changed(pathname);
+    if (res == 0) {
+        listing_changed(pathname, true, before);
+    }
+    return res;
 }
 
-int CustomVfs::rmdir(const std::string &pathname) {
+int CustomVfs::rmdir(std::string_view pathname) {
     // We don't want to start deleting files before we now that the directory is empty
-    for (const auto &entry : subfiles(pathname)) {
+    std::string directory(pathname);
+    std::vector<std::string> entries = subfiles(directory);
+
+    for (const auto &entry : entries) {
         if (!PrefixParser::is_prefixed(entry)) {
             return -ENOTEMPTY;
         }
     }
 
-    for (const auto &entry : subfiles(pathname)) {
-        if (PrefixParser::is_prefixed(entry)) {
-            unlink(Path(pathname) / entry);
-        }
+    for (const auto &entry : entries) {
+        unlink((Path(directory) / entry).to_string());
     }
 
-    return posix_call_result(::rmdir, to_backing(pathname).c_str());
+    struct stat before = listing_stamp(pathname);
+    int res = backend->rmdir(pathname);
+    attr_cache->invalidate_tree(pathname);
+    entry_changed(pathname);
+    dir_cache->invalidate_tree(pathname);
+    if (res == 0) {
+        listing_changed(pathname, false, before);
+    }
+    return res;
 }
 
-int CustomVfs::opendir(const std::string &pathname, struct fuse_file_info *fi) {
-    DIR *dp = ::opendir(to_backing(pathname).c_str());
-    if (dp == nullptr) {
-        return -errno;
+int CustomVfs::opendir(std::string_view pathname, struct fuse_file_info *fi) {
+    std::unique_ptr<DirHandle> handle;
+    int res = backend->opendir(pathname, handle);
+    if (res < 0) {
+        return res;
     }
-    fi->fh = reinterpret_cast<uintptr_t>(dp);
+
+    DirHandle::attach(fi, std::move(handle));
     return 0;
 }
 
-int CustomVfs::releasedir(const std::string &pathname, struct fuse_file_info *fi) {
-    DIR *dp = reinterpret_cast<DIR *>(fi->fh);
-    return posix_call_result(::closedir, dp);
+int CustomVfs::releasedir(std::string_view pathname, struct fuse_file_info *fi) {
+    std::unique_ptr<DirHandle> handle = DirHandle::detach(fi);
+    return handle == nullptr ? -EBADF : 0;
 }
 
-int CustomVfs::release(const std::string &pathname, struct fuse_file_info *fi) {
-    return posix_call_result(::close, static_cast<int>(fi->fh));
+int CustomVfs::release(std::string_view pathname, struct fuse_file_info *fi) {
+    std::unique_ptr<FileHandle> handle = FileHandle::detach(fi);
+    if (handle == nullptr) {
+        return -EBADF;
+    }
+
+    return backend->release(*handle);
 }
 
-int CustomVfs::flush(const std::string &pathname, struct fuse_file_info *fi) {
-    int fd = static_cast<int>(fi->fh);
-    return posix_call_result(::fsync, fd);
+int CustomVfs::flush(std::string_view pathname, struct fuse_file_info *fi) {
+    FileHandle *handle = FileHandle::from(fi);
+    if (handle == nullptr) {
+        return -EBADF;
+    }
+
+    // close() is not a durability point, only the legacy mode treats it as one
+    if (durability->load(std::memory_order_relaxed) != Durability::CLOSE) {
+        return 0;
+    }
+    return backend->fsync(*handle, false);
 }
 
-int CustomVfs::readdir(const std::string &pathname, off_t off, struct fuse_file_info *fi, readdir_flags flags) {
-    std::string real_path = to_backing(pathname);
-    struct stat stbuf {};
-    if (::lstat(real_path.c_str(), &stbuf) != 0 || !S_ISDIR(stbuf.st_mode)) {
-        return -ENOENT;
+int CustomVfs::fsync(std::string_view pathname, int datasync, struct fuse_file_info *fi) {
+    FileHandle *handle = FileHandle::from(fi);
+    if (handle == nullptr) {
+        return -EBADF;
     }
 
-    off_t current_offset = 0;
-    for (const auto &entry : std::filesystem::directory_iterator(real_path)) {
-        if (current_offset >= off) {
-            struct stat entry_stbuf {};
-            if (::lstat(entry.path().c_str(), &entry_stbuf) == 0) {
-                if (fill_dir(entry.path().filename(), &entry_stbuf, current_offset + 1, FILL_DIR_PLUS) == 1) {
-                    break;
-                }
-            }
-        }
-        current_offset++;
+    switch (durability->load(std::memory_order_relaxed)) {
+        case Durability::NONE:
+            return 0;
+        case Durability::GROUP:
+            return backend->syncfs();
+        case Durability::FSYNC:
+        case Durability::CLOSE:
+            break;
     }
+    return backend->fsync(*handle, datasync != 0);
+}
 
-    return 0;
+int CustomVfs::readdir(std::string_view pathname, off_t off, struct fuse_file_info *fi, readdir_flags flags) {
+    DirHandle *handle = DirHandle::from(fi);
+    if (handle == nullptr) {
+        return -EBADF;
+    }
+
+    /// Passes entries to fill_dir(), which may be overridden by decorators
+    class Filler : public StorageBackend::DirFiller {
+    public:
+        Filler(CustomVfs &vfs, bool plus) : vfs(vfs), plus(plus) {}
+
+        bool wants_attributes(std::string_view name) override {
+            // Hidden entries are dropped by fill_dir(), so their attributes are never needed
+            return plus && !PrefixParser::is_prefixed(name);
+        }
+
+        int add(std::string_view name, const struct stat *st, off_t next, bool attributes) override {
+            auto fill_flags = attributes ? FILL_DIR_PLUS : static_cast<FuseWrapper::fill_dir_flags>(0);
+            return vfs.fill_dir(name, st, next, fill_flags);
+        }
+
+    private:
+        CustomVfs &vfs;
+        bool plus;
+    };
+
+    std::lock_guard<std::mutex> lock(handle->lock);
+    Filler filler(*this, (flags & READDIR_PLUS) != 0);
+    return backend->readdir(*handle, off, filler);
 }
 
-int CustomVfs::fill_dir(const std::string &name, const struct stat *stbuf, off_t off,
+int CustomVfs::fill_dir(std::string_view name, const struct stat *stbuf, off_t off,
                         FuseWrapper::fill_dir_flags flags) {
     if (!PrefixParser::is_prefixed(name)) {
         return FuseWrapper::fill_dir(name, stbuf, off, flags);
@@ -222,32 +501,80 @@ int CustomVfs::fill_dir(const std::string &name, const struct stat *stbuf, off_t
 }
 
 std::vector<std::string> CustomVfs::subfiles(const std::string &pathname) const {
-    std::string real_path = to_backing(pathname);
     std::vector<std::string> files;
+    if (!dir_cache->enabled()) {
+        backend->list(pathname, files);
+        return files;
+    }
 
-    for (const auto &entry : std::filesystem::directory_iterator(real_path)) {
-        std::string path = entry.path();
-        files.push_back(Path::string_basename(path));
+    // The stamp is taken before reading, so that a change made in the meantime invalidates the stored listing
+    struct stat st {};
+    if (backend->stat(pathname, &st, true) != 0) {
+        return files;
     }
 
+    if (!dir_cache->names(pathname, st, files) && backend->list(pathname, files) == 0) {
+        dir_cache->store(pathname, st, files);
+    }
     return files;
 }
 
-bool CustomVfs::is_directory(const std::string &pathname) const {
-    std::string backing_path = to_backing(pathname);
-    return std::filesystem::is_directory(backing_path);
+std::vector<std::string> CustomVfs::prefixed_subfiles(const std::string &pathname, const std::string &name) const {
+    std::vector<std::string> files;
+
+    // Listings of a backend keeping sidecars apart never contain them, so neither does the cache
+    if (backend->separates_sidecars()) {
+        backend->list_sidecars(pathname, name, files);
+        return files;
+    }
+
+    if (dir_cache->enabled()) {
+        struct stat st {};
+        if (backend->stat(pathname, &st, true) != 0) {
+            return files;
+        }
+
+        if (dir_cache->prefixed(pathname, st, name, files)) {
+            return files;
+        }
+    }
+
+    // Loading the listing builds the index too, unless the listing does not fit into the cache
+    for (auto &file : CustomVfs::subfiles(pathname)) {
+        if (PrefixParser::is_prefixed(file) && PrefixParser::get_nonprefixed(file) == name) {
+            files.push_back(std::move(file));
+        }
+    }
+    return files;
 }
 
-std::string CustomVfs::to_backing(const std::string &pathname) const {
-    return backing_dir / pathname;
+bool CustomVfs::is_directory(const std::string &pathname) const {
+    struct stat st {};
+    if (stat_backing(pathname, &st) != 0) {
+        return false;
+    }
+    if (!S_ISLNK(st.st_mode)) {
+        return S_ISDIR(st.st_mode);
+    }
+
+    // Symbolic links are followed, their targets are not cached
+    return backend->stat(pathname, &st, true) == 0 && S_ISDIR(st.st_mode);
 }
 
-std::unique_ptr<std::ifstream> CustomVfs::get_ifstream(const std::string &path, std::ios_base::openmode mode) const {
-    return std::make_unique<std::ifstream>(to_backing(path), mode);
+std::unique_ptr<BackendIstream> CustomVfs::get_ifstream(const std::string &path, std::ios_base::openmode mode) const {
+    return std::make_unique<BackendIstream>(backend, path);
 }
 
-std::unique_ptr<std::ofstream> CustomVfs::get_ofstream(const std::string &path, std::ios_base::openmode mode) const {
-    return std::make_unique<std::ofstream>(to_backing(path), mode);
+std::unique_ptr<BackendOstream> CustomVfs::get_ofstream(const std::string &path, std::ios_base::openmode mode) const {
+    // Opening may create the file, closing changes its size and times
+    struct stat before = listing_stamp(path);
+    auto stream = std::make_unique<BackendOstream>(backend, path, mode,
+                                                   [cache = attr_cache, path] { cache->invalidate(path); });
+    entry_changed(path);
+    if (stream->is_open()) {
+        listing_changed(path, true, before);
+    }
+    return stream;
 }
 
 std::vector<std::string> CustomVfs::get_related_files(const std::string &pathname) const {
@@ -255,11 +582,125 @@ std::vector<std::string> CustomVfs::get_related_files(const std::string &pathnam
 }
 
 int CustomVfs::copy_file(const std::string &source, const std::string &destination) {
-    std::filesystem::copy_file(to_backing(source), to_backing(destination));
-    std::ofstream(to_backing(destination), std::ios_base::app).close();
-    return 0;
+    struct stat before = listing_stamp(destination);
+    int res = backend->copy(source, destination);
+    entry_changed(destination);
+    listing_changed(destination, res == 0, before);
+    return res;
 }
 
 bool CustomVfs::exists(const std::string &pathname) const {
-    return std::filesystem::exists(to_backing(pathname));
+    struct stat st {};
+    if (stat_backing(pathname, &st) != 0) {
+        return false;
+    }
+    if (!S_ISLNK(st.st_mode)) {
+        return true;
+    }
+
+    // A dangling symbolic link does not count, like with stat()
+    return backend->stat(pathname, &st, true) == 0;
+}
+
+int CustomVfs::stat_backing(std::string_view pathname, struct stat *st) const {
+    uint64_t generation = 0;
+    switch (attr_cache->lookup(pathname, st, generation)) {
+        case AttrCache::Result::HIT:
+            return 0;
+        case AttrCache::Result::NEGATIVE:
+            return -ENOENT;
+        case AttrCache::Result::MISS:
+            break;
+    }
+
+    int res = backend->stat(pathname, st, false);
+    if (res == 0) {
+        attr_cache->store(pathname, st, generation);
+    } else if (res == -ENOENT) {
+        attr_cache->store(pathname, nullptr, generation);
+    }
+    return res;
+}
+
+void CustomVfs::adjust_open_flags(struct fuse_file_info *fi) const {
+    if (!writeback_cache) {
+        return;
+    }
+
+    // The kernel reads in pages which are only partly written, also for files opened write-only, and it knows the end
+    // of the file better than the backing file while writes are cached, so it places appended data itself
+    if ((fi->flags & O_ACCMODE) == O_WRONLY) {
+        fi->flags = (fi->flags & ~O_ACCMODE) | O_RDWR;
+    }
+    fi->flags &= ~O_APPEND;
+}
+
+void CustomVfs::changed(std::string_view pathname) const {
+    attr_cache->invalidate(pathname);
+}
+
+namespace {
+
+/// Splits a path into its parent directory and its name, the parent of an entry of the root is ""
+std::pair<std::string_view, std::string_view> split_parent(std::string_view pathname) {
+    while (!pathname.empty() && pathname.back() == '/') {
+        pathname.remove_suffix(1);
+    }
+    auto slash = pathname.rfind('/');
+    if (slash == std::string_view::npos) {
+        return {std::string_view(), pathname};
+    }
+    return {pathname.substr(0, slash), pathname.substr(slash + 1)};
+}
+
+}  // namespace
+
+struct stat CustomVfs::listing_stamp(std::string_view pathname) const {
+    struct stat st {};
+    if (!dir_cache->enabled()) {
+        return st;
+    }
+
+    auto [parent, name] = split_parent(pathname);
+    if (backend->separates_sidecars() && PrefixParser::is_prefixed(name)) {
+        return st;
+    }
+    if (backend->stat(parent, &st, true) != 0) {
+        // Matches no listing, so the listing is dropped after the change
+        st = {};
+    }
+    return st;
+}
+
+void CustomVfs::listing_changed(std::string_view pathname, bool present, const struct stat &before) const {
+    if (!dir_cache->enabled()) {
+        return;
+    }
+
+    auto [parent, name] = split_parent(pathname);
+    if (backend->separates_sidecars() && PrefixParser::is_prefixed(name)) {
+        return;
+    }
+
+    struct stat st {};
+    if (backend->stat(parent, &st, true) != 0) {
+        dir_cache->invalidate_tree(parent);
+        return;
+    }
+
+    if (present) {
+        dir_cache->added(parent, name, before, st);
+    } else {
+        dir_cache->removed(parent, name, before, st);
+    }
+}
+
+void CustomVfs::entry_changed(std::string_view pathname) const {
+    attr_cache->invalidate(pathname);
+
+    while (!pathname.empty() && pathname.back() == '/') {
+        pathname.remove_suffix(1);
+    }
+    auto slash = pathname.rfind('/');
+    attr_cache->invalidate(slash == std::string_view::npos ? std::string_view() : pathname.substr(0, slash));
 }
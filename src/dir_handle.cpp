@@ -0,0 +1,49 @@
+#include "dir_handle.h"
+
+#include <cstdint>
+
+#include "fuse_wrapper.h"
+
+DirHandle::DirHandle(DIR *dir) : dir_(dir) {}
+
+DirHandle::~DirHandle() {
+    if (dir_ != nullptr) {
+        ::closedir(dir_);
+    }
+}
+
+int DirHandle::fd() const {
+    return ::dirfd(dir_);
+}
+
+void DirHandle::seek(off_t offset) {
+    if (offset == position) {
+        return;
+    }
+
+    if (offset == 0) {
+        ::rewinddir(dir_);
+    } else {
+        ::seekdir(dir_, offset);
+    }
+    position = offset;
+}
+
+void DirHandle::attach(struct fuse_file_info *fi, std::unique_ptr<DirHandle> handle) {
+    fi->fh = reinterpret_cast<uintptr_t>(handle.release());
+}
+
+DirHandle *DirHandle::from(const struct fuse_file_info *fi) {
+    if (fi == nullptr) {
+        return nullptr;
+    }
+    return reinterpret_cast<DirHandle *>(static_cast<uintptr_t>(fi->fh));
+}
+
+std::unique_ptr<DirHandle> DirHandle::detach(struct fuse_file_info *fi) {
+    std::unique_ptr<DirHandle> handle(from(fi));
+    if (fi != nullptr) {
+        fi->fh = 0;
+    }
+    return handle;
+}
@@ -0,0 +1,295 @@
+#include "dir_listing_cache.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "common/prefix_parser.h"
+
+namespace {
+
+/// Rough per-name overhead of the hash sets and maps on top of the name itself
+constexpr size_t ENTRY_OVERHEAD = 48;
+
+/// Rough overhead of an empty listing
+constexpr size_t LISTING_OVERHEAD = 256;
+
+bool same_time(const struct timespec &a, const struct timespec &b) {
+    return a.tv_sec == b.tv_sec && a.tv_nsec == b.tv_nsec;
+}
+
+}  // namespace
+
+std::string_view DirListingCache::NameArena::intern(std::string_view name) {
+    if (BLOCK_SIZE - used < name.size()) {
+        blocks.push_back(std::make_unique<char[]>(std::max(BLOCK_SIZE, name.size())));
+        used = 0;
+    }
+
+    char *start = blocks.back().get() + used;
+    std::memcpy(start, name.data(), name.size());
+    used += name.size();
+    return {start, name.size()};
+}
+
+bool DirListingCache::Listing::matches(const struct stat &st) const {
+    return ino == st.st_ino && dev == st.st_dev && same_time(mtime, st.st_mtim) && same_time(ctime, st.st_ctim);
+}
+
+void DirListingCache::Listing::stamp(const struct stat &st) {
+    ino = st.st_ino;
+    dev = st.st_dev;
+    mtime = st.st_mtim;
+    ctime = st.st_ctim;
+}
+
+void DirListingCache::Listing::insert(std::string_view name) {
+    if (names.count(name) > 0) {
+        return;
+    }
+
+    std::string_view interned = arena.intern(name);
+    names.insert(interned);
+
+    if (!PrefixParser::is_prefixed(interned)) {
+        return;
+    }
+
+    // Sidecars usually end with the name they decorate, so the key can mostly share the interned name
+    std::string decorated = PrefixParser::get_nonprefixed(std::string(interned));
+    std::string_view key;
+    if (interned.size() >= decorated.size() &&
+        interned.compare(interned.size() - decorated.size(), decorated.size(), decorated) == 0) {
+        key = interned.substr(interned.size() - decorated.size());
+    } else {
+        key = arena.intern(decorated);
+    }
+    prefixed[key].push_back(interned);
+}
+
+void DirListingCache::Listing::erase(std::string_view name) {
+    auto it = names.find(name);
+    if (it == names.end()) {
+        return;
+    }
+
+    std::string_view interned = *it;
+    names.erase(it);
+    dead_bytes += interned.size();
+
+    if (PrefixParser::is_prefixed(interned)) {
+        auto entry = prefixed.find(PrefixParser::get_nonprefixed(std::string(interned)));
+        if (entry != prefixed.end()) {
+            auto &decorations = entry->second;
+            decorations.erase(std::remove(decorations.begin(), decorations.end(), interned), decorations.end());
+            if (decorations.empty()) {
+                prefixed.erase(entry);
+            }
+        }
+    }
+
+    compact();
+}
+
+void DirListingCache::Listing::compact() {
+    if (dead_bytes * 2 < arena.capacity()) {
+        return;
+    }
+
+    std::vector<std::string> live(names.begin(), names.end());
+    names.clear();
+    prefixed.clear();
+    arena = NameArena();
+    dead_bytes = 0;
+
+    for (const auto &name : live) {
+        insert(name);
+    }
+}
+
+size_t DirListingCache::Listing::estimate() const {
+    return LISTING_OVERHEAD + arena.capacity() + names.size() * ENTRY_OVERHEAD + prefixed.size() * ENTRY_OVERHEAD;
+}
+
+DirListingCache::DirListingCache(size_t memory_limit)
+    : memory_limit(memory_limit),
+      hits(Metrics::counter("dir_cache.hits")),
+      misses(Metrics::counter("dir_cache.misses")),
+      updates(Metrics::counter("dir_cache.updates")) {}
+
+void DirListingCache::set_memory_limit(size_t new_limit) {
+    std::lock_guard<std::mutex> lock(mutex);
+    memory_limit = new_limit;
+    shrink();
+}
+
+bool DirListingCache::enabled() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return memory_limit > 0;
+}
+
+std::string_view DirListingCache::normalize(std::string_view directory) {
+    while (!directory.empty() && directory.front() == '/') {
+        directory.remove_prefix(1);
+    }
+    while (!directory.empty() && directory.back() == '/') {
+        directory.remove_suffix(1);
+    }
+    return directory;
+}
+
+DirListingCache::Listing *DirListingCache::find(std::string_view directory, const struct stat &st) {
+    auto it = listings.find(normalize(directory));
+    if (it == listings.end()) {
+        misses.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    if (!it->second->matches(st)) {
+        // Changed behind the VFS
+        misses.fetch_add(1, std::memory_order_relaxed);
+        erase(it);
+        return nullptr;
+    }
+
+    hits.fetch_add(1, std::memory_order_relaxed);
+    recency.splice(recency.begin(), recency, it->second->position);
+    return it->second.get();
+}
+
+bool DirListingCache::names(std::string_view directory, const struct stat &st, std::vector<std::string> &names) {
+    std::lock_guard<std::mutex> lock(mutex);
+    Listing *listing = find(directory, st);
+    if (listing == nullptr) {
+        return false;
+    }
+
+    names.assign(listing->names.begin(), listing->names.end());
+    return true;
+}
+
+bool DirListingCache::prefixed(std::string_view directory, const struct stat &st, std::string_view name,
+                               std::vector<std::string> &names) {
+    std::lock_guard<std::mutex> lock(mutex);
+    Listing *listing = find(directory, st);
+    if (listing == nullptr) {
+        return false;
+    }
+
+    names.clear();
+    auto it = listing->prefixed.find(name);
+    if (it != listing->prefixed.end()) {
+        names.assign(it->second.begin(), it->second.end());
+    }
+    return true;
+}
+
+void DirListingCache::store(std::string_view directory, const struct stat &st, const std::vector<std::string> &names) {
+    auto listing = std::make_unique<Listing>();
+    listing->stamp(st);
+    for (const auto &name : names) {
+        listing->insert(name);
+    }
+    listing->memory = listing->estimate();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (listing->memory > memory_limit) {
+        return;
+    }
+
+    std::string_view key = normalize(directory);
+    auto it = listings.find(key);
+    if (it != listings.end()) {
+        erase(it);
+    }
+
+    recency.emplace_front(key);
+    listing->position = recency.begin();
+    total_memory += listing->memory;
+    listings.emplace(recency.front(), std::move(listing));
+    shrink();
+}
+
+void DirListingCache::added(std::string_view directory, std::string_view name, const struct stat &before,
+                            const struct stat &after) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = listings.find(normalize(directory));
+    if (it == listings.end()) {
+        return;
+    }
+    if (!it->second->matches(before)) {
+        // Changed behind the VFS or by a concurrent change, restamping would hide that
+        erase(it);
+        return;
+    }
+
+    updates.fetch_add(1, std::memory_order_relaxed);
+    it->second->insert(name);
+    it->second->stamp(after);
+    account(*it->second);
+}
+
+void DirListingCache::removed(std::string_view directory, std::string_view name, const struct stat &before,
+                              const struct stat &after) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = listings.find(normalize(directory));
+    if (it == listings.end()) {
+        return;
+    }
+    if (!it->second->matches(before)) {
+        // Changed behind the VFS or by a concurrent change, restamping would hide that
+        erase(it);
+        return;
+    }
+
+    updates.fetch_add(1, std::memory_order_relaxed);
+    it->second->erase(name);
+    it->second->stamp(after);
+    account(*it->second);
+}
+
+void DirListingCache::invalidate_tree(std::string_view directory) {
+    std::string_view key = normalize(directory);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto it = listings.begin(); it != listings.end();) {
+        std::string_view cached = it->first;
+        bool below = key.empty() || (cached.size() > key.size() && cached[key.size()] == '/');
+        if (cached.compare(0, key.size(), key) == 0 && (cached.size() == key.size() || below)) {
+            auto next = std::next(it);
+            erase(it);
+            it = next;
+        } else {
+            ++it;
+        }
+    }
+}
+
+void DirListingCache::account(Listing &listing) {
+    total_memory -= listing.memory;
+    listing.memory = listing.estimate();
+    total_memory += listing.memory;
+    shrink();
+}
+
+void DirListingCache::shrink() {
+    while (total_memory > memory_limit && !recency.empty()) {
+        erase(listings.find(recency.back()));
+    }
+}
+
+void DirListingCache::erase(std::unordered_map<std::string_view, std::unique_ptr<Listing>>::iterator it) {
+    total_memory -= it->second->memory;
+    auto position = it->second->position;
+    listings.erase(it);
+    recency.erase(position);
+}
+
+size_t DirListingCache::memory() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return total_memory;
+}
+
+size_t DirListingCache::size() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return listings.size();
+}
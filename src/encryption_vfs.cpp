@@ -1,7 +1,9 @@
 #include "encryption_vfs.h"
 
+#include <fcntl.h>
 #include <sodium.h>
 
+#include <cerrno>
 #include <iostream>
 #include <stack>
 
@@ -19,27 +21,38 @@ EncryptionVfs::EncryptionVfs(CustomVfs &wrapped_vfs) : VfsDecorator(wrapped_vfs)
 #endif
 }
 
-int EncryptionVfs::write(const std::string &pathname, const char *buf, size_t count, off_t offset,
+int EncryptionVfs::write(std::string_view pathname, const char *buf, size_t count, off_t offset,
                          struct fuse_file_info *fi) {
+    if (!is_hook(pathname)) {
+        return get_wrapped().write(pathname, buf, count, offset, fi);
+    }
+
+    std::string path(pathname);
     std::string content(buf, count);
 
     try {
-        if (is_hook(pathname)) {
-            if (!handle_hook(pathname, content)) {
-                Logging::Debug("Failed to handle hook for %s", pathname.c_str());
-                return -1;
-            }
-
-            Logging::Debug("Hook handled for %s", pathname.c_str());
-            return 0;
+        if (!handle_hook(path, content)) {
+            Logging::Debug("Failed to handle hook for %s", path.c_str());
+            return -1;
         }
+
+        Logging::Debug("Hook handled for %s", path.c_str());
+        return 0;
     } catch (const std::exception &e) {
         // NOTE - improvement would be to have a way to return an error to the user
-        Logging::Error("Exception on handle hook for %s - %s", pathname.c_str(), e.what());
+        Logging::Error("Exception on handle hook for %s - %s", path.c_str(), e.what());
         return -1;
     }
+}
+
+int EncryptionVfs::write_buf(std::string_view pathname, struct fuse_bufvec *buf, off_t off,
+                             struct fuse_file_info *fi) {
+    // Hooks carry their arguments in the written data, so only they need it copied into memory for write()
+    if (is_hook(pathname)) {
+        return FuseWrapper::write_buf(pathname, buf, off, fi);
+    }
 
-    return get_wrapped().write(pathname, buf, count, offset, fi);
+    return get_wrapped().write_buf(pathname, buf, off, fi);
 }
 
 bool EncryptionVfs::handle_hook(const std::string &path, const std::string &content) {
@@ -132,7 +145,9 @@ bool EncryptionVfs::handle_encryption_action(const std::string &non_prefixed, co
     return false;
 }
 
-int EncryptionVfs::open(const std::string &pathname, struct fuse_file_info *fi) {
+int EncryptionVfs::open(std::string_view pathname_view, struct fuse_file_info *fi) {
+    std::string pathname(pathname_view);
+
     try {
         if (is_encrypted(pathname)) {
             std::string key_locked = PrefixParser::apply_prefix(pathname, prefix, {"key"});
@@ -142,7 +157,12 @@ int EncryptionVfs::open(const std::string &pathname, struct fuse_file_info *fi)
                     std::string temp_unlocked_indicator = PrefixParser::apply_prefix(pathname, prefix, {"tmp"});
                     get_wrapped().mknod(temp_unlocked_indicator, 0666, 0);
 
-                    return get_wrapped().open(pathname, fi);
+                    int res = get_wrapped().open(pathname, fi);
+                    if (res == 0) {
+                        // Content of encrypted files is owned by this layer, keep their reads off the zero-copy path
+                        FileHandle::from(fi)->set_passthrough(false);
+                    }
+                    return res;
                 }
             }
         }
@@ -154,7 +174,23 @@ int EncryptionVfs::open(const std::string &pathname, struct fuse_file_info *fi)
     return get_wrapped().open(pathname, fi);
 }
 
-int EncryptionVfs::release(const std::string &pathname, struct fuse_file_info *fi) {
+int EncryptionVfs::create(std::string_view pathname, mode_t mode, struct fuse_file_info *fi) {
+    // The kernel may still send create for an existing file, e.g. after a stale negative lookup. Creating exclusively
+    // costs nothing extra in the common case and lets an existing, possibly encrypted, file go through open() instead
+    int flags = fi->flags;
+    fi->flags |= O_EXCL;
+    int res = get_wrapped().create(pathname, mode, fi);
+    fi->flags = flags;
+
+    if (res == -EEXIST && !(flags & O_EXCL)) {
+        return open(pathname, fi);
+    }
+    return res;
+}
+
+int EncryptionVfs::release(std::string_view pathname_view, struct fuse_file_info *fi) {
+    std::string pathname(pathname_view);
+
     try {
         std::string temp_unlocked_indicator = PrefixParser::apply_prefix(pathname, prefix, {"tmp"});
         if (get_wrapped().exists(temp_unlocked_indicator) &&
@@ -193,7 +229,7 @@ std::vector<std::string> EncryptionVfs::prepare_files(const std::string &filenam
     return files;
 }
 
-std::pair<std::unique_ptr<std::ifstream>, std::unique_ptr<std::ofstream>> EncryptionVfs::prepare_streams(
+std::pair<std::unique_ptr<BackendIstream>, std::unique_ptr<BackendOstream>> EncryptionVfs::prepare_streams(
     const std::string &input_file, const std::string &output_file) {
     auto input = CustomVfs::get_ifstream(input_file, std::ios::binary);
     auto output = CustomVfs::get_ofstream(output_file, std::ios::binary);
@@ -358,9 +394,6 @@ bool EncryptionVfs::get_default_key_encryptor(Encryptor &encryptor) {
     return true;
 }
 
-bool EncryptionVfs::is_hook(const std::string &basicString) {
-    if (!PrefixParser::contains_prefix(basicString, prefix)) {
-        return false;
-    }
-    return true;
+bool EncryptionVfs::is_hook(std::string_view pathname) const {
+    return PrefixParser::contains_prefix(pathname, prefix);
 }
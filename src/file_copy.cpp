@@ -0,0 +1,158 @@
+#include "file_copy.h"
+
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <memory>
+
+#include "common/metrics.h"
+
+namespace {
+
+constexpr size_t BUFFER_SIZE = 1 << 20;
+
+/// Errors which mean that an operation is not supported between the two descriptors, not that the copy failed
+bool unsupported(int error) {
+    return error == EOPNOTSUPP || error == ENOTTY || error == EXDEV || error == EINVAL || error == ENOSYS;
+}
+
+}  // namespace
+
+int FileCopy::copy(int in, int out, off_t size, Strategy *strategy) {
+    static Metrics::Counter &reflinks = Metrics::counter("copy_file.reflink");
+    static Metrics::Counter &copy_ranges = Metrics::counter("copy_file.copy_range");
+    static Metrics::Counter &read_writes = Metrics::counter("copy_file.read_write");
+    static Metrics::Counter &copied_bytes = Metrics::counter("copy_file.copied_bytes");
+    static Metrics::Counter &hole_bytes = Metrics::counter("copy_file.hole_bytes");
+
+    Strategy used = Strategy::REFLINK;
+    off_t data_bytes = 0;
+
+#ifdef FICLONE
+    bool cloned = ::ioctl(out, FICLONE, in) == 0;
+    if (!cloned && !unsupported(errno)) {
+        return -errno;
+    }
+#else
+    bool cloned = false;
+#endif
+
+    if (!cloned) {
+        used = Strategy::COPY_RANGE;
+
+        for (off_t offset = 0; offset < size;) {
+            off_t data = ::lseek(in, offset, SEEK_DATA);
+            if (data < 0 && errno == ENXIO) {
+                // Only a hole remains
+                break;
+            }
+            if (data < 0) {
+                // The filesystem does not report holes, the whole rest is data
+                data = offset;
+            }
+
+            off_t hole = ::lseek(in, data, SEEK_HOLE);
+            if (hole < 0) {
+                hole = size;
+            }
+            hole = std::min(hole, size);
+
+            int res = copy_segment(in, out, data, hole - data, used);
+            if (res < 0) {
+                return res;
+            }
+
+            data_bytes += hole - data;
+            offset = hole;
+        }
+
+        // Sets the size even if the file ends with a hole
+        if (::ftruncate(out, size) != 0) {
+            return -errno;
+        }
+    }
+
+    switch (used) {
+        case Strategy::REFLINK:
+            reflinks.fetch_add(1, std::memory_order_relaxed);
+            break;
+        case Strategy::COPY_RANGE:
+            copy_ranges.fetch_add(1, std::memory_order_relaxed);
+            break;
+        case Strategy::READ_WRITE:
+            read_writes.fetch_add(1, std::memory_order_relaxed);
+            break;
+    }
+    if (!cloned) {
+        copied_bytes.fetch_add(static_cast<uint64_t>(data_bytes), std::memory_order_relaxed);
+        hole_bytes.fetch_add(static_cast<uint64_t>(size - data_bytes), std::memory_order_relaxed);
+    }
+
+    if (strategy != nullptr) {
+        *strategy = used;
+    }
+    return 0;
+}
+
+int FileCopy::copy_segment(int in, int out, off_t offset, off_t length, Strategy &strategy) {
+    off_t in_offset = offset;
+    off_t out_offset = offset;
+    off_t remaining = length;
+
+    while (remaining > 0 && strategy == Strategy::COPY_RANGE) {
+        ssize_t copied = ::copy_file_range(in, &in_offset, out, &out_offset, static_cast<size_t>(remaining), 0);
+        if (copied < 0) {
+            if (!unsupported(errno)) {
+                return -errno;
+            }
+            strategy = Strategy::READ_WRITE;
+            break;
+        }
+        if (copied == 0) {
+            // The source shrank while being copied
+            return 0;
+        }
+        remaining -= copied;
+    }
+
+    if (remaining == 0) {
+        return 0;
+    }
+    return read_write(in, out, in_offset, remaining);
+}
+
+int FileCopy::read_write(int in, int out, off_t offset, off_t length) {
+    auto buffer = std::make_unique<char[]>(BUFFER_SIZE);
+
+    while (length > 0) {
+        ssize_t count = ::pread(in, buffer.get(), std::min<size_t>(BUFFER_SIZE, static_cast<size_t>(length)), offset);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -errno;
+        }
+        if (count == 0) {
+            return 0;
+        }
+
+        for (ssize_t written = 0; written < count;) {
+            ssize_t res = ::pwrite(out, buffer.get() + written, static_cast<size_t>(count - written), offset + written);
+            if (res < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return -errno;
+            }
+            written += res;
+        }
+
+        offset += count;
+        length -= count;
+    }
+
+    return 0;
+}
@@ -0,0 +1,44 @@
+#include "file_handle.h"
+
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+
+#include "fuse_wrapper.h"
+
+FileHandle::FileHandle(int fd, int flags) : fd_(fd), flags_(flags) {}
+
+FileHandle::~FileHandle() {
+    close();
+}
+
+int FileHandle::close() {
+    if (fd_ < 0) {
+        return 0;
+    }
+
+    int result = ::close(fd_);
+    fd_ = -1;
+
+    return result < 0 ? -errno : 0;
+}
+
+void FileHandle::attach(struct fuse_file_info *fi, std::unique_ptr<FileHandle> handle) {
+    fi->fh = reinterpret_cast<uintptr_t>(handle.release());
+}
+
+FileHandle *FileHandle::from(const struct fuse_file_info *fi) {
+    if (fi == nullptr) {
+        return nullptr;
+    }
+    return reinterpret_cast<FileHandle *>(static_cast<uintptr_t>(fi->fh));
+}
+
+std::unique_ptr<FileHandle> FileHandle::detach(struct fuse_file_info *fi) {
+    std::unique_ptr<FileHandle> handle(from(fi));
+    if (fi != nullptr) {
+        fi->fh = 0;
+    }
+    return handle;
+}
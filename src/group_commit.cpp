@@ -0,0 +1,64 @@
+#include "group_commit.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+GroupCommit::GroupCommit(int dirfd)
+    : fd(::openat(dirfd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC)),
+      requests(Metrics::counter("durability.group_requests")),
+      syncs(Metrics::counter("durability.syncfs")) {
+    if (fd < 0) {
+        throw std::runtime_error("Backing directory could not be opened for syncing: " + std::string(strerror(errno)));
+    }
+}
+
+GroupCommit::~GroupCommit() {
+    ::close(fd);
+}
+
+int GroupCommit::sync() {
+    requests.fetch_add(1, std::memory_order_relaxed);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    uint64_t ticket = ++requested;
+
+    while (completed < ticket) {
+        if (running) {
+            finished.wait(lock);
+            continue;
+        }
+
+        // Everything requested up to now is covered by a syncfs() which starts only after the requests were made
+        running = true;
+        uint64_t batch = requested;
+        lock.unlock();
+
+        int res = ::syncfs(fd) == 0 ? 0 : -errno;
+        syncs.fetch_add(1, std::memory_order_relaxed);
+
+        lock.lock();
+        running = false;
+        if (res < 0) {
+            failures.emplace(batch, Failure{completed + 1, batch - completed, res});
+        }
+        completed = batch;
+        finished.notify_all();
+    }
+
+    // Later syncfs() calls may have finished meanwhile, the result is the one of the call which covered the ticket
+    auto it = failures.lower_bound(ticket);
+    if (it == failures.end() || it->second.first > ticket) {
+        return 0;
+    }
+
+    int res = it->second.error;
+    if (--it->second.waiting == 0) {
+        failures.erase(it);
+    }
+    return res;
+}
@@ -0,0 +1,25 @@
+#include "io_engine.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+
+ssize_t SyncIoEngine::pread(const FileHandle &handle, void *buf, size_t count, off_t offset) {
+    ssize_t res = ::pread(handle.fd(), buf, count, offset);
+    return res < 0 ? -errno : res;
+}
+
+ssize_t SyncIoEngine::pwrite(const FileHandle &handle, const void *buf, size_t count, off_t offset) {
+    ssize_t res = ::pwrite(handle.fd(), buf, count, offset);
+    return res < 0 ? -errno : res;
+}
+
+int SyncIoEngine::fsync(const FileHandle &handle, bool datasync) {
+    int res = datasync ? ::fdatasync(handle.fd()) : ::fsync(handle.fd());
+    return res < 0 ? -errno : 0;
+}
+
+int SyncIoEngine::stat(int dirfd, const char *name, struct stat *st, int flags) {
+    return ::fstatat(dirfd, name, st, flags) < 0 ? -errno : 0;
+}
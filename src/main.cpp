@@ -1,11 +1,23 @@
 #include <boost/program_options.hpp>
+#include <chrono>
 #include <filesystem>
 #include <iostream>
 
+#include "cached_backend.h"
+#include "chunked_backend.h"
 #include "common/logging.h"
 #include "custom_vfs.h"
 #include "encryption_vfs.h"
+#include "fuse_lowlevel_wrapper.h"
+#include "memory_backend.h"
+#include "multi_backend.h"
+#include "packed_backend.h"
+#include "posix_backend.h"
+#include "sidecar_backend.h"
+#include "tiered_backend.h"
+#include "uring_io_engine.h"
 #include "versioning_vfs.h"
+#include "write_back_vfs.h"
 
 /**
  * Sets up options_description object.
@@ -17,6 +29,74 @@ void setup_options(boost::program_options::options_description& desc) {
          "Directory used to store the data.")                                             //
         ("config,c", boost::program_options::value<std::string>(), "configuration file")  //
         ("test,t", "Create test files inside mount directory.")                           //
+        ("lowlevel,l", "Serve requests through the inode based low-level FUSE API")        //
+        ("single-thread,s", "Serve requests from a single thread")                         //
+        ("clone-fd", "Give each worker thread its own /dev/fuse descriptor")               //
+        ("max-idle-threads",
+         boost::program_options::value<unsigned int>()->default_value(FuseWrapper::loop_config{}.max_idle_threads),
+         "Maximum number of idle worker threads")  //
+        ("max-threads", boost::program_options::value<unsigned int>()->default_value(0),
+         "Maximum number of worker threads, 0 for the FUSE default")  //
+        ("max-write", boost::program_options::value<unsigned int>()->default_value(0),
+         "Maximum size of a write request in bytes, 0 for the FUSE default")  //
+        ("max-readahead", boost::program_options::value<unsigned int>()->default_value(0),
+         "Maximum readahead in bytes, 0 for the FUSE default")  //
+        ("max-background", boost::program_options::value<unsigned int>()->default_value(0),
+         "Maximum number of pending background requests, 0 for the FUSE default")  //
+        ("congestion-threshold", boost::program_options::value<unsigned int>()->default_value(0),
+         "Number of background requests considered a congestion, 0 for the FUSE default")  //
+        ("writeback-cache", "Let the kernel cache and coalesce writes if no layer vetoes it")  //
+        ("no-async-read", "Serve reads of a file one at a time")                              //
+        ("dirfd-cache", boost::program_options::value<size_t>()->default_value(0),
+         "Number of backing parent directory descriptors kept open, 0 disables the cache")  //
+        ("attr-cache-ttl", boost::program_options::value<double>()->default_value(0),
+         "Seconds for which attributes of backing files are cached, 0 disables the cache")  //
+        ("attr-cache-size", boost::program_options::value<size_t>()->default_value(65536),
+         "Maximum number of cached attributes of backing files")  //
+        ("dir-cache-size", boost::program_options::value<size_t>()->default_value(64 << 20),
+         "Bytes of memory for cached listings of backing directories, 0 disables the cache")  //
+        ("io-engine", boost::program_options::value<std::string>()->default_value("sync"),
+         "Engine for I/O on backing files: sync or uring")  //
+        ("uring-depth", boost::program_options::value<unsigned int>()->default_value(256),
+         "Maximum number of backing requests in flight with the uring engine")  //
+        ("uring-fixed-buffers", boost::program_options::value<unsigned int>()->default_value(64),
+         "Number of registered buffers of the uring engine, 0 disables them")  //
+        ("read-ahead", boost::program_options::value<size_t>()->default_value(4 << 20),
+         "Maximum bytes prefetched ahead of a sequential reader of a file, 0 disables prefetching")  //
+        ("backend", boost::program_options::value<std::string>()->default_value("posix"),
+         "Where files are stored: posix (the backing directory), packed (the backing directory with small files "
+         "packed together), chunked (the backing directory with file data deduplicated in chunks) or memory "
+         "(discarded on unmount)")  //
+        ("pack-threshold", boost::program_options::value<size_t>()->default_value(64 << 10),
+         "Largest file in bytes which the packed backend packs")  //
+        ("chunk-size", boost::program_options::value<size_t>()->default_value(16 << 10),
+         "Average chunk size in bytes of the chunked backend")  //
+        ("extra-backing", boost::program_options::value<std::vector<std::string>>()->composing(),
+         "Further directory, usually on another disk, to spread stored files over, may be given several times")  //
+        ("placement", boost::program_options::value<std::string>()->default_value("hash"),
+         "How files are spread over the backing directories: hash (each file whole in one directory), stripe (in "
+         "stripes over all of them) or mirror (copied to all of them)")  //
+        ("stripe-size", boost::program_options::value<size_t>()->default_value(1 << 20),
+         "Bytes of a stripe with the stripe placement")  //
+        ("capacity-backing", boost::program_options::value<std::string>(),
+         "Directory on slower, larger storage to which cold files and versions are moved")  //
+        ("cold-after", boost::program_options::value<unsigned int>()->default_value(86400),
+         "Seconds without accesses after which a file is moved to the capacity backing directory")  //
+        ("promote-after", boost::program_options::value<unsigned int>()->default_value(3),
+         "Opens of a cold file within --cold-after seconds which move it back to the backing directory")  //
+        ("migration-rate", boost::program_options::value<size_t>()->default_value(32 << 20),
+         "Bytes per second moved between the backing directories at most, 0 for no limit")  //
+        ("sidecar-layout", boost::program_options::value<std::string>()->default_value("flat"),
+         "Where versions, keys and other sidecar files are kept: flat (next to their files) or sharded (in a hashed "
+         "metadata tree, so that directories only hold user files)")  //
+        ("block-cache", boost::program_options::value<size_t>()->default_value(0),
+         "Bytes of file blocks kept in memory for repeated reads, 0 disables the cache")  //
+        ("block-cache-block", boost::program_options::value<size_t>()->default_value(CachedBackend::DEFAULT_BLOCK_SIZE),
+         "Bytes of a block of the block cache")  //
+        ("durability", boost::program_options::value<std::string>()->default_value("fsync"),
+         "When written data is made durable: none, fsync, group (concurrent fsyncs share one syncfs) or close")  //
+        ("write-back-buffer", boost::program_options::value<size_t>()->default_value(0),
+         "Bytes of small writes coalesced per open file before they are passed on, 0 disables buffering")  //
         ("fuse-args,f", boost::program_options::value<std::string>()->default_value(""), "FUSE arguments");
 }
 
@@ -102,6 +182,224 @@ std::vector<char*> prepare_fuse_arguments(const std::string& fuse_arg_str, const
     return fuse_argv;
 }
 
+/**
+ * Applies the event loop options and reports the resulting configuration.
+ */
+void configure_loop(const boost::program_options::variables_map& vm, FuseWrapper::loop_config& loop) {
+    loop.multithreaded = vm.count("single-thread") == 0;
+    loop.clone_fd = vm.count("clone-fd") > 0;
+    loop.max_idle_threads = vm["max-idle-threads"].as<unsigned int>();
+    loop.max_threads = vm["max-threads"].as<unsigned int>();
+
+    Logging::Info("Event loop: %s, clone_fd %s, max idle threads %u, max threads %u",
+                  loop.multithreaded ? "multithreaded" : "single threaded", loop.clone_fd ? "on" : "off",
+                  loop.max_idle_threads, loop.max_threads);
+
+#if FUSE_VERSION < 30
+    if (loop.clone_fd || loop.max_threads > 0 || loop.max_idle_threads != FuseWrapper::loop_config{}.max_idle_threads) {
+        Logging::Warn("clone_fd and worker limits require libfuse 3, they are ignored");
+    }
+#elif FUSE_USE_VERSION < 32
+    if (loop.max_threads > 0 || loop.max_idle_threads != FuseWrapper::loop_config{}.max_idle_threads) {
+        Logging::Warn("worker limits require FUSE_USE_VERSION 32, they are ignored");
+    }
+#elif FUSE_USE_VERSION < 312
+    if (loop.max_threads > 0) {
+        Logging::Warn("max threads requires FUSE_USE_VERSION 312, it is ignored");
+    }
+#endif
+}
+
+/**
+ * Reads the connection tuning options.
+ */
+CustomVfs::ConnectionSettings connection_settings(const boost::program_options::variables_map& vm) {
+    CustomVfs::ConnectionSettings settings;
+    settings.max_write = vm["max-write"].as<unsigned int>();
+    settings.max_readahead = vm["max-readahead"].as<unsigned int>();
+    settings.max_background = vm["max-background"].as<unsigned int>();
+    settings.congestion_threshold = vm["congestion-threshold"].as<unsigned int>();
+    settings.async_read = vm.count("no-async-read") == 0;
+    settings.writeback_cache = vm.count("writeback-cache") > 0;
+    return settings;
+}
+
+/**
+ * Reads the durability mode, unknown names fall back to the default.
+ */
+CustomVfs::Durability durability(const boost::program_options::variables_map& vm) {
+    std::string mode = vm["durability"].as<std::string>();
+    if (mode == "none") {
+        return CustomVfs::Durability::NONE;
+    }
+    if (mode == "group") {
+        return CustomVfs::Durability::GROUP;
+    }
+    if (mode == "close") {
+        return CustomVfs::Durability::CLOSE;
+    }
+    if (mode != "fsync") {
+        Logging::Warn("Unknown durability mode %s, using fsync", mode.c_str());
+    }
+    return CustomVfs::Durability::FSYNC;
+}
+
+/**
+ * Creates the I/O engine selected by the options, falls back to blocking syscalls if io_uring is not available.
+ */
+std::shared_ptr<IoEngine> io_engine(const boost::program_options::variables_map& vm) {
+    std::string engine = vm["io-engine"].as<std::string>();
+    if (engine == "uring") {
+        UringIoEngine::Settings settings;
+        settings.queue_depth = vm["uring-depth"].as<unsigned int>();
+        settings.fixed_buffers = vm["uring-fixed-buffers"].as<unsigned int>();
+
+        try {
+            auto uring = std::make_shared<UringIoEngine>(settings);
+            Logging::Info("I/O engine: io_uring, queue depth %u", settings.queue_depth);
+            return uring;
+        } catch (const std::runtime_error& e) {
+            Logging::Warn("%s, using blocking I/O", e.what());
+        }
+    } else if (engine != "sync") {
+        Logging::Warn("Unknown I/O engine %s, using blocking I/O", engine.c_str());
+    }
+
+    return std::make_shared<SyncIoEngine>();
+}
+
+/**
+ * Reads how files are spread over several backing directories, unknown names fall back to the default.
+ */
+MultiBackend::Placement placement(const boost::program_options::variables_map& vm) {
+    std::string placement = vm["placement"].as<std::string>();
+    if (placement == "stripe") {
+        return MultiBackend::Placement::STRIPE;
+    }
+    if (placement == "mirror") {
+        return MultiBackend::Placement::MIRROR;
+    }
+    if (placement != "hash") {
+        Logging::Warn("Unknown placement %s, storing each file in one directory", placement.c_str());
+    }
+    return MultiBackend::Placement::HASH;
+}
+
+/**
+ * Creates the store of the backing directory, spread over the extra backing directories if there are any.
+ */
+std::shared_ptr<StorageBackend> backing_store(const boost::program_options::variables_map& vm,
+                                              const std::string& backing) {
+    std::vector<std::string> directories{backing};
+    if (vm.count("extra-backing")) {
+        for (const auto& extra : vm["extra-backing"].as<std::vector<std::string>>()) {
+            directories.push_back(std::filesystem::absolute(extra).lexically_normal().string());
+            std::filesystem::create_directories(directories.back());
+        }
+    }
+
+    std::shared_ptr<IoEngine> engine = io_engine(vm);
+    std::vector<std::shared_ptr<StorageBackend>> devices;
+    for (const auto& directory : directories) {
+        auto posix = std::make_shared<PosixBackend>(directory);
+        posix->set_parent_cache_size(vm["dirfd-cache"].as<size_t>());
+        posix->set_io_engine(engine);
+        devices.push_back(posix);
+    }
+    if (devices.size() == 1) {
+        return devices[0];
+    }
+
+    Logging::Info("Spreading files over %zu backing directories", devices.size());
+    return std::make_shared<MultiBackend>(devices, placement(vm), vm["stripe-size"].as<size_t>());
+}
+
+/**
+ * Puts a capacity tier behind the store of the backing directory if a capacity backing directory is given.
+ */
+std::shared_ptr<StorageBackend> tiered_store(const boost::program_options::variables_map& vm,
+                                             std::shared_ptr<StorageBackend> store) {
+    if (!vm.count("capacity-backing")) {
+        return store;
+    }
+
+    auto directory = std::filesystem::absolute(vm["capacity-backing"].as<std::string>()).lexically_normal().string();
+    std::filesystem::create_directories(directory);
+    auto capacity = std::make_shared<PosixBackend>(directory);
+    capacity->set_parent_cache_size(vm["dirfd-cache"].as<size_t>());
+    capacity->set_io_engine(io_engine(vm));
+
+    TieredBackend::Settings settings;
+    settings.cold_after = std::chrono::seconds(vm["cold-after"].as<unsigned int>());
+    settings.promote_after = vm["promote-after"].as<unsigned int>();
+    settings.rate = vm["migration-rate"].as<size_t>();
+
+    // Packs and chunks are written to the backing directory by the packed and chunked backends themselves
+    settings.pinned = {std::string("/") + PackedBackend::PACK_DIRECTORY,
+                       std::string("/") + ChunkedBackend::CHUNK_DIRECTORY};
+
+    Logging::Info("Moving files not accessed for %u seconds to %s", vm["cold-after"].as<unsigned int>(),
+                  directory.c_str());
+    return std::make_shared<TieredBackend>(std::move(store), capacity, settings);
+}
+
+/**
+ * Creates the storage backend selected by the options.
+ */
+std::shared_ptr<StorageBackend> create_backend(const boost::program_options::variables_map& vm,
+                                               const std::string& mountpoint) {
+    std::string backend = vm["backend"].as<std::string>();
+    if (backend == "memory") {
+        if (vm.count("extra-backing") || vm.count("capacity-backing")) {
+            Logging::Warn("The memory backend does not use the extra or capacity backing directories");
+        }
+        Logging::Info("Storing files in memory, they are lost on unmount");
+        return std::make_shared<MemoryBackend>();
+    }
+    if (backend != "posix" && backend != "packed" && backend != "chunked") {
+        Logging::Warn("Unknown backend %s, using the backing directory", backend.c_str());
+    }
+
+    std::string backing = CustomVfs::backing_directory(vm["backing"].as<std::string>(), mountpoint);
+    std::shared_ptr<StorageBackend> store = tiered_store(vm, backing_store(vm, backing));
+
+    if (backend == "packed") {
+        size_t threshold = vm["pack-threshold"].as<size_t>();
+        Logging::Info("Packing files up to %zu bytes", threshold);
+        return std::make_shared<PackedBackend>(store, backing + "/" + PackedBackend::PACK_DIRECTORY, threshold);
+    }
+    if (backend == "chunked") {
+        size_t average = vm["chunk-size"].as<size_t>();
+        Logging::Info("Deduplicating file data in chunks of %zu bytes on average", average);
+        return std::make_shared<ChunkedBackend>(store, backing + "/" + ChunkedBackend::CHUNK_DIRECTORY, average);
+    }
+    return store;
+}
+
+/**
+ * Creates the innermost VFS storing files in the backend, with the sidecar layout and block cache selected by the
+ * options.
+ */
+std::unique_ptr<CustomVfs> create_vfs(const boost::program_options::variables_map& vm, const std::string& mountpoint) {
+    std::shared_ptr<StorageBackend> backend = create_backend(vm, mountpoint);
+
+    std::string layout = vm["sidecar-layout"].as<std::string>();
+    if (layout == "sharded") {
+        Logging::Info("Keeping sidecar files in a sharded metadata tree");
+        backend = std::make_shared<SidecarBackend>(backend);
+    } else if (layout != "flat") {
+        Logging::Warn("Unknown sidecar layout %s, keeping sidecars next to their files", layout.c_str());
+    }
+
+    size_t cache_size = vm["block-cache"].as<size_t>();
+    if (cache_size > 0) {
+        size_t block_size = std::max<size_t>(vm["block-cache-block"].as<size_t>(), 4096);
+        Logging::Info("Caching up to %zu bytes of file data in blocks of %zu bytes", cache_size, block_size);
+        backend = std::make_shared<CachedBackend>(backend, cache_size, block_size);
+    }
+    return std::make_unique<CustomVfs>(mountpoint, backend);
+}
+
 /// VFS entry point
 int main(int argc, char* argv[]) {
     boost::program_options::variables_map vm;
@@ -121,11 +419,20 @@ int main(int argc, char* argv[]) {
         Logging::Info("Sorry, config is not implemented yet.");
     }
 
-    std::string backing_dir = vm["backing"].as<std::string>();
-
-    CustomVfs custom_vfs(mountpoint, backing_dir);
+    std::unique_ptr<CustomVfs> innermost = create_vfs(vm, mountpoint);
+    CustomVfs& custom_vfs = *innermost;
+    custom_vfs.set_connection_settings(connection_settings(vm));
+    auto attr_cache_ttl = std::chrono::duration<double>(vm["attr-cache-ttl"].as<double>());
+    custom_vfs.set_attr_cache(std::chrono::duration_cast<std::chrono::nanoseconds>(attr_cache_ttl),
+                              vm["attr-cache-size"].as<size_t>());
+    custom_vfs.set_dir_cache_size(vm["dir-cache-size"].as<size_t>());
+    custom_vfs.set_read_ahead(vm["read-ahead"].as<size_t>());
+    custom_vfs.set_durability(durability(vm));
     VersioningVfs versioned(custom_vfs);
     EncryptionVfs encrypted(versioned);
+    WriteBackVfs buffered(encrypted, vm["write-back-buffer"].as<size_t>());
+
+    configure_loop(vm, buffered.loop);
 
     std::string fuse_args;
     if (vm.count("fuse-args")) {
@@ -133,7 +440,12 @@ int main(int argc, char* argv[]) {
     }
 
     auto fuse_argv = prepare_fuse_arguments(fuse_args, mountpoint, argv[0]);
-    encrypted.main(static_cast<int>(fuse_argv.size()), fuse_argv.data());
+    if (vm.count("lowlevel")) {
+        FuseLowlevelWrapper lowlevel(buffered);
+        lowlevel.main(static_cast<int>(fuse_argv.size()), fuse_argv.data());
+    } else {
+        buffered.main(static_cast<int>(fuse_argv.size()), fuse_argv.data());
+    }
 
     return 0;
 }
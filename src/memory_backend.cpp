@@ -0,0 +1,884 @@
+#include "memory_backend.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <ctime>
+
+#include "common/metrics.h"
+
+namespace {
+
+/// Symbolic links followed while resolving a single path, like MAXSYMLINKS of Linux
+constexpr int MAX_SYMLINK_DEPTH = 40;
+
+constexpr blksize_t BLOCK_SIZE = 4096;
+
+/// Removes trailing slashes which do not change what a path refers to
+std::string_view trim_path(std::string_view path) {
+    while (!path.empty() && path.back() == '/') {
+        path.remove_suffix(1);
+    }
+    return path;
+}
+
+/// Takes the next component of a path, skipping separators and "." components
+std::string_view next_component(std::string_view &path) {
+    while (!path.empty()) {
+        size_t start = path.find_first_not_of('/');
+        if (start == std::string_view::npos) {
+            path = {};
+            break;
+        }
+        path.remove_prefix(start);
+
+        size_t end = path.find('/');
+        std::string_view component = path.substr(0, end);
+        path.remove_prefix(end == std::string_view::npos ? path.size() : end);
+        if (component != ".") {
+            return component;
+        }
+    }
+    return {};
+}
+
+bool is_writable(int flags) {
+    return (flags & O_ACCMODE) != O_RDONLY;
+}
+
+bool is_readable(int flags) {
+    return (flags & O_ACCMODE) != O_WRONLY;
+}
+
+}  // namespace
+
+/// Open file of the memory backend, the inode stays alive while the file is open even after it is unlinked
+class MemoryBackend::Handle : public FileHandle {
+public:
+    Handle(int flags, std::shared_ptr<Inode> inode) : FileHandle(-1, flags), inode(std::move(inode)) {
+        set_passthrough(false);
+    }
+
+    std::shared_ptr<Inode> inode;
+};
+
+/// Open directory of the memory backend, entries are captured when it is opened
+class MemoryBackend::Listing : public DirHandle {
+public:
+    struct Entry {
+        std::string name;
+        std::shared_ptr<Inode> inode;
+    };
+
+    Listing() : DirHandle(nullptr) {}
+
+    std::vector<Entry> entries;
+};
+
+MemoryBackend::Inode::Inode(ino_t ino, mode_t mode, std::atomic<size_t> &usage) : type(mode & S_IFMT), usage(usage) {
+    attr.st_ino = ino;
+    attr.st_mode = mode;
+    attr.st_nlink = S_ISDIR(mode) ? 2 : 1;
+    attr.st_uid = ::getuid();
+    attr.st_gid = ::getgid();
+    attr.st_blksize = BLOCK_SIZE;
+    attr.st_size = S_ISDIR(mode) ? BLOCK_SIZE : 0;
+    attr.st_atim = attr.st_mtim = attr.st_ctim = MemoryBackend::now();
+}
+
+MemoryBackend::Inode::~Inode() {
+    usage.fetch_sub(allocated, std::memory_order_relaxed);
+}
+
+MemoryBackend::MemoryBackend() : root(make_inode(S_IFDIR | 0755)) {}
+
+std::mutex &MemoryBackend::stripe(const Inode &inode) const {
+    return stripes[inode.attr.st_ino % STRIPES];
+}
+
+struct timespec MemoryBackend::now() {
+    struct timespec time {};
+    ::clock_gettime(CLOCK_REALTIME, &time);
+    return time;
+}
+
+std::shared_ptr<MemoryBackend::Inode> MemoryBackend::make_inode(mode_t mode) {
+    return std::make_shared<Inode>(next_ino.fetch_add(1, std::memory_order_relaxed), mode, usage);
+}
+
+int MemoryBackend::resolve(const std::shared_ptr<Inode> &start, std::string_view path, bool follow,
+                           std::shared_ptr<Inode> &inode, int depth) const {
+    std::shared_ptr<Inode> current = start;
+
+    while (true) {
+        std::string_view component = next_component(path);
+        if (component.empty()) {
+            inode = std::move(current);
+            return 0;
+        }
+        if (component.size() > NAME_MAX) {
+            return -ENAMETOOLONG;
+        }
+        if (current->type != S_IFDIR) {
+            return -ENOTDIR;
+        }
+
+        auto it = current->entries.find(component);
+        if (it == current->entries.end()) {
+            return -ENOENT;
+        }
+
+        std::shared_ptr<Inode> next = it->second;
+        bool last = trim_path(path).empty();
+        if (next->type == S_IFLNK && (follow || !last)) {
+            if (depth >= MAX_SYMLINK_DEPTH) {
+                return -ELOOP;
+            }
+
+            // Absolute targets are paths within the store, relative ones start in the directory of the link
+            const std::shared_ptr<Inode> &base = next->target.front() == '/' ? root : current;
+            int res = resolve(base, next->target, true, next, depth + 1);
+            if (res < 0) {
+                return res;
+            }
+        }
+        current = std::move(next);
+    }
+}
+
+int MemoryBackend::resolve_parent(std::string_view path, std::shared_ptr<Inode> &parent, std::string &name) const {
+    path = trim_path(path);
+    size_t slash = path.rfind('/');
+    std::string_view leaf = slash == std::string_view::npos ? path : path.substr(slash + 1);
+    if (leaf.empty() || leaf == "." || leaf == "..") {
+        // The root and dot entries cannot be created, removed or renamed
+        return -EBUSY;
+    }
+    if (leaf.size() > NAME_MAX) {
+        return -ENAMETOOLONG;
+    }
+
+    int res = resolve(root, slash == std::string_view::npos ? std::string_view() : path.substr(0, slash), true, parent);
+    if (res < 0) {
+        return res;
+    }
+    if (parent->type != S_IFDIR) {
+        return -ENOTDIR;
+    }
+
+    name = leaf;
+    return 0;
+}
+
+void MemoryBackend::insert_entry(Inode &parent, const std::string &name, std::shared_ptr<Inode> inode) {
+    bool is_directory = inode->type == S_IFDIR;
+    parent.entries[name] = std::move(inode);
+
+    std::lock_guard<std::mutex> lock(stripe(parent));
+    if (is_directory) {
+        parent.attr.st_nlink++;
+    }
+    parent.attr.st_mtim = parent.attr.st_ctim = now();
+}
+
+void MemoryBackend::erase_entry(Inode &parent, const std::string &name) {
+    auto it = parent.entries.find(name);
+    if (it == parent.entries.end()) {
+        return;
+    }
+    bool is_directory = it->second->type == S_IFDIR;
+    parent.entries.erase(it);
+
+    std::lock_guard<std::mutex> lock(stripe(parent));
+    if (is_directory) {
+        parent.attr.st_nlink--;
+    }
+    parent.attr.st_mtim = parent.attr.st_ctim = now();
+}
+
+void MemoryBackend::add_links(Inode &inode, int links) {
+    std::lock_guard<std::mutex> lock(stripe(inode));
+    inode.attr.st_nlink += links;
+    inode.attr.st_ctim = now();
+}
+
+ssize_t MemoryBackend::read_data(const Inode &inode, char *buf, size_t count, off_t offset) {
+    if (offset >= inode.attr.st_size) {
+        return 0;
+    }
+    count = std::min(count, static_cast<size_t>(inode.attr.st_size - offset));
+    off_t end = offset + static_cast<off_t>(count);
+
+    auto it = inode.extents.upper_bound(offset);
+    if (it != inode.extents.begin()) {
+        --it;
+    }
+
+    // Ranges between extents are holes and read as zeros
+    off_t position = offset;
+    for (; it != inode.extents.end() && it->first < end; ++it) {
+        off_t from = std::max(offset, it->first);
+        off_t to = std::min(end, it->first + static_cast<off_t>(it->second.size()));
+        if (from >= to) {
+            continue;
+        }
+
+        std::memset(buf + (position - offset), 0, from - position);
+        std::memcpy(buf + (from - offset), it->second.data() + (from - it->first), to - from);
+        position = to;
+    }
+    std::memset(buf + (position - offset), 0, end - position);
+
+    return static_cast<ssize_t>(count);
+}
+
+void MemoryBackend::write_data(Inode &inode, const char *data, size_t count, off_t offset) {
+    auto &extents = inode.extents;
+    size_t allocated = inode.allocated;
+    off_t position = offset;
+    off_t end = offset + static_cast<off_t>(count);
+
+    auto it = extents.upper_bound(position);
+    if (it != extents.begin() && std::prev(it)->first + static_cast<off_t>(std::prev(it)->second.size()) > position) {
+        --it;
+    }
+
+    while (position < end) {
+        const char *source = data + (position - offset);
+
+        // Overwrite the part covered by an existing extent
+        if (it != extents.end() && it->first <= position) {
+            off_t to = std::min(end, it->first + static_cast<off_t>(it->second.size()));
+            std::memcpy(it->second.data() + (position - it->first), source, to - position);
+            position = to;
+            ++it;
+            continue;
+        }
+
+        off_t gap_end = it == extents.end() ? end : std::min(end, it->first);
+
+        // Appending to the extent right before the gap keeps sequentially written files in few extents
+        if (it != extents.begin()) {
+            auto &previous = *std::prev(it);
+            if (previous.first + static_cast<off_t>(previous.second.size()) == position &&
+                previous.second.size() < MAX_EXTENT) {
+                size_t length = std::min(static_cast<size_t>(gap_end - position), MAX_EXTENT - previous.second.size());
+                previous.second.insert(previous.second.end(), source, source + length);
+                allocated += length;
+                position += static_cast<off_t>(length);
+                continue;
+            }
+        }
+
+        size_t length = std::min(static_cast<size_t>(gap_end - position), MAX_EXTENT);
+        it = std::next(extents.emplace_hint(it, position, std::vector<char>(source, source + length)));
+        allocated += length;
+        position += static_cast<off_t>(length);
+    }
+
+    inode.attr.st_size = std::max(inode.attr.st_size, end);
+    account(inode, allocated);
+}
+
+void MemoryBackend::truncate_data(Inode &inode, off_t length) {
+    auto &extents = inode.extents;
+    size_t allocated = inode.allocated;
+
+    auto it = extents.lower_bound(length);
+    for (auto erased = it; erased != extents.end(); ++erased) {
+        allocated -= erased->second.size();
+    }
+    extents.erase(it, extents.end());
+
+    if (!extents.empty()) {
+        auto &last = *extents.rbegin();
+        off_t last_end = last.first + static_cast<off_t>(last.second.size());
+        if (last_end > length) {
+            allocated -= static_cast<size_t>(last_end - length);
+            last.second.resize(static_cast<size_t>(length - last.first));
+            last.second.shrink_to_fit();
+        }
+    }
+
+    inode.attr.st_size = length;
+    account(inode, allocated);
+}
+
+void MemoryBackend::account(Inode &inode, size_t allocated) {
+    if (allocated >= inode.allocated) {
+        inode.usage.fetch_add(allocated - inode.allocated, std::memory_order_relaxed);
+    } else {
+        inode.usage.fetch_sub(inode.allocated - allocated, std::memory_order_relaxed);
+    }
+    inode.allocated = allocated;
+    inode.attr.st_blocks = static_cast<blkcnt_t>((allocated + 511) / 512);
+}
+
+int MemoryBackend::open(std::string_view path, int flags, mode_t mode, std::unique_ptr<FileHandle> &handle) {
+    std::shared_ptr<Inode> inode;
+
+    if (flags & O_CREAT) {
+        std::unique_lock<std::shared_mutex> lock(tree);
+        std::shared_ptr<Inode> parent;
+        std::string name;
+        int res = resolve_parent(path, parent, name);
+        if (res < 0) {
+            return res;
+        }
+
+        auto it = parent->entries.find(name);
+        if (it == parent->entries.end()) {
+            inode = make_inode(S_IFREG | (mode & 07777));
+            insert_entry(*parent, name, inode);
+        } else if (flags & O_EXCL) {
+            return -EEXIST;
+        } else if ((res = resolve(root, path, true, inode)) < 0) {
+            return res;
+        }
+    } else {
+        std::shared_lock<std::shared_mutex> lock(tree);
+        int res = resolve(root, path, true, inode);
+        if (res < 0) {
+            return res;
+        }
+    }
+
+    if ((flags & O_DIRECTORY) && inode->type != S_IFDIR) {
+        return -ENOTDIR;
+    }
+    if (inode->type == S_IFDIR && is_writable(flags)) {
+        return -EISDIR;
+    }
+
+    if ((flags & O_TRUNC) && is_writable(flags) && inode->type == S_IFREG) {
+        std::lock_guard<std::mutex> lock(stripe(*inode));
+        truncate_data(*inode, 0);
+        inode->attr.st_mtim = inode->attr.st_ctim = now();
+    }
+
+    handle = std::make_unique<Handle>(flags, std::move(inode));
+    return 0;
+}
+
+ssize_t MemoryBackend::pread(FileHandle &handle, void *buf, size_t count, off_t offset) {
+    auto &file = static_cast<Handle &>(handle);
+    if (!is_readable(file.flags())) {
+        return -EBADF;
+    }
+    if (file.inode->type == S_IFDIR) {
+        return -EISDIR;
+    }
+    if (offset < 0) {
+        return -EINVAL;
+    }
+
+    std::lock_guard<std::mutex> lock(stripe(*file.inode));
+    return read_data(*file.inode, static_cast<char *>(buf), count, offset);
+}
+
+ssize_t MemoryBackend::pwrite(FileHandle &handle, const void *buf, size_t count, off_t offset) {
+    auto &file = static_cast<Handle &>(handle);
+    if (!is_writable(file.flags())) {
+        return -EBADF;
+    }
+    if (offset < 0) {
+        return -EINVAL;
+    }
+
+    std::lock_guard<std::mutex> lock(stripe(*file.inode));
+    if (file.flags() & O_APPEND) {
+        offset = file.inode->attr.st_size;
+    }
+    write_data(*file.inode, static_cast<const char *>(buf), count, offset);
+    file.inode->attr.st_mtim = file.inode->attr.st_ctim = now();
+    return static_cast<ssize_t>(count);
+}
+
+int MemoryBackend::ftruncate(FileHandle &handle, off_t length) {
+    auto &file = static_cast<Handle &>(handle);
+    if (!is_writable(file.flags()) || file.inode->type != S_IFREG || length < 0) {
+        return -EINVAL;
+    }
+
+    std::lock_guard<std::mutex> lock(stripe(*file.inode));
+    truncate_data(*file.inode, length);
+    file.inode->attr.st_mtim = file.inode->attr.st_ctim = now();
+    return 0;
+}
+
+int MemoryBackend::fsync(FileHandle &handle, bool datasync) {
+    return 0;
+}
+
+int MemoryBackend::release(FileHandle &handle) {
+    return 0;
+}
+
+int MemoryBackend::fstat(FileHandle &handle, struct stat *st) {
+    auto &file = static_cast<Handle &>(handle);
+    std::lock_guard<std::mutex> lock(stripe(*file.inode));
+    *st = file.inode->attr;
+    return 0;
+}
+
+int MemoryBackend::truncate(std::string_view path, off_t length) {
+    std::shared_lock<std::shared_mutex> lock(tree);
+    std::shared_ptr<Inode> inode;
+    int res = resolve(root, path, true, inode);
+    if (res < 0) {
+        return res;
+    }
+    if (inode->type == S_IFDIR) {
+        return -EISDIR;
+    }
+    if (inode->type != S_IFREG || length < 0) {
+        return -EINVAL;
+    }
+
+    std::lock_guard<std::mutex> data_lock(stripe(*inode));
+    truncate_data(*inode, length);
+    inode->attr.st_mtim = inode->attr.st_ctim = now();
+    return 0;
+}
+
+int MemoryBackend::copy(std::string_view source, std::string_view destination) {
+    std::unique_lock<std::shared_mutex> lock(tree);
+    std::shared_ptr<Inode> original;
+    int res = resolve(root, source, true, original);
+    if (res < 0) {
+        return res;
+    }
+    if (original->type == S_IFDIR) {
+        return -EISDIR;
+    }
+
+    std::shared_ptr<Inode> parent;
+    std::string name;
+    if ((res = resolve_parent(destination, parent, name)) < 0) {
+        return res;
+    }
+    if (parent->entries.count(name) > 0) {
+        return -EEXIST;
+    }
+
+    // The copy is not linked yet, so only the original needs its lock
+    std::shared_ptr<Inode> inode;
+    {
+        std::lock_guard<std::mutex> data_lock(stripe(*original));
+        inode = make_inode(S_IFREG | (original->attr.st_mode & 07777));
+        inode->extents = original->extents;
+        inode->attr.st_size = original->attr.st_size;
+        account(*inode, original->allocated);
+    }
+
+    Metrics::counter("copy_file.copied_bytes").fetch_add(inode->allocated, std::memory_order_relaxed);
+    insert_entry(*parent, name, std::move(inode));
+    return 0;
+}
+
+int MemoryBackend::stat(std::string_view path, struct stat *st, bool follow) {
+    std::shared_lock<std::shared_mutex> lock(tree);
+    std::shared_ptr<Inode> inode;
+    int res = resolve(root, path, follow, inode);
+    if (res < 0) {
+        return res;
+    }
+
+    std::lock_guard<std::mutex> data_lock(stripe(*inode));
+    *st = inode->attr;
+    return 0;
+}
+
+int MemoryBackend::utimens(std::string_view path, const struct timespec tv[2]) {
+    std::shared_lock<std::shared_mutex> lock(tree);
+    std::shared_ptr<Inode> inode;
+    int res = resolve(root, path, false, inode);
+    if (res < 0) {
+        return res;
+    }
+
+    struct timespec current = now();
+    auto pick = [&current, tv](int index, const struct timespec &old) {
+        if (tv == nullptr || tv[index].tv_nsec == UTIME_NOW) {
+            return current;
+        }
+        return tv[index].tv_nsec == UTIME_OMIT ? old : tv[index];
+    };
+
+    std::lock_guard<std::mutex> data_lock(stripe(*inode));
+    inode->attr.st_atim = pick(0, inode->attr.st_atim);
+    inode->attr.st_mtim = pick(1, inode->attr.st_mtim);
+    inode->attr.st_ctim = current;
+    return 0;
+}
+
+int MemoryBackend::chmod(std::string_view path, mode_t mode) {
+    std::shared_lock<std::shared_mutex> lock(tree);
+    std::shared_ptr<Inode> inode;
+    int res = resolve(root, path, true, inode);
+    if (res < 0) {
+        return res;
+    }
+
+    std::lock_guard<std::mutex> data_lock(stripe(*inode));
+    inode->attr.st_mode = inode->type | (mode & 07777);
+    inode->attr.st_ctim = now();
+    return 0;
+}
+
+int MemoryBackend::chown(std::string_view path, uid_t uid, gid_t gid) {
+    std::shared_lock<std::shared_mutex> lock(tree);
+    std::shared_ptr<Inode> inode;
+    int res = resolve(root, path, false, inode);
+    if (res < 0) {
+        return res;
+    }
+
+    std::lock_guard<std::mutex> data_lock(stripe(*inode));
+    if (uid != static_cast<uid_t>(-1)) {
+        inode->attr.st_uid = uid;
+    }
+    if (gid != static_cast<gid_t>(-1)) {
+        inode->attr.st_gid = gid;
+    }
+    inode->attr.st_ctim = now();
+    return 0;
+}
+
+int MemoryBackend::statfs(struct statvfs *stbuf) {
+    *stbuf = {};
+    stbuf->f_bsize = BLOCK_SIZE;
+    stbuf->f_frsize = BLOCK_SIZE;
+    stbuf->f_namemax = NAME_MAX;
+
+    // The store can grow as long as there is memory left
+    long page_size = ::sysconf(_SC_PAGESIZE);
+    long free_pages = ::sysconf(_SC_AVPHYS_PAGES);
+    fsblkcnt_t free_blocks = free_pages > 0 ? static_cast<fsblkcnt_t>(free_pages) * page_size / BLOCK_SIZE : 0;
+    fsblkcnt_t used_blocks = (memory_usage() + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+    stbuf->f_blocks = used_blocks + free_blocks;
+    stbuf->f_bfree = free_blocks;
+    stbuf->f_bavail = free_blocks;
+    stbuf->f_files = next_ino.load(std::memory_order_relaxed) + free_blocks;
+    stbuf->f_ffree = free_blocks;
+    stbuf->f_favail = free_blocks;
+    return 0;
+}
+
+int MemoryBackend::mknod(std::string_view path, mode_t mode, dev_t dev) {
+    mode_t type = mode & S_IFMT;
+    if (type == 0) {
+        type = S_IFREG;
+    }
+    if (type == S_IFDIR || type == S_IFLNK) {
+        return -EINVAL;
+    }
+
+    std::unique_lock<std::shared_mutex> lock(tree);
+    std::shared_ptr<Inode> parent;
+    std::string name;
+    int res = resolve_parent(path, parent, name);
+    if (res < 0) {
+        return res;
+    }
+    if (parent->entries.count(name) > 0) {
+        return -EEXIST;
+    }
+
+    auto inode = make_inode(type | (mode & 07777));
+    inode->attr.st_rdev = dev;
+    insert_entry(*parent, name, std::move(inode));
+    return 0;
+}
+
+int MemoryBackend::rename(std::string_view oldpath, std::string_view newpath, unsigned int flags) {
+    if (flags & ~(RENAME_NOREPLACE | RENAME_EXCHANGE)) {
+        return -EINVAL;
+    }
+    if ((flags & RENAME_NOREPLACE) && (flags & RENAME_EXCHANGE)) {
+        return -EINVAL;
+    }
+
+    std::unique_lock<std::shared_mutex> lock(tree);
+    std::shared_ptr<Inode> old_parent;
+    std::shared_ptr<Inode> new_parent;
+    std::string old_name;
+    std::string new_name;
+    int res = resolve_parent(oldpath, old_parent, old_name);
+    if (res < 0 || (res = resolve_parent(newpath, new_parent, new_name)) < 0) {
+        return res;
+    }
+
+    auto old_it = old_parent->entries.find(old_name);
+    if (old_it == old_parent->entries.end()) {
+        return -ENOENT;
+    }
+    std::shared_ptr<Inode> moved = old_it->second;
+
+    auto new_it = new_parent->entries.find(new_name);
+    std::shared_ptr<Inode> replaced = new_it == new_parent->entries.end() ? nullptr : new_it->second;
+
+    // A directory cannot be moved below itself, paths of the VFS are canonical so comparing them is enough
+    std::string_view old_trimmed = trim_path(oldpath);
+    std::string_view new_trimmed = trim_path(newpath);
+    auto below = [](std::string_view path, std::string_view directory) {
+        return path.size() > directory.size() && path.substr(0, directory.size()) == directory &&
+               path[directory.size()] == '/';
+    };
+
+    if (flags & RENAME_EXCHANGE) {
+        if (replaced == nullptr) {
+            return -ENOENT;
+        }
+        if ((moved->type == S_IFDIR && below(new_trimmed, old_trimmed)) ||
+            (replaced->type == S_IFDIR && below(old_trimmed, new_trimmed))) {
+            return -EINVAL;
+        }
+        if (moved == replaced) {
+            return 0;
+        }
+
+        erase_entry(*old_parent, old_name);
+        erase_entry(*new_parent, new_name);
+        insert_entry(*old_parent, old_name, replaced);
+        insert_entry(*new_parent, new_name, moved);
+        add_links(*moved, 0);
+        add_links(*replaced, 0);
+        return 0;
+    }
+
+    if (replaced != nullptr) {
+        if (flags & RENAME_NOREPLACE) {
+            return -EEXIST;
+        }
+        if (moved == replaced) {
+            // Both names are links of the same file, rename() does nothing then
+            return 0;
+        }
+        if (moved->type == S_IFDIR && replaced->type != S_IFDIR) {
+            return -ENOTDIR;
+        }
+        if (moved->type != S_IFDIR && replaced->type == S_IFDIR) {
+            return -EISDIR;
+        }
+        if (replaced->type == S_IFDIR && !replaced->entries.empty()) {
+            return -ENOTEMPTY;
+        }
+    }
+    if (moved->type == S_IFDIR && below(new_trimmed, old_trimmed)) {
+        return -EINVAL;
+    }
+
+    if (replaced != nullptr) {
+        erase_entry(*new_parent, new_name);
+        add_links(*replaced, replaced->type == S_IFDIR ? -static_cast<int>(replaced->attr.st_nlink) : -1);
+    }
+    erase_entry(*old_parent, old_name);
+    insert_entry(*new_parent, new_name, moved);
+    add_links(*moved, 0);
+    return 0;
+}
+
+int MemoryBackend::link(std::string_view oldpath, std::string_view newpath) {
+    std::unique_lock<std::shared_mutex> lock(tree);
+    std::shared_ptr<Inode> inode;
+    int res = resolve(root, oldpath, false, inode);
+    if (res < 0) {
+        return res;
+    }
+    if (inode->type == S_IFDIR) {
+        return -EPERM;
+    }
+
+    std::shared_ptr<Inode> parent;
+    std::string name;
+    if ((res = resolve_parent(newpath, parent, name)) < 0) {
+        return res;
+    }
+    if (parent->entries.count(name) > 0) {
+        return -EEXIST;
+    }
+
+    add_links(*inode, 1);
+    insert_entry(*parent, name, std::move(inode));
+    return 0;
+}
+
+int MemoryBackend::unlink(std::string_view path) {
+    std::unique_lock<std::shared_mutex> lock(tree);
+    std::shared_ptr<Inode> parent;
+    std::string name;
+    int res = resolve_parent(path, parent, name);
+    if (res < 0) {
+        return res;
+    }
+
+    auto it = parent->entries.find(name);
+    if (it == parent->entries.end()) {
+        return -ENOENT;
+    }
+    if (it->second->type == S_IFDIR) {
+        return -EISDIR;
+    }
+
+    std::shared_ptr<Inode> inode = it->second;
+    erase_entry(*parent, name);
+    add_links(*inode, -1);
+    return 0;
+}
+
+int MemoryBackend::symlink(std::string_view target, std::string_view linkpath) {
+    if (target.empty()) {
+        return -ENOENT;
+    }
+
+    std::unique_lock<std::shared_mutex> lock(tree);
+    std::shared_ptr<Inode> parent;
+    std::string name;
+    int res = resolve_parent(linkpath, parent, name);
+    if (res < 0) {
+        return res;
+    }
+    if (parent->entries.count(name) > 0) {
+        return -EEXIST;
+    }
+
+    auto inode = make_inode(S_IFLNK | 0777);
+    inode->target = target;
+    inode->attr.st_size = static_cast<off_t>(target.size());
+    insert_entry(*parent, name, std::move(inode));
+    return 0;
+}
+
+int MemoryBackend::readlink(std::string_view path, char *buf, size_t size) {
+    std::shared_lock<std::shared_mutex> lock(tree);
+    std::shared_ptr<Inode> inode;
+    int res = resolve(root, path, false, inode);
+    if (res < 0) {
+        return res;
+    }
+    if (inode->type != S_IFLNK) {
+        return -EINVAL;
+    }
+
+    size_t length = std::min(size, inode->target.size());
+    std::memcpy(buf, inode->target.data(), length);
+    return static_cast<int>(length);
+}
+
+int MemoryBackend::mkdir(std::string_view path, mode_t mode) {
+    std::unique_lock<std::shared_mutex> lock(tree);
+    std::shared_ptr<Inode> parent;
+    std::string name;
+    int res = resolve_parent(path, parent, name);
+    if (res < 0) {
+        return res == -EBUSY ? -EEXIST : res;
+    }
+    if (parent->entries.count(name) > 0) {
+        return -EEXIST;
+    }
+
+    insert_entry(*parent, name, make_inode(S_IFDIR | (mode & 07777)));
+    return 0;
+}
+
+int MemoryBackend::rmdir(std::string_view path) {
+    std::unique_lock<std::shared_mutex> lock(tree);
+    std::shared_ptr<Inode> parent;
+    std::string name;
+    int res = resolve_parent(path, parent, name);
+    if (res < 0) {
+        return res;
+    }
+
+    auto it = parent->entries.find(name);
+    if (it == parent->entries.end()) {
+        return -ENOENT;
+    }
+
+    std::shared_ptr<Inode> inode = it->second;
+    if (inode->type != S_IFDIR) {
+        return -ENOTDIR;
+    }
+    if (!inode->entries.empty()) {
+        return -ENOTEMPTY;
+    }
+
+    erase_entry(*parent, name);
+    add_links(*inode, -2);
+    return 0;
+}
+
+int MemoryBackend::list(std::string_view path, std::vector<std::string> &names) {
+    std::shared_lock<std::shared_mutex> lock(tree);
+    std::shared_ptr<Inode> inode;
+    int res = resolve(root, path, true, inode);
+    if (res < 0) {
+        return res;
+    }
+    if (inode->type != S_IFDIR) {
+        return -ENOTDIR;
+    }
+
+    names.reserve(names.size() + inode->entries.size());
+    for (const auto &entry : inode->entries) {
+        names.push_back(entry.first);
+    }
+    return 0;
+}
+
+int MemoryBackend::opendir(std::string_view path, std::unique_ptr<DirHandle> &handle) {
+    std::shared_lock<std::shared_mutex> lock(tree);
+    std::shared_ptr<Inode> inode;
+    int res = resolve(root, path, true, inode);
+    if (res < 0) {
+        return res;
+    }
+    if (inode->type != S_IFDIR) {
+        return -ENOTDIR;
+    }
+
+    auto listing = std::make_unique<Listing>();
+    listing->entries.reserve(inode->entries.size() + 2);
+    listing->entries.push_back({".", inode});
+    listing->entries.push_back({"..", inode});
+    for (const auto &entry : inode->entries) {
+        listing->entries.push_back({entry.first, entry.second});
+    }
+
+    handle = std::move(listing);
+    return 0;
+}
+
+int MemoryBackend::readdir(DirHandle &handle, off_t offset, DirFiller &filler) {
+    auto &listing = static_cast<Listing &>(handle);
+
+    // The offset of an entry is the index of the one after it
+    for (auto index = static_cast<size_t>(std::max<off_t>(offset, 0)); index < listing.entries.size(); index++) {
+        const auto &entry = listing.entries[index];
+
+        struct stat st {};
+        bool attributes = filler.wants_attributes(entry.name);
+        if (attributes) {
+            std::lock_guard<std::mutex> lock(stripe(*entry.inode));
+            st = entry.inode->attr;
+        } else {
+            st.st_ino = entry.inode->attr.st_ino;
+            st.st_mode = entry.inode->type;
+        }
+
+        if (filler.add(entry.name, &st, static_cast<off_t>(index + 1), attributes) == 1) {
+            return 0;
+        }
+    }
+    return 0;
+}
+
+int MemoryBackend::syncfs() {
+    return 0;
+}
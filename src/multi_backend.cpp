@@ -0,0 +1,845 @@
+#include "multi_backend.h"
+
+#include <fcntl.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+#include <unordered_set>
+
+#include "backend_listing.h"
+#include "common/logging.h"
+#include "common/path.h"
+
+namespace {
+
+bool any(const std::vector<bool> &devices) {
+    return std::find(devices.begin(), devices.end(), true) != devices.end();
+}
+
+}  // namespace
+
+/// Open file with a handle on every device holding a part or copy of it
+class MultiBackend::MultiHandle : public FileHandle {
+public:
+    MultiHandle(int flags, size_t devices) : FileHandle(-1, flags), parts(devices) {
+        set_passthrough(false);
+    }
+
+    /// The device holding the file with HASH placement
+    [[nodiscard]] size_t owner() const {
+        for (size_t i = 0; i < parts.size(); i++) {
+            if (parts[i]) {
+                return i;
+            }
+        }
+        return 0;
+    }
+
+    /// Handle per device, null on devices without the file
+    std::vector<std::unique_ptr<FileHandle>> parts;
+};
+
+/// Directory opened on the first device, or a snapshot of the entries of all devices
+class MultiBackend::Listing : public SnapshotListing {
+public:
+    using SnapshotListing::SnapshotListing;
+
+    /// Directory of the first device which readdir() is passed on to, if all entries are stored there
+    std::unique_ptr<DirHandle> inner;
+};
+
+MultiBackend::Device::Device(std::shared_ptr<StorageBackend> backend, size_t index)
+    : backend(std::move(backend)),
+      reads(Metrics::counter("devices." + std::to_string(index) + ".reads")),
+      read_bytes(Metrics::counter("devices." + std::to_string(index) + ".read_bytes")),
+      writes(Metrics::counter("devices." + std::to_string(index) + ".writes")),
+      write_bytes(Metrics::counter("devices." + std::to_string(index) + ".write_bytes")),
+      syncs(Metrics::counter("devices." + std::to_string(index) + ".syncs")),
+      busy_ns(Metrics::counter("devices." + std::to_string(index) + ".busy_ns")) {}
+
+MultiBackend::MultiBackend(std::vector<std::shared_ptr<StorageBackend>> devices, Placement placement,
+                           size_t stripe_size)
+    : placement(placement), stripe_size(stripe_size) {
+    if (devices.empty()) {
+        throw std::runtime_error("At least one device is needed");
+    }
+    if (stripe_size == 0) {
+        throw std::runtime_error("Stripes cannot be empty");
+    }
+
+    for (size_t i = 0; i < devices.size(); i++) {
+        this->devices.push_back(std::make_unique<Device>(std::move(devices[i]), i));
+    }
+}
+
+std::vector<MultiBackend::DeviceStatistics> MultiBackend::statistics() const {
+    std::vector<DeviceStatistics> statistics;
+    for (const auto &device : devices) {
+        statistics.push_back({device->in_flight.load(), device->reads.load(), device->read_bytes.load(),
+                              device->writes.load(), device->write_bytes.load(), device->syncs.load(),
+                              device->busy_ns.load()});
+    }
+    return statistics;
+}
+
+size_t MultiBackend::home(std::string_view path) const {
+    // FNV-1a over the path without redundant slashes, it has to give the same device in every run
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    bool slash = true;
+    for (char c : path) {
+        if (c == '/') {
+            slash = true;
+            continue;
+        }
+        if (slash) {
+            hash = (hash ^ '/') * 0x100000001b3ULL;
+            slash = false;
+        }
+        hash = (hash ^ static_cast<unsigned char>(c)) * 0x100000001b3ULL;
+    }
+    return hash % devices.size();
+}
+
+ssize_t MultiBackend::request(Device &device, Metrics::Counter &operations, Metrics::Counter *bytes,
+                              const std::function<ssize_t()> &operation) {
+    device.in_flight.fetch_add(1, std::memory_order_relaxed);
+    auto start = std::chrono::steady_clock::now();
+
+    ssize_t res = operation();
+
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    device.busy_ns.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count(),
+                             std::memory_order_relaxed);
+    operations.fetch_add(1, std::memory_order_relaxed);
+    if (bytes != nullptr && res > 0) {
+        bytes->fetch_add(res, std::memory_order_relaxed);
+    }
+    device.in_flight.fetch_sub(1, std::memory_order_relaxed);
+    return res;
+}
+
+int MultiBackend::replicate(const std::function<int(StorageBackend &)> &operation) {
+    int res = operation(*devices[0]->backend);
+    if (res < 0) {
+        return res;
+    }
+
+    for (size_t i = 1; i < devices.size(); i++) {
+        int replicated = operation(*devices[i]->backend);
+        if (replicated < 0) {
+            Logging::Error("Device %zu diverged from the first one: %s", i, strerror(-replicated));
+        }
+    }
+    return 0;
+}
+
+int MultiBackend::each(const std::function<int(StorageBackend &)> &operation) {
+    int error = 0;
+    bool found = false;
+    for (const auto &device : devices) {
+        int res = operation(*device->backend);
+        if (res == 0) {
+            found = true;
+        } else if (res != -ENOENT && error == 0) {
+            error = res;
+        }
+    }
+
+    if (error < 0) {
+        return error;
+    }
+    return found ? 0 : -ENOENT;
+}
+
+std::vector<bool> MultiBackend::presence(std::string_view path) const {
+    std::vector<bool> present(devices.size());
+    for (size_t i = 0; i < devices.size(); i++) {
+        struct stat st {};
+        present[i] = devices[i]->backend->stat(path, &st, false) == 0;
+    }
+    return present;
+}
+
+bool MultiBackend::exists(std::string_view path) const {
+    size_t first = home(path);
+    for (size_t i = 0; i < devices.size(); i++) {
+        struct stat st {};
+        if (devices[(first + i) % devices.size()]->backend->stat(path, &st, false) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+uint64_t MultiBackend::part_size(uint64_t size, size_t device) const {
+    uint64_t count = devices.size();
+    uint64_t full = size / stripe_size;
+
+    // Whole rounds over all devices, then the stripes of the last round up to the one the file ends in
+    uint64_t part = (full / count) * stripe_size;
+    if (device < full % count) {
+        part += stripe_size;
+    } else if (device == full % count) {
+        part += size % stripe_size;
+    }
+    return part;
+}
+
+uint64_t MultiBackend::striped_size(uint64_t part, size_t device) const {
+    if (part == 0) {
+        return 0;
+    }
+
+    uint64_t local = (part - 1) / stripe_size;
+    uint64_t stripe = local * devices.size() + device;
+    return stripe * stripe_size + (part - local * stripe_size);
+}
+
+int MultiBackend::striped_size(MultiHandle &handle, uint64_t &size) {
+    size = 0;
+    for (size_t i = 0; i < handle.parts.size(); i++) {
+        struct stat st {};
+        int res = devices[i]->backend->fstat(*handle.parts[i], &st);
+        if (res < 0) {
+            return res;
+        }
+        size = std::max(size, striped_size(st.st_size, i));
+    }
+    return 0;
+}
+
+int MultiBackend::open(std::string_view path, int flags, mode_t mode, std::unique_ptr<FileHandle> &handle) {
+    auto multi = std::make_unique<MultiHandle>(flags, devices.size());
+
+    if (placement == Placement::HASH) {
+        size_t first = home(path);
+        int res = -ENOENT;
+        if ((flags & O_CREAT) && (flags & O_EXCL)) {
+            res = exists(path) ? -EEXIST : devices[first]->backend->open(path, flags, mode, multi->parts[first]);
+        } else {
+            // Symbolic links exist on every device, so the file is on the device on which the open works
+            for (size_t i = 0; i < devices.size() && res == -ENOENT; i++) {
+                size_t index = (first + i) % devices.size();
+                res = devices[index]->backend->open(path, flags & ~O_CREAT, mode, multi->parts[index]);
+            }
+            if (res == -ENOENT && (flags & O_CREAT)) {
+                res = devices[first]->backend->open(path, flags, mode, multi->parts[first]);
+            }
+        }
+        if (res == 0) {
+            handle = std::move(multi);
+        }
+        return res;
+    }
+
+    // Every device holds a part or copy, the first one decides whether the file can be opened. The VFS passes the
+    // offset of appending writes, a part must not append on its own.
+    int part_flags = placement == Placement::STRIPE ? flags & ~O_APPEND : flags;
+    int res = devices[0]->backend->open(path, part_flags, mode, multi->parts[0]);
+    if (res < 0) {
+        return res;
+    }
+    for (size_t i = 1; i < devices.size(); i++) {
+        res = devices[i]->backend->open(path, part_flags & ~O_EXCL, mode, multi->parts[i]);
+        if (res < 0) {
+            Logging::Error("Failed to open %s on device %zu: %s", std::string(path).c_str(), i, strerror(-res));
+            multi->parts[i].reset();
+            release(*multi);
+            return res;
+        }
+    }
+
+    handle = std::move(multi);
+    return 0;
+}
+
+ssize_t MultiBackend::pread(FileHandle &handle, void *buf, size_t count, off_t offset) {
+    auto &multi = static_cast<MultiHandle &>(handle);
+    if (placement == Placement::STRIPE) {
+        return read_striped(multi, static_cast<char *>(buf), count, offset);
+    }
+
+    auto read = [&](size_t index) {
+        Device &device = *devices[index];
+        return request(device, device.reads, &device.read_bytes,
+                       [&]() { return device.backend->pread(*multi.parts[index], buf, count, offset); });
+    };
+    if (placement == Placement::HASH) {
+        return read(multi.owner());
+    }
+
+    // The least busy mirror serves the read, starting at a rotating device so that idle mirrors share the load
+    size_t first = next_mirror.fetch_add(1, std::memory_order_relaxed) % devices.size();
+    size_t chosen = first;
+    for (size_t i = 1; i < devices.size(); i++) {
+        size_t index = (first + i) % devices.size();
+        if (devices[index]->in_flight.load(std::memory_order_relaxed) <
+            devices[chosen]->in_flight.load(std::memory_order_relaxed)) {
+            chosen = index;
+        }
+    }
+
+    ssize_t res = read(chosen);
+    for (size_t i = 0; res == -EIO && i < devices.size(); i++) {
+        if (i != chosen) {
+            Logging::Warn("Read error on device %zu, reading from device %zu", chosen, i);
+            res = read(i);
+        }
+    }
+    return res;
+}
+
+ssize_t MultiBackend::read_striped(MultiHandle &handle, char *buf, size_t count, off_t offset) {
+    if (offset < 0) {
+        return -EINVAL;
+    }
+
+    // Only known once a part ends early, which is either a hole or the end of the file
+    uint64_t size = UINT64_MAX;
+    size_t done = 0;
+    while (done < count) {
+        uint64_t position = static_cast<uint64_t>(offset) + done;
+        if (position >= size) {
+            break;
+        }
+
+        uint64_t stripe = position / stripe_size;
+        uint64_t within = position % stripe_size;
+        size_t index = stripe % devices.size();
+        auto local = static_cast<off_t>((stripe / devices.size()) * stripe_size + within);
+        size_t length = std::min<uint64_t>(stripe_size - within, count - done);
+
+        Device &device = *devices[index];
+        ssize_t res = request(device, device.reads, &device.read_bytes, [&]() {
+            return device.backend->pread(*handle.parts[index], buf + done, length, local);
+        });
+        if (res < 0) {
+            return done > 0 ? static_cast<ssize_t>(done) : res;
+        }
+        done += res;
+        if (static_cast<size_t>(res) == length) {
+            continue;
+        }
+
+        if (size == UINT64_MAX) {
+            int error = striped_size(handle, size);
+            if (error < 0) {
+                return done > 0 ? static_cast<ssize_t>(done) : error;
+            }
+        }
+
+        // A part shorter than the file has a hole there
+        uint64_t end = std::min<uint64_t>(position + length, std::max<uint64_t>(size, position + res));
+        std::memset(buf + done, 0, end - position - res);
+        done += end - position - res;
+        if (end < position + length) {
+            break;
+        }
+    }
+    return static_cast<ssize_t>(done);
+}
+
+ssize_t MultiBackend::pwrite(FileHandle &handle, const void *buf, size_t count, off_t offset) {
+    auto &multi = static_cast<MultiHandle &>(handle);
+    if (placement == Placement::STRIPE) {
+        return write_striped(multi, static_cast<const char *>(buf), count, offset);
+    }
+
+    auto write = [&](size_t index, size_t done) {
+        Device &device = *devices[index];
+        return request(device, device.writes, &device.write_bytes, [&]() {
+            return device.backend->pwrite(*multi.parts[index], static_cast<const char *>(buf) + done, count - done,
+                                          offset + static_cast<off_t>(done));
+        });
+    };
+    if (placement == Placement::HASH) {
+        return write(multi.owner(), 0);
+    }
+
+    // Mirrors have to stay identical, so every one of them gets all of the data
+    for (size_t i = 0; i < devices.size(); i++) {
+        for (size_t done = 0; done < count;) {
+            ssize_t res = write(i, done);
+            if (res < 0) {
+                return res;
+            }
+            done += res;
+        }
+    }
+    return static_cast<ssize_t>(count);
+}
+
+ssize_t MultiBackend::write_striped(MultiHandle &handle, const char *buf, size_t count, off_t offset) {
+    if (offset < 0) {
+        return -EINVAL;
+    }
+
+    size_t done = 0;
+    while (done < count) {
+        uint64_t position = static_cast<uint64_t>(offset) + done;
+        uint64_t stripe = position / stripe_size;
+        uint64_t within = position % stripe_size;
+        size_t index = stripe % devices.size();
+        auto local = static_cast<off_t>((stripe / devices.size()) * stripe_size + within);
+        size_t length = std::min<uint64_t>(stripe_size - within, count - done);
+
+        Device &device = *devices[index];
+        ssize_t res = request(device, device.writes, &device.write_bytes, [&]() {
+            return device.backend->pwrite(*handle.parts[index], buf + done, length, local);
+        });
+        if (res < 0) {
+            return done > 0 ? static_cast<ssize_t>(done) : res;
+        }
+        done += res;
+        if (static_cast<size_t>(res) < length) {
+            break;
+        }
+    }
+    return static_cast<ssize_t>(done);
+}
+
+int MultiBackend::ftruncate(FileHandle &handle, off_t length) {
+    auto &multi = static_cast<MultiHandle &>(handle);
+    if (length < 0) {
+        return -EINVAL;
+    }
+
+    int res = 0;
+    for (size_t i = 0; i < multi.parts.size() && res == 0; i++) {
+        if (multi.parts[i]) {
+            off_t part = placement == Placement::STRIPE ? static_cast<off_t>(part_size(length, i)) : length;
+            res = devices[i]->backend->ftruncate(*multi.parts[i], part);
+        }
+    }
+    return res;
+}
+
+int MultiBackend::fsync(FileHandle &handle, bool datasync) {
+    auto &multi = static_cast<MultiHandle &>(handle);
+    int res = 0;
+    for (size_t i = 0; i < multi.parts.size(); i++) {
+        if (!multi.parts[i]) {
+            continue;
+        }
+
+        Device &device = *devices[i];
+        int synced = static_cast<int>(request(device, device.syncs, nullptr, [&]() {
+            return device.backend->fsync(*multi.parts[i], datasync);
+        }));
+        if (res == 0) {
+            res = synced;
+        }
+    }
+    return res;
+}
+
+int MultiBackend::release(FileHandle &handle) {
+    auto &multi = static_cast<MultiHandle &>(handle);
+    int res = 0;
+    for (size_t i = 0; i < multi.parts.size(); i++) {
+        if (multi.parts[i]) {
+            int released = devices[i]->backend->release(*multi.parts[i]);
+            if (res == 0) {
+                res = released;
+            }
+        }
+    }
+    return res;
+}
+
+int MultiBackend::fstat(FileHandle &handle, struct stat *st) {
+    auto &multi = static_cast<MultiHandle &>(handle);
+    size_t index = multi.owner();
+    int res = devices[index]->backend->fstat(*multi.parts[index], st);
+    if (res < 0 || placement != Placement::STRIPE) {
+        return res;
+    }
+
+    uint64_t size = 0;
+    res = striped_size(multi, size);
+    st->st_size = static_cast<off_t>(size);
+    st->st_blocks = (st->st_size + 511) / 512;
+    return res;
+}
+
+int MultiBackend::prefetch(FileHandle &handle, off_t offset, size_t length) {
+    auto &multi = static_cast<MultiHandle &>(handle);
+    if (placement == Placement::HASH) {
+        return devices[multi.owner()]->backend->prefetch(*multi.parts[multi.owner()], offset, length);
+    }
+    if (offset < 0 || length == 0) {
+        return offset < 0 ? -EINVAL : 0;
+    }
+
+    // Any mirror may serve the reads, a striped range covers one contiguous range of every device it touches
+    std::vector<std::pair<uint64_t, uint64_t>> ranges(devices.size(), {UINT64_MAX, 0});
+    if (placement == Placement::MIRROR) {
+        ranges.assign(devices.size(), {offset, offset + length});
+    } else {
+        for (uint64_t position = offset; position < static_cast<uint64_t>(offset) + length;) {
+            uint64_t stripe = position / stripe_size;
+            uint64_t within = position % stripe_size;
+            uint64_t local = (stripe / devices.size()) * stripe_size + within;
+            uint64_t part = std::min<uint64_t>(stripe_size - within, offset + length - position);
+            auto &range = ranges[stripe % devices.size()];
+            range = {std::min(range.first, local), std::max(range.second, local + part)};
+            position += part;
+        }
+    }
+
+    int res = 0;
+    for (size_t i = 0; i < devices.size(); i++) {
+        if (multi.parts[i] && ranges[i].first < ranges[i].second) {
+            int prefetched = devices[i]->backend->prefetch(*multi.parts[i], static_cast<off_t>(ranges[i].first),
+                                                           ranges[i].second - ranges[i].first);
+            res = res < 0 ? res : prefetched;
+        }
+    }
+    return res;
+}
+
+int MultiBackend::truncate(std::string_view path, off_t length) {
+    if (placement != Placement::STRIPE) {
+        return each([&](StorageBackend &device) { return device.truncate(path, length); });
+    }
+    if (length < 0) {
+        return -EINVAL;
+    }
+
+    int res = devices[0]->backend->truncate(path, static_cast<off_t>(part_size(length, 0)));
+    for (size_t i = 1; i < devices.size() && res == 0; i++) {
+        res = devices[i]->backend->truncate(path, static_cast<off_t>(part_size(length, i)));
+    }
+    return res;
+}
+
+int MultiBackend::copy(std::string_view source, std::string_view destination) {
+    if (placement == Placement::HASH) {
+        if (exists(destination)) {
+            return -EEXIST;
+        }
+
+        // The copy stays on the device of the source, where the data can be shared or copied without a transfer
+        size_t first = home(source);
+        int res = -ENOENT;
+        for (size_t i = 0; i < devices.size() && res == -ENOENT; i++) {
+            res = devices[(first + i) % devices.size()]->backend->copy(source, destination);
+        }
+        return res;
+    }
+
+    // Parts and mirrors are copied on their own devices
+    for (size_t i = 0; i < devices.size(); i++) {
+        int res = devices[i]->backend->copy(source, destination);
+        if (res < 0) {
+            while (i-- > 0) {
+                devices[i]->backend->unlink(destination);
+            }
+            return res;
+        }
+    }
+    return 0;
+}
+
+int MultiBackend::stat(std::string_view path, struct stat *st, bool follow) {
+    if (placement == Placement::HASH) {
+        size_t first = home(path);
+        int res = -ENOENT;
+        for (size_t i = 0; i < devices.size() && res == -ENOENT; i++) {
+            res = devices[(first + i) % devices.size()]->backend->stat(path, st, follow);
+        }
+        return res;
+    }
+
+    int res = devices[0]->backend->stat(path, st, follow);
+    if (res < 0 || placement != Placement::STRIPE || !S_ISREG(st->st_mode)) {
+        return res;
+    }
+
+    uint64_t size = striped_size(st->st_size, 0);
+    blkcnt_t blocks = st->st_blocks;
+    for (size_t i = 1; i < devices.size(); i++) {
+        struct stat part {};
+        if (devices[i]->backend->stat(path, &part, follow) == 0) {
+            size = std::max(size, striped_size(part.st_size, i));
+            blocks += part.st_blocks;
+        }
+    }
+    st->st_size = static_cast<off_t>(size);
+    st->st_blocks = blocks;
+    return 0;
+}
+
+int MultiBackend::utimens(std::string_view path, const struct timespec tv[2]) {
+    return each([&](StorageBackend &device) { return device.utimens(path, tv); });
+}
+
+int MultiBackend::chmod(std::string_view path, mode_t mode) {
+    return each([&](StorageBackend &device) { return device.chmod(path, mode); });
+}
+
+int MultiBackend::chown(std::string_view path, uid_t uid, gid_t gid) {
+    return each([&](StorageBackend &device) { return device.chown(path, uid, gid); });
+}
+
+int MultiBackend::statfs(struct statvfs *stbuf) {
+    int res = devices[0]->backend->statfs(stbuf);
+    if (res < 0) {
+        return res;
+    }
+
+    // Mirrors hold everything on every device, otherwise the devices add up
+    for (size_t i = 1; i < devices.size(); i++) {
+        struct statvfs other {};
+        if (devices[i]->backend->statfs(&other) < 0 || stbuf->f_frsize == 0) {
+            continue;
+        }
+
+        auto scale = [&](fsblkcnt_t blocks) { return blocks * other.f_frsize / stbuf->f_frsize; };
+        if (placement == Placement::MIRROR) {
+            stbuf->f_blocks = std::min(stbuf->f_blocks, scale(other.f_blocks));
+            stbuf->f_bfree = std::min(stbuf->f_bfree, scale(other.f_bfree));
+            stbuf->f_bavail = std::min(stbuf->f_bavail, scale(other.f_bavail));
+            stbuf->f_files = std::min(stbuf->f_files, other.f_files);
+            stbuf->f_ffree = std::min(stbuf->f_ffree, other.f_ffree);
+            stbuf->f_favail = std::min(stbuf->f_favail, other.f_favail);
+        } else {
+            stbuf->f_blocks += scale(other.f_blocks);
+            stbuf->f_bfree += scale(other.f_bfree);
+            stbuf->f_bavail += scale(other.f_bavail);
+            stbuf->f_files += other.f_files;
+            stbuf->f_ffree += other.f_ffree;
+            stbuf->f_favail += other.f_favail;
+        }
+    }
+    return 0;
+}
+
+int MultiBackend::mknod(std::string_view path, mode_t mode, dev_t dev) {
+    if (placement != Placement::HASH) {
+        return replicate([&](StorageBackend &device) { return device.mknod(path, mode, dev); });
+    }
+
+    // Files of other paths may be stored on any device
+    if (exists(path)) {
+        return -EEXIST;
+    }
+    if (S_ISREG(mode) || (mode & S_IFMT) == 0) {
+        return devices[home(path)]->backend->mknod(path, mode, dev);
+    }
+    return replicate([&](StorageBackend &device) { return device.mknod(path, mode, dev); });
+}
+
+int MultiBackend::rename(std::string_view oldpath, std::string_view newpath, unsigned int flags) {
+    std::vector<bool> from = presence(oldpath);
+    std::vector<bool> to = presence(newpath);
+    if (!any(from)) {
+        return -ENOENT;
+    }
+
+    if (flags & RENAME_EXCHANGE) {
+        if (!any(to)) {
+            return -ENOENT;
+        }
+
+        // A device holding only one of the entries moves it to the other name
+        for (size_t i = 0; i < devices.size(); i++) {
+            auto &device = *devices[i]->backend;
+            int res = 0;
+            if (from[i] && to[i]) {
+                res = device.rename(oldpath, newpath, RENAME_EXCHANGE);
+            } else if (from[i]) {
+                res = device.rename(oldpath, newpath, 0);
+            } else if (to[i]) {
+                res = device.rename(newpath, oldpath, 0);
+            }
+            if (res < 0) {
+                return res;
+            }
+        }
+        return 0;
+    }
+
+    if (any(to)) {
+        if (flags & RENAME_NOREPLACE) {
+            return -EEXIST;
+        }
+
+        // A directory is only empty if it is empty on every device
+        struct stat st {};
+        if (devices[0]->backend->stat(newpath, &st, false) == 0 && S_ISDIR(st.st_mode)) {
+            for (const auto &device : devices) {
+                std::vector<std::string> names;
+                if (device->backend->list(newpath, names) == 0 && !names.empty()) {
+                    return -ENOTEMPTY;
+                }
+            }
+        }
+    }
+
+    // The first device holding the entry reports errors like replacing a directory with a file
+    bool renamed = false;
+    for (size_t i = 0; i < devices.size(); i++) {
+        if (!from[i]) {
+            continue;
+        }
+        int res = devices[i]->backend->rename(oldpath, newpath, flags);
+        if (res < 0 && !renamed) {
+            return res;
+        }
+        if (res < 0) {
+            Logging::Error("Device %zu diverged from the first one: %s", i, strerror(-res));
+        }
+        renamed = true;
+    }
+
+    // An entry which was replaced but stored on another device is removed there
+    for (size_t i = 0; i < devices.size(); i++) {
+        if (to[i] && !from[i]) {
+            struct stat st {};
+            auto &device = *devices[i]->backend;
+            if (device.stat(newpath, &st, false) == 0) {
+                S_ISDIR(st.st_mode) ? device.rmdir(newpath) : device.unlink(newpath);
+            }
+        }
+    }
+    return 0;
+}
+
+int MultiBackend::link(std::string_view oldpath, std::string_view newpath) {
+    if (exists(newpath)) {
+        return -EEXIST;
+    }
+
+    // Links stay on the devices of the file
+    std::vector<bool> from = presence(oldpath);
+    bool linked = false;
+    for (size_t i = 0; i < devices.size(); i++) {
+        if (!from[i]) {
+            continue;
+        }
+        int res = devices[i]->backend->link(oldpath, newpath);
+        if (res < 0 && !linked) {
+            return res;
+        }
+        linked = true;
+    }
+    return linked ? 0 : -ENOENT;
+}
+
+int MultiBackend::unlink(std::string_view path) {
+    return each([&](StorageBackend &device) { return device.unlink(path); });
+}
+
+int MultiBackend::symlink(std::string_view target, std::string_view linkpath) {
+    if (placement == Placement::HASH && exists(linkpath)) {
+        return -EEXIST;
+    }
+    return replicate([&](StorageBackend &device) { return device.symlink(target, linkpath); });
+}
+
+int MultiBackend::readlink(std::string_view path, char *buf, size_t size) {
+    return devices[0]->backend->readlink(path, buf, size);
+}
+
+int MultiBackend::mkdir(std::string_view path, mode_t mode) {
+    if (placement == Placement::HASH && exists(path)) {
+        return -EEXIST;
+    }
+    return replicate([&](StorageBackend &device) { return device.mkdir(path, mode); });
+}
+
+int MultiBackend::rmdir(std::string_view path) {
+    if (placement == Placement::HASH) {
+        // Files in the directory may be stored on any device
+        for (size_t i = 1; i < devices.size(); i++) {
+            std::vector<std::string> names;
+            if (devices[i]->backend->list(path, names) == 0 && !names.empty()) {
+                return -ENOTEMPTY;
+            }
+        }
+    }
+    return replicate([&](StorageBackend &device) { return device.rmdir(path); });
+}
+
+int MultiBackend::list(std::string_view path, std::vector<std::string> &names) {
+    if (placement != Placement::HASH) {
+        return devices[0]->backend->list(path, names);
+    }
+
+    size_t first = names.size();
+    int res = devices[0]->backend->list(path, names);
+    if (res < 0) {
+        return res;
+    }
+
+    std::unordered_set<std::string> seen(names.begin() + static_cast<std::ptrdiff_t>(first), names.end());
+    for (size_t i = 1; i < devices.size(); i++) {
+        std::vector<std::string> more;
+        devices[i]->backend->list(path, more);
+        for (auto &name : more) {
+            if (seen.insert(name).second) {
+                names.push_back(std::move(name));
+            }
+        }
+    }
+    return 0;
+}
+
+int MultiBackend::opendir(std::string_view path, std::unique_ptr<DirHandle> &handle) {
+    auto listing = std::make_unique<Listing>(path);
+
+    // Mirrors list everything with its attributes on the first device
+    if (placement == Placement::MIRROR) {
+        int res = devices[0]->backend->opendir(path, listing->inner);
+        if (res == 0) {
+            handle = std::move(listing);
+        }
+        return res;
+    }
+
+    // Otherwise the sizes of striped files or the entries stored on other devices have to be put together
+    SnapshotListing::Collector collector(*listing);
+    size_t count = placement == Placement::HASH ? devices.size() : 1;
+    for (size_t i = 0; i < count; i++) {
+        std::unique_ptr<DirHandle> directory;
+        int res = devices[i]->backend->opendir(path, directory);
+        if (res < 0) {
+            if (i == 0) {
+                return res;
+            }
+            continue;
+        }
+
+        std::lock_guard<std::mutex> lock(directory->lock);
+        devices[i]->backend->readdir(*directory, 0, collector);
+    }
+
+    handle = std::move(listing);
+    return 0;
+}
+
+int MultiBackend::readdir(DirHandle &handle, off_t offset, DirFiller &filler) {
+    auto &listing = static_cast<Listing &>(handle);
+    if (listing.inner) {
+        std::lock_guard<std::mutex> lock(listing.inner->lock);
+        return devices[0]->backend->readdir(*listing.inner, offset, filler);
+    }
+
+    return listing.read(*this, offset, filler);
+}
+
+int MultiBackend::syncfs() {
+    int res = 0;
+    for (const auto &device : devices) {
+        int synced = static_cast<int>(
+            request(*device, device->syncs, nullptr, [&]() { return device->backend->syncfs(); }));
+        if (res == 0) {
+            res = synced;
+        }
+    }
+    return res;
+}
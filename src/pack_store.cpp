@@ -0,0 +1,762 @@
+#include "pack_store.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+
+#include "common/logging.h"
+#include "common/metrics.h"
+
+namespace {
+
+/// Inode numbers of packed files start high above those of the backing filesystem
+constexpr ino_t FIRST_INO = static_cast<ino_t>(1) << 62;
+
+constexpr const char *LOG_NAME = "index";
+constexpr const char *LOG_TEMP_NAME = "index.tmp";
+
+template <typename T>
+void put_value(std::string &buffer, T value) {
+    buffer.append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+template <typename T>
+bool get_value(const std::string &buffer, size_t &position, T &value) {
+    if (buffer.size() - position < sizeof(value)) {
+        return false;
+    }
+    std::memcpy(&value, buffer.data() + position, sizeof(value));
+    position += sizeof(value);
+    return true;
+}
+
+void put_time(std::string &buffer, const struct timespec &time) {
+    put_value<int64_t>(buffer, time.tv_sec);
+    put_value<int64_t>(buffer, time.tv_nsec);
+}
+
+bool get_time(const std::string &buffer, size_t &position, struct timespec &time) {
+    int64_t sec = 0;
+    int64_t nsec = 0;
+    if (!get_value(buffer, position, sec) || !get_value(buffer, position, nsec)) {
+        return false;
+    }
+    time.tv_sec = static_cast<time_t>(sec);
+    time.tv_nsec = static_cast<long>(nsec);
+    return true;
+}
+
+bool write_all(int fd, const char *data, size_t length) {
+    while (length > 0) {
+        ssize_t written = ::write(fd, data, length);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += written;
+        length -= written;
+    }
+    return true;
+}
+
+}  // namespace
+
+void PackStore::Entry::fill(struct stat *st) const {
+    *st = {};
+    st->st_ino = ino;
+    st->st_mode = mode;
+    st->st_nlink = 1;
+    st->st_uid = uid;
+    st->st_gid = gid;
+    st->st_size = length;
+    st->st_blksize = 4096;
+    st->st_blocks = (length + 511) / 512;
+    st->st_atim = atime;
+    st->st_mtim = mtime;
+    st->st_ctim = ctime;
+}
+
+PackStore::Pack::Pack(uint32_t id, int fd, uint64_t size) : id(id), fd(fd), size(size) {}
+
+PackStore::Pack::~Pack() {
+    ::close(fd);
+}
+
+ssize_t PackStore::Pack::read(const Entry &entry, void *buf, size_t count, off_t offset) const {
+    if (offset < 0) {
+        return -EINVAL;
+    }
+    if (static_cast<uint64_t>(offset) >= entry.length) {
+        return 0;
+    }
+
+    count = std::min<size_t>(count, entry.length - offset);
+    size_t done = 0;
+    while (done < count) {
+        ssize_t res = ::pread(fd, static_cast<char *>(buf) + done, count - done,
+                              static_cast<off_t>(entry.offset + offset + done));
+        if (res < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -errno;
+        }
+        if (res == 0) {
+            break;
+        }
+        done += res;
+    }
+    return static_cast<ssize_t>(done);
+}
+
+int PackStore::Pack::prefetch(const Entry &entry, off_t offset, size_t count) const {
+    if (offset < 0) {
+        return -EINVAL;
+    }
+    if (static_cast<uint64_t>(offset) >= entry.length) {
+        return 0;
+    }
+
+    count = std::min<size_t>(count, entry.length - offset);
+    return -::posix_fadvise(fd, static_cast<off_t>(entry.offset + offset), static_cast<off_t>(count),
+                            POSIX_FADV_WILLNEED);
+}
+
+PackStore::PackStore(const std::string &directory, const Settings &settings)
+    : directory(directory), settings(settings), next_ino(FIRST_INO) {
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+    if (error) {
+        throw std::runtime_error("Pack directory could not be created: " + error.message());
+    }
+
+    load();
+
+    log_fd = ::open((directory + "/" + LOG_NAME).c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    if (log_fd < 0) {
+        throw std::runtime_error("Pack index could not be opened: " + std::string(strerror(errno)));
+    }
+
+    compactor = std::thread(&PackStore::compaction_loop, this);
+}
+
+PackStore::PackStore(const std::string &directory) : PackStore(directory, Settings()) {}
+
+PackStore::~PackStore() {
+    {
+        std::lock_guard<std::mutex> lock(thread_mutex);
+        stopping = true;
+    }
+    wakeup.notify_all();
+    compactor.join();
+
+    sync();
+    ::close(log_fd);
+}
+
+void PackStore::split(std::string_view path, std::string_view &directory, std::string_view &name) {
+    path = directory_key(path);
+    size_t slash = path.rfind('/');
+    if (slash == std::string_view::npos) {
+        directory = {};
+        name = path;
+    } else {
+        directory = path.substr(0, slash);
+        name = path.substr(slash + 1);
+    }
+}
+
+std::string_view PackStore::directory_key(std::string_view path) {
+    while (!path.empty() && path.back() == '/') {
+        path.remove_suffix(1);
+    }
+    return path;
+}
+
+const PackStore::Entry *PackStore::lookup(std::string_view path) const {
+    std::string_view parent;
+    std::string_view name;
+    split(path, parent, name);
+
+    auto dir = directories.find(parent);
+    if (dir == directories.end()) {
+        return nullptr;
+    }
+    auto it = dir->second.find(name);
+    return it == dir->second.end() ? nullptr : &it->second;
+}
+
+bool PackStore::find(std::string_view path, Entry &entry, std::shared_ptr<Pack> &pack) const {
+    std::shared_lock<std::shared_mutex> lock(index_mutex);
+    const Entry *found = lookup(path);
+    if (found == nullptr) {
+        return false;
+    }
+
+    auto it = packs.find(found->pack);
+    if (it == packs.end()) {
+        return false;
+    }
+    entry = *found;
+    pack = it->second;
+    return true;
+}
+
+bool PackStore::contains(std::string_view path) const {
+    std::shared_lock<std::shared_mutex> lock(index_mutex);
+    return lookup(path) != nullptr;
+}
+
+void PackStore::insert(std::string_view path, const Entry &entry) {
+    std::string_view parent;
+    std::string_view name;
+    split(path, parent, name);
+
+    auto dir = directories.find(parent);
+    if (dir == directories.end()) {
+        dir = directories.emplace(std::string(parent), Directory()).first;
+    }
+
+    auto it = dir->second.find(name);
+    if (it == dir->second.end()) {
+        it = dir->second.emplace(std::string(name), entry).first;
+        entry_count++;
+    } else {
+        auto old = packs.find(it->second.pack);
+        if (old != packs.end()) {
+            old->second->live -= it->second.length;
+        }
+        it->second = entry;
+    }
+
+    auto pack = packs.find(entry.pack);
+    if (pack != packs.end()) {
+        pack->second->live += entry.length;
+    }
+    log(PUT, path, &entry);
+}
+
+bool PackStore::erase(std::string_view path) {
+    std::string_view parent;
+    std::string_view name;
+    split(path, parent, name);
+
+    auto dir = directories.find(parent);
+    if (dir == directories.end()) {
+        return false;
+    }
+    auto it = dir->second.find(name);
+    if (it == dir->second.end()) {
+        return false;
+    }
+
+    auto pack = packs.find(it->second.pack);
+    if (pack != packs.end()) {
+        pack->second->live -= it->second.length;
+    }
+    dir->second.erase(it);
+    if (dir->second.empty()) {
+        directories.erase(dir);
+    }
+    entry_count--;
+    log(DEL, path, nullptr);
+    return true;
+}
+
+int PackStore::put(std::string_view path, const char *data, size_t length, const Entry &attributes) {
+    if (length > UINT32_MAX) {
+        return -EFBIG;
+    }
+
+    Entry entry = attributes;
+    entry.length = static_cast<uint32_t>(length);
+    int res = append(data, length, entry.pack, entry.offset);
+    if (res < 0) {
+        return res;
+    }
+
+    std::unique_lock<std::shared_mutex> lock(index_mutex);
+    entry.ino = next_ino++;
+    insert(path, entry);
+    return 0;
+}
+
+bool PackStore::update(std::string_view path, const std::function<void(Entry &)> &change) {
+    std::unique_lock<std::shared_mutex> lock(index_mutex);
+    const Entry *found = lookup(path);
+    if (found == nullptr) {
+        return false;
+    }
+
+    Entry entry = *found;
+    change(entry);
+    insert(path, entry);
+    return true;
+}
+
+bool PackStore::remove(std::string_view path) {
+    std::unique_lock<std::shared_mutex> lock(index_mutex);
+    return erase(path);
+}
+
+bool PackStore::rename(std::string_view oldpath, std::string_view newpath) {
+    std::unique_lock<std::shared_mutex> lock(index_mutex);
+    const Entry *found = lookup(oldpath);
+    if (found == nullptr) {
+        return false;
+    }
+
+    Entry entry = *found;
+    erase(oldpath);
+    insert(newpath, entry);
+    return true;
+}
+
+bool PackStore::exchange(std::string_view first, std::string_view second) {
+    std::unique_lock<std::shared_mutex> lock(index_mutex);
+    const Entry *a = lookup(first);
+    const Entry *b = lookup(second);
+    if (a == nullptr || b == nullptr) {
+        return false;
+    }
+
+    Entry entry_a = *a;
+    Entry entry_b = *b;
+    insert(first, entry_b);
+    insert(second, entry_a);
+    return true;
+}
+
+void PackStore::move_tree(std::string_view from, std::string_view to, bool exchange) {
+    std::string from_key(directory_key(from));
+    std::string to_key(directory_key(to));
+
+    std::unique_lock<std::shared_mutex> lock(index_mutex);
+
+    // Takes out the directory and everything below it, keyed relative to the directory
+    auto extract = [this](const std::string &key) {
+        std::vector<std::pair<std::string, Directory>> moved;
+        for (auto it = directories.lower_bound(key); it != directories.end();) {
+            const std::string &name = it->first;
+            if (name.compare(0, key.size(), key) != 0) {
+                break;
+            }
+            if (name.size() > key.size() && name[key.size()] != '/') {
+                ++it;
+                continue;
+            }
+            moved.emplace_back(name.substr(key.size()), std::move(it->second));
+            it = directories.erase(it);
+        }
+        return moved;
+    };
+
+    auto reinsert = [this](const std::string &old_key, const std::string &new_key,
+                           std::vector<std::pair<std::string, Directory>> &moved) {
+        for (auto &[suffix, dir] : moved) {
+            for (auto &[name, entry] : dir) {
+                log(DEL, old_key + suffix + "/" + name, nullptr);
+                log(PUT, new_key + suffix + "/" + name, &entry);
+            }
+            auto &target = directories[new_key + suffix];
+            if (target.empty()) {
+                target = std::move(dir);
+            } else {
+                for (auto &[name, entry] : dir) {
+                    auto [it, inserted] = target.try_emplace(name, entry);
+                    if (!inserted) {
+                        auto pack = packs.find(it->second.pack);
+                        if (pack != packs.end()) {
+                            pack->second->live -= it->second.length;
+                        }
+                        it->second = entry;
+                        entry_count--;
+                    }
+                }
+            }
+        }
+    };
+
+    auto moved_from = extract(from_key);
+    std::vector<std::pair<std::string, Directory>> moved_to;
+    if (exchange) {
+        moved_to = extract(to_key);
+    }
+    reinsert(from_key, to_key, moved_from);
+    reinsert(to_key, from_key, moved_to);
+}
+
+void PackStore::names(std::string_view directory, std::vector<std::string> &names) const {
+    std::shared_lock<std::shared_mutex> lock(index_mutex);
+    auto dir = directories.find(directory_key(directory));
+    if (dir == directories.end()) {
+        return;
+    }
+    names.reserve(names.size() + dir->second.size());
+    for (const auto &entry : dir->second) {
+        names.push_back(entry.first);
+    }
+}
+
+bool PackStore::has_entries(std::string_view directory) const {
+    std::shared_lock<std::shared_mutex> lock(index_mutex);
+    return directories.find(directory_key(directory)) != directories.end();
+}
+
+std::string PackStore::pack_path(uint32_t id) const {
+    char name[32];
+    std::snprintf(name, sizeof(name), "%08x.pack", id);
+    return directory + "/" + name;
+}
+
+std::shared_ptr<PackStore::Pack> PackStore::open_pack(uint32_t id, bool create) const {
+    int flags = O_RDWR | O_CLOEXEC | (create ? O_CREAT | O_EXCL : 0);
+    int fd = ::open(pack_path(id).c_str(), flags, 0600);
+    if (fd < 0) {
+        return nullptr;
+    }
+
+    struct stat st {};
+    if (::fstat(fd, &st) != 0) {
+        ::close(fd);
+        return nullptr;
+    }
+    return std::make_shared<Pack>(id, fd, static_cast<uint64_t>(st.st_size));
+}
+
+int PackStore::append(const char *data, size_t length, uint32_t &pack, uint64_t &offset) {
+    std::lock_guard<std::mutex> lock(append_mutex);
+
+    if (current == nullptr || (current->size > 0 && current->size + length > settings.pack_size)) {
+        uint32_t id = 0;
+        if (current != nullptr) {
+            // Everything written to a sealed pack is durable before the index may point there
+            ::fdatasync(current->fd);
+            id = current->id + 1;
+        }
+
+        std::shared_ptr<Pack> created = open_pack(id, true);
+        if (created == nullptr) {
+            return -errno;
+        }
+        {
+            std::unique_lock<std::shared_mutex> index_lock(index_mutex);
+            packs[id] = created;
+        }
+        current = created;
+    }
+
+    size_t done = 0;
+    while (done < length) {
+        ssize_t res = ::pwrite(current->fd, data + done, length - done, static_cast<off_t>(current->size + done));
+        if (res < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -errno;
+        }
+        done += res;
+    }
+
+    pack = current->id;
+    offset = current->size;
+    current->size += length;
+    return 0;
+}
+
+void PackStore::load() {
+    uint32_t last = 0;
+    bool any = false;
+    for (const auto &file : std::filesystem::directory_iterator(directory)) {
+        std::string name = file.path().filename().string();
+        unsigned int id = 0;
+        char suffix[8] = {};
+        if (name.size() != 13 || std::sscanf(name.c_str(), "%8x.%4s", &id, suffix) != 2 ||
+            std::strcmp(suffix, "pack") != 0) {
+            continue;
+        }
+
+        std::shared_ptr<Pack> pack = open_pack(id, false);
+        if (pack == nullptr) {
+            throw std::runtime_error("Pack " + name + " could not be opened: " + strerror(errno));
+        }
+        packs[id] = pack;
+        if (!any || id > last) {
+            last = id;
+            any = true;
+        }
+    }
+
+    std::string path = directory + "/" + LOG_NAME;
+    int fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        if (errno == ENOENT) {
+            return;
+        }
+        throw std::runtime_error("Pack index could not be read: " + std::string(strerror(errno)));
+    }
+
+    std::string buffer;
+    char chunk[64 * 1024];
+    ssize_t count = 0;
+    while ((count = ::read(fd, chunk, sizeof(chunk))) > 0) {
+        buffer.append(chunk, count);
+    }
+
+    // Records are replayed in order, a record cut short by a crash ends the log
+    size_t position = 0;
+    size_t valid = 0;
+    while (position < buffer.size()) {
+        uint8_t type = 0;
+        uint16_t length = 0;
+        if (!get_value(buffer, position, type) || !get_value(buffer, position, length) ||
+            buffer.size() - position < length) {
+            break;
+        }
+        std::string record_path = buffer.substr(position, length);
+        position += length;
+
+        if (type == DEL) {
+            erase(record_path);
+        } else if (type == PUT) {
+            Entry entry;
+            uint32_t mode = 0;
+            uint32_t uid = 0;
+            uint32_t gid = 0;
+            if (!get_value(buffer, position, entry.pack) || !get_value(buffer, position, entry.offset) ||
+                !get_value(buffer, position, entry.length) || !get_value(buffer, position, mode) ||
+                !get_value(buffer, position, uid) || !get_value(buffer, position, gid) ||
+                !get_time(buffer, position, entry.atime) || !get_time(buffer, position, entry.mtime) ||
+                !get_time(buffer, position, entry.ctime)) {
+                break;
+            }
+            entry.mode = mode;
+            entry.uid = uid;
+            entry.gid = gid;
+
+            const Entry *existing = lookup(record_path);
+            entry.ino = existing != nullptr ? existing->ino : next_ino++;
+            insert(record_path, entry);
+        } else {
+            break;
+        }
+        valid = position;
+    }
+
+    if (valid < buffer.size()) {
+        Logging::Warn("Dropping %zu bytes of an incomplete pack index record", buffer.size() - valid);
+        if (::ftruncate(fd, static_cast<off_t>(valid)) != 0) {
+            Logging::Warn("Pack index could not be truncated: %s", strerror(errno));
+        }
+    }
+    ::close(fd);
+
+    // Data appended after the last sync may be missing, files pointing past the end of their pack are lost
+    std::vector<std::string> lost;
+    for (const auto &[key, dir] : directories) {
+        for (const auto &[name, entry] : dir) {
+            auto pack = packs.find(entry.pack);
+            if (pack == packs.end() || entry.offset + entry.length > pack->second->size) {
+                lost.push_back(key + "/" + name);
+            }
+        }
+    }
+    for (const auto &path_lost : lost) {
+        Logging::Warn("Packed file %s lost its data", path_lost.c_str());
+        erase(path_lost);
+    }
+
+    if (any) {
+        current = packs[last];
+    }
+}
+
+void PackStore::log(Record type, std::string_view path, const Entry *entry) {
+    log_records++;
+    if (log_fd < 0) {
+        // Replaying the log on start
+        return;
+    }
+
+    std::string record;
+    put_value<uint8_t>(record, type);
+    put_value<uint16_t>(record, static_cast<uint16_t>(path.size()));
+    record.append(path);
+    if (type == PUT) {
+        put_value<uint32_t>(record, entry->pack);
+        put_value<uint64_t>(record, entry->offset);
+        put_value<uint32_t>(record, entry->length);
+        put_value<uint32_t>(record, entry->mode);
+        put_value<uint32_t>(record, entry->uid);
+        put_value<uint32_t>(record, entry->gid);
+        put_time(record, entry->atime);
+        put_time(record, entry->mtime);
+        put_time(record, entry->ctime);
+    }
+
+    if (!write_all(log_fd, record.data(), record.size())) {
+        Logging::Error("Pack index could not be written: %s", strerror(errno));
+    }
+}
+
+void PackStore::rewrite_log() {
+    std::string temp_path = directory + "/" + LOG_TEMP_NAME;
+    int fd = ::open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        Logging::Warn("Pack index could not be rewritten: %s", strerror(errno));
+        return;
+    }
+
+    int old_fd = log_fd;
+    log_fd = fd;
+    log_records = 0;
+    for (const auto &[key, dir] : directories) {
+        for (const auto &[name, entry] : dir) {
+            log(PUT, key + "/" + name, &entry);
+        }
+    }
+
+    if (::fsync(fd) != 0 || ::rename(temp_path.c_str(), (directory + "/" + LOG_NAME).c_str()) != 0) {
+        Logging::Warn("Pack index could not be replaced: %s", strerror(errno));
+        ::close(fd);
+        ::unlink(temp_path.c_str());
+        log_fd = old_fd;
+        return;
+    }
+    ::close(old_fd);
+}
+
+int PackStore::sync() {
+    std::shared_ptr<Pack> pack;
+    {
+        std::lock_guard<std::mutex> lock(append_mutex);
+        pack = current;
+    }
+    if (pack != nullptr && ::fdatasync(pack->fd) != 0) {
+        return -errno;
+    }
+
+    std::shared_lock<std::shared_mutex> lock(index_mutex);
+    return ::fdatasync(log_fd) == 0 ? 0 : -errno;
+}
+
+void PackStore::usage(uint64_t &total, uint64_t &dead) const {
+    std::lock_guard<std::mutex> append_lock(append_mutex);
+    std::shared_lock<std::shared_mutex> lock(index_mutex);
+    total = 0;
+    dead = 0;
+    for (const auto &[id, pack] : packs) {
+        total += pack->size;
+        dead += pack->size - pack->live;
+    }
+}
+
+uint64_t PackStore::compact() {
+    std::lock_guard<std::mutex> compact_lock(compact_mutex);
+
+    // The current pack is still being appended to
+    std::vector<std::shared_ptr<Pack>> candidates;
+    {
+        std::lock_guard<std::mutex> append_lock(append_mutex);
+        std::shared_lock<std::shared_mutex> lock(index_mutex);
+        for (const auto &[id, pack] : packs) {
+            auto dead = static_cast<double>(pack->size - pack->live);
+            if (pack != current && dead >= settings.compact_ratio * static_cast<double>(pack->size)) {
+                candidates.push_back(pack);
+            }
+        }
+    }
+
+    uint64_t reclaimed = 0;
+    for (const auto &pack : candidates) {
+        reclaimed += compact_pack(pack);
+    }
+
+    std::unique_lock<std::shared_mutex> lock(index_mutex);
+    if (log_records > 2 * entry_count + 1024) {
+        rewrite_log();
+    }
+    return reclaimed;
+}
+
+uint64_t PackStore::compact_pack(const std::shared_ptr<Pack> &pack) {
+    static Metrics::Counter &moved_bytes = Metrics::counter("packed.compacted_bytes");
+    static Metrics::Counter &reclaimed_bytes = Metrics::counter("packed.reclaimed_bytes");
+
+    std::vector<std::pair<std::string, Entry>> live;
+    {
+        std::shared_lock<std::shared_mutex> lock(index_mutex);
+        for (const auto &[key, dir] : directories) {
+            for (const auto &[name, entry] : dir) {
+                if (entry.pack == pack->id) {
+                    live.emplace_back(key + "/" + name, entry);
+                }
+            }
+        }
+    }
+
+    std::vector<char> data;
+    for (const auto &[path, entry] : live) {
+        data.resize(entry.length);
+        if (pack->read(entry, data.data(), data.size(), 0) != static_cast<ssize_t>(entry.length)) {
+            Logging::Warn("Packed file %s could not be read for compaction", path.c_str());
+            return 0;
+        }
+
+        Entry moved = entry;
+        if (append(data.data(), data.size(), moved.pack, moved.offset) < 0) {
+            return 0;
+        }
+
+        // A file replaced or removed meanwhile keeps its new state, the copy just became dead space
+        std::unique_lock<std::shared_mutex> lock(index_mutex);
+        const Entry *found = lookup(path);
+        if (found != nullptr && found->pack == entry.pack && found->offset == entry.offset) {
+            moved.ino = found->ino;
+            moved.mode = found->mode;
+            moved.uid = found->uid;
+            moved.gid = found->gid;
+            moved.atime = found->atime;
+            moved.mtime = found->mtime;
+            moved.ctime = found->ctime;
+            insert(path, moved);
+            moved_bytes.fetch_add(entry.length, std::memory_order_relaxed);
+        }
+    }
+
+    // The index has to point at the new copies durably before the old ones go away
+    if (sync() < 0) {
+        return 0;
+    }
+
+    std::unique_lock<std::shared_mutex> lock(index_mutex);
+    if (pack->live != 0) {
+        return 0;
+    }
+    packs.erase(pack->id);
+    ::unlink(pack_path(pack->id).c_str());
+    reclaimed_bytes.fetch_add(pack->size, std::memory_order_relaxed);
+    return pack->size;
+}
+
+void PackStore::compaction_loop() {
+    std::unique_lock<std::mutex> lock(thread_mutex);
+    while (!stopping) {
+        wakeup.wait_for(lock, settings.compact_interval);
+        if (stopping) {
+            break;
+        }
+
+        lock.unlock();
+        compact();
+        lock.lock();
+    }
+}
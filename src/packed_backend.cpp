@@ -0,0 +1,802 @@
+#include "packed_backend.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <ctime>
+#include <filesystem>
+#include <functional>
+#include <unordered_set>
+
+#include "backend_helpers.h"
+#include "backend_listing.h"
+#include "common/logging.h"
+#include "common/metrics.h"
+#include "common/path.h"
+
+using BackendHelpers::now;
+using BackendHelpers::is_writable;
+using BackendHelpers::PairLock;
+
+/// Read-only handle of a packed file, it keeps reading the data it was opened with
+class PackedBackend::PackedHandle : public FileHandle {
+public:
+    PackedHandle(int flags, const PackStore::Entry &entry, std::shared_ptr<PackStore::Pack> pack)
+        : FileHandle(-1, flags), entry(entry), pack(std::move(pack)) {
+        set_passthrough(false);
+    }
+
+    const PackStore::Entry entry;
+    const std::shared_ptr<PackStore::Pack> pack;
+};
+
+/// Attached to writable handles of plain files, which are packed once the last of them is closed
+struct PackedBackend::Writer : FileHandle::State {
+    std::string path;
+};
+
+PackedBackend::PackedBackend(std::shared_ptr<StorageBackend> inner, const std::string &pack_directory,
+                             size_t threshold, const PackStore::Settings &settings)
+    : inner(std::move(inner)), store(std::make_unique<PackStore>(pack_directory, settings)), threshold(threshold) {}
+
+PackedBackend::~PackedBackend() {
+    settle();
+}
+
+bool PackedBackend::hidden(std::string_view path) {
+    size_t start = path.find_first_not_of('/');
+    if (start == std::string_view::npos) {
+        return false;
+    }
+    std::string_view first = path.substr(start, path.find('/', start) - start);
+    return first == PACK_DIRECTORY;
+}
+
+std::mutex &PackedBackend::path_lock(std::string_view path) {
+    return path_locks[std::hash<std::string_view>()(path) % PATH_LOCKS];
+}
+
+std::string PackedBackend::packed_target(std::string_view path) {
+    std::string current(path);
+    for (int depth = 0; depth < MAX_SYMLINK_DEPTH; depth++) {
+        if (store->contains(current)) {
+            return current;
+        }
+
+        struct stat st {};
+        if (inner->stat(current, &st, false) < 0 || !S_ISLNK(st.st_mode)) {
+            return {};
+        }
+        char target[PATH_MAX];
+        int length = inner->readlink(current, target, sizeof(target));
+        if (length <= 0 || target[0] == '/') {
+            return {};
+        }
+        current = std::filesystem::path(Path::join(Path::view_parent(current), std::string_view(target, length)))
+                      .lexically_normal()
+                      .string();
+    }
+    return {};
+}
+
+int PackedBackend::check_parent(std::string_view path) {
+    struct stat st {};
+    int res = inner->stat(Path::view_parent(path), &st, true);
+    if (res < 0) {
+        return res;
+    }
+    return S_ISDIR(st.st_mode) ? 0 : -ENOTDIR;
+}
+
+int PackedBackend::read_plain(std::string_view path, std::vector<char> &data) {
+    std::unique_ptr<FileHandle> handle;
+    int res = inner->open(path, O_RDONLY, 0, handle);
+    if (res < 0) {
+        return res;
+    }
+
+    // One byte more than the threshold tells a file which grew too large
+    data.resize(threshold + 1);
+    size_t done = 0;
+    while (done < data.size()) {
+        ssize_t count = inner->pread(*handle, data.data() + done, data.size() - done, static_cast<off_t>(done));
+        if (count < 0) {
+            res = static_cast<int>(count);
+            break;
+        }
+        if (count == 0) {
+            break;
+        }
+        done += count;
+    }
+    inner->release(*handle);
+
+    if (res < 0) {
+        return res;
+    }
+    if (done > threshold) {
+        return -EFBIG;
+    }
+    data.resize(done);
+    return 0;
+}
+
+void PackedBackend::pack(std::string_view path, ino_t ino) {
+    static Metrics::Counter &packed_files = Metrics::counter("packed.files_packed");
+
+    struct stat st {};
+    if (inner->stat(path, &st, false) < 0 || !S_ISREG(st.st_mode) || st.st_nlink != 1 ||
+        static_cast<size_t>(st.st_size) > threshold || (ino != 0 && st.st_ino != ino)) {
+        return;
+    }
+
+    std::vector<char> data;
+    if (read_plain(path, data) < 0) {
+        return;
+    }
+
+    PackStore::Entry entry;
+    entry.mode = st.st_mode;
+    entry.uid = st.st_uid;
+    entry.gid = st.st_gid;
+    entry.atime = st.st_atim;
+    entry.mtime = st.st_mtim;
+    entry.ctime = st.st_ctim;
+    if (store->put(path, data.data(), data.size(), entry) < 0) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(pending_mutex);
+    pending[std::string(path)] = st.st_ino;
+    packed_files.fetch_add(1, std::memory_order_relaxed);
+}
+
+int PackedBackend::unpack(std::string_view path, bool truncate) {
+    static Metrics::Counter &unpacked_files = Metrics::counter("packed.files_unpacked");
+
+    PackStore::Entry entry;
+    std::shared_ptr<PackStore::Pack> pack;
+    if (!store->find(path, entry, pack)) {
+        return 0;
+    }
+
+    std::vector<char> data;
+    if (!truncate) {
+        data.resize(entry.length);
+        ssize_t count = pack->read(entry, data.data(), data.size(), 0);
+        if (count < 0) {
+            return static_cast<int>(count);
+        }
+        data.resize(count);
+    }
+
+    // A plain copy still waiting for removal is simply overwritten
+    std::unique_ptr<FileHandle> handle;
+    int res = inner->open(path, O_WRONLY | O_CREAT | O_TRUNC, entry.mode & 07777, handle);
+    if (res < 0) {
+        return res;
+    }
+    for (size_t done = 0; done < data.size();) {
+        ssize_t count = inner->pwrite(*handle, data.data() + done, data.size() - done, static_cast<off_t>(done));
+        if (count < 0) {
+            res = static_cast<int>(count);
+            break;
+        }
+        done += count;
+    }
+    int closed = inner->release(*handle);
+    if (res == 0) {
+        res = closed;
+    }
+    if (res < 0) {
+        inner->unlink(path);
+        return res;
+    }
+
+    inner->chmod(path, entry.mode & 07777);
+    inner->chown(path, entry.uid, entry.gid);
+    if (!truncate) {
+        const struct timespec times[2] = {entry.atime, entry.mtime};
+        inner->utimens(path, times);
+    }
+
+    store->remove(path);
+    unpacked_files.fetch_add(1, std::memory_order_relaxed);
+    return 0;
+}
+
+int PackedBackend::settle() {
+    std::shared_lock<std::shared_mutex> namespace_lock(namespace_mutex);
+    return settle_locked();
+}
+
+int PackedBackend::settle_locked() {
+    std::map<std::string, ino_t, std::less<>> batch;
+    {
+        std::lock_guard<std::mutex> lock(pending_mutex);
+        batch.swap(pending);
+    }
+
+    int res = store->sync();
+    if (res < 0) {
+        std::lock_guard<std::mutex> lock(pending_mutex);
+        pending.merge(batch);
+        return res;
+    }
+
+    // Plain copies replaced since they were packed or whose packed file is gone again stay
+    for (const auto &[path, ino] : batch) {
+        std::lock_guard<std::mutex> lock(path_lock(path));
+        struct stat st {};
+        if (store->contains(path) && inner->stat(path, &st, false) == 0 && st.st_ino == ino) {
+            inner->unlink(path);
+        }
+    }
+    return 0;
+}
+
+int PackedBackend::open(std::string_view path, int flags, mode_t mode, std::unique_ptr<FileHandle> &handle) {
+    int res = open_path(path, flags, mode, handle);
+    if (res == -ENOENT && !(flags & O_NOFOLLOW)) {
+        std::string target = packed_target(path);
+        if (!target.empty()) {
+            res = open_path(target, flags, mode, handle);
+        }
+    }
+    return res;
+}
+
+int PackedBackend::open_path(std::string_view path, int flags, mode_t mode, std::unique_ptr<FileHandle> &handle) {
+    if (hidden(path)) {
+        return (flags & O_CREAT) ? -EPERM : -ENOENT;
+    }
+
+    std::shared_lock<std::shared_mutex> namespace_lock(namespace_mutex);
+    std::lock_guard<std::mutex> lock(path_lock(path));
+
+    PackStore::Entry entry;
+    std::shared_ptr<PackStore::Pack> pack;
+    if (store->find(path, entry, pack)) {
+        if ((flags & O_CREAT) && (flags & O_EXCL)) {
+            return -EEXIST;
+        }
+        if (flags & O_DIRECTORY) {
+            return -ENOTDIR;
+        }
+        if (!is_writable(flags) && !(flags & O_TRUNC)) {
+            handle = std::make_unique<PackedHandle>(flags, entry, std::move(pack));
+            return 0;
+        }
+
+        int res = unpack(path, (flags & O_TRUNC) != 0);
+        if (res < 0) {
+            return res;
+        }
+    }
+
+    int res = inner->open(path, flags, mode, handle);
+    if (res == 0 && is_writable(flags)) {
+        handle->state<Writer>().path = path;
+        std::lock_guard<std::mutex> writers_lock(writers_mutex);
+        writers[std::string(path)]++;
+    }
+    return res;
+}
+
+ssize_t PackedBackend::pread(FileHandle &handle, void *buf, size_t count, off_t offset) {
+    if (auto *packed = dynamic_cast<PackedHandle *>(&handle)) {
+        return packed->pack->read(packed->entry, buf, count, offset);
+    }
+    return inner->pread(handle, buf, count, offset);
+}
+
+ssize_t PackedBackend::pwrite(FileHandle &handle, const void *buf, size_t count, off_t offset) {
+    if (dynamic_cast<PackedHandle *>(&handle) != nullptr) {
+        return -EBADF;
+    }
+    return inner->pwrite(handle, buf, count, offset);
+}
+
+int PackedBackend::ftruncate(FileHandle &handle, off_t length) {
+    if (dynamic_cast<PackedHandle *>(&handle) != nullptr) {
+        return -EINVAL;
+    }
+    return inner->ftruncate(handle, length);
+}
+
+int PackedBackend::fsync(FileHandle &handle, bool datasync) {
+    if (dynamic_cast<PackedHandle *>(&handle) != nullptr) {
+        return store->sync();
+    }
+    return inner->fsync(handle, datasync);
+}
+
+int PackedBackend::release(FileHandle &handle) {
+    if (dynamic_cast<PackedHandle *>(&handle) != nullptr) {
+        return 0;
+    }
+
+    Writer *writer = handle.find_state<Writer>();
+    ino_t ino = 0;
+    struct stat st {};
+    if (writer != nullptr && inner->fstat(handle, &st) == 0) {
+        ino = st.st_ino;
+    }
+
+    int res = inner->release(handle);
+    if (writer == nullptr) {
+        return res;
+    }
+
+    bool settling = false;
+    {
+        std::shared_lock<std::shared_mutex> namespace_lock(namespace_mutex);
+        std::lock_guard<std::mutex> lock(path_lock(writer->path));
+        {
+            std::lock_guard<std::mutex> writers_lock(writers_mutex);
+            auto it = writers.find(writer->path);
+            if (it != writers.end() && --it->second > 0) {
+                return res;
+            }
+            writers.erase(writer->path);
+        }
+        pack(writer->path, ino);
+
+        std::lock_guard<std::mutex> pending_lock(pending_mutex);
+        settling = pending.size() >= MAX_PENDING;
+    }
+
+    if (settling) {
+        settle();
+    }
+    return res;
+}
+
+int PackedBackend::fstat(FileHandle &handle, struct stat *st) {
+    if (auto *packed = dynamic_cast<PackedHandle *>(&handle)) {
+        packed->entry.fill(st);
+        return 0;
+    }
+    return inner->fstat(handle, st);
+}
+
+int PackedBackend::prefetch(FileHandle &handle, off_t offset, size_t length) {
+    if (auto *packed = dynamic_cast<PackedHandle *>(&handle)) {
+        return packed->pack->prefetch(packed->entry, offset, length);
+    }
+    return inner->prefetch(handle, offset, length);
+}
+
+int PackedBackend::truncate(std::string_view path, off_t length) {
+    if (hidden(path)) {
+        return -ENOENT;
+    }
+
+    std::shared_lock<std::shared_mutex> namespace_lock(namespace_mutex);
+    std::lock_guard<std::mutex> lock(path_lock(path));
+
+    if (!store->contains(path)) {
+        return inner->truncate(path, length);
+    }
+
+    int res = unpack(path, length == 0);
+    if (res == 0) {
+        res = inner->truncate(path, length);
+    }
+
+    std::lock_guard<std::mutex> writers_lock(writers_mutex);
+    if (res == 0 && writers.find(std::string(path)) == writers.end()) {
+        pack(path, 0);
+    }
+    return res;
+}
+
+int PackedBackend::copy(std::string_view source, std::string_view destination) {
+    static Metrics::Counter &copied = Metrics::counter("packed.copies");
+
+    if (hidden(source)) {
+        return -ENOENT;
+    }
+    if (hidden(destination)) {
+        return -EPERM;
+    }
+
+    std::shared_lock<std::shared_mutex> namespace_lock(namespace_mutex);
+    PairLock lock(path_lock(source), path_lock(destination));
+
+    struct stat st {};
+    if (store->contains(destination) || inner->stat(destination, &st, false) == 0) {
+        return -EEXIST;
+    }
+
+    std::vector<char> data;
+    PackStore::Entry entry;
+    std::shared_ptr<PackStore::Pack> pack;
+    if (store->find(source, entry, pack)) {
+        data.resize(entry.length);
+        ssize_t count = pack->read(entry, data.data(), data.size(), 0);
+        if (count < 0) {
+            return static_cast<int>(count);
+        }
+        data.resize(count);
+    } else {
+        int res = inner->stat(source, &st, true);
+        if (res < 0) {
+            return res;
+        }
+        if (!S_ISREG(st.st_mode) || static_cast<size_t>(st.st_size) > threshold ||
+            read_plain(source, data) < 0) {
+            return inner->copy(source, destination);
+        }
+        entry.mode = st.st_mode;
+    }
+
+    int res = check_parent(destination);
+    if (res < 0) {
+        return res;
+    }
+
+    entry.uid = ::geteuid();
+    entry.gid = ::getegid();
+    entry.atime = entry.mtime = entry.ctime = now();
+    res = store->put(destination, data.data(), data.size(), entry);
+    if (res == 0) {
+        copied.fetch_add(1, std::memory_order_relaxed);
+    }
+    return res;
+}
+
+int PackedBackend::stat(std::string_view path, struct stat *st, bool follow) {
+    if (hidden(path)) {
+        return -ENOENT;
+    }
+
+    PackStore::Entry entry;
+    std::shared_ptr<PackStore::Pack> pack;
+    if (store->find(path, entry, pack)) {
+        entry.fill(st);
+        return 0;
+    }
+
+    int res = inner->stat(path, st, follow);
+    if (res == -ENOENT && follow) {
+        std::string target = packed_target(path);
+        if (!target.empty() && store->find(target, entry, pack)) {
+            entry.fill(st);
+            return 0;
+        }
+    }
+    return res;
+}
+
+int PackedBackend::utimens(std::string_view path, const struct timespec tv[2]) {
+    if (hidden(path)) {
+        return -ENOENT;
+    }
+
+    std::shared_lock<std::shared_mutex> namespace_lock(namespace_mutex);
+    std::lock_guard<std::mutex> lock(path_lock(path));
+
+    struct timespec current = now();
+    auto pick = [&current](const struct timespec *time, struct timespec &target) {
+        if (time == nullptr || time->tv_nsec == UTIME_NOW) {
+            target = current;
+        } else if (time->tv_nsec != UTIME_OMIT) {
+            target = *time;
+        }
+    };
+
+    bool packed = store->update(path, [&](PackStore::Entry &entry) {
+        pick(tv == nullptr ? nullptr : &tv[0], entry.atime);
+        pick(tv == nullptr ? nullptr : &tv[1], entry.mtime);
+        entry.ctime = current;
+    });
+    return packed ? 0 : inner->utimens(path, tv);
+}
+
+int PackedBackend::chmod(std::string_view path, mode_t mode) {
+    if (hidden(path)) {
+        return -ENOENT;
+    }
+
+    std::shared_lock<std::shared_mutex> namespace_lock(namespace_mutex);
+    std::lock_guard<std::mutex> lock(path_lock(path));
+
+    bool packed = store->update(path, [mode](PackStore::Entry &entry) {
+        entry.mode = (entry.mode & S_IFMT) | (mode & 07777);
+        entry.ctime = now();
+    });
+    return packed ? 0 : inner->chmod(path, mode);
+}
+
+int PackedBackend::chown(std::string_view path, uid_t uid, gid_t gid) {
+    if (hidden(path)) {
+        return -ENOENT;
+    }
+
+    std::shared_lock<std::shared_mutex> namespace_lock(namespace_mutex);
+    std::lock_guard<std::mutex> lock(path_lock(path));
+
+    PackStore::Entry entry;
+    std::shared_ptr<PackStore::Pack> pack;
+    if (!store->find(path, entry, pack)) {
+        return inner->chown(path, uid, gid);
+    }
+
+    // Only root may give a file away, like chown() on the backing filesystem
+    uid_t euid = ::geteuid();
+    if (euid != 0 && ((uid != static_cast<uid_t>(-1) && uid != entry.uid) || entry.uid != euid)) {
+        return -EPERM;
+    }
+    store->update(path, [uid, gid](PackStore::Entry &changed) {
+        if (uid != static_cast<uid_t>(-1)) {
+            changed.uid = uid;
+        }
+        if (gid != static_cast<gid_t>(-1)) {
+            changed.gid = gid;
+        }
+        changed.ctime = now();
+    });
+    return 0;
+}
+
+int PackedBackend::statfs(struct statvfs *stbuf) {
+    return inner->statfs(stbuf);
+}
+
+int PackedBackend::mknod(std::string_view path, mode_t mode, dev_t dev) {
+    if (hidden(path)) {
+        return -EPERM;
+    }
+
+    std::shared_lock<std::shared_mutex> namespace_lock(namespace_mutex);
+    std::lock_guard<std::mutex> lock(path_lock(path));
+    if (store->contains(path)) {
+        return -EEXIST;
+    }
+    return inner->mknod(path, mode, dev);
+}
+
+int PackedBackend::rename(std::string_view oldpath, std::string_view newpath, unsigned int flags) {
+    if (hidden(oldpath)) {
+        return -ENOENT;
+    }
+    if (hidden(newpath)) {
+        return -EPERM;
+    }
+    if (flags & ~(RENAME_NOREPLACE | RENAME_EXCHANGE)) {
+        return -EINVAL;
+    }
+
+    std::unique_lock<std::shared_mutex> namespace_lock(namespace_mutex);
+
+    bool old_packed = store->contains(oldpath);
+    bool new_packed = store->contains(newpath);
+    struct stat old_st {};
+    struct stat new_st {};
+    bool old_exists = old_packed || inner->stat(oldpath, &old_st, false) == 0;
+    bool new_exists = new_packed || inner->stat(newpath, &new_st, false) == 0;
+
+    if (!old_exists) {
+        return -ENOENT;
+    }
+    if ((flags & RENAME_NOREPLACE) && new_exists) {
+        return -EEXIST;
+    }
+
+    if (flags & RENAME_EXCHANGE) {
+        if (old_packed && new_packed) {
+            store->exchange(oldpath, newpath);
+            return 0;
+        }
+
+        // The inner store swaps a packed file with anything else once it is plain again
+        int res = old_packed ? unpack(oldpath, false) : new_packed ? unpack(newpath, false) : 0;
+        if (res < 0) {
+            return res;
+        }
+    } else if (old_packed) {
+        if (!new_packed && new_exists) {
+            if (S_ISDIR(new_st.st_mode)) {
+                return -EISDIR;
+            }
+            int res = inner->unlink(newpath);
+            if (res < 0) {
+                return res;
+            }
+        }
+        int res = check_parent(newpath);
+        if (res < 0) {
+            return res;
+        }
+
+        store->rename(oldpath, newpath);
+        inner->unlink(oldpath);
+        return 0;
+    } else if (new_packed) {
+        if (S_ISDIR(old_st.st_mode)) {
+            return -ENOTDIR;
+        }
+        int res = inner->rename(oldpath, newpath, flags);
+        if (res == 0) {
+            store->remove(newpath);
+        }
+        return res;
+    }
+
+    // Plain copies moved along with a directory would no longer be found by the pending removals
+    if (S_ISDIR(old_st.st_mode) || S_ISDIR(new_st.st_mode)) {
+        settle_locked();
+    }
+
+    int res = inner->rename(oldpath, newpath, flags);
+    if (res == 0) {
+        store->move_tree(oldpath, newpath, (flags & RENAME_EXCHANGE) != 0);
+    }
+    return res;
+}
+
+int PackedBackend::link(std::string_view oldpath, std::string_view newpath) {
+    if (hidden(oldpath)) {
+        return -ENOENT;
+    }
+    if (hidden(newpath)) {
+        return -EPERM;
+    }
+
+    std::shared_lock<std::shared_mutex> namespace_lock(namespace_mutex);
+    PairLock lock(path_lock(oldpath), path_lock(newpath));
+
+    if (store->contains(newpath)) {
+        return -EEXIST;
+    }
+
+    // Packed files have a single name, a second one needs the file to be plain
+    int res = unpack(oldpath, false);
+    if (res < 0) {
+        return res;
+    }
+    return inner->link(oldpath, newpath);
+}
+
+int PackedBackend::unlink(std::string_view path) {
+    if (hidden(path)) {
+        return -ENOENT;
+    }
+
+    std::shared_lock<std::shared_mutex> namespace_lock(namespace_mutex);
+    std::lock_guard<std::mutex> lock(path_lock(path));
+
+    if (store->remove(path)) {
+        inner->unlink(path);
+        return 0;
+    }
+    return inner->unlink(path);
+}
+
+int PackedBackend::symlink(std::string_view target, std::string_view linkpath) {
+    if (hidden(linkpath)) {
+        return -EPERM;
+    }
+
+    std::shared_lock<std::shared_mutex> namespace_lock(namespace_mutex);
+    std::lock_guard<std::mutex> lock(path_lock(linkpath));
+    if (store->contains(linkpath)) {
+        return -EEXIST;
+    }
+    return inner->symlink(target, linkpath);
+}
+
+int PackedBackend::readlink(std::string_view path, char *buf, size_t size) {
+    if (hidden(path)) {
+        return -ENOENT;
+    }
+    if (store->contains(path)) {
+        return -EINVAL;
+    }
+    return inner->readlink(path, buf, size);
+}
+
+int PackedBackend::mkdir(std::string_view path, mode_t mode) {
+    if (hidden(path)) {
+        return -EPERM;
+    }
+
+    std::shared_lock<std::shared_mutex> namespace_lock(namespace_mutex);
+    std::lock_guard<std::mutex> lock(path_lock(path));
+    if (store->contains(path)) {
+        return -EEXIST;
+    }
+    return inner->mkdir(path, mode);
+}
+
+int PackedBackend::rmdir(std::string_view path) {
+    if (hidden(path)) {
+        return -ENOENT;
+    }
+
+    std::unique_lock<std::shared_mutex> namespace_lock(namespace_mutex);
+    if (store->contains(path)) {
+        return -ENOTDIR;
+    }
+    if (store->has_entries(path)) {
+        return -ENOTEMPTY;
+    }
+    return inner->rmdir(path);
+}
+
+int PackedBackend::list(std::string_view path, std::vector<std::string> &names) {
+    if (hidden(path)) {
+        return -ENOENT;
+    }
+    if (store->contains(path)) {
+        return -ENOTDIR;
+    }
+
+    size_t first = names.size();
+    int res = inner->list(path, names);
+    if (res < 0) {
+        return res;
+    }
+
+    if (Path::is_root(path)) {
+        names.erase(std::remove(names.begin() + static_cast<std::ptrdiff_t>(first), names.end(), PACK_DIRECTORY),
+                    names.end());
+    }
+
+    std::vector<std::string> packed;
+    store->names(path, packed);
+    if (packed.empty()) {
+        return 0;
+    }
+
+    // Plain copies waiting for removal are listed once
+    std::unordered_set<std::string_view> plain;
+    for (size_t i = first; i < names.size(); i++) {
+        plain.insert(names[i]);
+    }
+    std::vector<std::string> added;
+    for (auto &name : packed) {
+        if (plain.find(name) == plain.end()) {
+            added.push_back(std::move(name));
+        }
+    }
+    names.insert(names.end(), std::make_move_iterator(added.begin()), std::make_move_iterator(added.end()));
+    return 0;
+}
+
+int PackedBackend::opendir(std::string_view path, std::unique_ptr<DirHandle> &handle) {
+    std::vector<std::string> plain;
+    int res = list(path, plain);
+    if (res < 0) {
+        return res;
+    }
+
+    auto listing = std::make_unique<SnapshotListing>(path);
+    listing->items.reserve(plain.size() + 2);
+    listing->add(".", S_IFDIR);
+    listing->add("..", S_IFDIR);
+    for (auto &name : plain) {
+        listing->add(std::move(name), 0);
+    }
+
+    handle = std::move(listing);
+    return 0;
+}
+
+int PackedBackend::readdir(DirHandle &handle, off_t offset, DirFiller &filler) {
+    return static_cast<SnapshotListing &>(handle).read(*this, offset, filler);
+}
+
+int PackedBackend::syncfs() {
+    int res = inner->syncfs();
+    int settled = settle();
+    return res < 0 ? res : settled;
+}
+
+bool PackedBackend::allows_splice() const {
+    return inner->allows_splice();
+}
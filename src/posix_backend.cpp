@@ -0,0 +1,271 @@
+#include "posix_backend.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+
+#include "file_copy.h"
+
+PosixBackend::PosixBackend(const std::string &path)
+    : root(path), io(std::make_shared<SyncIoEngine>()), group_commit(root.root_fd()) {}
+
+void PosixBackend::set_parent_cache_size(size_t capacity) {
+    root.set_cache_capacity(capacity);
+}
+
+void PosixBackend::set_io_engine(std::shared_ptr<IoEngine> engine) {
+    io = std::move(engine);
+}
+
+int PosixBackend::open(std::string_view path, int flags, mode_t mode, std::unique_ptr<FileHandle> &handle) {
+    auto location = root.resolve(path);
+    int fd = ::openat(location.dirfd(), location.name(), flags | O_CLOEXEC, mode);
+    if (fd < 0) {
+        return -errno;
+    }
+
+    handle = std::make_unique<FileHandle>(fd, flags);
+    handle->set_io_slot(io->register_file(fd));
+    return 0;
+}
+
+ssize_t PosixBackend::pread(FileHandle &handle, void *buf, size_t count, off_t offset) {
+    return io->pread(handle, buf, count, offset);
+}
+
+ssize_t PosixBackend::pwrite(FileHandle &handle, const void *buf, size_t count, off_t offset) {
+    return io->pwrite(handle, buf, count, offset);
+}
+
+int PosixBackend::ftruncate(FileHandle &handle, off_t length) {
+    return posix_call_result(::ftruncate, handle.fd(), length);
+}
+
+int PosixBackend::fsync(FileHandle &handle, bool datasync) {
+    return io->fsync(handle, datasync);
+}
+
+int PosixBackend::release(FileHandle &handle) {
+    io->unregister_file(handle.io_slot());
+    return handle.close();
+}
+
+int PosixBackend::truncate(std::string_view path, off_t length) {
+    // There is no truncateat(), a short lived descriptor keeps the lookup relative to the backing directory
+    auto location = root.resolve(path);
+    int fd = ::openat(location.dirfd(), location.name(), O_WRONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -errno;
+    }
+
+    int res = posix_call_result(::ftruncate, fd, length);
+    ::close(fd);
+    return res;
+}
+
+int PosixBackend::copy(std::string_view source, std::string_view destination) {
+    auto source_location = root.resolve(source);
+    int in = ::openat(source_location.dirfd(), source_location.name(), O_RDONLY | O_CLOEXEC);
+    if (in < 0) {
+        return -errno;
+    }
+
+    struct stat st {};
+    if (::fstat(in, &st) != 0) {
+        int error = errno;
+        ::close(in);
+        return -error;
+    }
+
+    auto destination_location = root.resolve(destination);
+    int out = ::openat(destination_location.dirfd(), destination_location.name(),
+                       O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, st.st_mode & 07777);
+    if (out < 0) {
+        int error = errno;
+        ::close(in);
+        return -error;
+    }
+
+    int res = FileCopy::copy(in, out, st.st_size);
+    ::close(in);
+    if (::close(out) != 0 && res == 0) {
+        res = -errno;
+    }
+
+    // A partial copy would look like a valid version
+    if (res < 0) {
+        ::unlinkat(destination_location.dirfd(), destination_location.name(), 0);
+    }
+    return res;
+}
+
+int PosixBackend::stat(std::string_view path, struct stat *st, bool follow) {
+    auto location = root.resolve(path);
+    return io->stat(location.dirfd(), location.name(), st, follow ? 0 : AT_SYMLINK_NOFOLLOW);
+}
+
+int PosixBackend::utimens(std::string_view path, const struct timespec tv[2]) {
+    auto location = root.resolve(path);
+    return posix_call_result(::utimensat, location.dirfd(), location.name(), tv, AT_SYMLINK_NOFOLLOW);
+}
+
+int PosixBackend::chmod(std::string_view path, mode_t mode) {
+    auto location = root.resolve(path);
+    return posix_call_result(::fchmodat, location.dirfd(), location.name(), mode, 0);
+}
+
+int PosixBackend::chown(std::string_view path, uid_t uid, gid_t gid) {
+    auto location = root.resolve(path);
+    return posix_call_result(::fchownat, location.dirfd(), location.name(), uid, gid, AT_SYMLINK_NOFOLLOW);
+}
+
+int PosixBackend::statfs(struct statvfs *stbuf) {
+    return posix_call_result(::fstatvfs, root.root_fd(), stbuf);
+}
+
+int PosixBackend::mknod(std::string_view path, mode_t mode, dev_t dev) {
+    auto location = root.resolve(path);
+    return posix_call_result(::mknodat, location.dirfd(), location.name(), mode, dev);
+}
+
+int PosixBackend::rename(std::string_view oldpath, std::string_view newpath, unsigned int flags) {
+    auto old_location = root.resolve(oldpath);
+    auto new_location = root.resolve(newpath);
+    int res = posix_call_result(::renameat2, old_location.dirfd(), old_location.name(), new_location.dirfd(),
+                                new_location.name(), flags);
+
+    // Cached descriptors follow the moved directory, so neither path may resolve through them anymore
+    root.invalidate(oldpath);
+    root.invalidate(newpath);
+    return res;
+}
+
+int PosixBackend::link(std::string_view oldpath, std::string_view newpath) {
+    auto old_location = root.resolve(oldpath);
+    auto new_location = root.resolve(newpath);
+    return posix_call_result(::linkat, old_location.dirfd(), old_location.name(), new_location.dirfd(),
+                             new_location.name(), 0);
+}
+
+int PosixBackend::unlink(std::string_view path) {
+    auto location = root.resolve(path);
+    int res = posix_call_result(::unlinkat, location.dirfd(), location.name(), 0);
+
+    // The name may have been a symbolic link to a directory, cached descriptors below it point to the target
+    root.invalidate(path);
+    return res;
+}
+
+int PosixBackend::symlink(std::string_view target, std::string_view linkpath) {
+    root.invalidate(linkpath);
+    auto location = root.resolve(linkpath);
+    return posix_call_result(::symlinkat, std::string(target).c_str(), location.dirfd(), location.name());
+}
+
+int PosixBackend::readlink(std::string_view path, char *buf, size_t size) {
+    auto location = root.resolve(path);
+    return posix_call_result(::readlinkat, location.dirfd(), location.name(), buf, size);
+}
+
+int PosixBackend::mkdir(std::string_view path, mode_t mode) {
+    root.invalidate(path);
+    auto location = root.resolve(path);
+    return posix_call_result(::mkdirat, location.dirfd(), location.name(), mode);
+}
+
+int PosixBackend::rmdir(std::string_view path) {
+    auto location = root.resolve(path);
+    int res = posix_call_result(::unlinkat, location.dirfd(), location.name(), AT_REMOVEDIR);
+    root.invalidate(path);
+    return res;
+}
+
+int PosixBackend::list(std::string_view path, std::vector<std::string> &names) {
+    auto location = root.resolve(path);
+    int fd = ::openat(location.dirfd(), location.name(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        return -errno;
+    }
+
+    DIR *dir = ::fdopendir(fd);
+    if (dir == nullptr) {
+        int error = errno;
+        ::close(fd);
+        return -error;
+    }
+
+    while (true) {
+        errno = 0;
+        struct dirent *entry = ::readdir(dir);
+        if (entry == nullptr) {
+            break;
+        }
+
+        std::string_view name(entry->d_name);
+        if (name != "." && name != "..") {
+            names.emplace_back(name);
+        }
+    }
+
+    int res = -errno;
+    ::closedir(dir);
+    return res;
+}
+
+int PosixBackend::opendir(std::string_view path, std::unique_ptr<DirHandle> &handle) {
+    auto location = root.resolve(path);
+    int fd = ::openat(location.dirfd(), location.name(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        return -errno;
+    }
+
+    DIR *dir = ::fdopendir(fd);
+    if (dir == nullptr) {
+        int error = errno;
+        ::close(fd);
+        return -error;
+    }
+
+    handle = std::make_unique<DirHandle>(dir);
+    return 0;
+}
+
+int PosixBackend::readdir(DirHandle &handle, off_t offset, DirFiller &filler) {
+    handle.seek(offset);
+
+    while (true) {
+        errno = 0;
+        struct dirent *entry = ::readdir(handle.dir());
+        if (entry == nullptr) {
+            return -errno;
+        }
+
+        // The offset of an entry is the cookie of the one after it, so a resumed listing continues right there
+        off_t next = ::telldir(handle.dir());
+
+        struct stat stbuf {};
+        bool attributes = filler.wants_attributes(entry->d_name) &&
+                          io->stat(handle.fd(), entry->d_name, &stbuf, AT_SYMLINK_NOFOLLOW) == 0;
+        if (!attributes) {
+            stbuf.st_ino = entry->d_ino;
+            stbuf.st_mode = DTTOIF(entry->d_type);
+        }
+
+        if (filler.add(entry->d_name, &stbuf, next, attributes) == 1) {
+            // The entry did not fit, the stream is already past it
+            handle.set_position(-1);
+            return 0;
+        }
+        handle.set_position(next);
+    }
+}
+
+int PosixBackend::syncfs() {
+    return group_commit.sync();
+}
+
+bool PosixBackend::allows_splice() const {
+    return io->allows_splice();
+}
@@ -0,0 +1,58 @@
+#include "read_ahead.h"
+
+#include <algorithm>
+
+ReadAhead::ReadAhead(size_t max_window)
+    : max_window(max_window),
+      sequential(Metrics::counter("read_ahead.sequential")),
+      random(Metrics::counter("read_ahead.random")),
+      bytes(Metrics::counter("read_ahead.bytes")) {}
+
+void ReadAhead::set_max_window(size_t max_window) {
+    this->max_window = max_window;
+}
+
+ReadAhead::Range ReadAhead::plan(Stream &stream, off_t offset, size_t count) {
+    std::lock_guard<std::mutex> lock(stream.mutex);
+
+    off_t end = offset + static_cast<off_t>(count);
+    bool is_sequential = offset == stream.next;
+    stream.next = end;
+
+    if (!is_sequential) {
+        random.fetch_add(1, std::memory_order_relaxed);
+        stream.window /= 2;
+        stream.prefetched = end;
+        return {};
+    }
+
+    sequential.fetch_add(1, std::memory_order_relaxed);
+    size_t grown = stream.window == 0 ? MIN_WINDOW : stream.window * 2;
+    stream.window = std::min(std::max(grown, MIN_WINDOW), max_window);
+
+    // Prefetch again only once the reader used up half of the previous window, so the advice is not issued per read
+    off_t target = end + static_cast<off_t>(stream.window);
+    off_t start = std::max(stream.prefetched, end);
+    if (target - start < static_cast<off_t>(stream.window / 2)) {
+        return {};
+    }
+
+    stream.prefetched = target;
+    return {start, static_cast<size_t>(target - start)};
+}
+
+void ReadAhead::advise(StorageBackend &backend, FileHandle &handle, off_t offset, size_t count) {
+    if (!enabled()) {
+        return;
+    }
+
+    Range range = plan(handle.state<Stream>(), offset, count);
+    if (range.length == 0) {
+        return;
+    }
+
+    // Prefetching only starts the reads, failures do not matter for the reader
+    if (backend.prefetch(handle, range.offset, range.length) == 0) {
+        bytes.fetch_add(range.length, std::memory_order_relaxed);
+    }
+}
@@ -0,0 +1,693 @@
+#include "sidecar_backend.h"
+
+#include <fcntl.h>
+#include <sodium.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+#include <map>
+
+#include "backend_listing.h"
+#include "common/logging.h"
+#include "common/path.h"
+#include "common/prefix_parser.h"
+
+namespace {
+
+/// Bytes of the hash naming the metadata directory of a directory, the first one picks its shard
+constexpr size_t DIGEST_SIZE = 16;
+
+/// Suffixes of the intent file of a rename while its metadata directories are parked and once they all are
+constexpr std::string_view PARKING = ".moves";
+constexpr std::string_view PARKED = ".parked";
+
+/// Path without empty and "." components or slashes around it, so that every spelling of a directory hashes the same
+std::string normalize(std::string_view path) {
+    std::string normalized;
+    while (!path.empty()) {
+        size_t slash = path.find('/');
+        std::string_view component = path.substr(0, slash);
+        path.remove_prefix(slash == std::string_view::npos ? path.size() : slash + 1);
+        if (component.empty() || component == ".") {
+            continue;
+        }
+        if (!normalized.empty()) {
+            normalized += '/';
+        }
+        normalized += component;
+    }
+    return normalized;
+}
+
+std::string to_hex(const unsigned char *data, size_t length) {
+    static const char digits[] = "0123456789abcdef";
+    std::string hex;
+    hex.reserve(length * 2);
+    for (size_t i = 0; i < length; i++) {
+        hex += digits[data[i] >> 4];
+        hex += digits[data[i] & 0xf];
+    }
+    return hex;
+}
+
+}  // namespace
+
+/// Hides the metadata directory from listings of the root
+class SidecarBackend::Filler : public StorageBackend::DirFiller {
+public:
+    explicit Filler(DirFiller &wrapped) : wrapped(wrapped) {}
+
+    bool wants_attributes(std::string_view name) override {
+        return name != METADATA_DIRECTORY && wrapped.wants_attributes(name);
+    }
+
+    int add(std::string_view name, const struct stat *st, off_t next, bool attributes) override {
+        if (name == METADATA_DIRECTORY) {
+            return 0;
+        }
+        return wrapped.add(name, st, next, attributes);
+    }
+
+private:
+    DirFiller &wrapped;
+};
+
+SidecarBackend::SidecarBackend(std::shared_ptr<StorageBackend> inner)
+    : inner(std::move(inner)), staging_directory(std::string("/") + METADATA_DIRECTORY + "/staging") {
+#ifndef __aarch64__
+    if (sodium_init() == -1) {
+        throw std::runtime_error("Sodium failed to initialize");
+    }
+#endif
+
+    struct stat st {};
+    bool fresh = this->inner->stat(std::string("/") + METADATA_DIRECTORY, &st, false) == -ENOENT;
+    this->inner->mkdir(std::string("/") + METADATA_DIRECTORY, 0700);
+    this->inner->mkdir(staging_directory, 0700);
+
+    recover();
+
+    if (fresh) {
+        size_t moved = migrate("/");
+        if (moved > 0) {
+            Logging::Info("Moved %zu sidecar files into the metadata tree", moved);
+        }
+    }
+}
+
+bool SidecarBackend::hidden(std::string_view path) {
+    size_t start = path.find_first_not_of('/');
+    if (start == std::string_view::npos) {
+        return false;
+    }
+    std::string_view first = path.substr(start, path.find('/', start) - start);
+    return first == METADATA_DIRECTORY;
+}
+
+std::string SidecarBackend::metadata_directory(std::string_view directory) {
+    std::string key = normalize(directory);
+    unsigned char digest[DIGEST_SIZE];
+    crypto_generichash(digest, sizeof(digest), reinterpret_cast<const unsigned char *>(key.data()), key.size(),
+                       nullptr, 0);
+
+    std::string hex = to_hex(digest, sizeof(digest));
+    return std::string("/") + METADATA_DIRECTORY + "/" + hex.substr(0, 2) + "/" + hex.substr(2);
+}
+
+std::string SidecarBackend::bucket_directory(std::string_view directory, std::string_view name) {
+    // All sidecars of an entry share its bucket, however many prefixes they carry
+    std::string base = PrefixParser::get_nonprefixed(std::string(name));
+    unsigned char digest[8];
+    crypto_generichash(digest, sizeof(digest), reinterpret_cast<const unsigned char *>(base.data()), base.size(),
+                       nullptr, 0);
+
+    char bucket[8];
+    std::snprintf(bucket, sizeof(bucket), "%02x", digest[0] % BUCKETS);
+    return Path::join(metadata_directory(directory), bucket);
+}
+
+std::string SidecarBackend::locate(std::string_view path) const {
+    // Only the last prefixed component counts, everything below it is kept in the metadata tree as it is
+    size_t end = path.size();
+    while (end > 0) {
+        size_t slash = path.rfind('/', end - 1);
+        size_t start = slash == std::string_view::npos ? 0 : slash + 1;
+        std::string_view component = path.substr(start, end - start);
+        if (!component.empty() && PrefixParser::is_prefixed(component)) {
+            std::string_view directory = start == 0 ? std::string_view("/") : path.substr(0, start);
+            return Path::join(bucket_directory(directory, component), path.substr(start));
+        }
+        if (slash == std::string_view::npos) {
+            break;
+        }
+        end = slash;
+    }
+    return std::string(path);
+}
+
+int SidecarBackend::create(std::string_view path, const std::function<int()> &operation) {
+    int res = operation();
+    if (res != -ENOENT || !PrefixParser::is_prefixed(path)) {
+        return res;
+    }
+
+    res = prepare(path);
+    if (res < 0) {
+        return res;
+    }
+    return operation();
+}
+
+int SidecarBackend::prepare(std::string_view path) {
+    // Sidecars only exist next to an existing directory, like the prefixed files they replace
+    std::string_view directory = Path::view_parent(path);
+    struct stat st {};
+    int res = inner->stat(locate(directory), &st, true);
+    if (res < 0) {
+        return res;
+    }
+    if (!S_ISDIR(st.st_mode)) {
+        return -ENOTDIR;
+    }
+
+    std::string bucket = bucket_directory(directory, Path::view_basename(path));
+    std::string metadata(Path::view_parent(bucket));
+    for (const auto &level : {std::string(Path::view_parent(metadata)), metadata, bucket}) {
+        res = inner->mkdir(level, 0700);
+        if (res < 0 && res != -EEXIST) {
+            return res;
+        }
+    }
+    return 0;
+}
+
+void SidecarBackend::remove_tree(const std::string &path) {
+    struct stat st {};
+    if (inner->stat(path, &st, false) < 0) {
+        return;
+    }
+    if (!S_ISDIR(st.st_mode)) {
+        inner->unlink(path);
+        return;
+    }
+
+    std::vector<std::string> names;
+    inner->list(path, names);
+    for (const auto &name : names) {
+        remove_tree(Path::join(path, name));
+    }
+    inner->rmdir(path);
+}
+
+void SidecarBackend::subdirectories(const std::string &directory, const std::string &relative,
+                                    std::vector<std::string> &found) {
+    std::vector<std::string> names;
+    inner->list(directory, names);
+    for (const auto &name : names) {
+        std::string path = Path::join(directory, name);
+        struct stat st {};
+        if (!hidden(path) && inner->stat(path, &st, false) == 0 && S_ISDIR(st.st_mode)) {
+            std::string below = relative.empty() ? name : relative + "/" + name;
+            found.push_back(below);
+            subdirectories(path, below, found);
+        }
+    }
+}
+
+void SidecarBackend::move_metadata(const Moves &moves) {
+    if (moves.empty()) {
+        return;
+    }
+
+    std::string base = Path::join(staging_directory, std::to_string(next_staging.fetch_add(1)));
+    std::string intent = base + std::string(PARKING);
+    int res = write_intent(intent, moves);
+    if (res < 0) {
+        Logging::Error("Failed to record moving sidecars: %s", strerror(-res));
+        inner->unlink(intent);
+    }
+
+    // Everything is parked first, so that exchanged directories do not overwrite each other
+    park(base, moves);
+    if (res == 0 && inner->rename(intent, base + std::string(PARKED), 0) == 0) {
+        intent = base + std::string(PARKED);
+    }
+    place(base, moves);
+    if (res == 0) {
+        inner->unlink(intent);
+    }
+}
+
+int SidecarBackend::write_intent(const std::string &intent, const Moves &moves) {
+    std::string content;
+    for (const auto &[source, destination] : moves) {
+        content += source + " " + destination + "\n";
+    }
+
+    std::unique_ptr<FileHandle> handle;
+    int res = inner->open(intent, O_WRONLY | O_CREAT | O_EXCL, 0600, handle);
+    if (res < 0) {
+        return res;
+    }
+    for (size_t done = 0; res == 0 && done < content.size();) {
+        ssize_t written = inner->pwrite(*handle, content.data() + done, content.size() - done,
+                                        static_cast<off_t>(done));
+        if (written < 0) {
+            res = static_cast<int>(written);
+        }
+        done += std::max<ssize_t>(written, 0);
+    }
+    if (res == 0) {
+        res = inner->fsync(*handle, false);
+    }
+    int released = inner->release(*handle);
+    return res < 0 ? res : released;
+}
+
+int SidecarBackend::read_intent(const std::string &intent, Moves &moves) {
+    std::unique_ptr<FileHandle> handle;
+    int res = inner->open(intent, O_RDONLY, 0, handle);
+    if (res < 0) {
+        return res;
+    }
+
+    std::string content;
+    char buffer[4096];
+    ssize_t length;
+    while ((length = inner->pread(*handle, buffer, sizeof(buffer), static_cast<off_t>(content.size()))) > 0) {
+        content.append(buffer, length);
+    }
+    inner->release(*handle);
+    if (length < 0) {
+        return static_cast<int>(length);
+    }
+
+    // A record cut short by the crash means nothing was parked yet
+    std::string_view rest(content);
+    while (!rest.empty()) {
+        size_t end = rest.find('\n');
+        size_t space = rest.find(' ');
+        if (end == std::string_view::npos || space >= end) {
+            return -EIO;
+        }
+        moves.emplace_back(rest.substr(0, space), rest.substr(space + 1, end - space - 1));
+        rest.remove_prefix(end + 1);
+    }
+    return 0;
+}
+
+void SidecarBackend::park(const std::string &base, const Moves &moves) {
+    for (size_t i = 0; i < moves.size(); i++) {
+        std::string parked = base + "." + std::to_string(i);
+        struct stat st {};
+        if (inner->stat(parked, &st, false) == 0) {
+            continue;
+        }
+        if (inner->rename(moves[i].first, parked, 0) < 0) {
+            // So that the destination is cleared all the same when the move is finished after a crash
+            inner->mkdir(parked, 0700);
+        }
+    }
+}
+
+void SidecarBackend::place(const std::string &base, const Moves &moves) {
+    for (size_t i = 0; i < moves.size(); i++) {
+        // A parked directory which is gone was placed already
+        std::string parked = base + "." + std::to_string(i);
+        struct stat st {};
+        if (inner->stat(parked, &st, false) < 0) {
+            continue;
+        }
+
+        // Whatever is left at the destination belonged to a directory which no longer exists
+        const std::string &destination = moves[i].second;
+        remove_tree(destination);
+        if (inner->rmdir(parked) == 0) {
+            continue;
+        }
+
+        inner->mkdir(Path::view_parent(destination), 0700);
+        int res = inner->rename(parked, destination, 0);
+        if (res < 0) {
+            Logging::Error("Failed to move sidecars to %s: %s", destination.c_str(), strerror(-res));
+            remove_tree(parked);
+        }
+    }
+}
+
+void SidecarBackend::recover() {
+    std::vector<std::string> names;
+    inner->list(staging_directory, names);
+
+    // Renames are finished in the order they were made, a later one may have taken a destination of an earlier one
+    std::map<uint64_t, std::string> intents;
+    for (const auto &name : names) {
+        size_t dot = name.find('.');
+        std::string_view suffix = dot == std::string::npos ? std::string_view() : std::string_view(name).substr(dot);
+        uint64_t id = 0;
+        auto [end, error] = std::from_chars(name.data(), name.data() + std::min(dot, name.size()), id);
+        if ((suffix == PARKING || suffix == PARKED) && error == std::errc() && end == name.data() + dot) {
+            intents.emplace(id, name);
+        }
+    }
+
+    for (const auto &[id, name] : intents) {
+        std::string base = Path::join(staging_directory, std::to_string(id));
+        std::string intent = Path::join(staging_directory, name);
+        Moves moves;
+        if (read_intent(intent, moves) == 0) {
+            Logging::Warn("Finishing a rename of sidecars interrupted by a crash");
+            if (std::string_view(name).substr(name.find('.')) == PARKING) {
+                park(base, moves);
+            }
+            place(base, moves);
+        }
+        inner->unlink(intent);
+    }
+
+    // What is left was not recorded and cannot be told apart anymore
+    names.clear();
+    inner->list(staging_directory, names);
+    for (const auto &name : names) {
+        Logging::Warn("Deleting sidecars left behind by an interrupted rename");
+        remove_tree(Path::join(staging_directory, name));
+    }
+}
+
+size_t SidecarBackend::migrate(const std::string &directory) {
+    std::vector<std::string> names;
+    if (inner->list(directory, names) < 0) {
+        return 0;
+    }
+
+    size_t moved = 0;
+    for (const auto &name : names) {
+        std::string path = Path::join(directory, name);
+        if (hidden(path)) {
+            continue;
+        }
+
+        struct stat st {};
+        if (PrefixParser::is_prefixed(name)) {
+            if (prepare(path) == 0 && inner->rename(path, locate(path), RENAME_NOREPLACE) == 0) {
+                moved++;
+            }
+        } else if (inner->stat(path, &st, false) == 0 && S_ISDIR(st.st_mode)) {
+            moved += migrate(path);
+        }
+    }
+    return moved;
+}
+
+int SidecarBackend::open(std::string_view path, int flags, mode_t mode, std::unique_ptr<FileHandle> &handle) {
+    if (hidden(path)) {
+        return (flags & O_CREAT) ? -EPERM : -ENOENT;
+    }
+    std::shared_lock<std::shared_mutex> namespace_lock(namespace_mutex);
+
+    std::string located = locate(path);
+    if (!(flags & O_CREAT)) {
+        return inner->open(located, flags, mode, handle);
+    }
+    return create(path, [&]() { return inner->open(located, flags, mode, handle); });
+}
+
+ssize_t SidecarBackend::pread(FileHandle &handle, void *buf, size_t count, off_t offset) {
+    return inner->pread(handle, buf, count, offset);
+}
+
+ssize_t SidecarBackend::pwrite(FileHandle &handle, const void *buf, size_t count, off_t offset) {
+    return inner->pwrite(handle, buf, count, offset);
+}
+
+int SidecarBackend::ftruncate(FileHandle &handle, off_t length) {
+    return inner->ftruncate(handle, length);
+}
+
+int SidecarBackend::fsync(FileHandle &handle, bool datasync) {
+    return inner->fsync(handle, datasync);
+}
+
+int SidecarBackend::release(FileHandle &handle) {
+    return inner->release(handle);
+}
+
+int SidecarBackend::fstat(FileHandle &handle, struct stat *st) {
+    return inner->fstat(handle, st);
+}
+
+int SidecarBackend::prefetch(FileHandle &handle, off_t offset, size_t length) {
+    return inner->prefetch(handle, offset, length);
+}
+
+int SidecarBackend::truncate(std::string_view path, off_t length) {
+    if (hidden(path)) {
+        return -ENOENT;
+    }
+    std::shared_lock<std::shared_mutex> namespace_lock(namespace_mutex);
+    return inner->truncate(locate(path), length);
+}
+
+int SidecarBackend::copy(std::string_view source, std::string_view destination) {
+    if (hidden(source)) {
+        return -ENOENT;
+    }
+    if (hidden(destination)) {
+        return -EPERM;
+    }
+    std::shared_lock<std::shared_mutex> namespace_lock(namespace_mutex);
+
+    std::string from = locate(source);
+    std::string to = locate(destination);
+    return create(destination, [&]() { return inner->copy(from, to); });
+}
+
+int SidecarBackend::stat(std::string_view path, struct stat *st, bool follow) {
+    if (hidden(path)) {
+        return -ENOENT;
+    }
+    std::shared_lock<std::shared_mutex> namespace_lock(namespace_mutex);
+    return inner->stat(locate(path), st, follow);
+}
+
+int SidecarBackend::utimens(std::string_view path, const struct timespec tv[2]) {
+    if (hidden(path)) {
+        return -ENOENT;
+    }
+    std::shared_lock<std::shared_mutex> namespace_lock(namespace_mutex);
+    return inner->utimens(locate(path), tv);
+}
+
+int SidecarBackend::chmod(std::string_view path, mode_t mode) {
+    if (hidden(path)) {
+        return -ENOENT;
+    }
+    std::shared_lock<std::shared_mutex> namespace_lock(namespace_mutex);
+    return inner->chmod(locate(path), mode);
+}
+
+int SidecarBackend::chown(std::string_view path, uid_t uid, gid_t gid) {
+    if (hidden(path)) {
+        return -ENOENT;
+    }
+    std::shared_lock<std::shared_mutex> namespace_lock(namespace_mutex);
+    return inner->chown(locate(path), uid, gid);
+}
+
+int SidecarBackend::statfs(struct statvfs *stbuf) {
+    return inner->statfs(stbuf);
+}
+
+int SidecarBackend::mknod(std::string_view path, mode_t mode, dev_t dev) {
+    if (hidden(path)) {
+        return -EPERM;
+    }
+    std::shared_lock<std::shared_mutex> namespace_lock(namespace_mutex);
+
+    std::string located = locate(path);
+    return create(path, [&]() { return inner->mknod(located, mode, dev); });
+}
+
+int SidecarBackend::rename(std::string_view oldpath, std::string_view newpath, unsigned int flags) {
+    if (hidden(oldpath)) {
+        return -ENOENT;
+    }
+    if (hidden(newpath)) {
+        return -EPERM;
+    }
+
+    std::string from = locate(oldpath);
+    std::string to = locate(newpath);
+
+    // Renamed sidecars stay in their buckets, anything else may be a directory whose metadata moves along
+    bool plain = from == oldpath && to == newpath;
+    std::shared_lock<std::shared_mutex> shared(namespace_mutex, std::defer_lock);
+    std::unique_lock<std::shared_mutex> exclusive(namespace_mutex, std::defer_lock);
+    if (plain) {
+        exclusive.lock();
+    } else {
+        shared.lock();
+    }
+
+    // A directory takes the metadata of its whole subtree along, which has to be collected before the paths change
+    std::vector<std::pair<std::string, std::string>> moves;
+    auto collect = [&](std::string_view source, std::string_view target) {
+        struct stat st {};
+        if (inner->stat(source, &st, false) < 0 || !S_ISDIR(st.st_mode)) {
+            return;
+        }
+
+        std::vector<std::string> below{""};
+        subdirectories(std::string(source), "", below);
+        for (const auto &relative : below) {
+            moves.emplace_back(metadata_directory(Path::join(source, relative)),
+                               metadata_directory(Path::join(target, relative)));
+        }
+    };
+    if (plain) {
+        collect(oldpath, newpath);
+        if (flags & RENAME_EXCHANGE) {
+            collect(newpath, oldpath);
+        }
+    }
+
+    int res = create(newpath, [&]() { return inner->rename(from, to, flags); });
+    if (res == 0) {
+        move_metadata(moves);
+    }
+    return res;
+}
+
+int SidecarBackend::link(std::string_view oldpath, std::string_view newpath) {
+    if (hidden(oldpath)) {
+        return -ENOENT;
+    }
+    if (hidden(newpath)) {
+        return -EPERM;
+    }
+    std::shared_lock<std::shared_mutex> namespace_lock(namespace_mutex);
+
+    std::string from = locate(oldpath);
+    std::string to = locate(newpath);
+    return create(newpath, [&]() { return inner->link(from, to); });
+}
+
+int SidecarBackend::unlink(std::string_view path) {
+    if (hidden(path)) {
+        return -ENOENT;
+    }
+    std::shared_lock<std::shared_mutex> namespace_lock(namespace_mutex);
+    return inner->unlink(locate(path));
+}
+
+int SidecarBackend::symlink(std::string_view target, std::string_view linkpath) {
+    if (hidden(linkpath)) {
+        return -EPERM;
+    }
+    std::shared_lock<std::shared_mutex> namespace_lock(namespace_mutex);
+
+    std::string located = locate(linkpath);
+    return create(linkpath, [&]() { return inner->symlink(target, located); });
+}
+
+int SidecarBackend::readlink(std::string_view path, char *buf, size_t size) {
+    if (hidden(path)) {
+        return -ENOENT;
+    }
+    std::shared_lock<std::shared_mutex> namespace_lock(namespace_mutex);
+    return inner->readlink(locate(path), buf, size);
+}
+
+int SidecarBackend::mkdir(std::string_view path, mode_t mode) {
+    if (hidden(path)) {
+        return -EPERM;
+    }
+    std::shared_lock<std::shared_mutex> namespace_lock(namespace_mutex);
+
+    std::string located = locate(path);
+    return create(path, [&]() { return inner->mkdir(located, mode); });
+}
+
+int SidecarBackend::rmdir(std::string_view path) {
+    if (hidden(path)) {
+        return -ENOENT;
+    }
+
+    // The sidecars of the entries of a directory go with it, like they did when they were stored inside it
+    std::unique_lock<std::shared_mutex> namespace_lock(namespace_mutex);
+    std::string located = locate(path);
+    int res = inner->rmdir(located);
+    if (res == 0 && located == path) {
+        remove_tree(metadata_directory(path));
+    }
+    return res;
+}
+
+int SidecarBackend::list(std::string_view path, std::vector<std::string> &names) {
+    if (hidden(path)) {
+        return -ENOENT;
+    }
+    std::shared_lock<std::shared_mutex> namespace_lock(namespace_mutex);
+
+    size_t first = names.size();
+    int res = inner->list(locate(path), names);
+    if (res == 0 && Path::is_root(path)) {
+        names.erase(std::remove(names.begin() + static_cast<std::ptrdiff_t>(first), names.end(), METADATA_DIRECTORY),
+                    names.end());
+    }
+    return res;
+}
+
+int SidecarBackend::list_sidecars(std::string_view directory, std::string_view name,
+                                  std::vector<std::string> &names) {
+    std::shared_lock<std::shared_mutex> namespace_lock(namespace_mutex);
+    std::vector<std::string> entries;
+    int res = inner->list(bucket_directory(directory, name), entries);
+    if (res == -ENOENT) {
+        return 0;
+    }
+
+    // Other entries hashed into the same bucket are skipped
+    for (auto &entry : entries) {
+        if (PrefixParser::get_nonprefixed(entry) == name) {
+            names.push_back(std::move(entry));
+        }
+    }
+    return res;
+}
+
+int SidecarBackend::opendir(std::string_view path, std::unique_ptr<DirHandle> &handle) {
+    if (hidden(path)) {
+        return -ENOENT;
+    }
+    std::shared_lock<std::shared_mutex> namespace_lock(namespace_mutex);
+
+    std::unique_ptr<DirHandle> wrapped;
+    int res = inner->opendir(locate(path), wrapped);
+    if (res == 0) {
+        handle = std::make_unique<InnerListing>(std::move(wrapped), path);
+    }
+    return res;
+}
+
+int SidecarBackend::readdir(DirHandle &handle, off_t offset, DirFiller &filler) {
+    auto &listing = static_cast<InnerListing &>(handle);
+    std::lock_guard<std::mutex> lock(listing.inner->lock);
+    if (!Path::is_root(listing.path)) {
+        return inner->readdir(*listing.inner, offset, filler);
+    }
+
+    Filler wrapper(filler);
+    return inner->readdir(*listing.inner, offset, wrapper);
+}
+
+int SidecarBackend::syncfs() {
+    return inner->syncfs();
+}
+
+bool SidecarBackend::allows_splice() const {
+    return inner->allows_splice();
+}
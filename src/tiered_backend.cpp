@@ -0,0 +1,1014 @@
+#include "tiered_backend.h"
+
+#include <fcntl.h>
+#include <linux/limits.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <unordered_set>
+
+#include "backend_helpers.h"
+#include "backend_listing.h"
+#include "common/config.h"
+#include "common/logging.h"
+#include "common/path.h"
+#include "common/prefix_parser.h"
+
+using BackendHelpers::is_writable;
+using BackendHelpers::same_time;
+using BackendHelpers::PairLock;
+
+namespace {
+
+std::chrono::system_clock::time_point time_point(const struct timespec &ts) {
+    return std::chrono::system_clock::time_point(std::chrono::duration_cast<std::chrono::system_clock::duration>(
+        std::chrono::seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec)));
+}
+
+}  // namespace
+
+/// Tier a handle was opened on, attached to the handle of that tier
+struct TieredBackend::Residence : FileHandle::State {
+    Tier tier = FAST;
+
+    /// Whether the handle counts as a writer of the inode
+    bool writer = false;
+    ino_t ino = 0;
+};
+
+TieredBackend::TieredBackend(std::shared_ptr<StorageBackend> fast, std::shared_ptr<StorageBackend> capacity,
+                             const Settings &settings)
+    : tiers{std::move(fast), std::move(capacity)},
+      settings(settings),
+      promoted(Metrics::counter("tiering.promoted")),
+      demoted(Metrics::counter("tiering.demoted")),
+      migrated_bytes(Metrics::counter("tiering.migrated_bytes")) {
+    if (!tiers[FAST] || !tiers[CAPACITY]) {
+        throw std::runtime_error("Both tiers need a store");
+    }
+
+    clean_staging();
+    migrator = std::thread(&TieredBackend::migration_loop, this);
+}
+
+TieredBackend::TieredBackend(std::shared_ptr<StorageBackend> fast, std::shared_ptr<StorageBackend> capacity)
+    : TieredBackend(std::move(fast), std::move(capacity), Settings()) {}
+
+TieredBackend::~TieredBackend() {
+    {
+        std::lock_guard<std::mutex> lock(thread_mutex);
+        stopping = true;
+    }
+    wakeup.notify_all();
+    migrator.join();
+}
+
+bool TieredBackend::hidden(std::string_view path) {
+    size_t start = path.find_first_not_of('/');
+    if (start == std::string_view::npos) {
+        return false;
+    }
+    std::string_view first = path.substr(start, path.find('/', start) - start);
+    return first == STAGING_DIRECTORY;
+}
+
+bool TieredBackend::is_version(std::string_view path) {
+    return PrefixParser::contains_prefix(path, Config::versioning.prefix);
+}
+
+std::mutex &TieredBackend::path_lock(std::string_view path) {
+    return path_locks[std::hash<std::string_view>()(path) % PATH_LOCKS];
+}
+
+bool TieredBackend::pinned(std::string_view path) const {
+    for (std::string_view prefix : settings.pinned) {
+        while (!prefix.empty() && prefix.back() == '/') {
+            prefix.remove_suffix(1);
+        }
+        if (path.compare(0, prefix.size(), prefix) == 0 &&
+            (path.size() == prefix.size() || path[prefix.size()] == '/')) {
+            return true;
+        }
+    }
+    return false;
+}
+
+TieredBackend::Tier TieredBackend::residence(FileHandle &handle) {
+    auto *residence = handle.find_state<Residence>();
+    return residence == nullptr ? FAST : residence->tier;
+}
+
+int TieredBackend::tier(std::string_view path, Tier &tier) {
+    if (hidden(path)) {
+        return -ENOENT;
+    }
+    struct stat st {};
+    return locate(path, tier, &st, false);
+}
+
+int TieredBackend::locate(std::string_view path, Tier &tier, struct stat *st, bool follow) {
+    int res = tiers[FAST]->stat(path, st, follow);
+    if (res != -ENOENT) {
+        tier = FAST;
+        return res;
+    }
+
+    // A symbolic link may lead to a file on the capacity tier, where the link has a copy
+    res = tiers[CAPACITY]->stat(path, st, follow);
+    if (res == 0) {
+        tier = CAPACITY;
+        return 0;
+    }
+    tier = FAST;
+    return -ENOENT;
+}
+
+bool TieredBackend::on_capacity(std::string_view path) {
+    struct stat st {};
+    return tiers[CAPACITY]->stat(path, &st, false) == 0;
+}
+
+int TieredBackend::prepare_parents(std::string_view path, bool durable) {
+    std::string_view parent = Path::view_parent(path);
+    struct stat st {};
+    if (Path::is_root(parent) || tiers[CAPACITY]->stat(parent, &st, true) == 0) {
+        return 0;
+    }
+
+    int res = prepare_parents(parent, durable);
+    if (res < 0) {
+        return res;
+    }
+
+    res = tiers[FAST]->stat(parent, &st, false);
+    if (res < 0) {
+        return res;
+    }
+    if (S_ISDIR(st.st_mode)) {
+        res = tiers[CAPACITY]->mkdir(parent, st.st_mode & 07777);
+    } else if (S_ISLNK(st.st_mode)) {
+        char target[PATH_MAX];
+        res = tiers[FAST]->readlink(parent, target, sizeof(target));
+        if (res >= 0) {
+            res = tiers[CAPACITY]->symlink(std::string_view(target, res), parent);
+        }
+    } else {
+        return -ENOTDIR;
+    }
+    if (res == 0 && durable) {
+        res = sync_directory(CAPACITY, Path::view_parent(parent));
+    }
+    return res == -EEXIST ? 0 : res;
+}
+
+int TieredBackend::sync_directory(Tier tier, std::string_view path) {
+    std::unique_ptr<FileHandle> directory;
+    int res = tiers[tier]->open(path, O_RDONLY | O_DIRECTORY, 0, directory);
+    if (res < 0) {
+        return res;
+    }
+    res = tiers[tier]->fsync(*directory, false);
+    int released = tiers[tier]->release(*directory);
+    return res < 0 ? res : released;
+}
+
+void TieredBackend::replicate_link(const std::string &path) {
+    std::shared_lock<std::shared_mutex> namespace_lock(namespace_mutex);
+    std::lock_guard<std::mutex> lock(path_lock(path));
+
+    struct stat st {};
+    if (on_capacity(path) || tiers[FAST]->stat(path, &st, false) < 0 || !S_ISLNK(st.st_mode)) {
+        return;
+    }
+
+    char target[PATH_MAX];
+    int length = tiers[FAST]->readlink(path, target, sizeof(target));
+    if (length >= 0 && prepare_parents(path) == 0) {
+        tiers[CAPACITY]->symlink(std::string_view(target, length), path);
+    }
+}
+
+void TieredBackend::move_heat(std::string_view from, std::string_view to, bool exchange) {
+    std::lock_guard<std::mutex> lock(heat_mutex);
+    if (exchange) {
+        auto first = heat.find(from);
+        auto second = heat.find(to);
+        Heat moved_from = first == heat.end() ? Heat{} : first->second;
+        Heat moved_to = second == heat.end() ? Heat{} : second->second;
+        heat[std::string(from)] = moved_to;
+        heat[std::string(to)] = moved_from;
+        return;
+    }
+
+    std::vector<std::pair<std::string, Heat>> moved;
+    for (auto it = heat.lower_bound(from); it != heat.end() && it->first.compare(0, from.size(), from) == 0;) {
+        if (it->first.size() == from.size() || it->first[from.size()] == '/') {
+            moved.emplace_back(std::string(to) + it->first.substr(from.size()), it->second);
+            it = heat.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    for (auto &[path, value] : moved) {
+        heat[path] = value;
+    }
+}
+
+int TieredBackend::drop(Tier tier, std::string_view path) {
+    std::unique_lock<std::shared_mutex> lock(listing_mutex);
+    return tiers[tier]->unlink(path);
+}
+
+void TieredBackend::record_access(const std::string &path, Tier tier) {
+    auto now = std::chrono::system_clock::now();
+    bool hot;
+    {
+        std::lock_guard<std::mutex> lock(heat_mutex);
+        Heat &entry = heat[path];
+        if (now - entry.last > settings.cold_after) {
+            entry.accesses = 0;
+        }
+        entry.accesses++;
+        entry.last = now;
+        hot = entry.accesses >= settings.promote_after;
+    }
+
+    // Reading an old version is usually a one-off restore, versions stay where they are
+    if (tier == CAPACITY && hot && !is_version(path)) {
+        std::lock_guard<std::mutex> lock(thread_mutex);
+        if (promotions.size() < MAX_QUEUED && promotions.insert(path).second) {
+            wakeup.notify_all();
+        }
+    }
+}
+
+bool TieredBackend::is_cold(const std::string &path, const struct stat &st) {
+    auto last = std::max(time_point(st.st_mtim), time_point(st.st_atim));
+    {
+        std::lock_guard<std::mutex> lock(heat_mutex);
+        auto it = heat.find(path);
+        if (it != heat.end()) {
+            last = std::max(last, it->second.last);
+        }
+    }
+    return std::chrono::system_clock::now() - last >= settings.cold_after;
+}
+
+bool TieredBackend::throttle(Budget &budget, size_t bytes) {
+    budget.bytes += bytes;
+
+    std::unique_lock<std::mutex> lock(thread_mutex);
+    if (settings.rate > 0) {
+        auto due = budget.start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                      std::chrono::duration<double>(static_cast<double>(budget.bytes) /
+                                                                    static_cast<double>(settings.rate)));
+        wakeup.wait_until(lock, due, [this]() { return stopping; });
+    }
+    return !stopping;
+}
+
+int TieredBackend::stage(const std::string &path, Tier from, const struct stat &st, const std::string &staging,
+                         Budget &budget) {
+    StorageBackend &source = *tiers[from];
+    StorageBackend &destination = *tiers[from == FAST ? CAPACITY : FAST];
+
+    int res = destination.mkdir(std::string("/") + STAGING_DIRECTORY, 0700);
+    if (res < 0 && res != -EEXIST) {
+        return res;
+    }
+
+    std::unique_ptr<FileHandle> input;
+    res = source.open(path, O_RDONLY, 0, input);
+    if (res < 0) {
+        return res;
+    }
+    std::unique_ptr<FileHandle> output;
+    res = destination.open(staging, O_WRONLY | O_CREAT | O_EXCL, 0600, output);
+    if (res < 0) {
+        source.release(*input);
+        return res;
+    }
+
+    std::vector<char> buffer(COPY_BUFFER);
+    off_t offset = 0;
+    while (true) {
+        ssize_t length = source.pread(*input, buffer.data(), buffer.size(), offset);
+        if (length <= 0) {
+            res = static_cast<int>(length);
+            break;
+        }
+        for (ssize_t done = 0; done < length;) {
+            ssize_t written = destination.pwrite(*output, buffer.data() + done, length - done, offset + done);
+            if (written < 0) {
+                res = static_cast<int>(written);
+                break;
+            }
+            done += written;
+        }
+        if (res < 0) {
+            break;
+        }
+        offset += length;
+        if (!throttle(budget, length)) {
+            res = -ECANCELED;
+            break;
+        }
+    }
+    if (res == 0) {
+        res = destination.fsync(*output, false);
+    }
+    source.release(*input);
+    int released = destination.release(*output);
+    if (res < 0 || released < 0) {
+        return res < 0 ? res : released;
+    }
+
+    // Ownership can only be kept when running as root, the copy then belongs to the user running the VFS
+    struct timespec times[2] = {st.st_atim, st.st_mtim};
+    destination.chown(staging, st.st_uid, st.st_gid);
+    res = destination.chmod(staging, st.st_mode & 07777);
+    if (res == 0) {
+        res = destination.utimens(staging, times);
+    }
+    if (res == 0) {
+        migrated_bytes.fetch_add(offset, std::memory_order_relaxed);
+    }
+    return res;
+}
+
+bool TieredBackend::move(const std::string &path, Tier from, const struct stat &st, Budget &budget) {
+    {
+        std::lock_guard<std::mutex> lock(writers_mutex);
+        if (writers.count({from, st.st_ino}) > 0) {
+            return false;
+        }
+    }
+
+    Tier to = from == FAST ? CAPACITY : FAST;
+    std::string staging = Path::join(std::string("/") + STAGING_DIRECTORY, std::to_string(next_staging++));
+    int res = stage(path, from, st, staging, budget);
+
+    if (res == 0) {
+        std::shared_lock<std::shared_mutex> namespace_lock(namespace_mutex);
+        std::lock_guard<std::mutex> lock(path_lock(path));
+
+        // Anything done to the file while it was copied makes the copy stale
+        struct stat now {};
+        if (tiers[from]->stat(path, &now, false) < 0 || now.st_ino != st.st_ino || now.st_size != st.st_size ||
+            now.st_nlink != 1 || !same_time(now.st_mtim, st.st_mtim) || !same_time(now.st_ctim, st.st_ctim)) {
+            res = -EAGAIN;
+        }
+        if (res == 0) {
+            std::lock_guard<std::mutex> writers_lock(writers_mutex);
+            if (writers.count({from, st.st_ino}) > 0) {
+                res = -EBUSY;
+            }
+        }
+        if (res == 0 && to == CAPACITY) {
+            res = prepare_parents(path, true);
+        }
+        if (res == 0) {
+            res = tiers[to]->rename(staging, path, RENAME_NOREPLACE);
+        }
+
+        // Only a durable copy may replace the original. stage() synced the data, so the new entry is all that is left
+        // and syncing its directory keeps the other files of the tier out of the locked section.
+        if (res == 0) {
+            res = sync_directory(to, Path::view_parent(path));
+            if (res == 0) {
+                res = drop(from, path);
+            }
+            if (res < 0) {
+                Logging::Error("Failed to move %s between tiers: %s", path.c_str(), strerror(-res));
+                tiers[to]->unlink(path);
+            }
+        }
+    }
+
+    if (res < 0) {
+        tiers[to]->unlink(staging);
+        return false;
+    }
+    return true;
+}
+
+size_t TieredBackend::promote_queued(Budget &budget) {
+    std::set<std::string> queued;
+    {
+        std::lock_guard<std::mutex> lock(thread_mutex);
+        queued.swap(promotions);
+    }
+
+    size_t moved = 0;
+    for (const auto &path : queued) {
+        struct stat st {};
+        if (tiers[CAPACITY]->stat(path, &st, false) < 0 || !S_ISREG(st.st_mode) || st.st_nlink != 1) {
+            continue;
+        }
+        if (move(path, CAPACITY, st, budget)) {
+            promoted.fetch_add(1, std::memory_order_relaxed);
+            moved++;
+        }
+    }
+    return moved;
+}
+
+size_t TieredBackend::demote_cold(const std::string &directory, Budget &budget) {
+    std::vector<std::string> names;
+    if (tiers[FAST]->list(directory, names) < 0) {
+        return 0;
+    }
+
+    size_t moved = 0;
+    for (const auto &name : names) {
+        std::string path = Path::join(directory, name);
+        if (hidden(path) || pinned(path)) {
+            continue;
+        }
+        {
+            std::lock_guard<std::mutex> lock(thread_mutex);
+            if (stopping) {
+                break;
+            }
+        }
+
+        struct stat st {};
+        if (tiers[FAST]->stat(path, &st, false) < 0) {
+            continue;
+        }
+        if (S_ISDIR(st.st_mode)) {
+            moved += demote_cold(path, budget);
+        } else if (S_ISLNK(st.st_mode)) {
+            replicate_link(path);
+        } else if (S_ISREG(st.st_mode) && st.st_nlink == 1 && (is_version(path) || is_cold(path, st))) {
+            if (move(path, FAST, st, budget)) {
+                demoted.fetch_add(1, std::memory_order_relaxed);
+                std::lock_guard<std::mutex> lock(heat_mutex);
+                heat.erase(path);
+                moved++;
+            }
+        }
+    }
+    return moved;
+}
+
+size_t TieredBackend::migrate() {
+    std::lock_guard<std::mutex> lock(migration_mutex);
+    Budget budget;
+    size_t moved = promote_queued(budget);
+    return moved + demote_cold("/", budget);
+}
+
+void TieredBackend::clean_staging() {
+    std::string staging = std::string("/") + STAGING_DIRECTORY;
+    for (auto &tier : tiers) {
+        std::vector<std::string> names;
+        if (tier->list(staging, names) == 0) {
+            for (const auto &name : names) {
+                tier->unlink(Path::join(staging, name));
+            }
+        }
+    }
+}
+
+void TieredBackend::migration_loop() {
+    auto next_scan = std::chrono::steady_clock::now() + settings.scan_interval;
+    std::unique_lock<std::mutex> lock(thread_mutex);
+    while (!stopping) {
+        wakeup.wait_until(lock, next_scan, [this]() { return stopping || !promotions.empty(); });
+        if (stopping) {
+            break;
+        }
+
+        // Promotions are served as soon as they are queued, the fast tier is scanned for cold files less often
+        bool scan = std::chrono::steady_clock::now() >= next_scan;
+        lock.unlock();
+        if (scan) {
+            migrate();
+        } else {
+            std::lock_guard<std::mutex> migration_lock(migration_mutex);
+            Budget budget;
+            promote_queued(budget);
+        }
+        lock.lock();
+
+        if (scan) {
+            next_scan = std::chrono::steady_clock::now() + settings.scan_interval;
+        }
+    }
+}
+
+int TieredBackend::open(std::string_view path, int flags, mode_t mode, std::unique_ptr<FileHandle> &handle) {
+    if (hidden(path)) {
+        return (flags & O_CREAT) ? -EPERM : -ENOENT;
+    }
+
+    std::string current(path);
+    std::shared_lock<std::shared_mutex> namespace_lock(namespace_mutex);
+    std::lock_guard<std::mutex> lock(path_lock(current));
+
+    Tier tier = FAST;
+    struct stat st {};
+    int res = locate(current, tier, &st, !(flags & O_NOFOLLOW));
+    if (res < 0 && res != -ENOENT) {
+        return res;
+    }
+
+    if (res == 0 && tier == CAPACITY) {
+        if ((flags & O_CREAT) && (flags & O_EXCL)) {
+            return -EEXIST;
+        }
+
+        // A file which is rewritten from scratch is new data, which belongs on the fast tier
+        struct stat own {};
+        if ((flags & O_TRUNC) && is_writable(flags) && tiers[CAPACITY]->stat(current, &own, false) == 0 &&
+            S_ISREG(own.st_mode) && own.st_nlink == 1) {
+            res = tiers[FAST]->open(current, flags | O_CREAT | O_EXCL, own.st_mode & 07777, handle);
+            if (res == 0) {
+                tiers[FAST]->chown(current, own.st_uid, own.st_gid);
+                tiers[FAST]->chmod(current, own.st_mode & 07777);
+                drop(CAPACITY, current);
+                tier = FAST;
+            }
+        } else {
+            res = tiers[CAPACITY]->open(current, flags, mode, handle);
+        }
+    } else {
+        tier = FAST;
+        res = tiers[FAST]->open(current, flags, mode, handle);
+    }
+    if (res < 0) {
+        return res;
+    }
+
+    auto &residence = handle->state<Residence>();
+    residence.tier = tier;
+    struct stat opened {};
+    if (is_writable(flags) && tiers[tier]->fstat(*handle, &opened) == 0) {
+        residence.writer = true;
+        residence.ino = opened.st_ino;
+        std::lock_guard<std::mutex> writers_lock(writers_mutex);
+        writers[{tier, opened.st_ino}]++;
+    }
+    record_access(current, tier);
+    return 0;
+}
+
+ssize_t TieredBackend::pread(FileHandle &handle, void *buf, size_t count, off_t offset) {
+    return tiers[residence(handle)]->pread(handle, buf, count, offset);
+}
+
+ssize_t TieredBackend::pwrite(FileHandle &handle, const void *buf, size_t count, off_t offset) {
+    return tiers[residence(handle)]->pwrite(handle, buf, count, offset);
+}
+
+int TieredBackend::ftruncate(FileHandle &handle, off_t length) {
+    return tiers[residence(handle)]->ftruncate(handle, length);
+}
+
+int TieredBackend::fsync(FileHandle &handle, bool datasync) {
+    return tiers[residence(handle)]->fsync(handle, datasync);
+}
+
+int TieredBackend::release(FileHandle &handle) {
+    auto *residence = handle.find_state<Residence>();
+    Tier tier = residence == nullptr ? FAST : residence->tier;
+    int res = tiers[tier]->release(handle);
+
+    if (residence != nullptr && residence->writer) {
+        std::lock_guard<std::mutex> lock(writers_mutex);
+        auto it = writers.find({tier, residence->ino});
+        if (it != writers.end() && --it->second == 0) {
+            writers.erase(it);
+        }
+    }
+    return res;
+}
+
+int TieredBackend::fstat(FileHandle &handle, struct stat *st) {
+    return tiers[residence(handle)]->fstat(handle, st);
+}
+
+int TieredBackend::prefetch(FileHandle &handle, off_t offset, size_t length) {
+    return tiers[residence(handle)]->prefetch(handle, offset, length);
+}
+
+int TieredBackend::truncate(std::string_view path, off_t length) {
+    if (hidden(path)) {
+        return -ENOENT;
+    }
+
+    std::shared_lock<std::shared_mutex> namespace_lock(namespace_mutex);
+    std::lock_guard<std::mutex> lock(path_lock(path));
+    Tier tier = FAST;
+    struct stat st {};
+    int res = locate(path, tier, &st, true);
+    return res < 0 ? res : tiers[tier]->truncate(path, length);
+}
+
+int TieredBackend::copy(std::string_view source, std::string_view destination) {
+    if (hidden(source)) {
+        return -ENOENT;
+    }
+    if (hidden(destination)) {
+        return -EPERM;
+    }
+
+    std::shared_lock<std::shared_mutex> namespace_lock(namespace_mutex);
+    PairLock lock(path_lock(source), path_lock(destination));
+
+    Tier tier = FAST;
+    struct stat st {};
+    if (locate(destination, tier, &st, false) == 0) {
+        return -EEXIST;
+    }
+    int res = locate(source, tier, &st, true);
+    if (res < 0) {
+        return res;
+    }
+
+    // Copies of cold files, like the versions of a file taken there, start out cold as well
+    if (tier == CAPACITY) {
+        res = prepare_parents(destination);
+        if (res < 0) {
+            return res;
+        }
+    }
+    return tiers[tier]->copy(source, destination);
+}
+
+int TieredBackend::stat(std::string_view path, struct stat *st, bool follow) {
+    if (hidden(path)) {
+        return -ENOENT;
+    }
+    Tier tier = FAST;
+    return locate(path, tier, st, follow);
+}
+
+int TieredBackend::utimens(std::string_view path, const struct timespec tv[2]) {
+    if (hidden(path)) {
+        return -ENOENT;
+    }
+
+    std::shared_lock<std::shared_mutex> namespace_lock(namespace_mutex);
+    std::lock_guard<std::mutex> lock(path_lock(path));
+    Tier tier = FAST;
+    struct stat st {};
+    int res = locate(path, tier, &st, true);
+    return res < 0 ? res : tiers[tier]->utimens(path, tv);
+}
+
+int TieredBackend::chmod(std::string_view path, mode_t mode) {
+    if (hidden(path)) {
+        return -ENOENT;
+    }
+
+    std::shared_lock<std::shared_mutex> namespace_lock(namespace_mutex);
+    std::lock_guard<std::mutex> lock(path_lock(path));
+    Tier tier = FAST;
+    struct stat st {};
+    int res = locate(path, tier, &st, true);
+    return res < 0 ? res : tiers[tier]->chmod(path, mode);
+}
+
+int TieredBackend::chown(std::string_view path, uid_t uid, gid_t gid) {
+    if (hidden(path)) {
+        return -ENOENT;
+    }
+
+    std::shared_lock<std::shared_mutex> namespace_lock(namespace_mutex);
+    std::lock_guard<std::mutex> lock(path_lock(path));
+    Tier tier = FAST;
+    struct stat st {};
+    int res = locate(path, tier, &st, true);
+    return res < 0 ? res : tiers[tier]->chown(path, uid, gid);
+}
+
+int TieredBackend::statfs(struct statvfs *stbuf) {
+    int res = tiers[FAST]->statfs(stbuf);
+    if (res < 0) {
+        return res;
+    }
+
+    struct statvfs capacity {};
+    if (tiers[CAPACITY]->statfs(&capacity) == 0 && stbuf->f_frsize > 0) {
+        auto scale = [&](fsblkcnt_t blocks) { return blocks * capacity.f_frsize / stbuf->f_frsize; };
+        stbuf->f_blocks += scale(capacity.f_blocks);
+        stbuf->f_bfree += scale(capacity.f_bfree);
+        stbuf->f_bavail += scale(capacity.f_bavail);
+        stbuf->f_files += capacity.f_files;
+        stbuf->f_ffree += capacity.f_ffree;
+        stbuf->f_favail += capacity.f_favail;
+    }
+    return 0;
+}
+
+int TieredBackend::mknod(std::string_view path, mode_t mode, dev_t dev) {
+    if (hidden(path)) {
+        return -EPERM;
+    }
+
+    std::shared_lock<std::shared_mutex> namespace_lock(namespace_mutex);
+    std::lock_guard<std::mutex> lock(path_lock(path));
+    return on_capacity(path) ? -EEXIST : tiers[FAST]->mknod(path, mode, dev);
+}
+
+int TieredBackend::rename(std::string_view oldpath, std::string_view newpath, unsigned int flags) {
+    if (hidden(oldpath)) {
+        return -ENOENT;
+    }
+    if (hidden(newpath)) {
+        return -EPERM;
+    }
+
+    std::unique_lock<std::shared_mutex> namespace_lock(namespace_mutex);
+
+    std::array<bool, 2> from{};
+    std::array<bool, 2> to{};
+    struct stat old_st {};
+    struct stat new_st {};
+    for (Tier tier : {CAPACITY, FAST}) {
+        struct stat st {};
+        if (tiers[tier]->stat(oldpath, &st, false) == 0) {
+            from[tier] = true;
+            old_st = st;
+        }
+        if (tiers[tier]->stat(newpath, &st, false) == 0) {
+            to[tier] = true;
+            new_st = st;
+        }
+    }
+    if (!from[FAST] && !from[CAPACITY]) {
+        return -ENOENT;
+    }
+    if (oldpath == newpath) {
+        return 0;
+    }
+
+    if (flags & RENAME_EXCHANGE) {
+        if (!to[FAST] && !to[CAPACITY]) {
+            return -ENOENT;
+        }
+
+        // A tier holding only one of the entries moves it to the other name
+        for (Tier tier : {FAST, CAPACITY}) {
+            int res = 0;
+            if (tier == CAPACITY && from[tier] != to[tier]) {
+                res = prepare_parents(from[tier] ? newpath : oldpath);
+            }
+            if (res == 0 && from[tier] && to[tier]) {
+                res = tiers[tier]->rename(oldpath, newpath, RENAME_EXCHANGE);
+            } else if (res == 0 && from[tier]) {
+                res = tiers[tier]->rename(oldpath, newpath, 0);
+            } else if (res == 0 && to[tier]) {
+                res = tiers[tier]->rename(newpath, oldpath, 0);
+            }
+            if (res < 0) {
+                return res;
+            }
+        }
+        move_heat(oldpath, newpath, true);
+        return 0;
+    }
+
+    if (to[FAST] || to[CAPACITY]) {
+        if (flags & RENAME_NOREPLACE) {
+            return -EEXIST;
+        }
+        if (S_ISDIR(old_st.st_mode) && !S_ISDIR(new_st.st_mode)) {
+            return -ENOTDIR;
+        }
+        if (!S_ISDIR(old_st.st_mode) && S_ISDIR(new_st.st_mode)) {
+            return -EISDIR;
+        }
+
+        // A directory is only empty if it is empty on both tiers
+        if (S_ISDIR(new_st.st_mode)) {
+            for (auto &tier : tiers) {
+                std::vector<std::string> names;
+                if (tier->list(newpath, names) == 0 && !names.empty()) {
+                    return -ENOTEMPTY;
+                }
+            }
+        }
+    }
+
+    // The fast tier holds every directory, it reports errors like moving a directory into itself
+    bool renamed = false;
+    for (Tier tier : {FAST, CAPACITY}) {
+        if (!from[tier]) {
+            continue;
+        }
+        int res = tier == CAPACITY ? prepare_parents(newpath) : 0;
+        if (res == 0) {
+            res = tiers[tier]->rename(oldpath, newpath, flags);
+        }
+        if (res < 0 && !renamed) {
+            return res;
+        }
+        if (res < 0) {
+            Logging::Error("Capacity tier diverged from the fast tier: %s", strerror(-res));
+        }
+        renamed = true;
+    }
+
+    // An entry which was replaced on the other tier is removed there
+    for (Tier tier : {FAST, CAPACITY}) {
+        if (to[tier] && !from[tier]) {
+            struct stat st {};
+            if (tiers[tier]->stat(newpath, &st, false) == 0) {
+                S_ISDIR(st.st_mode) ? tiers[tier]->rmdir(newpath) : tiers[tier]->unlink(newpath);
+            }
+        }
+    }
+    move_heat(oldpath, newpath, false);
+    return 0;
+}
+
+int TieredBackend::link(std::string_view oldpath, std::string_view newpath) {
+    if (hidden(oldpath)) {
+        return -ENOENT;
+    }
+    if (hidden(newpath)) {
+        return -EPERM;
+    }
+
+    std::shared_lock<std::shared_mutex> namespace_lock(namespace_mutex);
+    PairLock lock(path_lock(oldpath), path_lock(newpath));
+
+    Tier tier = FAST;
+    struct stat st {};
+    if (locate(newpath, tier, &st, false) == 0) {
+        return -EEXIST;
+    }
+
+    // Links stay on the tier of the file, symbolic links are linked on both
+    bool linked = false;
+    for (Tier holder : {FAST, CAPACITY}) {
+        if (tiers[holder]->stat(oldpath, &st, false) < 0) {
+            continue;
+        }
+        int res = holder == CAPACITY ? prepare_parents(newpath) : 0;
+        if (res == 0) {
+            res = tiers[holder]->link(oldpath, newpath);
+        }
+        if (res < 0 && !linked) {
+            return res;
+        }
+        linked = true;
+    }
+    return linked ? 0 : -ENOENT;
+}
+
+int TieredBackend::unlink(std::string_view path) {
+    if (hidden(path)) {
+        return -ENOENT;
+    }
+
+    std::shared_lock<std::shared_mutex> namespace_lock(namespace_mutex);
+    std::lock_guard<std::mutex> lock(path_lock(path));
+
+    // Files are on one tier, symbolic links on both
+    int res = tiers[FAST]->unlink(path);
+    int capacity = tiers[CAPACITY]->unlink(path);
+    if (res == -ENOENT || (res < 0 && capacity == 0)) {
+        res = capacity;
+    }
+    if (res == 0) {
+        std::lock_guard<std::mutex> heat_lock(heat_mutex);
+        heat.erase(std::string(path));
+    }
+    return res;
+}
+
+int TieredBackend::symlink(std::string_view target, std::string_view linkpath) {
+    if (hidden(linkpath)) {
+        return -EPERM;
+    }
+
+    std::shared_lock<std::shared_mutex> namespace_lock(namespace_mutex);
+    std::lock_guard<std::mutex> lock(path_lock(linkpath));
+    if (on_capacity(linkpath)) {
+        return -EEXIST;
+    }
+
+    int res = tiers[FAST]->symlink(target, linkpath);
+    if (res == 0) {
+        int copied = prepare_parents(linkpath);
+        if (copied == 0) {
+            copied = tiers[CAPACITY]->symlink(target, linkpath);
+        }
+        if (copied < 0) {
+            Logging::Warn("Failed to copy symbolic link %s to the capacity tier: %s",
+                          std::string(linkpath).c_str(), strerror(-copied));
+        }
+    }
+    return res;
+}
+
+int TieredBackend::readlink(std::string_view path, char *buf, size_t size) {
+    if (hidden(path)) {
+        return -ENOENT;
+    }
+    return tiers[FAST]->readlink(path, buf, size);
+}
+
+int TieredBackend::mkdir(std::string_view path, mode_t mode) {
+    if (hidden(path)) {
+        return -EPERM;
+    }
+
+    // Directories are created on the capacity tier once a file in them is moved there
+    std::shared_lock<std::shared_mutex> namespace_lock(namespace_mutex);
+    std::lock_guard<std::mutex> lock(path_lock(path));
+    return on_capacity(path) ? -EEXIST : tiers[FAST]->mkdir(path, mode);
+}
+
+int TieredBackend::rmdir(std::string_view path) {
+    if (hidden(path)) {
+        return -ENOENT;
+    }
+
+    std::unique_lock<std::shared_mutex> namespace_lock(namespace_mutex);
+    std::vector<std::string> names;
+    if (tiers[CAPACITY]->list(path, names) == 0 && !names.empty()) {
+        return -ENOTEMPTY;
+    }
+
+    int res = tiers[FAST]->rmdir(path);
+    if (res == 0) {
+        tiers[CAPACITY]->rmdir(path);
+    }
+    return res;
+}
+
+int TieredBackend::list(std::string_view path, std::vector<std::string> &names) {
+    if (hidden(path)) {
+        return -ENOENT;
+    }
+
+    std::shared_lock<std::shared_mutex> lock(listing_mutex);
+    size_t first = names.size();
+    int res = tiers[FAST]->list(path, names);
+    if (res < 0) {
+        return res;
+    }
+
+    std::unordered_set<std::string> seen(names.begin() + static_cast<std::ptrdiff_t>(first), names.end());
+    std::vector<std::string> cold;
+    tiers[CAPACITY]->list(path, cold);
+    for (auto &name : cold) {
+        if (seen.insert(name).second) {
+            names.push_back(std::move(name));
+        }
+    }
+
+    if (Path::is_root(path)) {
+        names.erase(std::remove(names.begin() + static_cast<std::ptrdiff_t>(first), names.end(), STAGING_DIRECTORY),
+                    names.end());
+    }
+    return 0;
+}
+
+int TieredBackend::opendir(std::string_view path, std::unique_ptr<DirHandle> &handle) {
+    if (hidden(path)) {
+        return -ENOENT;
+    }
+
+    auto listing = std::make_unique<SnapshotListing>(path);
+    SnapshotListing::Collector collector(*listing, STAGING_DIRECTORY);
+
+    std::shared_lock<std::shared_mutex> lock(listing_mutex);
+    for (Tier tier : {FAST, CAPACITY}) {
+        std::unique_ptr<DirHandle> directory;
+        int res = tiers[tier]->opendir(path, directory);
+        if (res < 0) {
+            if (tier == FAST) {
+                return res;
+            }
+            continue;
+        }
+
+        std::lock_guard<std::mutex> directory_lock(directory->lock);
+        tiers[tier]->readdir(*directory, 0, collector);
+    }
+
+    handle = std::move(listing);
+    return 0;
+}
+
+int TieredBackend::readdir(DirHandle &handle, off_t offset, DirFiller &filler) {
+    return static_cast<SnapshotListing &>(handle).read(*this, offset, filler);
+}
+
+int TieredBackend::syncfs() {
+    int res = tiers[FAST]->syncfs();
+    int synced = tiers[CAPACITY]->syncfs();
+    return res < 0 ? res : synced;
+}
+
+bool TieredBackend::allows_splice() const {
+    return tiers[FAST]->allows_splice() && tiers[CAPACITY]->allows_splice();
+}
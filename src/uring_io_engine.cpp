@@ -0,0 +1,424 @@
+#include "uring_io_engine.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include "common/logging.h"
+
+namespace {
+
+int io_uring_setup(unsigned int entries, struct io_uring_params *params) {
+    return static_cast<int>(::syscall(__NR_io_uring_setup, entries, params));
+}
+
+int io_uring_enter(int fd, unsigned int to_submit, unsigned int min_complete, unsigned int flags) {
+    return static_cast<int>(::syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+}
+
+int io_uring_register(int fd, unsigned int opcode, const void *arg, unsigned int count) {
+    return static_cast<int>(::syscall(__NR_io_uring_register, fd, opcode, arg, count));
+}
+
+template <typename T>
+T *ring_field(void *ring, uint32_t offset) {
+    return reinterpret_cast<T *>(static_cast<char *>(ring) + offset);
+}
+
+void to_stat(const struct statx &stx, struct stat *st) {
+    *st = {};
+    st->st_dev = makedev(stx.stx_dev_major, stx.stx_dev_minor);
+    st->st_ino = stx.stx_ino;
+    st->st_mode = stx.stx_mode;
+    st->st_nlink = stx.stx_nlink;
+    st->st_uid = stx.stx_uid;
+    st->st_gid = stx.stx_gid;
+    st->st_rdev = makedev(stx.stx_rdev_major, stx.stx_rdev_minor);
+    st->st_size = static_cast<off_t>(stx.stx_size);
+    st->st_blksize = stx.stx_blksize;
+    st->st_blocks = static_cast<blkcnt_t>(stx.stx_blocks);
+    st->st_atim = {stx.stx_atime.tv_sec, stx.stx_atime.tv_nsec};
+    st->st_mtim = {stx.stx_mtime.tv_sec, stx.stx_mtime.tv_nsec};
+    st->st_ctim = {stx.stx_ctime.tv_sec, stx.stx_ctime.tv_nsec};
+}
+
+}  // namespace
+
+/// Completion slot of a single request, lives on the stack of the waiting thread
+struct UringIoEngine::Request {
+    std::mutex mutex;
+    std::condition_variable completed;
+    bool done = false;
+    int32_t result = 0;
+};
+
+UringIoEngine::UringIoEngine(const Settings &settings)
+    : submit_calls(Metrics::counter("uring.submit_calls")),
+      submitted(Metrics::counter("uring.submitted")),
+      fixed_buffer_ops(Metrics::counter("uring.fixed_buffer_ops")) {
+    // The completion queue is twice as deep as the submission queue, in_flight is bounded by the latter
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = settings.queue_depth * 2;
+
+    ring_fd = io_uring_setup(settings.queue_depth, &params);
+    if (ring_fd < 0) {
+        throw std::runtime_error("io_uring could not be set up: " + std::string(strerror(errno)));
+    }
+
+    sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        sq_ring_size = cq_ring_size = std::max(sq_ring_size, cq_ring_size);
+    }
+
+    sq_ring = ::mmap(nullptr, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd,
+                     IORING_OFF_SQ_RING);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        cq_ring = sq_ring;
+    } else if (sq_ring != MAP_FAILED) {
+        cq_ring = ::mmap(nullptr, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd,
+                         IORING_OFF_CQ_RING);
+    }
+    sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    if (cq_ring != nullptr && cq_ring != MAP_FAILED) {
+        sqes = static_cast<struct io_uring_sqe *>(::mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE,
+                                                         MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES));
+    }
+
+    if (sq_ring == MAP_FAILED || cq_ring == nullptr || cq_ring == MAP_FAILED || sqes == nullptr || sqes == MAP_FAILED) {
+        int error = errno;
+        if (sq_ring != MAP_FAILED) {
+            ::munmap(sq_ring, sq_ring_size);
+        }
+        if (cq_ring != nullptr && cq_ring != MAP_FAILED && cq_ring != sq_ring) {
+            ::munmap(cq_ring, cq_ring_size);
+        }
+        ::close(ring_fd);
+        throw std::runtime_error("io_uring rings could not be mapped: " + std::string(strerror(error)));
+    }
+
+    sq_head = ring_field<std::atomic<uint32_t>>(sq_ring, params.sq_off.head);
+    sq_tail = ring_field<std::atomic<uint32_t>>(sq_ring, params.sq_off.tail);
+    sq_mask = *ring_field<uint32_t>(sq_ring, params.sq_off.ring_mask);
+    sq_array = ring_field<uint32_t>(sq_ring, params.sq_off.array);
+    cq_head = ring_field<std::atomic<uint32_t>>(cq_ring, params.cq_off.head);
+    cq_tail = ring_field<std::atomic<uint32_t>>(cq_ring, params.cq_off.tail);
+    cq_mask = *ring_field<uint32_t>(cq_ring, params.cq_off.ring_mask);
+    cqes = ring_field<struct io_uring_cqe>(cq_ring, params.cq_off.cqes);
+
+    if (settings.registered_files > 0) {
+        std::vector<int> empty(settings.registered_files, -1);
+        if (io_uring_register(ring_fd, IORING_REGISTER_FILES, empty.data(), settings.registered_files) == 0) {
+            for (int slot = static_cast<int>(settings.registered_files) - 1; slot >= 0; slot--) {
+                free_slots.push_back(slot);
+            }
+        } else {
+            Logging::Warn("io_uring: files could not be registered: %s", strerror(errno));
+        }
+    }
+
+    if (settings.fixed_buffers > 0 && settings.fixed_buffer_size > 0) {
+        buffer_size = settings.fixed_buffer_size;
+        buffer_memory_size = buffer_size * settings.fixed_buffers;
+        void *memory = ::mmap(nullptr, buffer_memory_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+        std::vector<struct iovec> buffers;
+        if (memory != MAP_FAILED) {
+            buffer_memory = static_cast<char *>(memory);
+            for (unsigned int i = 0; i < settings.fixed_buffers; i++) {
+                buffers.push_back({buffer_memory + i * buffer_size, buffer_size});
+            }
+        }
+
+        if (memory != MAP_FAILED &&
+            io_uring_register(ring_fd, IORING_REGISTER_BUFFERS, buffers.data(), settings.fixed_buffers) == 0) {
+            for (int index = static_cast<int>(settings.fixed_buffers) - 1; index >= 0; index--) {
+                free_buffers.push_back(index);
+            }
+        } else {
+            Logging::Warn("io_uring: buffers could not be registered: %s", strerror(errno));
+            if (memory != MAP_FAILED) {
+                ::munmap(memory, buffer_memory_size);
+            }
+            buffer_memory = nullptr;
+            buffer_size = 0;
+        }
+    }
+
+    reaper = std::thread(&UringIoEngine::reap, this);
+}
+
+UringIoEngine::~UringIoEngine() {
+    // A no-op without a request tells the completion thread to stop once everything before it completed
+    stopping = true;
+    struct io_uring_sqe stop {};
+    stop.opcode = IORING_OP_NOP;
+    enqueue(stop);
+    submit();
+    reaper.join();
+
+    if (buffer_memory != nullptr) {
+        ::munmap(buffer_memory, buffer_memory_size);
+    }
+    ::munmap(sqes, sqes_size);
+    if (cq_ring != sq_ring) {
+        ::munmap(cq_ring, cq_ring_size);
+    }
+    ::munmap(sq_ring, sq_ring_size);
+    ::close(ring_fd);
+}
+
+void UringIoEngine::enqueue(const struct io_uring_sqe &entry) {
+    std::unique_lock<std::mutex> lock(sq_mutex);
+    sq_space.wait(lock, [this]() { return in_flight < params.sq_entries; });
+
+    uint32_t tail = sq_tail->load(std::memory_order_relaxed);
+    uint32_t index = tail & sq_mask;
+    sqes[index] = entry;
+    sq_array[index] = index;
+    sq_tail->store(tail + 1, std::memory_order_release);
+
+    unsubmitted++;
+    in_flight++;
+}
+
+void UringIoEngine::submit() {
+    {
+        std::lock_guard<std::mutex> lock(sq_mutex);
+        if (submitting || unsubmitted == 0) {
+            return;
+        }
+        submitting = true;
+    }
+
+    // Entries queued by other threads while this one is in the kernel are picked up by the next iteration
+    while (true) {
+        uint32_t count;
+        {
+            std::lock_guard<std::mutex> lock(sq_mutex);
+            count = unsubmitted;
+            if (count == 0) {
+                submitting = false;
+                return;
+            }
+        }
+
+        int res = io_uring_enter(ring_fd, count, 0, 0);
+        if (res < 0) {
+            if (errno == EINTR || errno == EAGAIN || errno == EBUSY) {
+                std::this_thread::yield();
+                continue;
+            }
+
+            // The queued requests would never complete
+            Logging::Fatal("io_uring: submission failed: %s", strerror(errno));
+            std::abort();
+        }
+
+        submit_calls.fetch_add(1, std::memory_order_relaxed);
+        submitted.fetch_add(static_cast<uint64_t>(res), std::memory_order_relaxed);
+
+        std::lock_guard<std::mutex> lock(sq_mutex);
+        unsubmitted -= static_cast<uint32_t>(res);
+    }
+}
+
+void UringIoEngine::reap() {
+    bool stop = false;
+
+    while (!stop) {
+        if (io_uring_enter(ring_fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR) {
+            Logging::Error("io_uring: waiting for completions failed: %s", strerror(errno));
+        }
+
+        uint32_t head = cq_head->load(std::memory_order_relaxed);
+        uint32_t tail = cq_tail->load(std::memory_order_acquire);
+        uint32_t completed = 0;
+
+        for (; head != tail; head++) {
+            const struct io_uring_cqe &cqe = cqes[head & cq_mask];
+            completed++;
+
+            if (cqe.user_data == 0) {
+                stop = stopping.load();
+                continue;
+            }
+
+            // Notified under the lock, the waiting thread destroys the request as soon as it sees it done
+            auto *request = reinterpret_cast<Request *>(static_cast<uintptr_t>(cqe.user_data));
+            std::lock_guard<std::mutex> lock(request->mutex);
+            request->result = cqe.res;
+            request->done = true;
+            request->completed.notify_one();
+        }
+        cq_head->store(head, std::memory_order_release);
+
+        if (completed > 0) {
+            {
+                std::lock_guard<std::mutex> lock(sq_mutex);
+                in_flight -= completed;
+            }
+            sq_space.notify_all();
+        }
+    }
+}
+
+int64_t UringIoEngine::execute(struct io_uring_sqe entry) {
+    Request request;
+    entry.user_data = reinterpret_cast<uintptr_t>(&request);
+
+    enqueue(entry);
+    submit();
+
+    std::unique_lock<std::mutex> lock(request.mutex);
+    request.completed.wait(lock, [&request]() { return request.done; });
+    return request.result;
+}
+
+void UringIoEngine::set_file(struct io_uring_sqe &entry, const FileHandle &handle) {
+    if (handle.io_slot() >= 0) {
+        entry.fd = handle.io_slot();
+        entry.flags |= IOSQE_FIXED_FILE;
+    } else {
+        entry.fd = handle.fd();
+    }
+}
+
+ssize_t UringIoEngine::pread(const FileHandle &handle, void *buf, size_t count, off_t offset) {
+    struct io_uring_sqe entry {};
+    set_file(entry, handle);
+    entry.len = static_cast<uint32_t>(count);
+    entry.off = static_cast<uint64_t>(offset);
+
+    int buffer = count <= buffer_size ? acquire_buffer() : -1;
+    if (buffer < 0) {
+        entry.opcode = IORING_OP_READ;
+        entry.addr = reinterpret_cast<uintptr_t>(buf);
+        return execute(entry);
+    }
+
+    char *fixed = buffer_memory + buffer * buffer_size;
+    entry.opcode = IORING_OP_READ_FIXED;
+    entry.addr = reinterpret_cast<uintptr_t>(fixed);
+    entry.buf_index = static_cast<uint16_t>(buffer);
+
+    int64_t res = execute(entry);
+    if (res > 0) {
+        std::memcpy(buf, fixed, static_cast<size_t>(res));
+    }
+    release_buffer(buffer);
+    fixed_buffer_ops.fetch_add(1, std::memory_order_relaxed);
+    return res;
+}
+
+ssize_t UringIoEngine::pwrite(const FileHandle &handle, const void *buf, size_t count, off_t offset) {
+    struct io_uring_sqe entry {};
+    set_file(entry, handle);
+    entry.len = static_cast<uint32_t>(count);
+    entry.off = static_cast<uint64_t>(offset);
+
+    int buffer = count <= buffer_size ? acquire_buffer() : -1;
+    if (buffer < 0) {
+        entry.opcode = IORING_OP_WRITE;
+        entry.addr = reinterpret_cast<uintptr_t>(buf);
+        return execute(entry);
+    }
+
+    char *fixed = buffer_memory + buffer * buffer_size;
+    std::memcpy(fixed, buf, count);
+    entry.opcode = IORING_OP_WRITE_FIXED;
+    entry.addr = reinterpret_cast<uintptr_t>(fixed);
+    entry.buf_index = static_cast<uint16_t>(buffer);
+
+    int64_t res = execute(entry);
+    release_buffer(buffer);
+    fixed_buffer_ops.fetch_add(1, std::memory_order_relaxed);
+    return res;
+}
+
+int UringIoEngine::fsync(const FileHandle &handle, bool datasync) {
+    struct io_uring_sqe entry {};
+    entry.opcode = IORING_OP_FSYNC;
+    set_file(entry, handle);
+    entry.fsync_flags = datasync ? IORING_FSYNC_DATASYNC : 0;
+    return static_cast<int>(execute(entry));
+}
+
+int UringIoEngine::stat(int dirfd, const char *name, struct stat *st, int flags) {
+    struct statx stx {};
+    struct io_uring_sqe entry {};
+    entry.opcode = IORING_OP_STATX;
+    entry.fd = dirfd;
+    entry.addr = reinterpret_cast<uintptr_t>(name);
+    entry.len = STATX_BASIC_STATS;
+    entry.off = reinterpret_cast<uintptr_t>(&stx);
+    entry.statx_flags = static_cast<uint32_t>(flags);
+
+    int res = static_cast<int>(execute(entry));
+    if (res == 0) {
+        to_stat(stx, st);
+    }
+    return res;
+}
+
+int UringIoEngine::register_file(int fd) {
+    int slot;
+    {
+        std::lock_guard<std::mutex> lock(files_mutex);
+        if (free_slots.empty()) {
+            return -1;
+        }
+        slot = free_slots.back();
+        free_slots.pop_back();
+    }
+
+    struct io_uring_files_update update {};
+    update.offset = static_cast<uint32_t>(slot);
+    update.fds = reinterpret_cast<uintptr_t>(&fd);
+    if (io_uring_register(ring_fd, IORING_REGISTER_FILES_UPDATE, &update, 1) == 1) {
+        return slot;
+    }
+
+    std::lock_guard<std::mutex> lock(files_mutex);
+    free_slots.push_back(slot);
+    return -1;
+}
+
+void UringIoEngine::unregister_file(int slot) {
+    if (slot < 0) {
+        return;
+    }
+
+    int none = -1;
+    struct io_uring_files_update update {};
+    update.offset = static_cast<uint32_t>(slot);
+    update.fds = reinterpret_cast<uintptr_t>(&none);
+    io_uring_register(ring_fd, IORING_REGISTER_FILES_UPDATE, &update, 1);
+
+    std::lock_guard<std::mutex> lock(files_mutex);
+    free_slots.push_back(slot);
+}
+
+int UringIoEngine::acquire_buffer() {
+    std::lock_guard<std::mutex> lock(buffers_mutex);
+    if (free_buffers.empty()) {
+        return -1;
+    }
+    int index = free_buffers.back();
+    free_buffers.pop_back();
+    return index;
+}
+
+void UringIoEngine::release_buffer(int index) {
+    std::lock_guard<std::mutex> lock(buffers_mutex);
+    free_buffers.push_back(index);
+}
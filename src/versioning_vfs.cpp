@@ -8,8 +8,26 @@
 #include "common/logging.h"
 #include "common/prefix_parser.h"
 
-int VersioningVfs::write(const std::string &pathname, const char *buf, size_t count, off_t offset,
+void VersioningVfs::init(connection &conn) {
+    VfsDecorator::init(conn);
+
+    // With the writeback cache the kernel coalesces writes and sends them whenever it decides to flush the page cache,
+    // so the versions would no longer correspond to the writes made by applications
+    conn.veto(CAP_WRITEBACK_CACHE);
+}
+
+int VersioningVfs::write(std::string_view pathname, const char *buf, size_t count, off_t offset,
                          struct fuse_file_info *fi) {
+    return versioned_write(std::string(pathname),
+                           [&]() { return get_wrapped().write(pathname, buf, count, offset, fi); });
+}
+
+int VersioningVfs::write_buf(std::string_view pathname, struct fuse_bufvec *buf, off_t off,
+                             struct fuse_file_info *fi) {
+    return versioned_write(std::string(pathname), [&]() { return get_wrapped().write_buf(pathname, buf, off, fi); });
+}
+
+int VersioningVfs::versioned_write(const std::string &pathname, const std::function<int()> &write_operation) {
     try {
         if (handle_hook(pathname)) {
             Logging::Debug("Hook handled for %s", pathname.c_str());
@@ -21,7 +39,7 @@ int VersioningVfs::write(const std::string &pathname, const char *buf, size_t co
     }
 
     if (PrefixParser::is_prefixed(Path::string_basename(pathname))) {
-        return get_wrapped().write(pathname, buf, count, offset, fi);
+        return write_operation();
     }
 
     int max_version = get_max_version(pathname);
@@ -29,11 +47,12 @@ int VersioningVfs::write(const std::string &pathname, const char *buf, size_t co
     std::string new_version_path = PrefixParser::apply_prefix(pathname, prefix, {std::to_string(max_version + 1)});
     Logging::Debug("Saving old version of %s to %s", pathname.c_str(), new_version_path.c_str());
 
-    int res = get_wrapped().write(pathname, buf, count, offset, fi);
+    int res = write_operation();
 
-    if (get_wrapped().copy_file(pathname, new_version_path) == -1) {
+    int copied = get_wrapped().copy_file(pathname, new_version_path);
+    if (copied < 0) {
         Logging::Error("Failed to store version of %s to %s", pathname.c_str(), new_version_path.c_str());
-        return -1;
+        return copied;
     }
 
     return res;
@@ -145,7 +164,7 @@ void VersioningVfs::list_versions(const std::string &arg_path, const std::string
 
     for (const auto &version : versions) {
         auto stbuf = std::make_unique<struct stat>();
-        get_wrapped().getattr(parent / version, stbuf.get());
+        get_wrapped().getattr((parent / version).to_string(), stbuf.get());
 
         const auto rawtime = stbuf->st_mtime;
         const auto timeinfo = localtime(&rawtime);
@@ -169,9 +188,9 @@ void VersioningVfs::delete_version(const std::string &pathname, int version) {
     get_wrapped().unlink(version_path);
 }
 
-int VersioningVfs::fill_dir(const std::string &name, const struct stat *stbuf, off_t off,
+int VersioningVfs::fill_dir(std::string_view name, const struct stat *stbuf, off_t off,
                             FuseWrapper::fill_dir_flags flags) {
-    if (is_version_file(name)) {
+    if (PrefixParser::contains_prefix(name, prefix) && is_version_file(std::string(name))) {
         return 0;
     }
 
@@ -202,21 +221,23 @@ void VersioningVfs::restore_version(const std::string &pathname, int version) {
         get_wrapped().unlink(pathname);
     }
 
-    get_wrapped().copy_file(restored_path, pathname);
+    if (get_wrapped().copy_file(restored_path, pathname) < 0) {
+        Logging::Error("Failed to restore version %d of file %s", version, pathname.c_str());
+        return;
+    }
 
     Logging::Info("Restored version %d of file %s", version, pathname.c_str());
 }
 
 std::vector<std::string> VersioningVfs::get_related_names(const std::string &pathname) const {
-    std::vector<std::string> path_files = get_wrapped().subfiles(Path::string_parent(pathname));
+    // Only the sidecars of the file are looked at, not the whole directory
+    std::vector<std::string> path_files =
+        get_wrapped().prefixed_subfiles(Path::string_parent(pathname), Path::string_basename(pathname));
     std::vector<std::string> version_files;
 
-    for (const std::string &filename : path_files) {
+    for (std::string &filename : path_files) {
         if (is_version_file(filename)) {
-            if (Path::string_basename(Path::string_basename(PrefixParser::get_nonprefixed(filename))) ==
-                Path::string_basename(pathname)) {
-                version_files.push_back(filename);
-            }
+            version_files.push_back(std::move(filename));
         }
     }
 
@@ -0,0 +1,332 @@
+#include "write_back_vfs.h"
+
+#include <fcntl.h>
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+#include "common/prefix_parser.h"
+
+namespace {
+
+/// Whether a path is the same as or below a directory
+bool is_within(std::string_view path, std::string_view directory) {
+    return path.size() >= directory.size() && path.compare(0, directory.size(), directory) == 0 &&
+           (path.size() == directory.size() || path[directory.size()] == '/');
+}
+
+}  // namespace
+
+WriteBackVfs::WriteBackVfs(CustomVfs &wrapped_vfs, size_t buffer_size)
+    : VfsDecorator(wrapped_vfs),
+      buffer_size(buffer_size),
+      buffered_writes(Metrics::counter("write_back.buffered_writes")),
+      flushed_writes(Metrics::counter("write_back.flushed_writes")) {}
+
+WriteBackVfs::Buffer *WriteBackVfs::buffer_of(struct fuse_file_info *fi) {
+    FileHandle *handle = FileHandle::from(fi);
+    return handle == nullptr ? nullptr : handle->find_state<Buffer>();
+}
+
+void WriteBackVfs::attach(std::string_view pathname, struct fuse_file_info *fi) {
+    FileHandle *handle = FileHandle::from(fi);
+    if (buffer_size == 0 || handle == nullptr || (fi->flags & O_APPEND) || PrefixParser::is_prefixed(pathname)) {
+        return;
+    }
+
+    Buffer &buffer = handle->state<Buffer>();
+    buffer.path = pathname;
+    buffer.file_info = *fi;
+    buffer.data.reserve(buffer_size);
+
+    std::lock_guard<std::mutex> lock(buffers_mutex);
+    buffers[buffer.path].push_back(&buffer);
+}
+
+int WriteBackVfs::open(std::string_view pathname, struct fuse_file_info *fi) {
+    int res = get_wrapped().open(pathname, fi);
+    if (res == 0) {
+        attach(pathname, fi);
+    }
+    return res;
+}
+
+int WriteBackVfs::create(std::string_view pathname, mode_t mode, struct fuse_file_info *fi) {
+    int res = get_wrapped().create(pathname, mode, fi);
+    if (res == 0) {
+        attach(pathname, fi);
+    }
+    return res;
+}
+
+int WriteBackVfs::write(std::string_view pathname, const char *buf, size_t count, off_t offset,
+                        struct fuse_file_info *fi) {
+    Buffer *buffer = buffer_of(fi);
+    if (buffer == nullptr) {
+        return get_wrapped().write(pathname, buf, count, offset, fi);
+    }
+
+    std::lock_guard<std::mutex> lock(buffer->lock);
+    if (buffer->error != 0) {
+        return std::exchange(buffer->error, 0);
+    }
+
+    if (count >= buffer_size) {
+        int res = flush_locked(*buffer);
+        return res < 0 ? res : get_wrapped().write(pathname, buf, count, offset, fi);
+    }
+
+    // Continues or overwrites the buffered extent without growing past the buffer
+    off_t end = buffer->offset + static_cast<off_t>(buffer->data.size());
+    bool mergeable = offset >= buffer->offset && offset <= end &&
+                     offset + static_cast<off_t>(count) <= buffer->offset + static_cast<off_t>(buffer_size);
+
+    if (!buffer->data.empty() && !mergeable) {
+        int res = flush_locked(*buffer);
+        if (res < 0) {
+            return res;
+        }
+    }
+
+    if (buffer->data.empty()) {
+        buffer->offset = offset;
+        dirty.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    size_t at = static_cast<size_t>(offset - buffer->offset);
+    if (at + count > buffer->data.size()) {
+        buffer->data.resize(at + count);
+    }
+    std::memcpy(buffer->data.data() + at, buf, count);
+    buffered_writes.fetch_add(1, std::memory_order_relaxed);
+
+    if (buffer->data.size() == buffer_size) {
+        int res = flush_locked(*buffer);
+        if (res < 0) {
+            return res;
+        }
+    }
+
+    return static_cast<int>(count);
+}
+
+int WriteBackVfs::write_buf(std::string_view pathname, struct fuse_bufvec *buf, off_t off,
+                            struct fuse_file_info *fi) {
+    Buffer *buffer = buffer_of(fi);
+    if (buffer == nullptr || fuse_buf_size(buf) >= buffer_size) {
+        // Large writes keep the zero-copy path of the wrapped VFS
+        if (buffer != nullptr) {
+            std::lock_guard<std::mutex> lock(buffer->lock);
+            int res = flush_locked(*buffer);
+            if (res < 0) {
+                return res;
+            }
+        }
+        return get_wrapped().write_buf(pathname, buf, off, fi);
+    }
+
+    // Collects the data into memory and passes it to write()
+    return FuseWrapper::write_buf(pathname, buf, off, fi);
+}
+
+int WriteBackVfs::read(std::string_view pathname, char *buf, size_t count, off_t offset, struct fuse_file_info *fi) {
+    flush_path(pathname, offset, static_cast<off_t>(count));
+    return get_wrapped().read(pathname, buf, count, offset, fi);
+}
+
+int WriteBackVfs::read_buf(std::string_view pathname, struct fuse_bufvec **bufp, size_t size, off_t off,
+                           struct fuse_file_info *fi) {
+    flush_path(pathname, off, static_cast<off_t>(size));
+    return get_wrapped().read_buf(pathname, bufp, size, off, fi);
+}
+
+int WriteBackVfs::getattr(std::string_view pathname, struct stat *st) {
+    int res = get_wrapped().getattr(pathname, st);
+    if (res != 0 || dirty.load(std::memory_order_relaxed) == 0) {
+        return res;
+    }
+
+    std::lock_guard<std::mutex> lock(buffers_mutex);
+    auto it = buffers.find(std::string(pathname));
+    if (it == buffers.end()) {
+        return res;
+    }
+
+    for (Buffer *buffer : it->second) {
+        std::lock_guard<std::mutex> buffer_lock(buffer->lock);
+        if (!buffer->data.empty()) {
+            st->st_size = std::max(st->st_size, buffer->offset + static_cast<off_t>(buffer->data.size()));
+        }
+    }
+    return res;
+}
+
+int WriteBackVfs::truncate(std::string_view pathname, off_t length) {
+    flush_path(pathname, 0, -1);
+    return get_wrapped().truncate(pathname, length);
+}
+
+int WriteBackVfs::ftruncate(std::string_view pathname, off_t length, struct fuse_file_info *fi) {
+    flush_path(pathname, 0, -1);
+    return get_wrapped().ftruncate(pathname, length, fi);
+}
+
+int WriteBackVfs::rename(std::string_view oldpath, std::string_view newpath, unsigned int flags) {
+    // Everything buffered below either path reaches the wrapped VFS under the name it was written to. The buffers are
+    // flushed without holding buffers_mutex, release() waits until the rename is done with them.
+    std::vector<Buffer *> affected;
+    {
+        std::lock_guard<std::mutex> lock(buffers_mutex);
+        for (auto &[path, list] : buffers) {
+            if (is_within(path, oldpath) || is_within(path, newpath)) {
+                for (Buffer *buffer : list) {
+                    buffer->renames++;
+                    affected.push_back(buffer);
+                }
+            }
+        }
+    }
+
+    for (Buffer *buffer : affected) {
+        std::lock_guard<std::mutex> buffer_lock(buffer->lock);
+        int res = flush_locked(*buffer);
+        if (res < 0) {
+            buffer->error = res;
+        }
+    }
+
+    if (!affected.empty()) {
+        std::lock_guard<std::mutex> lock(buffers_mutex);
+        for (Buffer *buffer : affected) {
+            buffer->renames--;
+        }
+        renamed.notify_all();
+    }
+
+    int res = get_wrapped().rename(oldpath, newpath, flags);
+    if (res < 0) {
+        // A failed rename leaves the files where they were
+        return res;
+    }
+
+    std::lock_guard<std::mutex> lock(buffers_mutex);
+    std::vector<std::pair<std::string, std::vector<Buffer *>>> moved;
+    for (auto it = buffers.begin(); it != buffers.end();) {
+        if (is_within(it->first, oldpath)) {
+            moved.emplace_back(std::string(newpath) + it->first.substr(oldpath.size()), std::move(it->second));
+            it = buffers.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    for (auto &[path, moved_buffers] : moved) {
+        for (Buffer *buffer : moved_buffers) {
+            std::lock_guard<std::mutex> buffer_lock(buffer->lock);
+            buffer->path = path;
+        }
+        auto &target = buffers[path];
+        target.insert(target.end(), moved_buffers.begin(), moved_buffers.end());
+    }
+
+    return res;
+}
+
+int WriteBackVfs::flush(std::string_view pathname, struct fuse_file_info *fi) {
+    int res = flush_handle(fi);
+    int wrapped = get_wrapped().flush(pathname, fi);
+    return res < 0 ? res : wrapped;
+}
+
+int WriteBackVfs::fsync(std::string_view pathname, int datasync, struct fuse_file_info *fi) {
+    int res = flush_handle(fi);
+    if (res < 0) {
+        return res;
+    }
+    return get_wrapped().fsync(pathname, datasync, fi);
+}
+
+int WriteBackVfs::release(std::string_view pathname, struct fuse_file_info *fi) {
+    Buffer *buffer = buffer_of(fi);
+    if (buffer != nullptr) {
+        flush_handle(fi);
+
+        std::unique_lock<std::mutex> lock(buffers_mutex);
+        renamed.wait(lock, [buffer] { return buffer->renames == 0; });
+        auto it = buffers.find(buffer->path);
+        if (it != buffers.end()) {
+            auto &list = it->second;
+            list.erase(std::remove(list.begin(), list.end(), buffer), list.end());
+            if (list.empty()) {
+                buffers.erase(it);
+            }
+        }
+    }
+
+    return get_wrapped().release(pathname, fi);
+}
+
+int WriteBackVfs::flush_locked(Buffer &buffer) {
+    if (buffer.data.empty()) {
+        return 0;
+    }
+
+    int res = 0;
+    for (size_t done = 0; done < buffer.data.size();) {
+        int written = get_wrapped().write(buffer.path, buffer.data.data() + done, buffer.data.size() - done,
+                                          buffer.offset + static_cast<off_t>(done), &buffer.file_info);
+        if (written <= 0) {
+            res = written < 0 ? written : -EIO;
+            break;
+        }
+        done += static_cast<size_t>(written);
+    }
+
+    // Data which could not be written is dropped, the error is what the application gets to see
+    buffer.data.clear();
+    dirty.fetch_sub(1, std::memory_order_relaxed);
+    flushed_writes.fetch_add(1, std::memory_order_relaxed);
+    return res;
+}
+
+int WriteBackVfs::flush_handle(struct fuse_file_info *fi) {
+    Buffer *buffer = buffer_of(fi);
+    if (buffer == nullptr) {
+        return 0;
+    }
+
+    std::lock_guard<std::mutex> lock(buffer->lock);
+    int res = flush_locked(*buffer);
+    if (res == 0 && buffer->error != 0) {
+        res = std::exchange(buffer->error, 0);
+    }
+    return res;
+}
+
+void WriteBackVfs::flush_path(std::string_view pathname, off_t offset, off_t length) {
+    if (dirty.load(std::memory_order_relaxed) == 0) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(buffers_mutex);
+    auto it = buffers.find(std::string(pathname));
+    if (it == buffers.end()) {
+        return;
+    }
+
+    for (Buffer *buffer : it->second) {
+        std::lock_guard<std::mutex> buffer_lock(buffer->lock);
+        if (buffer->data.empty()) {
+            continue;
+        }
+
+        off_t end = buffer->offset + static_cast<off_t>(buffer->data.size());
+        if ((length < 0 || offset < end) && (length < 0 || buffer->offset < offset + length)) {
+            int res = flush_locked(*buffer);
+            if (res < 0) {
+                buffer->error = res;
+            }
+        }
+    }
+}
@@ -0,0 +1,44 @@
+#ifndef TESTS_BACKEND_TEST_HELPERS_H
+#define TESTS_BACKEND_TEST_HELPERS_H
+
+#include <fcntl.h>
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <string>
+
+#include "storage_backend.h"
+
+namespace BackendTest {
+
+/// Writes content to a file at an offset, creating the file if needed. A write at offset 0 replaces the whole file.
+inline void write_file(StorageBackend &backend, const std::string &path, const std::string &content,
+                       off_t offset = 0) {
+    std::unique_ptr<FileHandle> handle;
+    int flags = O_WRONLY | O_CREAT | (offset == 0 ? O_TRUNC : 0);
+    ASSERT_EQ(backend.open(path, flags, 0644, handle), 0) << path;
+    ASSERT_EQ(backend.pwrite(*handle, content.data(), content.size(), offset), static_cast<ssize_t>(content.size()));
+    ASSERT_EQ(backend.release(*handle), 0);
+}
+
+/// Reads a whole file, "<missing>" if it cannot be opened
+inline std::string read_file(StorageBackend &backend, const std::string &path) {
+    std::unique_ptr<FileHandle> handle;
+    if (backend.open(path, O_RDONLY, 0, handle) != 0) {
+        return "<missing>";
+    }
+
+    std::string content;
+    char buffer[4096];
+    ssize_t count;
+    while ((count = backend.pread(*handle, buffer, sizeof(buffer), static_cast<off_t>(content.size()))) > 0) {
+        content.append(buffer, count);
+    }
+    EXPECT_GE(count, 0) << path;
+    EXPECT_EQ(backend.release(*handle), 0);
+    return content;
+}
+
+}  // namespace BackendTest
+
+#endif  // TESTS_BACKEND_TEST_HELPERS_H
@@ -1,5 +1,9 @@
+#include <fcntl.h>
 #include <gtest/gtest.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
+#include <cerrno>
 #include <filesystem>
 #include <fstream>
 
@@ -46,4 +50,23 @@ TEST(CustomVfs, create_file) {
     file2 >> content;
     file2.close();
     EXPECT_EQ(content, "test");
-}
\ No newline at end of file
+}
+
+TEST(CustomVfs, create_exclusive) {
+    Common::clean_mountpoint();
+
+    std::string path = TestConfig::inst().mountpoint / "created";
+
+    int fd = ::open(path.c_str(), O_CREAT | O_EXCL | O_WRONLY, 0640);
+    ASSERT_GE(fd, 0);
+    EXPECT_EQ(::write(fd, "test", 4), 4);
+    EXPECT_EQ(::close(fd), 0);
+
+    EXPECT_EQ(::open(path.c_str(), O_CREAT | O_EXCL | O_WRONLY, 0640), -1);
+    EXPECT_EQ(errno, EEXIST);
+
+    struct stat st {};
+    ASSERT_EQ(::stat(path.c_str(), &st), 0);
+    EXPECT_EQ(st.st_mode & 0777, 0640);
+    EXPECT_EQ(Common::read_file(path), "test");
+}
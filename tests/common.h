@@ -1,10 +1,13 @@
 #ifndef TESTS_COMMON_H
 #define TESTS_COMMON_H
 
+#include <unistd.h>
+
 #include <filesystem>
 #include <fstream>
 #include <sstream>
 #include <string>
+#include <system_error>
 
 #include "custom_vfs.h"
 #include "encryption_vfs.h"
@@ -69,6 +72,26 @@ inline bool write_file(const std::string& path, const std::string& content) {
     return true;
 }
 
+/// Scratch directory under the system temporary directory, emptied on creation and removed with its contents when it
+/// goes out of scope. The name is made unique to the test process.
+class TempDirectory : public std::filesystem::path {
+public:
+    explicit TempDirectory(const std::string& name)
+        : std::filesystem::path(std::filesystem::temp_directory_path() /
+                                ("customvfs_" + name + "_" + std::to_string(::getpid()))) {
+        std::filesystem::remove_all(*this);
+        std::filesystem::create_directories(*this);
+    }
+
+    ~TempDirectory() {
+        std::error_code ignored;
+        std::filesystem::remove_all(*this, ignored);
+    }
+
+    TempDirectory(const TempDirectory&) = delete;
+    TempDirectory& operator=(const TempDirectory&) = delete;
+};
+
 }  // namespace Common
 
 #endif
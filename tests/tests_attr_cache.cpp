@@ -0,0 +1,121 @@
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+#include "attr_cache.h"
+#include "common.h"
+#include "custom_vfs.h"
+
+using namespace std::chrono_literals;
+
+TEST(AttrCache, disabled_by_default_limits) {
+    AttrCache cache(0s, 0);
+    struct stat st {};
+    uint64_t generation = 0;
+
+    cache.store("/file", &st, generation);
+    EXPECT_EQ(cache.lookup("/file", &st, generation), AttrCache::Result::MISS);
+    EXPECT_EQ(cache.size(), 0);
+}
+
+TEST(AttrCache, positive_and_negative_entries) {
+    AttrCache cache(60s, 128);
+    struct stat st {};
+    st.st_size = 42;
+    uint64_t generation = 0;
+
+    ASSERT_EQ(cache.lookup("/file", nullptr, generation), AttrCache::Result::MISS);
+    cache.store("/file", &st, generation);
+    ASSERT_EQ(cache.lookup("/missing", nullptr, generation), AttrCache::Result::MISS);
+    cache.store("/missing", nullptr, generation);
+
+    struct stat cached {};
+    EXPECT_EQ(cache.lookup("file", &cached, generation), AttrCache::Result::HIT);
+    EXPECT_EQ(cached.st_size, 42);
+    EXPECT_EQ(cache.lookup("/missing", nullptr, generation), AttrCache::Result::NEGATIVE);
+}
+
+TEST(AttrCache, store_after_invalidation_is_dropped) {
+    AttrCache cache(60s, 128);
+    struct stat st {};
+    uint64_t generation = 0;
+
+    ASSERT_EQ(cache.lookup("/file", nullptr, generation), AttrCache::Result::MISS);
+    cache.invalidate("/file");
+    cache.store("/file", &st, generation);
+
+    EXPECT_EQ(cache.lookup("/file", nullptr, generation), AttrCache::Result::MISS);
+}
+
+TEST(AttrCache, invalidate_tree) {
+    AttrCache cache(60s, 128);
+    struct stat st {};
+    uint64_t generation = 0;
+
+    for (const char *path : {"/dir", "/dir/a", "/dir/b/c", "/directory"}) {
+        cache.lookup(path, nullptr, generation);
+        cache.store(path, &st, generation);
+    }
+
+    cache.invalidate_tree("/dir");
+    EXPECT_EQ(cache.lookup("/dir", nullptr, generation), AttrCache::Result::MISS);
+    EXPECT_EQ(cache.lookup("/dir/a", nullptr, generation), AttrCache::Result::MISS);
+    EXPECT_EQ(cache.lookup("/dir/b/c", nullptr, generation), AttrCache::Result::MISS);
+    EXPECT_EQ(cache.lookup("/directory", nullptr, generation), AttrCache::Result::HIT);
+}
+
+TEST(AttrCache, capacity_is_bounded) {
+    AttrCache cache(60s, 32);
+    struct stat st {};
+
+    for (int i = 0; i < 1000; i++) {
+        uint64_t generation = 0;
+        std::string path = "/file" + std::to_string(i);
+        cache.lookup(path, nullptr, generation);
+        cache.store(path, &st, generation);
+    }
+
+    EXPECT_LE(cache.size(), 32);
+}
+
+TEST(AttrCache, vfs_invalidates_on_changes) {
+    Common::TempDirectory root("attr");
+    std::filesystem::create_directories(root / "backing");
+
+    {
+        CustomVfs vfs((root / "mount").string(), (root / "backing").string());
+        vfs.set_attr_cache(60s, 1024);
+
+        auto &hits = Metrics::counter("attr_cache.negative_hits");
+        uint64_t hits_before = hits.load();
+        EXPECT_FALSE(vfs.exists("/file"));
+        EXPECT_FALSE(vfs.exists("/file"));
+        EXPECT_EQ(hits.load(), hits_before + 1);
+
+        EXPECT_EQ(vfs.mknod("/file", S_IFREG | 0644, 0), 0);
+        EXPECT_TRUE(vfs.exists("/file"));
+
+        struct stat st {};
+        EXPECT_EQ(vfs.getattr("/file", &st), 0);
+        EXPECT_EQ(st.st_size, 0);
+
+        EXPECT_EQ(vfs.truncate("/file", 100), 0);
+        EXPECT_EQ(vfs.getattr("/file", &st), 0);
+        EXPECT_EQ(st.st_size, 100);
+
+        *vfs.get_ofstream("/file", std::ios::binary) << "data";
+        EXPECT_EQ(vfs.getattr("/file", &st), 0);
+        EXPECT_EQ(st.st_size, 4);
+
+        EXPECT_EQ(vfs.rename("/file", "/renamed", 0), 0);
+        EXPECT_EQ(vfs.getattr("/file", &st), -ENOENT);
+        EXPECT_EQ(vfs.getattr("/renamed", &st), 0);
+
+        EXPECT_EQ(vfs.unlink("/renamed"), 0);
+        EXPECT_FALSE(vfs.exists("/renamed"));
+    }
+}
@@ -0,0 +1,91 @@
+#include <fcntl.h>
+#include <gtest/gtest.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+#include "backing_directory.h"
+#include "common.h"
+#include "posix_backend.h"
+
+namespace {
+
+class BackingDirectoryTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        std::filesystem::create_directories(root / "a" / "b");
+        std::ofstream(root / "a" / "b" / "file") << "content";
+    }
+
+    static bool exists(const BackingDirectory::Location &location) {
+        struct stat st {};
+        return ::fstatat(location.dirfd(), location.name(), &st, AT_SYMLINK_NOFOLLOW) == 0;
+    }
+
+    Common::TempDirectory root{"backing"};
+};
+
+}  // namespace
+
+TEST_F(BackingDirectoryTest, resolve_root) {
+    BackingDirectory backing(root);
+
+    auto location = backing.resolve("/");
+    EXPECT_EQ(location.dirfd(), backing.root_fd());
+    EXPECT_STREQ(location.name(), ".");
+}
+
+TEST_F(BackingDirectoryTest, resolve_without_cache) {
+    BackingDirectory backing(root);
+
+    auto location = backing.resolve("/a/b/file");
+    EXPECT_EQ(location.dirfd(), backing.root_fd());
+    EXPECT_STREQ(location.name(), "a/b/file");
+    EXPECT_TRUE(exists(location));
+    EXPECT_EQ(backing.cached(), 0);
+}
+
+TEST_F(BackingDirectoryTest, resolve_through_cache) {
+    BackingDirectory backing(root);
+    backing.set_cache_capacity(1);
+
+    auto location = backing.resolve("/a/b/file");
+    EXPECT_NE(location.dirfd(), backing.root_fd());
+    EXPECT_STREQ(location.name(), "file");
+    EXPECT_TRUE(exists(location));
+    EXPECT_EQ(backing.cached(), 1);
+
+    EXPECT_TRUE(exists(backing.resolve("/a/b")));
+    EXPECT_EQ(backing.cached(), 1);
+}
+
+TEST_F(BackingDirectoryTest, invalidate_after_rename) {
+    BackingDirectory backing(root);
+    backing.set_cache_capacity(4);
+
+    EXPECT_TRUE(exists(backing.resolve("/a/b/file")));
+    std::filesystem::rename(root / "a", root / "c");
+    backing.invalidate("/a");
+    EXPECT_EQ(backing.cached(), 0);
+
+    EXPECT_FALSE(exists(backing.resolve("/a/b/file")));
+    EXPECT_TRUE(exists(backing.resolve("/c/b/file")));
+}
+
+TEST_F(BackingDirectoryTest, replaced_symlink_is_not_resolved_through_the_cache) {
+    PosixBackend backend(root.string());
+    backend.set_parent_cache_size(4);
+
+    ASSERT_EQ(backend.symlink("a", "/link"), 0);
+    struct stat st {};
+    ASSERT_EQ(backend.stat("/link/b/file", &st, false), 0);
+
+    ASSERT_EQ(backend.unlink("/link"), 0);
+    ASSERT_EQ(backend.mkdir("/link", 0755), 0);
+    ASSERT_EQ(backend.mkdir("/link/b", 0755), 0);
+    EXPECT_EQ(backend.stat("/link/b/file", &st, false), -ENOENT);
+    EXPECT_TRUE(std::filesystem::exists(root / "a" / "b" / "file"));
+}
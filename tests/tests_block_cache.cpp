@@ -0,0 +1,198 @@
+#include <fcntl.h>
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <memory>
+#include <string>
+
+#include "backend_test_helpers.h"
+#include "block_cache.h"
+#include "cached_backend.h"
+#include "memory_backend.h"
+
+namespace {
+
+std::shared_ptr<const BlockCache::Block> block_of(char c, size_t size = 16) {
+    return std::make_shared<const BlockCache::Block>(size, c);
+}
+
+class CachedBackendTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        inner = std::make_shared<MemoryBackend>();
+        backend = std::make_shared<CachedBackend>(inner, 64 * 1024, 1024);
+    }
+
+    void write_file(const std::string &path, const std::string &content) {
+        BackendTest::write_file(*backend, path, content);
+    }
+
+    std::string read(FileHandle &handle, size_t count, off_t offset) {
+        std::string content(count, 'x');
+        ssize_t res = backend->pread(handle, content.data(), count, offset);
+        EXPECT_GE(res, 0);
+        content.resize(std::max<ssize_t>(res, 0));
+        return content;
+    }
+
+    std::string read_file(const std::string &path) {
+        return BackendTest::read_file(*backend, path);
+    }
+
+    static std::string pattern(size_t size) {
+        std::string content(size, 0);
+        for (size_t i = 0; i < size; i++) {
+            content[i] = static_cast<char>('a' + i % 23);
+        }
+        return content;
+    }
+
+    std::shared_ptr<MemoryBackend> inner;
+    std::shared_ptr<CachedBackend> backend;
+};
+
+}  // namespace
+
+TEST(BlockCacheTest, counts_hits_misses_and_memory) {
+    BlockCache cache(4 * 16, 16, 1);
+    EXPECT_EQ(cache.find({1, 0}), nullptr);
+    cache.insert({1, 0}, block_of('a'));
+    cache.insert({1, 1}, block_of('b', 10));
+
+    auto block = cache.find({1, 0});
+    ASSERT_NE(block, nullptr);
+    EXPECT_EQ(block->front(), 'a');
+    EXPECT_EQ(cache.find({2, 0}), nullptr);
+
+    auto statistics = cache.statistics();
+    EXPECT_EQ(statistics.hits, 1u);
+    EXPECT_EQ(statistics.misses, 2u);
+    EXPECT_EQ(statistics.bytes, 26u);
+    EXPECT_EQ(statistics.capacity, 64u);
+    EXPECT_DOUBLE_EQ(statistics.hit_ratio(), 1.0 / 3.0);
+
+    cache.erase({1, 0});
+    EXPECT_EQ(cache.find({1, 0}), nullptr);
+    EXPECT_EQ(cache.statistics().bytes, 10u);
+}
+
+TEST(BlockCacheTest, stays_within_capacity) {
+    BlockCache cache(8 * 16, 16, 2);
+    for (uint64_t i = 0; i < 100; i++) {
+        cache.insert({7, i}, block_of('c'));
+        EXPECT_LE(cache.statistics().bytes, cache.statistics().capacity);
+    }
+    EXPECT_EQ(cache.statistics().evictions, 92u);
+
+    // Replacing a cached block does not take more room
+    cache.insert({7, 99}, block_of('d'));
+    EXPECT_EQ(cache.statistics().bytes, 8u * 16);
+    EXPECT_EQ(cache.find({7, 99})->front(), 'd');
+}
+
+TEST(BlockCacheTest, blocks_read_again_survive_scans) {
+    BlockCache cache(4 * 16, 16, 1);
+    cache.insert({1, 0}, block_of('a'));
+    cache.insert({1, 1}, block_of('b'));
+    ASSERT_NE(cache.find({1, 0}), nullptr);
+    ASSERT_NE(cache.find({1, 1}), nullptr);
+
+    // Blocks read once only replace each other, even when there are many more of them than fit
+    for (uint64_t i = 0; i < 32; i++) {
+        cache.insert({2, i}, block_of('s'));
+    }
+    EXPECT_NE(cache.find({1, 0}), nullptr);
+    EXPECT_NE(cache.find({1, 1}), nullptr);
+    EXPECT_EQ(cache.find({2, 0}), nullptr);
+    EXPECT_NE(cache.find({2, 31}), nullptr);
+}
+
+TEST(BlockCacheTest, recently_evicted_blocks_come_back_as_frequent) {
+    BlockCache cache(4 * 16, 16, 1);
+    cache.insert({3, 0}, block_of('f'));
+    ASSERT_NE(cache.find({3, 0}), nullptr);
+    for (uint64_t i = 0; i < 4; i++) {
+        cache.insert({1, i}, block_of('a'));
+    }
+    ASSERT_EQ(cache.find({1, 0}), nullptr);
+
+    // A block missed soon after its eviction was needed, so it is kept like one read twice
+    cache.insert({1, 0}, block_of('a'));
+    for (uint64_t i = 0; i < 32; i++) {
+        cache.insert({2, i}, block_of('s'));
+    }
+    EXPECT_NE(cache.find({1, 0}), nullptr);
+    EXPECT_NE(cache.find({3, 0}), nullptr);
+}
+
+TEST_F(CachedBackendTest, repeated_reads_are_served_from_memory) {
+    std::string content = pattern(10000);
+    write_file("/file", content);
+
+    EXPECT_EQ(read_file("/file"), content);
+    auto first = backend->statistics();
+    EXPECT_EQ(first.misses, 10u);
+    EXPECT_EQ(first.bytes, 10000u);
+
+    // Blocks belong to the file, not to its name
+    ASSERT_EQ(backend->rename("/file", "/renamed", 0), 0);
+    EXPECT_EQ(read_file("/renamed"), content);
+    auto second = backend->statistics();
+    EXPECT_EQ(second.misses, first.misses);
+    EXPECT_EQ(second.hits - first.hits, 11u);
+
+    std::unique_ptr<FileHandle> handle;
+    ASSERT_EQ(backend->open("/renamed", O_RDONLY, 0, handle), 0);
+    EXPECT_EQ(read(*handle, 3000, 1000), content.substr(1000, 3000));
+    EXPECT_EQ(read(*handle, 5000, 9000), content.substr(9000));
+    EXPECT_EQ(read(*handle, 100, 10000), "");
+    EXPECT_EQ(read(*handle, 100, 20000), "");
+    ASSERT_EQ(backend->release(*handle), 0);
+}
+
+TEST_F(CachedBackendTest, writes_and_truncations_drop_blocks) {
+    std::string content = pattern(5000);
+    write_file("/file", content);
+
+    std::unique_ptr<FileHandle> reader;
+    std::unique_ptr<FileHandle> writer;
+    ASSERT_EQ(backend->open("/file", O_RDONLY, 0, reader), 0);
+    ASSERT_EQ(backend->open("/file", O_RDWR, 0, writer), 0);
+    ASSERT_EQ(read(*reader, 5000, 0), content);
+
+    std::string update(1500, 'W');
+    ASSERT_EQ(backend->pwrite(*writer, update.data(), update.size(), 1000), 1500);
+    content.replace(1000, 1500, update);
+    EXPECT_EQ(read(*reader, 5000, 0), content);
+
+    ASSERT_EQ(backend->ftruncate(*writer, 2048), 0);
+    content.resize(2048);
+    EXPECT_EQ(read(*reader, 5000, 0), content);
+
+    // The short last block grows when a write past the end leaves a hole
+    ASSERT_EQ(backend->pwrite(*writer, "end", 3, 4000), 3);
+    content.resize(4000, '\0');
+    content += "end";
+    EXPECT_EQ(read(*reader, 5000, 0), content);
+
+    ASSERT_EQ(backend->truncate("/file", 100), 0);
+    EXPECT_EQ(read(*reader, 5000, 0), content.substr(0, 100));
+
+    ASSERT_EQ(backend->release(*reader), 0);
+    ASSERT_EQ(backend->release(*writer), 0);
+
+    write_file("/file", "rewritten");
+    EXPECT_EQ(read_file("/file"), "rewritten");
+}
+
+TEST_F(CachedBackendTest, changes_behind_the_cache_are_noticed_on_open) {
+    write_file("/file", std::string(3000, 'o'));
+    EXPECT_EQ(read_file("/file"), std::string(3000, 'o'));
+
+    std::unique_ptr<FileHandle> handle;
+    ASSERT_EQ(inner->open("/file", O_WRONLY, 0, handle), 0);
+    ASSERT_EQ(inner->pwrite(*handle, "new", 3, 0), 3);
+    ASSERT_EQ(inner->release(*handle), 0);
+
+    EXPECT_EQ(read_file("/file"), "new" + std::string(2997, 'o'));
+}
@@ -0,0 +1,233 @@
+#include <fcntl.h>
+#include <gtest/gtest.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <filesystem>
+#include <memory>
+#include <random>
+#include <string>
+
+#include "backend_test_helpers.h"
+#include "chunked_backend.h"
+#include "chunker.h"
+#include "common.h"
+#include "posix_backend.h"
+
+namespace {
+
+/// Average chunk size of the tests, small enough for files of a few KiB to have many chunks
+constexpr size_t AVERAGE_CHUNK = 512;
+
+std::string random_content(size_t size, unsigned int seed) {
+    std::mt19937 generator(seed);
+    std::string data(size, '\0');
+    for (auto &c : data) {
+        c = static_cast<char>(generator());
+    }
+    return data;
+}
+
+class ChunkedBackendTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        open_backend();
+    }
+
+    void TearDown() override {
+        backend.reset();
+    }
+
+    void open_backend() {
+        backend.reset();
+        backend = std::make_shared<ChunkedBackend>(std::make_shared<PosixBackend>(root.string()),
+                                                   (root / ChunkedBackend::CHUNK_DIRECTORY).string(), AVERAGE_CHUNK);
+    }
+
+    void write_file(const std::string &path, const std::string &content) {
+        BackendTest::write_file(*backend, path, content);
+    }
+
+    std::string read_file(const std::string &path) {
+        return BackendTest::read_file(*backend, path);
+    }
+
+    /// Whether the file in the backing directory is a manifest
+    bool chunked(const std::string &path) const {
+        struct stat st {};
+        return ::lstat((root / path.substr(1)).c_str(), &st) == 0 && (st.st_mode & S_ISVTX) != 0;
+    }
+
+    size_t stored_chunks() const {
+        size_t chunks = 0;
+        uint64_t bytes = 0;
+        backend->chunks().usage(chunks, bytes);
+        return chunks;
+    }
+
+    Common::TempDirectory root{"chunked"};
+    std::shared_ptr<ChunkedBackend> backend;
+};
+
+}  // namespace
+
+TEST(ChunkerTest, boundaries_survive_an_insert) {
+    Chunker chunker(AVERAGE_CHUNK);
+    std::string data = random_content(64 * 1024, 1);
+    std::string shifted = "inserted" + data;
+
+    auto boundaries = [&](const std::string &input, size_t skip) {
+        std::vector<size_t> cuts;
+        for (size_t offset = 0; offset < input.size();) {
+            size_t length = chunker.cut(input.data() + offset, input.size() - offset, true);
+            EXPECT_GE(length, std::min(chunker.min_size(), input.size() - offset));
+            EXPECT_LE(length, chunker.max_size());
+            offset += length;
+            if (offset > skip) {
+                cuts.push_back(offset - skip);
+            }
+        }
+        return cuts;
+    };
+
+    auto original = boundaries(data, 0);
+    auto moved = boundaries(shifted, 8);
+    EXPECT_GT(original.size(), 32u);
+
+    // After the first few chunks the boundaries resynchronize
+    size_t common = 0;
+    for (size_t cut : moved) {
+        common += std::find(original.begin(), original.end(), cut) != original.end();
+    }
+    EXPECT_GE(common + 3, original.size());
+}
+
+TEST_F(ChunkedBackendTest, files_are_chunked_once_synced) {
+    std::string data = random_content(8192, 2);
+    write_file("/file", data);
+    write_file("/tiny", "tiny");
+    EXPECT_FALSE(chunked("/file"));
+
+    ASSERT_EQ(backend->syncfs(), 0);
+    EXPECT_TRUE(chunked("/file"));
+    EXPECT_FALSE(chunked("/tiny"));
+
+    struct stat st {};
+    ASSERT_EQ(backend->stat("/file", &st, false), 0);
+    EXPECT_EQ(st.st_size, 8192);
+    EXPECT_EQ(st.st_mode & 07777, 0644u);
+    EXPECT_EQ(read_file("/file"), data);
+    EXPECT_EQ(read_file("/tiny"), "tiny");
+
+    std::vector<std::string> names;
+    ASSERT_EQ(backend->list("/", names), 0);
+    EXPECT_EQ(std::count(names.begin(), names.end(), ChunkedBackend::CHUNK_DIRECTORY), 0);
+}
+
+TEST_F(ChunkedBackendTest, similar_files_share_chunks) {
+    std::string data = random_content(32 * 1024, 3);
+    write_file("/a", data);
+    ASSERT_EQ(backend->syncfs(), 0);
+    size_t alone = stored_chunks();
+
+    std::string edited = data.substr(0, 10000) + "an edit in the middle" + data.substr(10000);
+    write_file("/b", edited);
+    ASSERT_EQ(backend->syncfs(), 0);
+
+    EXPECT_LE(stored_chunks(), alone + 4);
+    EXPECT_EQ(read_file("/a"), data);
+    EXPECT_EQ(read_file("/b"), edited);
+}
+
+TEST_F(ChunkedBackendTest, copies_share_chunks_and_unlink_frees_them) {
+    std::string data = random_content(16 * 1024, 4);
+    write_file("/file", data);
+    ASSERT_EQ(backend->syncfs(), 0);
+    size_t chunks = stored_chunks();
+
+    ASSERT_EQ(backend->copy("/file", "/copy"), 0);
+    EXPECT_TRUE(chunked("/copy"));
+    EXPECT_EQ(stored_chunks(), chunks);
+    EXPECT_EQ(read_file("/copy"), data);
+
+    ASSERT_EQ(backend->unlink("/file"), 0);
+    EXPECT_EQ(stored_chunks(), chunks);
+    ASSERT_EQ(backend->unlink("/copy"), 0);
+    EXPECT_EQ(stored_chunks(), 0u);
+}
+
+TEST_F(ChunkedBackendTest, copies_of_plain_files_are_chunked_in_the_background) {
+    std::string data = random_content(16 * 1024, 7);
+    write_file("/file", data);
+
+    ASSERT_EQ(backend->copy("/file", "/copy"), 0);
+    EXPECT_FALSE(chunked("/copy"));
+    EXPECT_EQ(read_file("/copy"), data);
+
+    ASSERT_EQ(backend->syncfs(), 0);
+    EXPECT_TRUE(chunked("/file"));
+    EXPECT_TRUE(chunked("/copy"));
+    EXPECT_EQ(read_file("/copy"), data);
+}
+
+TEST_F(ChunkedBackendTest, writing_expands_the_file) {
+    std::string data = random_content(4096, 5);
+    write_file("/file", data);
+    ASSERT_EQ(backend->syncfs(), 0);
+
+    std::unique_ptr<FileHandle> handle;
+    ASSERT_EQ(backend->open("/file", O_WRONLY, 0, handle), 0);
+    EXPECT_FALSE(chunked("/file"));
+    ASSERT_EQ(backend->pwrite(*handle, "new", 3, 0), 3);
+    ASSERT_EQ(backend->release(*handle), 0);
+
+    EXPECT_EQ(read_file("/file"), "new" + data.substr(3));
+    ASSERT_EQ(backend->syncfs(), 0);
+    EXPECT_TRUE(chunked("/file"));
+    EXPECT_EQ(read_file("/file"), "new" + data.substr(3));
+
+    ASSERT_EQ(backend->truncate("/file", 100), 0);
+    EXPECT_EQ(read_file("/file"), "new" + data.substr(3, 97));
+}
+
+TEST_F(ChunkedBackendTest, reference_counts_survive_restarts) {
+    std::string data = random_content(16 * 1024, 6);
+    write_file("/file", data);
+    ASSERT_EQ(backend->copy("/file", "/copy"), 0);
+    ASSERT_EQ(backend->syncfs(), 0);
+    size_t chunks = stored_chunks();
+
+    open_backend();
+    EXPECT_TRUE(backend->chunks().counts_loaded());
+    EXPECT_EQ(stored_chunks(), chunks);
+
+    // Without saved counts they are rebuilt from the manifests
+    backend.reset();
+    std::filesystem::remove(root / ChunkedBackend::CHUNK_DIRECTORY / "counts");
+    open_backend();
+    EXPECT_EQ(stored_chunks(), chunks);
+    ASSERT_EQ(backend->unlink("/file"), 0);
+    ASSERT_EQ(backend->unlink("/copy"), 0);
+    EXPECT_EQ(stored_chunks(), 0u);
+    EXPECT_EQ(read_file("/file"), "<missing>");
+}
+
+TEST_F(ChunkedBackendTest, renamed_files_being_written_are_not_chunked) {
+    std::string data = random_content(8192, 8);
+    std::unique_ptr<FileHandle> handle;
+    ASSERT_EQ(backend->open("/file", O_WRONLY | O_CREAT, 0644, handle), 0);
+    ASSERT_EQ(backend->pwrite(*handle, data.data(), 4096, 0), 4096);
+
+    ASSERT_EQ(backend->rename("/file", "/moved", 0), 0);
+    ASSERT_EQ(backend->truncate("/moved", 4096), 0);
+    ASSERT_EQ(backend->syncfs(), 0);
+    EXPECT_FALSE(chunked("/moved"));
+
+    // The handle still writes to the file under its new name, which is chunked once closed
+    ASSERT_EQ(backend->pwrite(*handle, data.data() + 4096, 4096, 4096), 4096);
+    ASSERT_EQ(backend->release(*handle), 0);
+    ASSERT_EQ(backend->syncfs(), 0);
+    EXPECT_TRUE(chunked("/moved"));
+    EXPECT_EQ(read_file("/moved"), data);
+}
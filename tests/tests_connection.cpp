@@ -0,0 +1,87 @@
+#include <fcntl.h>
+#include <gtest/gtest.h>
+
+#include <memory>
+
+#include "common.h"
+#include "custom_vfs.h"
+#include "fuse_wrapper.h"
+#include "memory_backend.h"
+
+namespace {
+
+struct fuse_conn_info offered_connection() {
+    struct fuse_conn_info info {};
+    info.capable = FUSE_CAP_ASYNC_READ | FUSE_CAP_SPLICE_READ | FUSE_CAP_SPLICE_WRITE;
+    info.want = FUSE_CAP_ASYNC_READ;
+    info.max_write = 4096;
+    info.max_readahead = 131072;
+    return info;
+}
+
+}  // namespace
+
+TEST(FuseConnection, keeps_proposed_values) {
+    struct fuse_conn_info info = offered_connection();
+    FuseWrapper::connection conn(&info);
+
+    EXPECT_TRUE(conn.capable(FuseWrapper::CAP_SPLICE_READ));
+    EXPECT_FALSE(conn.capable(FuseWrapper::CAP_SPLICE_MOVE));
+    EXPECT_TRUE(conn.enabled(FuseWrapper::CAP_ASYNC_READ));
+    EXPECT_EQ(conn.max_write, 4096);
+    EXPECT_EQ(conn.max_readahead, 131072);
+}
+
+TEST(FuseConnection, veto_wins_over_want) {
+    struct fuse_conn_info info = offered_connection();
+    FuseWrapper::connection conn(&info);
+
+    conn.veto(FuseWrapper::CAP_SPLICE_READ);
+    conn.want(FuseWrapper::CAP_SPLICE_READ);
+    conn.veto(FuseWrapper::CAP_ASYNC_READ);
+    conn.want(FuseWrapper::CAP_SPLICE_WRITE);
+
+    EXPECT_FALSE(conn.enabled(FuseWrapper::CAP_SPLICE_READ));
+    EXPECT_FALSE(conn.enabled(FuseWrapper::CAP_ASYNC_READ));
+    EXPECT_TRUE(conn.enabled(FuseWrapper::CAP_SPLICE_WRITE));
+
+    conn.apply(&info);
+    EXPECT_EQ(info.want & FUSE_CAP_SPLICE_READ, 0);
+    EXPECT_EQ(info.want & FUSE_CAP_ASYNC_READ, 0);
+    EXPECT_NE(info.want & FUSE_CAP_SPLICE_WRITE, 0);
+}
+
+TEST(FuseConnection, unsupported_capability_stays_disabled) {
+    struct fuse_conn_info info = offered_connection();
+    FuseWrapper::connection conn(&info);
+
+    conn.want(FuseWrapper::CAP_SPLICE_MOVE);
+    conn.max_write = 1 << 20;
+    conn.apply(&info);
+
+    EXPECT_FALSE(conn.enabled(FuseWrapper::CAP_SPLICE_MOVE));
+    EXPECT_EQ(info.want & FUSE_CAP_SPLICE_MOVE, 0);
+    EXPECT_EQ(info.max_write, 1 << 20);
+}
+
+TEST(FuseConnection, writeback_cache_opens_files_for_reading_without_append) {
+#ifndef FUSE_CAP_WRITEBACK_CACHE
+    GTEST_SKIP() << "libfuse does not offer the writeback cache";
+#else
+    Common::TempDirectory root("connection");
+    CustomVfs vfs((root / "mount").string(), std::make_shared<MemoryBackend>());
+
+    struct fuse_conn_info info = offered_connection();
+    info.capable |= FUSE_CAP_WRITEBACK_CACHE;
+    FuseWrapper::connection conn(&info);
+    conn.want(FuseWrapper::CAP_WRITEBACK_CACHE);
+    vfs.negotiated(conn);
+
+    struct fuse_file_info fi {};
+    fi.flags = O_WRONLY | O_APPEND;
+    ASSERT_EQ(vfs.create("/file", 0644, &fi), 0);
+    EXPECT_EQ(fi.flags & O_ACCMODE, O_RDWR);
+    EXPECT_EQ(fi.flags & O_APPEND, 0);
+    EXPECT_EQ(vfs.release("/file", &fi), 0);
+#endif
+}
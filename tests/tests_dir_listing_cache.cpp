@@ -0,0 +1,140 @@
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "common.h"
+#include "custom_vfs.h"
+#include "dir_listing_cache.h"
+
+namespace {
+
+struct stat stamp(long seconds) {
+    struct stat st {};
+    st.st_ino = 1;
+    st.st_mtim.tv_sec = seconds;
+    st.st_ctim.tv_sec = seconds;
+    return st;
+}
+
+std::vector<std::string> sorted(std::vector<std::string> names) {
+    std::sort(names.begin(), names.end());
+    return names;
+}
+
+}  // namespace
+
+TEST(DirListingCache, listing_is_revalidated_by_stamp) {
+    DirListingCache cache(1 << 20);
+    cache.store("/dir", stamp(1), {"a", "b"});
+
+    std::vector<std::string> names;
+    ASSERT_TRUE(cache.names("/dir", stamp(1), names));
+    EXPECT_EQ(sorted(names), (std::vector<std::string>{"a", "b"}));
+
+    EXPECT_FALSE(cache.names("/dir", stamp(2), names));
+    EXPECT_EQ(cache.size(), 0);
+}
+
+TEST(DirListingCache, incremental_updates) {
+    DirListingCache cache(1 << 20);
+    cache.store("/dir", stamp(1), {"a", "b"});
+
+    cache.added("/dir", "c", stamp(1), stamp(2));
+    cache.removed("/dir", "a", stamp(2), stamp(3));
+
+    std::vector<std::string> names;
+    ASSERT_TRUE(cache.names("/dir", stamp(3), names));
+    EXPECT_EQ(sorted(names), (std::vector<std::string>{"b", "c"}));
+}
+
+TEST(DirListingCache, updates_of_a_stale_listing_drop_it) {
+    DirListingCache cache(1 << 20);
+    cache.store("/dir", stamp(1), {"a", "b"});
+
+    // The directory changed behind the cache between stamp(1) and the stamp before the update
+    cache.added("/dir", "c", stamp(2), stamp(3));
+    EXPECT_EQ(cache.size(), 0);
+
+    std::vector<std::string> names;
+    EXPECT_FALSE(cache.names("/dir", stamp(3), names));
+}
+
+TEST(DirListingCache, prefixed_index) {
+    DirListingCache cache(1 << 20);
+    cache.store("/", stamp(1), {"file", "other", "#VERSION-1#file", "#VERSION-2#file", "#VERSION-1#other"});
+
+    std::vector<std::string> names;
+    ASSERT_TRUE(cache.prefixed("/", stamp(1), "file", names));
+    EXPECT_EQ(sorted(names), (std::vector<std::string>{"#VERSION-1#file", "#VERSION-2#file"}));
+
+    cache.removed("/", "#VERSION-1#file", stamp(1), stamp(2));
+    cache.added("/", "#VERSION-3#file", stamp(2), stamp(3));
+    ASSERT_TRUE(cache.prefixed("/", stamp(3), "file", names));
+    EXPECT_EQ(sorted(names), (std::vector<std::string>{"#VERSION-2#file", "#VERSION-3#file"}));
+
+    ASSERT_TRUE(cache.prefixed("/", stamp(3), "missing", names));
+    EXPECT_TRUE(names.empty());
+}
+
+TEST(DirListingCache, memory_is_bounded) {
+    DirListingCache cache(64 << 10);
+
+    std::vector<std::string> names;
+    for (int i = 0; i < 200; i++) {
+        names.push_back("name" + std::to_string(i));
+    }
+
+    for (int i = 0; i < 100; i++) {
+        cache.store("/dir" + std::to_string(i), stamp(1), names);
+    }
+
+    EXPECT_GT(cache.size(), 0);
+    EXPECT_LT(cache.size(), 100);
+    EXPECT_LE(cache.memory(), 64 << 10);
+}
+
+TEST(DirListingCache, invalidate_tree) {
+    DirListingCache cache(1 << 20);
+    cache.store("/dir", stamp(1), {"a"});
+    cache.store("/dir/sub", stamp(1), {"b"});
+    cache.store("/directory", stamp(1), {"c"});
+
+    cache.invalidate_tree("/dir");
+
+    std::vector<std::string> names;
+    EXPECT_FALSE(cache.names("/dir", stamp(1), names));
+    EXPECT_FALSE(cache.names("/dir/sub", stamp(1), names));
+    EXPECT_TRUE(cache.names("/directory", stamp(1), names));
+}
+
+TEST(DirListingCache, vfs_keeps_listing_in_sync) {
+    Common::TempDirectory root("listing");
+    std::filesystem::create_directories(root / "backing");
+
+    {
+        CustomVfs vfs((root / "mount").string(), (root / "backing").string());
+        vfs.set_dir_cache_size(1 << 20);
+
+        EXPECT_TRUE(vfs.subfiles("/").empty());
+        EXPECT_EQ(vfs.mknod("/file", S_IFREG | 0644, 0), 0);
+        EXPECT_EQ(vfs.copy_file("/file", "/#VERSION-1#file"), 0);
+        EXPECT_EQ(sorted(vfs.subfiles("/")), (std::vector<std::string>{"#VERSION-1#file", "file"}));
+        EXPECT_EQ(vfs.prefixed_subfiles("/", "file"), (std::vector<std::string>{"#VERSION-1#file"}));
+
+        EXPECT_EQ(vfs.unlink("/#VERSION-1#file"), 0);
+        EXPECT_TRUE(vfs.prefixed_subfiles("/", "file").empty());
+
+        // Changes behind the VFS are noticed through the directory stamps, the mtime is moved explicitly as two
+        // changes within one timestamp tick are indistinguishable
+        std::ofstream(root / "backing" / "external") << "data";
+        std::filesystem::last_write_time(root / "backing",
+                                         std::filesystem::file_time_type::clock::now() + std::chrono::seconds(5));
+        EXPECT_EQ(sorted(vfs.subfiles("/")), (std::vector<std::string>{"external", "file"}));
+    }
+}
@@ -0,0 +1,140 @@
+#include <fcntl.h>
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "common.h"
+#include "common/metrics.h"
+#include "custom_vfs.h"
+#include "group_commit.h"
+#include "io_engine.h"
+#include "write_back_vfs.h"
+
+namespace {
+
+/// Counts the syncs requested from the engine
+class CountingIoEngine : public SyncIoEngine {
+public:
+    int fsync(const FileHandle &handle, bool datasync) override {
+        (datasync ? datasyncs : fsyncs)++;
+        return SyncIoEngine::fsync(handle, datasync);
+    }
+
+    int fsyncs = 0;
+    int datasyncs = 0;
+};
+
+class DurabilityTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        std::filesystem::create_directories(root / "backing");
+        vfs = std::make_unique<CustomVfs>((root / "mount").string(), (root / "backing").string());
+        engine = std::make_shared<CountingIoEngine>();
+        vfs->set_io_engine(engine);
+    }
+
+    void TearDown() override {
+        vfs.reset();
+    }
+
+    /// Creates a file, writes to it and closes it again
+    void write_file(struct fuse_file_info &fi, bool sync) {
+        fi.flags = O_RDWR;
+        ASSERT_EQ(vfs->create("/file", 0644, &fi), 0);
+        ASSERT_EQ(vfs->write("/file", "data", 4, 0, &fi), 4);
+        if (sync) {
+            ASSERT_EQ(vfs->fsync("/file", 1, &fi), 0);
+        }
+        ASSERT_EQ(vfs->flush("/file", &fi), 0);
+        ASSERT_EQ(vfs->release("/file", &fi), 0);
+    }
+
+    Common::TempDirectory root{"durability"};
+    std::unique_ptr<CustomVfs> vfs;
+    std::shared_ptr<CountingIoEngine> engine;
+};
+
+}  // namespace
+
+TEST_F(DurabilityTest, close_does_not_sync_by_default) {
+    struct fuse_file_info fi {};
+    write_file(fi, false);
+    EXPECT_EQ(engine->fsyncs + engine->datasyncs, 0);
+}
+
+TEST_F(DurabilityTest, fsync_honours_datasync) {
+    struct fuse_file_info fi {};
+    write_file(fi, true);
+    EXPECT_EQ(engine->datasyncs, 1);
+    EXPECT_EQ(engine->fsyncs, 0);
+}
+
+TEST_F(DurabilityTest, close_mode_syncs_on_close) {
+    vfs->set_durability(CustomVfs::Durability::CLOSE);
+    struct fuse_file_info fi {};
+    write_file(fi, false);
+    EXPECT_EQ(engine->fsyncs, 1);
+}
+
+TEST_F(DurabilityTest, mode_set_on_a_decorator_reaches_the_wrapped_instance) {
+    WriteBackVfs decorated(*vfs, 0);
+    decorated.set_durability(CustomVfs::Durability::CLOSE);
+
+    struct fuse_file_info fi {};
+    write_file(fi, false);
+    EXPECT_EQ(engine->fsyncs, 1);
+}
+
+TEST_F(DurabilityTest, none_mode_ignores_fsync) {
+    vfs->set_durability(CustomVfs::Durability::NONE);
+    struct fuse_file_info fi {};
+    write_file(fi, true);
+    EXPECT_EQ(engine->fsyncs + engine->datasyncs, 0);
+}
+
+TEST_F(DurabilityTest, group_mode_uses_syncfs) {
+    vfs->set_durability(CustomVfs::Durability::GROUP);
+    auto &syncs = Metrics::counter("durability.syncfs");
+    uint64_t before = syncs.load();
+
+    struct fuse_file_info fi {};
+    write_file(fi, true);
+    EXPECT_EQ(engine->fsyncs + engine->datasyncs, 0);
+    EXPECT_EQ(syncs.load(), before + 1);
+}
+
+TEST_F(DurabilityTest, concurrent_group_requests_share_syncs) {
+    int fd = ::open(root.c_str(), O_RDONLY | O_DIRECTORY);
+    ASSERT_GE(fd, 0);
+    GroupCommit group(fd);
+
+    auto &requests = Metrics::counter("durability.group_requests");
+    auto &syncs = Metrics::counter("durability.syncfs");
+    uint64_t requests_before = requests.load();
+    uint64_t syncs_before = syncs.load();
+
+    std::vector<std::thread> threads;
+    std::atomic<int> failures(0);
+    for (int i = 0; i < 16; i++) {
+        threads.emplace_back([&] {
+            for (int j = 0; j < 8; j++) {
+                if (group.sync() != 0) {
+                    failures++;
+                }
+            }
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    ::close(fd);
+
+    EXPECT_EQ(failures.load(), 0);
+    EXPECT_EQ(requests.load() - requests_before, 128u);
+    EXPECT_GE(syncs.load() - syncs_before, 1u);
+    EXPECT_LE(syncs.load() - syncs_before, 128u);
+}
@@ -1,5 +1,6 @@
 #include <gtest/gtest.h>
 
+#include "common.h"
 #include "encryptor.h"
 
 TEST(Encryptor, password_encryptor) {
@@ -68,12 +69,13 @@ TEST(Encryptor, invalid_random_encryptor) {
 
 TEST(Encryptor, from_file) {
     Encryptor encryptor;
+    Common::TempDirectory root("encryptor");
 
-    std::ofstream file("test_file");
+    std::ofstream file(root / "key");
     encryptor.store_key(file);
     file.close();
 
-    std::ifstream file2("test_file");
+    std::ifstream file2(root / "key");
     auto encryptor2 = Encryptor(file2);
     file2.close();
 
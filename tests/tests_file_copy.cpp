@@ -0,0 +1,87 @@
+#include <fcntl.h>
+#include <gtest/gtest.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <filesystem>
+#include <string>
+
+#include "common.h"
+#include "custom_vfs.h"
+#include "file_copy.h"
+
+namespace {
+
+class FileCopyTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        std::filesystem::create_directories(root / "backing");
+    }
+
+    std::string backing(const std::string &name) const {
+        return (root / "backing" / name).string();
+    }
+
+    Common::TempDirectory root{"copy"};
+};
+
+std::string read_all(const std::string &path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    std::string content;
+    char buffer[4096];
+    ssize_t count;
+    while ((count = ::read(fd, buffer, sizeof(buffer))) > 0) {
+        content.append(buffer, static_cast<size_t>(count));
+    }
+    ::close(fd);
+    return content;
+}
+
+}  // namespace
+
+TEST_F(FileCopyTest, sparse_file_keeps_content_and_size) {
+    const off_t size = 8 << 20;
+    int fd = ::open(backing("sparse").c_str(), O_WRONLY | O_CREAT, 0640);
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(::pwrite(fd, "head", 4, 0), 4);
+    ASSERT_EQ(::pwrite(fd, "middle", 6, 4 << 20), 6);
+    ASSERT_EQ(::ftruncate(fd, size), 0);
+    ::close(fd);
+
+    CustomVfs vfs((root / "mount").string(), (root / "backing").string());
+    ASSERT_EQ(vfs.copy_file("/sparse", "/copy"), 0);
+
+    struct stat source {};
+    struct stat copy {};
+    ASSERT_EQ(::stat(backing("sparse").c_str(), &source), 0);
+    ASSERT_EQ(::stat(backing("copy").c_str(), &copy), 0);
+    EXPECT_EQ(copy.st_size, size);
+    EXPECT_EQ(copy.st_mode & 07777, 0640);
+    EXPECT_EQ(read_all(backing("copy")), read_all(backing("sparse")));
+
+    // Holes are never filled, whatever the strategy was
+    EXPECT_LE(copy.st_blocks, source.st_blocks);
+}
+
+TEST_F(FileCopyTest, existing_destination_is_kept) {
+    CustomVfs vfs((root / "mount").string(), (root / "backing").string());
+    ASSERT_EQ(vfs.mknod("/source", S_IFREG | 0644, 0), 0);
+    ASSERT_EQ(vfs.mknod("/destination", S_IFREG | 0644, 0), 0);
+
+    EXPECT_EQ(vfs.copy_file("/source", "/destination"), -EEXIST);
+    EXPECT_EQ(vfs.copy_file("/missing", "/other"), -ENOENT);
+    EXPECT_FALSE(vfs.exists("/other"));
+}
+
+TEST_F(FileCopyTest, copy_between_descriptors) {
+    int fd = ::open(backing("source").c_str(), O_RDWR | O_CREAT, 0644);
+    ASSERT_EQ(::write(fd, "content", 7), 7);
+    int out = ::open(backing("destination").c_str(), O_WRONLY | O_CREAT, 0644);
+
+    FileCopy::Strategy strategy;
+    ASSERT_EQ(FileCopy::copy(fd, out, 7, &strategy), 0);
+    ::close(fd);
+    ::close(out);
+
+    EXPECT_EQ(read_all(backing("destination")), "content");
+}
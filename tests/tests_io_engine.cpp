@@ -0,0 +1,116 @@
+#include <fcntl.h>
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <filesystem>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "common.h"
+#include "io_engine.h"
+#include "uring_io_engine.h"
+
+namespace {
+
+std::shared_ptr<IoEngine> make_engine(const std::string &name) {
+    if (name == "uring") {
+        UringIoEngine::Settings settings;
+        settings.queue_depth = 8;
+        settings.fixed_buffers = 2;
+        settings.fixed_buffer_size = 4096;
+        return std::make_shared<UringIoEngine>(settings);
+    }
+    return std::make_shared<SyncIoEngine>();
+}
+
+class IoEngineTest : public ::testing::TestWithParam<std::string> {
+protected:
+    void SetUp() override {
+        try {
+            engine = make_engine(GetParam());
+        } catch (const std::runtime_error &e) {
+            GTEST_SKIP() << e.what();
+        }
+    }
+
+    void TearDown() override {
+        engine.reset();
+    }
+
+    std::unique_ptr<FileHandle> open(const std::string &name) {
+        int fd = ::open((root / name).c_str(), O_RDWR | O_CREAT, 0644);
+        auto handle = std::make_unique<FileHandle>(fd, O_RDWR);
+        handle->set_io_slot(engine->register_file(fd));
+        return handle;
+    }
+
+    void close(std::unique_ptr<FileHandle> handle) {
+        engine->unregister_file(handle->io_slot());
+        handle->close();
+    }
+
+    std::shared_ptr<IoEngine> engine;
+    Common::TempDirectory root{"io_" + GetParam()};
+};
+
+}  // namespace
+
+TEST_P(IoEngineTest, write_read_sync_stat) {
+    auto handle = open("file");
+
+    // Fits into a fixed buffer and does not
+    std::string small = "small write";
+    std::string large(64 * 1024, 'x');
+    ASSERT_EQ(engine->pwrite(*handle, small.data(), small.size(), 0), static_cast<ssize_t>(small.size()));
+    ASSERT_EQ(engine->pwrite(*handle, large.data(), large.size(), 4096), static_cast<ssize_t>(large.size()));
+    EXPECT_EQ(engine->fsync(*handle, true), 0);
+
+    std::string read(small.size(), '\0');
+    ASSERT_EQ(engine->pread(*handle, read.data(), read.size(), 0), static_cast<ssize_t>(read.size()));
+    EXPECT_EQ(read, small);
+
+    std::string read_large(large.size(), '\0');
+    ASSERT_EQ(engine->pread(*handle, read_large.data(), read_large.size(), 4096),
+              static_cast<ssize_t>(read_large.size()));
+    EXPECT_EQ(read_large, large);
+
+    struct stat st {};
+    int dirfd = ::open(root.c_str(), O_PATH | O_DIRECTORY);
+    EXPECT_EQ(engine->stat(dirfd, "file", &st, AT_SYMLINK_NOFOLLOW), 0);
+    EXPECT_EQ(st.st_size, static_cast<off_t>(4096 + large.size()));
+    EXPECT_TRUE(S_ISREG(st.st_mode));
+    EXPECT_EQ(engine->stat(dirfd, "missing", &st, 0), -ENOENT);
+    ::close(dirfd);
+
+    close(std::move(handle));
+}
+
+TEST_P(IoEngineTest, concurrent_requests) {
+    auto handle = open("shared");
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 16; t++) {
+        threads.emplace_back([&, t]() {
+            std::string block(512, static_cast<char>('a' + t));
+            for (int i = 0; i < 50; i++) {
+                EXPECT_EQ(engine->pwrite(*handle, block.data(), block.size(), t * 512), 512);
+            }
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    for (int t = 0; t < 16; t++) {
+        std::string block(512, '\0');
+        ASSERT_EQ(engine->pread(*handle, block.data(), block.size(), t * 512), 512);
+        EXPECT_EQ(block, std::string(512, static_cast<char>('a' + t)));
+    }
+
+    close(std::move(handle));
+}
+
+INSTANTIATE_TEST_SUITE_P(Engines, IoEngineTest, ::testing::Values("sync", "uring"));
@@ -0,0 +1,219 @@
+#include <fcntl.h>
+#include <gtest/gtest.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "backend_test_helpers.h"
+#include "memory_backend.h"
+#include "multi_backend.h"
+
+namespace {
+
+/// Collects the names of a listing
+class NameFiller : public StorageBackend::DirFiller {
+public:
+    bool wants_attributes(std::string_view name) override {
+        return true;
+    }
+
+    int add(std::string_view name, const struct stat *st, off_t next, bool attributes) override {
+        names.emplace_back(name);
+        sizes.push_back(st->st_size);
+        return 0;
+    }
+
+    std::vector<std::string> names;
+    std::vector<off_t> sizes;
+};
+
+class MultiBackendTest : public ::testing::Test {
+protected:
+    void create(MultiBackend::Placement placement, size_t stripe_size = 4096) {
+        devices.clear();
+        for (int i = 0; i < 3; i++) {
+            devices.push_back(std::make_shared<MemoryBackend>());
+        }
+        std::vector<std::shared_ptr<StorageBackend>> stores(devices.begin(), devices.end());
+        backend = std::make_shared<MultiBackend>(stores, placement, stripe_size);
+    }
+
+    void write_file(const std::string &path, const std::string &content, off_t offset = 0) {
+        BackendTest::write_file(*backend, path, content, offset);
+    }
+
+    std::string read_file(const std::string &path) {
+        return BackendTest::read_file(*backend, path);
+    }
+
+    /// Devices holding an entry
+    size_t holders(const std::string &path) {
+        size_t count = 0;
+        for (auto &device : devices) {
+            struct stat st {};
+            count += device->stat(path, &st, false) == 0;
+        }
+        return count;
+    }
+
+    off_t size(const std::string &path) {
+        struct stat st {};
+        EXPECT_EQ(backend->stat(path, &st, false), 0);
+        return st.st_size;
+    }
+
+    std::vector<std::shared_ptr<MemoryBackend>> devices;
+    std::shared_ptr<MultiBackend> backend;
+};
+
+}  // namespace
+
+TEST_F(MultiBackendTest, hash_placement_spreads_files) {
+    create(MultiBackend::Placement::HASH);
+    ASSERT_EQ(backend->mkdir("/dir", 0755), 0);
+    EXPECT_EQ(holders("/dir"), 3u);
+
+    for (int i = 0; i < 30; i++) {
+        write_file("/dir/file" + std::to_string(i), "content " + std::to_string(i));
+    }
+    for (int i = 0; i < 30; i++) {
+        EXPECT_EQ(holders("/dir/file" + std::to_string(i)), 1u);
+        EXPECT_EQ(read_file("/dir/file" + std::to_string(i)), "content " + std::to_string(i));
+    }
+    for (auto &device : devices) {
+        std::vector<std::string> names;
+        ASSERT_EQ(device->list("/dir", names), 0);
+        EXPECT_FALSE(names.empty());
+        EXPECT_LT(names.size(), 30u);
+    }
+
+    // The listing is the union of all devices
+    std::vector<std::string> names;
+    ASSERT_EQ(backend->list("/dir", names), 0);
+    EXPECT_EQ(names.size(), 30u);
+
+    std::unique_ptr<DirHandle> directory;
+    ASSERT_EQ(backend->opendir("/dir", directory), 0);
+    NameFiller filler;
+    ASSERT_EQ(backend->readdir(*directory, 0, filler), 0);
+    EXPECT_EQ(filler.names.size(), 32u);
+    EXPECT_NE(std::find(filler.names.begin(), filler.names.end(), ".."), filler.names.end());
+    auto found = std::find(filler.names.begin(), filler.names.end(), "file7");
+    ASSERT_NE(found, filler.names.end());
+    EXPECT_EQ(filler.sizes[found - filler.names.begin()], 9);
+
+    std::unique_ptr<FileHandle> handle;
+    EXPECT_EQ(backend->open("/dir/file3", O_WRONLY | O_CREAT | O_EXCL, 0644, handle), -EEXIST);
+    EXPECT_EQ(backend->mkdir("/dir/file3", 0755), -EEXIST);
+    EXPECT_EQ(backend->rmdir("/dir"), -ENOTEMPTY);
+}
+
+TEST_F(MultiBackendTest, renamed_files_are_found_on_their_device) {
+    create(MultiBackend::Placement::HASH);
+    for (int i = 0; i < 10; i++) {
+        write_file("/a" + std::to_string(i), "file " + std::to_string(i));
+    }
+    write_file("/b", "replaced");
+
+    // Whatever devices the names hash to, the files stay where they are
+    for (int i = 0; i < 10; i++) {
+        ASSERT_EQ(backend->rename("/a" + std::to_string(i), "/b", 0), 0);
+        EXPECT_EQ(holders("/b"), 1u);
+        EXPECT_EQ(read_file("/b"), "file " + std::to_string(i));
+    }
+
+    write_file("/c", "other");
+    ASSERT_EQ(backend->rename("/b", "/c", RENAME_EXCHANGE), 0);
+    EXPECT_EQ(read_file("/b"), "other");
+    EXPECT_EQ(read_file("/c"), "file 9");
+    EXPECT_EQ(backend->rename("/b", "/c", RENAME_NOREPLACE), -EEXIST);
+
+    ASSERT_EQ(backend->link("/c", "/d"), 0);
+    EXPECT_EQ(read_file("/d"), "file 9");
+    ASSERT_EQ(backend->copy("/c", "/e"), 0);
+    EXPECT_EQ(read_file("/e"), "file 9");
+
+    ASSERT_EQ(backend->unlink("/c"), 0);
+    EXPECT_EQ(holders("/c"), 0u);
+    EXPECT_EQ(backend->unlink("/c"), -ENOENT);
+}
+
+TEST_F(MultiBackendTest, stripes_go_round_robin) {
+    create(MultiBackend::Placement::STRIPE, 4);
+    write_file("/file", "0123456789abcdefghij");
+    EXPECT_EQ(size("/file"), 20);
+
+    // Stripes 0 and 3 on the first device, 1 and 4 on the second, 2 on the third
+    std::vector<std::string> parts{"0123cdef", "4567ghij", "89ab"};
+    for (size_t i = 0; i < devices.size(); i++) {
+        std::unique_ptr<FileHandle> handle;
+        ASSERT_EQ(devices[i]->open("/file", O_RDONLY, 0, handle), 0);
+        std::string part(16, 'x');
+        ssize_t res = devices[i]->pread(*handle, part.data(), part.size(), 0);
+        ASSERT_GE(res, 0);
+        part.resize(res);
+        EXPECT_EQ(part, parts[i]);
+        ASSERT_EQ(devices[i]->release(*handle), 0);
+    }
+    EXPECT_EQ(read_file("/file"), "0123456789abcdefghij");
+
+    // A write far behind the end leaves holes on every device
+    write_file("/file", "XY", 30);
+    EXPECT_EQ(size("/file"), 32);
+    EXPECT_EQ(read_file("/file"), "0123456789abcdefghij" + std::string(10, '\0') + "XY");
+
+    std::unique_ptr<FileHandle> handle;
+    ASSERT_EQ(backend->open("/file", O_RDWR, 0, handle), 0);
+    ASSERT_EQ(backend->ftruncate(*handle, 10), 0);
+    struct stat st {};
+    ASSERT_EQ(backend->fstat(*handle, &st), 0);
+    EXPECT_EQ(st.st_size, 10);
+    ASSERT_EQ(backend->release(*handle), 0);
+    EXPECT_EQ(read_file("/file"), "0123456789");
+
+    ASSERT_EQ(backend->truncate("/file", 13), 0);
+    EXPECT_EQ(size("/file"), 13);
+    EXPECT_EQ(read_file("/file"), std::string("0123456789") + std::string(3, '\0'));
+
+    // Reads starting inside a stripe and ending before the end of the file
+    ASSERT_EQ(backend->open("/file", O_RDONLY, 0, handle), 0);
+    std::string middle(5, 'x');
+    ASSERT_EQ(backend->pread(*handle, middle.data(), middle.size(), 3), 5);
+    EXPECT_EQ(middle, "34567");
+    ASSERT_EQ(backend->pread(*handle, middle.data(), middle.size(), 13), 0);
+    ASSERT_EQ(backend->release(*handle), 0);
+}
+
+TEST_F(MultiBackendTest, mirrors_share_reads) {
+    create(MultiBackend::Placement::MIRROR);
+    std::string content(10000, 'm');
+    write_file("/file", content);
+    EXPECT_EQ(holders("/file"), 3u);
+
+    for (int i = 0; i < 30; i++) {
+        EXPECT_EQ(read_file("/file"), content);
+    }
+
+    for (const auto &device : backend->statistics()) {
+        EXPECT_EQ(device.in_flight, 0u);
+        EXPECT_GE(device.writes, 1u);
+        EXPECT_GE(device.write_bytes, content.size());
+        EXPECT_GE(device.reads, 1u);
+    }
+
+    ASSERT_EQ(backend->truncate("/file", 10), 0);
+    for (auto &device : devices) {
+        struct stat st {};
+        ASSERT_EQ(device->stat("/file", &st, false), 0);
+        EXPECT_EQ(st.st_size, 10);
+    }
+    ASSERT_EQ(backend->chmod("/file", 0600), 0);
+    for (auto &device : devices) {
+        struct stat st {};
+        ASSERT_EQ(device->stat("/file", &st, false), 0);
+        EXPECT_EQ(st.st_mode & 0777, 0600u);
+    }
+}
@@ -0,0 +1,159 @@
+#include <fcntl.h>
+#include <gtest/gtest.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "backend_test_helpers.h"
+#include "common.h"
+#include "packed_backend.h"
+#include "posix_backend.h"
+
+namespace {
+
+class PackedBackendTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        open_backend();
+    }
+
+    void TearDown() override {
+        backend.reset();
+    }
+
+    void open_backend(const PackStore::Settings &settings = {}) {
+        backend.reset();
+        backend = std::make_shared<PackedBackend>(std::make_shared<PosixBackend>(root.string()),
+                                                  (root / PackedBackend::PACK_DIRECTORY).string(), 1024, settings);
+    }
+
+    void write_file(const std::string &path, const std::string &content) {
+        BackendTest::write_file(*backend, path, content);
+    }
+
+    std::string read_file(const std::string &path) {
+        return BackendTest::read_file(*backend, path);
+    }
+
+    bool plain(const std::string &path) const {
+        return std::filesystem::exists(root / path.substr(1));
+    }
+
+    Common::TempDirectory root{"packed"};
+    std::shared_ptr<PackedBackend> backend;
+};
+
+}  // namespace
+
+TEST_F(PackedBackendTest, small_files_are_packed_once_synced) {
+    write_file("/small", "tiny");
+    write_file("/large", std::string(2048, 'x'));
+
+    // The plain copy stays until the pack is durable
+    EXPECT_TRUE(plain("/small"));
+    ASSERT_EQ(backend->syncfs(), 0);
+    EXPECT_FALSE(plain("/small"));
+    EXPECT_TRUE(plain("/large"));
+
+    struct stat st {};
+    ASSERT_EQ(backend->stat("/small", &st, false), 0);
+    EXPECT_TRUE(S_ISREG(st.st_mode));
+    EXPECT_EQ(st.st_size, 4);
+    EXPECT_EQ(read_file("/small"), "tiny");
+
+    std::vector<std::string> names;
+    ASSERT_EQ(backend->list("/", names), 0);
+    std::sort(names.begin(), names.end());
+    EXPECT_EQ(names, (std::vector<std::string>{"large", "small"}));
+    EXPECT_EQ(backend->stat(std::string("/") + PackedBackend::PACK_DIRECTORY, &st, false), -ENOENT);
+}
+
+TEST_F(PackedBackendTest, writers_unpack_and_the_last_close_packs_again) {
+    write_file("/file", "before");
+    ASSERT_EQ(backend->syncfs(), 0);
+    ASSERT_FALSE(plain("/file"));
+
+    std::unique_ptr<FileHandle> first;
+    std::unique_ptr<FileHandle> second;
+    ASSERT_EQ(backend->open("/file", O_RDWR, 0, first), 0);
+    ASSERT_EQ(backend->open("/file", O_RDWR, 0, second), 0);
+    EXPECT_TRUE(plain("/file"));
+
+    char buf[16];
+    ASSERT_EQ(backend->pread(*first, buf, sizeof(buf), 0), 6);
+    EXPECT_EQ(std::string(buf, 6), "before");
+    ASSERT_EQ(backend->pwrite(*first, "after!", 6, 0), 6);
+    ASSERT_EQ(backend->release(*first), 0);
+
+    ASSERT_EQ(backend->syncfs(), 0);
+    EXPECT_TRUE(plain("/file"));
+
+    ASSERT_EQ(backend->release(*second), 0);
+    ASSERT_EQ(backend->syncfs(), 0);
+    EXPECT_FALSE(plain("/file"));
+    EXPECT_EQ(read_file("/file"), "after!");
+}
+
+TEST_F(PackedBackendTest, index_survives_a_restart) {
+    ASSERT_EQ(backend->mkdir("/dir", 0755), 0);
+    write_file("/dir/kept", "kept");
+    write_file("/dir/removed", "removed");
+    write_file("/dir/renamed", "renamed");
+    ASSERT_EQ(backend->chmod("/dir/kept", 0600), 0);
+    ASSERT_EQ(backend->unlink("/dir/removed"), 0);
+    ASSERT_EQ(backend->rename("/dir/renamed", "/moved", 0), 0);
+
+    open_backend();
+
+    EXPECT_EQ(read_file("/dir/kept"), "kept");
+    EXPECT_EQ(read_file("/dir/removed"), "<missing>");
+    EXPECT_EQ(read_file("/moved"), "renamed");
+    struct stat st {};
+    ASSERT_EQ(backend->stat("/dir/kept", &st, false), 0);
+    EXPECT_EQ(st.st_mode & 0777, 0600);
+    EXPECT_EQ(backend->rmdir("/dir"), -ENOTEMPTY);
+}
+
+TEST_F(PackedBackendTest, copies_of_small_files_go_to_the_pack) {
+    write_file("/source", std::string(100, 's'));
+    ASSERT_EQ(backend->copy("/source", "/copy"), 0);
+    EXPECT_FALSE(plain("/copy"));
+    EXPECT_EQ(read_file("/copy"), std::string(100, 's'));
+    EXPECT_EQ(backend->copy("/source", "/copy"), -EEXIST);
+}
+
+TEST_F(PackedBackendTest, compaction_reclaims_dead_packs) {
+    PackStore::Settings settings;
+    settings.pack_size = 4096;
+    open_backend(settings);
+
+    for (int i = 0; i < 32; i++) {
+        write_file("/file" + std::to_string(i), std::string(512, static_cast<char>('a' + i % 26)));
+    }
+    for (int i = 0; i < 32; i++) {
+        if (i % 4 != 0) {
+            ASSERT_EQ(backend->unlink("/file" + std::to_string(i)), 0);
+        }
+    }
+
+    uint64_t total = 0;
+    uint64_t dead = 0;
+    backend->packs().usage(total, dead);
+    EXPECT_EQ(total, 32u * 512);
+    EXPECT_EQ(dead, 24u * 512);
+
+    EXPECT_GT(backend->packs().compact(), 0u);
+    backend->packs().usage(total, dead);
+    EXPECT_LT(total, 32u * 512);
+    EXPECT_GE(total, 8u * 512);
+
+    open_backend(settings);
+    for (int i = 0; i < 32; i += 4) {
+        EXPECT_EQ(read_file("/file" + std::to_string(i)), std::string(512, static_cast<char>('a' + i % 26)));
+    }
+}
@@ -50,3 +50,17 @@ TEST(Path, pathlib_equal) {
     EXPECT_NE(path, "/test/something/dir2");
     EXPECT_NE(path, Path("/test/something/dir2"));
 }
+
+TEST(Path, backend_helpers) {
+    EXPECT_EQ(Path::view_parent("/dir/file"), "/dir");
+    EXPECT_EQ(Path::view_parent("/dir/"), "/");
+    EXPECT_EQ(Path::view_parent("/"), "/");
+
+    EXPECT_EQ(Path::join("/", "file"), "/file");
+    EXPECT_EQ(Path::join("/dir", "file"), "/dir/file");
+    EXPECT_EQ(Path::join("/dir/", "file"), "/dir/file");
+
+    EXPECT_TRUE(Path::is_root("/"));
+    EXPECT_TRUE(Path::is_root("//"));
+    EXPECT_FALSE(Path::is_root("/dir"));
+}
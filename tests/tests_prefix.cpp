@@ -82,3 +82,14 @@ TEST(Prefix, basename) {
     std::string result2 = PrefixParser::get_nonprefixed(path2);
     EXPECT_EQ(result2, "/test/something/di#r");
 }
+
+TEST(Prefix, contains_prefix) {
+    EXPECT_TRUE(PrefixParser::contains_prefix("/test/#TEST-aaa#dir", "TEST"));
+    EXPECT_TRUE(PrefixParser::contains_prefix("/test/#TEST2-bbb##TEST-#dir", "TEST"));
+    EXPECT_FALSE(PrefixParser::contains_prefix("/test/#TEST2-bbb#dir", "TEST"));
+    EXPECT_FALSE(PrefixParser::contains_prefix("/#TEST-aaa#test/dir", "TEST"));
+
+    std::string_view view = std::string_view("/test/#TEST-aaa#dir/trailing").substr(0, 19);
+    EXPECT_TRUE(PrefixParser::contains_prefix(view, "TEST"));
+    EXPECT_EQ(Path::view_basename(view), "#TEST-aaa#dir");
+}
@@ -0,0 +1,120 @@
+#include <fcntl.h>
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "common.h"
+#include "common/metrics.h"
+#include "custom_vfs.h"
+#include "multi_backend.h"
+#include "posix_backend.h"
+#include "read_ahead.h"
+
+TEST(ReadAheadTest, sequential_reads_grow_the_window) {
+    ReadAhead read_ahead(1 << 20);
+    ReadAhead::Stream stream;
+
+    EXPECT_EQ(read_ahead.plan(stream, 0, 4096).length, 0u);
+
+    ReadAhead::Range range = read_ahead.plan(stream, 4096, 4096);
+    EXPECT_EQ(range.offset, 8192);
+    EXPECT_EQ(range.length, ReadAhead::MIN_WINDOW);
+
+    off_t offset = 8192;
+    for (int i = 0; i < 16; i++, offset += 4096) {
+        read_ahead.plan(stream, offset, 4096);
+    }
+    EXPECT_EQ(stream.window, 1u << 20);
+    EXPECT_GT(stream.prefetched, offset);
+    EXPECT_LE(stream.prefetched, offset + (1 << 20));
+}
+
+TEST(ReadAheadTest, prefetched_ranges_do_not_overlap) {
+    ReadAhead read_ahead(256 * 1024);
+    ReadAhead::Stream stream;
+
+    off_t covered = 0;
+    for (off_t offset = 0; offset < (8 << 20); offset += 4096) {
+        ReadAhead::Range range = read_ahead.plan(stream, offset, 4096);
+        if (range.length > 0) {
+            EXPECT_GE(range.offset, covered);
+            EXPECT_GE(range.offset, offset + 4096);
+            covered = range.offset + static_cast<off_t>(range.length);
+        }
+    }
+    EXPECT_GT(covered, 8 << 20);
+}
+
+TEST(ReadAheadTest, random_reads_shrink_the_window) {
+    ReadAhead read_ahead(1 << 20);
+    ReadAhead::Stream stream;
+
+    for (off_t offset = 0; offset < 64 * 4096; offset += 4096) {
+        read_ahead.plan(stream, offset, 4096);
+    }
+    ASSERT_EQ(stream.window, 1u << 20);
+
+    EXPECT_EQ(read_ahead.plan(stream, 10 << 20, 4096).length, 0u);
+    EXPECT_EQ(stream.window, 512u * 1024);
+    EXPECT_EQ(read_ahead.plan(stream, 3 << 20, 4096).length, 0u);
+    EXPECT_EQ(stream.window, 256u * 1024);
+}
+
+TEST(ReadAheadTest, custom_vfs_prefetches_sequential_files) {
+    Common::TempDirectory root("read_ahead");
+    std::filesystem::create_directories(root / "backing");
+    {
+        CustomVfs vfs((root / "mount").string(), (root / "backing").string());
+        vfs.set_read_ahead(1 << 20);
+
+        struct fuse_file_info fi {};
+        fi.flags = O_RDWR;
+        ASSERT_EQ(vfs.create("/file", 0644, &fi), 0);
+        std::string data(1 << 20, 'x');
+        ASSERT_EQ(vfs.write("/file", data.data(), data.size(), 0, &fi), static_cast<int>(data.size()));
+
+        auto &bytes = Metrics::counter("read_ahead.bytes");
+        uint64_t before = bytes.load();
+
+        std::vector<char> buf(4096);
+        for (off_t offset = 0; offset < 64 * 4096; offset += 4096) {
+            ASSERT_EQ(vfs.read("/file", buf.data(), buf.size(), offset, &fi), 4096);
+        }
+        EXPECT_GT(bytes.load(), before);
+        ASSERT_EQ(vfs.release("/file", &fi), 0);
+    }
+}
+
+TEST(ReadAheadTest, backends_without_descriptors_prefetch_their_parts) {
+    Common::TempDirectory root("read_ahead_multi");
+    std::vector<std::shared_ptr<StorageBackend>> devices;
+    for (int i = 0; i < 3; i++) {
+        std::filesystem::create_directories(root / std::to_string(i));
+        devices.push_back(std::make_shared<PosixBackend>((root / std::to_string(i)).string()));
+    }
+    {
+        auto backend = std::make_shared<MultiBackend>(devices, MultiBackend::Placement::STRIPE, 64 * 1024);
+        CustomVfs vfs((root / "mount").string(), backend);
+        vfs.set_read_ahead(1 << 20);
+
+        struct fuse_file_info fi {};
+        fi.flags = O_RDWR;
+        ASSERT_EQ(vfs.create("/file", 0644, &fi), 0);
+        std::string data(1 << 20, 'x');
+        ASSERT_EQ(vfs.write("/file", data.data(), data.size(), 0, &fi), static_cast<int>(data.size()));
+
+        auto &bytes = Metrics::counter("read_ahead.bytes");
+        uint64_t before = bytes.load();
+
+        std::vector<char> buf(4096);
+        for (off_t offset = 0; offset < 64 * 4096; offset += 4096) {
+            ASSERT_EQ(vfs.read("/file", buf.data(), buf.size(), offset, &fi), 4096);
+        }
+        EXPECT_GT(bytes.load(), before);
+        ASSERT_EQ(vfs.release("/file", &fi), 0);
+    }
+}
@@ -0,0 +1,106 @@
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <filesystem>
+#include <fstream>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "common.h"
+#include "custom_vfs.h"
+
+namespace {
+
+/// Collects entries like a reply buffer which can hold only a few of them
+struct Listing {
+    std::vector<std::string> names;
+    off_t last_offset = 0;
+    size_t capacity = 0;
+    bool plus = true;
+};
+
+#if FUSE_VERSION < 30
+int collect(void *handle, const char *name, const struct stat *stbuf, off_t off) {
+#else
+int collect(void *handle, const char *name, const struct stat *stbuf, off_t off, enum fuse_fill_dir_flags) {
+#endif
+    auto *listing = static_cast<Listing *>(handle);
+    if (listing->names.size() == listing->capacity) {
+        return 1;
+    }
+
+    listing->names.emplace_back(name);
+    listing->last_offset = off;
+    listing->plus = listing->plus && stbuf->st_size > 0;
+    return 0;
+}
+
+class ReaddirTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        std::filesystem::create_directories(root / "backing");
+
+        for (int i = 0; i < 40; i++) {
+            std::ofstream(root / "backing" / ("file" + std::to_string(i))) << "content";
+        }
+        std::ofstream(root / "backing" / "#VERSION-1#file0") << "content";
+    }
+
+    /// Lists the whole root directory in chunks of a given size
+    std::vector<std::string> list(CustomVfs &vfs, size_t chunk, FuseWrapper::readdir_flags flags, bool *plus) {
+        struct fuse_file_info fi {};
+        EXPECT_EQ(vfs.opendir("/", &fi), 0);
+
+        std::vector<std::string> names;
+        off_t offset = 0;
+        *plus = true;
+
+        while (true) {
+            Listing listing;
+            listing.capacity = chunk;
+            FuseWrapper::set_dir_filler(&listing, collect);
+
+            EXPECT_EQ(vfs.readdir("/", offset, &fi, flags), 0);
+            names.insert(names.end(), listing.names.begin(), listing.names.end());
+            *plus = *plus && listing.plus;
+
+            if (listing.names.empty()) {
+                break;
+            }
+            offset = listing.last_offset;
+        }
+
+        EXPECT_EQ(vfs.releasedir("/", &fi), 0);
+        return names;
+    }
+
+    Common::TempDirectory root{"readdir"};
+};
+
+}  // namespace
+
+TEST_F(ReaddirTest, resumes_from_cookie) {
+    CustomVfs vfs((root / "mount").string(), (root / "backing").string());
+
+    bool plus = false;
+    std::vector<std::string> names = list(vfs, 7, static_cast<FuseWrapper::readdir_flags>(0), &plus);
+    std::set<std::string> unique(names.begin(), names.end());
+
+    EXPECT_EQ(names.size(), unique.size());
+    EXPECT_EQ(unique.count("file0"), 1);
+    EXPECT_EQ(unique.count("file39"), 1);
+    EXPECT_EQ(unique.count("#VERSION-1#file0"), 0);
+    EXPECT_EQ(unique.size(), 42);  // 40 files, "." and ".."
+    EXPECT_FALSE(plus);
+}
+
+TEST_F(ReaddirTest, stats_only_in_plus_mode) {
+    CustomVfs vfs((root / "mount").string(), (root / "backing").string());
+
+    bool plus = false;
+    std::vector<std::string> names = list(vfs, 1000, FuseWrapper::READDIR_PLUS, &plus);
+
+    EXPECT_EQ(names.size(), 42);
+    EXPECT_TRUE(plus);
+}
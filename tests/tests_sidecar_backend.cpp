@@ -0,0 +1,227 @@
+#include <fcntl.h>
+#include <gtest/gtest.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "backend_test_helpers.h"
+#include "common.h"
+#include "common/path.h"
+#include "custom_vfs.h"
+#include "encryption_vfs.h"
+#include "hook-generation/encryption.h"
+#include "memory_backend.h"
+#include "sidecar_backend.h"
+#include "versioning_vfs.h"
+
+namespace {
+
+class SidecarBackendTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        store = std::make_shared<MemoryBackend>();
+        backend = std::make_shared<SidecarBackend>(store);
+    }
+
+    void write_file(const std::string &path, const std::string &content) {
+        BackendTest::write_file(*backend, path, content);
+    }
+
+    std::vector<std::string> sidecars(const std::string &directory, const std::string &name) {
+        std::vector<std::string> names;
+        EXPECT_EQ(backend->list_sidecars(directory, name, names), 0);
+        std::sort(names.begin(), names.end());
+        return names;
+    }
+
+    bool exists(const std::string &path) {
+        struct stat st {};
+        return backend->stat(path, &st, false) == 0;
+    }
+
+    std::shared_ptr<MemoryBackend> store;
+    std::shared_ptr<SidecarBackend> backend;
+};
+
+}  // namespace
+
+TEST_F(SidecarBackendTest, sidecars_are_kept_out_of_directories) {
+    ASSERT_EQ(backend->mkdir("/dir", 0755), 0);
+    write_file("/dir/file", "current");
+    write_file("/dir/#VERSION-1#file", "old");
+    write_file("/dir/#VERSION-2#file", "older");
+    write_file("/dir/#ENCRYPTION-key#other", "key");
+
+    std::vector<std::string> names;
+    ASSERT_EQ(backend->list("/dir", names), 0);
+    EXPECT_EQ(names, std::vector<std::string>{"file"});
+
+    names.clear();
+    ASSERT_EQ(backend->list("/", names), 0);
+    EXPECT_EQ(names, std::vector<std::string>{"dir"});
+
+    EXPECT_EQ(sidecars("/dir", "file"), (std::vector<std::string>{"#VERSION-1#file", "#VERSION-2#file"}));
+    EXPECT_EQ(sidecars("/dir/", "other"), std::vector<std::string>{"#ENCRYPTION-key#other"});
+    EXPECT_TRUE(sidecars("/dir", "missing").empty());
+
+    struct stat st {};
+    ASSERT_EQ(backend->stat("/dir/#VERSION-2#file", &st, false), 0);
+    EXPECT_EQ(st.st_size, 5);
+    EXPECT_EQ(backend->locate("/dir/file"), "/dir/file");
+    EXPECT_NE(backend->locate("/dir/#VERSION-2#file").find(SidecarBackend::METADATA_DIRECTORY), std::string::npos);
+
+    // Sidecars need their directory like any other file
+    std::unique_ptr<FileHandle> handle;
+    EXPECT_EQ(backend->open("/missing/#VERSION-1#file", O_WRONLY | O_CREAT, 0644, handle), -ENOENT);
+    EXPECT_EQ(backend->open("/dir/file/#VERSION-1#x", O_WRONLY | O_CREAT, 0644, handle), -ENOTDIR);
+    EXPECT_EQ(backend->mkdir(std::string("/") + SidecarBackend::METADATA_DIRECTORY + "/x", 0755), -EPERM);
+}
+
+TEST_F(SidecarBackendTest, metadata_follows_renamed_directories) {
+    ASSERT_EQ(backend->mkdir("/a", 0755), 0);
+    ASSERT_EQ(backend->mkdir("/a/sub", 0755), 0);
+    ASSERT_EQ(backend->mkdir("/b", 0755), 0);
+    write_file("/a/#VERSION-1#file", "a");
+    write_file("/a/sub/#VERSION-1#file", "sub");
+    write_file("/b/#VERSION-1#file", "b");
+
+    ASSERT_EQ(backend->rename("/a", "/c", 0), 0);
+    EXPECT_FALSE(exists("/a/#VERSION-1#file"));
+    EXPECT_TRUE(exists("/c/#VERSION-1#file"));
+    EXPECT_TRUE(exists("/c/sub/#VERSION-1#file"));
+
+    ASSERT_EQ(backend->rename("/b", "/c", RENAME_EXCHANGE), 0);
+    struct stat st {};
+    ASSERT_EQ(backend->stat("/c/#VERSION-1#file", &st, false), 0);
+    EXPECT_EQ(st.st_size, 1);
+    ASSERT_EQ(backend->stat("/b/sub/#VERSION-1#file", &st, false), 0);
+    EXPECT_EQ(st.st_size, 3);
+
+    // A directory replacing an empty one does not inherit its sidecars
+    ASSERT_EQ(backend->unlink("/b/sub/#VERSION-1#file"), 0);
+    ASSERT_EQ(backend->rename("/b/sub", "/c", 0), 0);
+    EXPECT_TRUE(sidecars("/c", "file").empty());
+    EXPECT_TRUE(sidecars("/b/sub", "file").empty());
+}
+
+TEST_F(SidecarBackendTest, sidecars_created_during_a_rename_are_kept) {
+    ASSERT_EQ(backend->mkdir("/a", 0755), 0);
+
+    std::atomic<bool> done{false};
+    std::thread renamer([&] {
+        for (int i = 0; i < 200; i++) {
+            ASSERT_EQ(backend->rename(i % 2 == 0 ? "/a" : "/b", i % 2 == 0 ? "/b" : "/a", 0), 0);
+        }
+        done = true;
+    });
+
+    // Each sidecar is created under whichever name the directory has at the moment
+    int created = 0;
+    while (!done) {
+        std::string name = "#VERSION-" + std::to_string(created) + "#file";
+        std::unique_ptr<FileHandle> handle;
+        if (backend->open("/a/" + name, O_WRONLY | O_CREAT, 0644, handle) == 0 ||
+            backend->open("/b/" + name, O_WRONLY | O_CREAT, 0644, handle) == 0) {
+            backend->release(*handle);
+            created++;
+        }
+    }
+    renamer.join();
+
+    EXPECT_EQ(sidecars("/a", "file").size(), static_cast<size_t>(created));
+}
+
+TEST_F(SidecarBackendTest, interrupted_rename_is_finished_on_the_next_start) {
+    ASSERT_EQ(backend->mkdir("/a", 0755), 0);
+    ASSERT_EQ(backend->mkdir("/a/sub", 0755), 0);
+    write_file("/a/#VERSION-1#file", "a");
+    write_file("/a/sub/#VERSION-1#file", "sub");
+
+    auto metadata = [&](const std::string &directory) {
+        return std::string(Path::view_parent(Path::view_parent(backend->locate(directory + "/#VERSION-1#file"))));
+    };
+    std::string staging = std::string("/") + SidecarBackend::METADATA_DIRECTORY + "/staging";
+
+    // The directory was renamed and only the first of its metadata directories parked when the process died
+    BackendTest::write_file(*store, staging + "/7.moves",
+                            metadata("/a") + " " + metadata("/c") + "\n" + metadata("/a/sub") + " " +
+                                metadata("/c/sub") + "\n");
+    ASSERT_EQ(store->rename(metadata("/a"), staging + "/7.0", 0), 0);
+    ASSERT_EQ(store->rename("/a", "/c", 0), 0);
+
+    backend = std::make_shared<SidecarBackend>(store);
+    EXPECT_EQ(BackendTest::read_file(*backend, "/c/#VERSION-1#file"), "a");
+    EXPECT_EQ(BackendTest::read_file(*backend, "/c/sub/#VERSION-1#file"), "sub");
+
+    std::vector<std::string> left;
+    ASSERT_EQ(store->list(staging, left), 0);
+    EXPECT_TRUE(left.empty());
+}
+
+TEST_F(SidecarBackendTest, rmdir_deletes_sidecars) {
+    ASSERT_EQ(backend->mkdir("/dir", 0755), 0);
+    write_file("/dir/#VERSION-1#file", "old");
+    ASSERT_EQ(backend->rmdir("/dir"), 0);
+
+    ASSERT_EQ(backend->mkdir("/dir", 0755), 0);
+    EXPECT_FALSE(exists("/dir/#VERSION-1#file"));
+}
+
+TEST_F(SidecarBackendTest, existing_sidecars_are_migrated) {
+    auto flat = std::make_shared<MemoryBackend>();
+    ASSERT_EQ(flat->mkdir("/dir", 0755), 0);
+    std::unique_ptr<FileHandle> handle;
+    for (const char *path : {"/dir/file", "/dir/#VERSION-1#file", "/#ENCRYPTION#dir"}) {
+        ASSERT_EQ(flat->open(path, O_WRONLY | O_CREAT, 0644, handle), 0);
+        ASSERT_EQ(flat->release(*handle), 0);
+    }
+
+    backend = std::make_shared<SidecarBackend>(flat);
+    std::vector<std::string> names;
+    ASSERT_EQ(backend->list("/dir", names), 0);
+    EXPECT_EQ(names, std::vector<std::string>{"file"});
+    EXPECT_EQ(sidecars("/dir", "file"), std::vector<std::string>{"#VERSION-1#file"});
+    EXPECT_TRUE(exists("/#ENCRYPTION#dir"));
+}
+
+TEST_F(SidecarBackendTest, versioning_and_encryption_use_the_metadata_tree) {
+    Common::TempDirectory mount("sidecar");
+    {
+        CustomVfs vfs(mount.string(), backend);
+        VersioningVfs versioned(vfs);
+        EncryptionVfs encrypted(versioned);
+
+        struct fuse_file_info fi {};
+        fi.flags = O_RDWR;
+        ASSERT_EQ(encrypted.create("/file.txt", 0644, &fi), 0);
+        std::string content = "Hello World!\n";
+        ASSERT_EQ(encrypted.write("/file.txt", content.data(), content.size(), 0, &fi),
+                  static_cast<int>(content.size()));
+        ASSERT_EQ(encrypted.write("/file.txt", content.data(), content.size(), 0, &fi),
+                  static_cast<int>(content.size()));
+        ASSERT_EQ(encrypted.release("/file.txt", &fi), 0);
+
+        std::vector<std::string> stored;
+        ASSERT_EQ(store->list("/", stored), 0);
+        EXPECT_EQ(std::count(stored.begin(), stored.end(), "file.txt"), 1);
+        EXPECT_EQ(std::count_if(stored.begin(), stored.end(), PrefixParser::is_prefixed), 0);
+        EXPECT_EQ(vfs.prefixed_subfiles("/", "file.txt").size(), 2u);
+
+        std::string password = "test";
+        std::string lock = EncryptionHookGenerator::lock_pass_hook("/file.txt");
+        ASSERT_EQ(encrypted.write(lock, password.data(), password.size(), 0, nullptr), 0);
+        std::string unlock = EncryptionHookGenerator::unlock_pass_hook("/file.txt");
+        ASSERT_EQ(encrypted.write(unlock, password.data(), password.size(), 0, nullptr), 0);
+
+        auto input = vfs.get_ifstream("/file.txt", std::ios::binary);
+        std::string unlocked((std::istreambuf_iterator<char>(*input)), {});
+        EXPECT_EQ(unlocked, content);
+    }
+}
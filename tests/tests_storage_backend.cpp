@@ -0,0 +1,350 @@
+#include <fcntl.h>
+#include <gtest/gtest.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "backend_test_helpers.h"
+#include "cached_backend.h"
+#include "chunked_backend.h"
+#include "common.h"
+#include "custom_vfs.h"
+#include "encryption_vfs.h"
+#include "hook-generation/encryption.h"
+#include "memory_backend.h"
+#include "multi_backend.h"
+#include "packed_backend.h"
+#include "posix_backend.h"
+#include "sidecar_backend.h"
+#include "tiered_backend.h"
+#include "versioning_vfs.h"
+
+namespace {
+
+/// Collects entries of a listing, accepting at most limit of them per readdir()
+class CollectingFiller : public StorageBackend::DirFiller {
+public:
+    explicit CollectingFiller(size_t limit) : limit(limit) {}
+
+    bool wants_attributes(std::string_view name) override {
+        return true;
+    }
+
+    int add(std::string_view name, const struct stat *st, off_t next, bool attributes) override {
+        if (accepted == limit) {
+            return 1;
+        }
+        accepted++;
+        names.emplace_back(name);
+        offset = next;
+        return 0;
+    }
+
+    size_t limit;
+    size_t accepted = 0;
+    off_t offset = 0;
+    std::vector<std::string> names;
+};
+
+class StorageBackendTest : public ::testing::TestWithParam<std::string> {
+protected:
+    void SetUp() override {
+        if (GetParam() != "memory" && GetParam() != "striped" && GetParam() != "tiered") {
+            backend = std::make_shared<PosixBackend>(root.string());
+            if (GetParam() == "packed") {
+                backend = std::make_shared<PackedBackend>(backend, (root / PackedBackend::PACK_DIRECTORY).string(),
+                                                          64 * 1024);
+            } else if (GetParam() == "chunked") {
+                backend = std::make_shared<ChunkedBackend>(backend, (root / ChunkedBackend::CHUNK_DIRECTORY).string(),
+                                                           1024);
+            }
+        } else {
+            backend = std::make_shared<MemoryBackend>();
+        }
+        if (GetParam() == "striped") {
+            std::vector<std::shared_ptr<StorageBackend>> devices{backend, std::make_shared<MemoryBackend>(),
+                                                                 std::make_shared<MemoryBackend>()};
+            backend = std::make_shared<MultiBackend>(devices, MultiBackend::Placement::STRIPE, 4096);
+        }
+        if (GetParam() == "tiered") {
+            backend = std::make_shared<TieredBackend>(backend, std::make_shared<MemoryBackend>());
+        }
+        if (GetParam() == "sidecar") {
+            backend = std::make_shared<SidecarBackend>(backend);
+        }
+        if (GetParam() == "cached") {
+            backend = std::make_shared<CachedBackend>(backend, 64 * 1024, 4096);
+        }
+    }
+
+    void TearDown() override {
+        backend.reset();
+    }
+
+    std::unique_ptr<FileHandle> create(const std::string &path, mode_t mode = 0644) {
+        std::unique_ptr<FileHandle> handle;
+        EXPECT_EQ(backend->open(path, O_RDWR | O_CREAT, mode, handle), 0);
+        return handle;
+    }
+
+    void write_file(const std::string &path, const std::string &content) {
+        BackendTest::write_file(*backend, path, content);
+    }
+
+    std::string read_file(const std::string &path) {
+        return BackendTest::read_file(*backend, path);
+    }
+
+    std::vector<std::string> list(const std::string &path) {
+        std::vector<std::string> names;
+        EXPECT_EQ(backend->list(path, names), 0);
+        std::sort(names.begin(), names.end());
+        return names;
+    }
+
+    Common::TempDirectory root{"backend"};
+    std::shared_ptr<StorageBackend> backend;
+};
+
+}  // namespace
+
+TEST_P(StorageBackendTest, write_read_and_truncate) {
+    auto handle = create("/file");
+    ASSERT_EQ(backend->pwrite(*handle, "hello", 5, 0), 5);
+    ASSERT_EQ(backend->pwrite(*handle, "world", 5, 10), 5);
+
+    char buf[32];
+    ASSERT_EQ(backend->pread(*handle, buf, sizeof(buf), 0), 15);
+    EXPECT_EQ(std::string(buf, 15), std::string("hello\0\0\0\0\0world", 15));
+    EXPECT_EQ(backend->pread(*handle, buf, sizeof(buf), 15), 0);
+
+    ASSERT_EQ(backend->ftruncate(*handle, 7), 0);
+    struct stat st {};
+    ASSERT_EQ(backend->stat("/file", &st, false), 0);
+    EXPECT_EQ(st.st_size, 7);
+    EXPECT_TRUE(S_ISREG(st.st_mode));
+    EXPECT_EQ(st.st_mode & 0777, 0644);
+    ASSERT_EQ(backend->release(*handle), 0);
+
+    ASSERT_EQ(backend->truncate("/file", 2), 0);
+    EXPECT_EQ(read_file("/file"), "he");
+}
+
+TEST_P(StorageBackendTest, directories_and_rename) {
+    ASSERT_EQ(backend->mkdir("/dir", 0755), 0);
+    EXPECT_EQ(backend->mkdir("/dir", 0755), -EEXIST);
+    write_file("/dir/file", "content");
+
+    ASSERT_EQ(backend->rename("/dir", "/moved", 0), 0);
+    struct stat st {};
+    EXPECT_EQ(backend->stat("/dir", &st, false), -ENOENT);
+    EXPECT_EQ(read_file("/moved/file"), "content");
+    EXPECT_EQ(list("/moved"), std::vector<std::string>{"file"});
+
+    EXPECT_EQ(backend->rmdir("/moved"), -ENOTEMPTY);
+    ASSERT_EQ(backend->unlink("/moved/file"), 0);
+    EXPECT_EQ(backend->rmdir("/moved"), 0);
+    EXPECT_EQ(list("/"), std::vector<std::string>{});
+}
+
+TEST_P(StorageBackendTest, rename_flags) {
+    write_file("/a", "first");
+    write_file("/b", "second");
+
+    EXPECT_EQ(backend->rename("/a", "/b", RENAME_NOREPLACE), -EEXIST);
+    ASSERT_EQ(backend->rename("/a", "/b", RENAME_EXCHANGE), 0);
+    EXPECT_EQ(read_file("/a"), "second");
+    EXPECT_EQ(read_file("/b"), "first");
+
+    ASSERT_EQ(backend->rename("/a", "/b", 0), 0);
+    EXPECT_EQ(read_file("/b"), "second");
+    EXPECT_EQ(read_file("/a"), "<missing>");
+}
+
+TEST_P(StorageBackendTest, links) {
+    write_file("/file", "data");
+    ASSERT_EQ(backend->link("/file", "/hard"), 0);
+    ASSERT_EQ(backend->symlink("file", "/soft"), 0);
+
+    struct stat st {};
+    ASSERT_EQ(backend->stat("/hard", &st, false), 0);
+    EXPECT_EQ(st.st_nlink, 2u);
+
+    ASSERT_EQ(backend->stat("/soft", &st, false), 0);
+    EXPECT_TRUE(S_ISLNK(st.st_mode));
+    ASSERT_EQ(backend->stat("/soft", &st, true), 0);
+    EXPECT_TRUE(S_ISREG(st.st_mode));
+
+    char target[16];
+    ASSERT_EQ(backend->readlink("/soft", target, sizeof(target)), 4);
+    EXPECT_EQ(std::string(target, 4), "file");
+    EXPECT_EQ(read_file("/soft"), "data");
+
+    ASSERT_EQ(backend->unlink("/file"), 0);
+    EXPECT_EQ(read_file("/hard"), "data");
+    EXPECT_EQ(backend->stat("/soft", &st, true), -ENOENT);
+}
+
+TEST_P(StorageBackendTest, unlinked_file_stays_readable_while_open) {
+    write_file("/file", "still here");
+    std::unique_ptr<FileHandle> handle;
+    ASSERT_EQ(backend->open("/file", O_RDONLY, 0, handle), 0);
+    ASSERT_EQ(backend->unlink("/file"), 0);
+
+    char buf[16];
+    ASSERT_EQ(backend->pread(*handle, buf, sizeof(buf), 0), 10);
+    EXPECT_EQ(std::string(buf, 10), "still here");
+    EXPECT_EQ(backend->release(*handle), 0);
+}
+
+TEST_P(StorageBackendTest, copy) {
+    write_file("/source", "copied data");
+    ASSERT_EQ(backend->chmod("/source", 0600), 0);
+
+    ASSERT_EQ(backend->copy("/source", "/copy"), 0);
+    EXPECT_EQ(read_file("/copy"), "copied data");
+    struct stat st {};
+    ASSERT_EQ(backend->stat("/copy", &st, false), 0);
+    EXPECT_EQ(st.st_mode & 0777, 0600);
+
+    EXPECT_EQ(backend->copy("/source", "/copy"), -EEXIST);
+    EXPECT_EQ(backend->copy("/missing", "/other"), -ENOENT);
+}
+
+TEST_P(StorageBackendTest, readdir_resumes_at_offsets) {
+    std::vector<std::string> expected = {".", ".."};
+    for (int i = 0; i < 10; i++) {
+        std::string name = "file" + std::to_string(i);
+        write_file("/" + name, "x");
+        expected.push_back(name);
+    }
+
+    std::unique_ptr<DirHandle> handle;
+    ASSERT_EQ(backend->opendir("/", handle), 0);
+
+    std::vector<std::string> names;
+    off_t offset = 0;
+    while (true) {
+        CollectingFiller filler(3);
+        ASSERT_EQ(backend->readdir(*handle, offset, filler), 0);
+        names.insert(names.end(), filler.names.begin(), filler.names.end());
+        if (filler.accepted < 3) {
+            break;
+        }
+        offset = filler.offset;
+    }
+
+    std::sort(names.begin(), names.end());
+    std::sort(expected.begin(), expected.end());
+    EXPECT_EQ(names, expected);
+}
+
+INSTANTIATE_TEST_SUITE_P(Backends, StorageBackendTest,
+                         ::testing::Values("posix", "memory", "packed", "chunked", "sidecar", "striped",
+                                           "tiered", "cached"));
+
+TEST(MemoryBackendTest, sparse_files_keep_only_written_extents) {
+    MemoryBackend backend;
+    std::unique_ptr<FileHandle> handle;
+    ASSERT_EQ(backend.open("/sparse", O_RDWR | O_CREAT, 0644, handle), 0);
+
+    std::string block(4096, 'a');
+    ASSERT_EQ(backend.pwrite(*handle, block.data(), block.size(), 1 << 30), 4096);
+    EXPECT_EQ(backend.memory_usage(), 4096u);
+
+    struct stat st {};
+    ASSERT_EQ(backend.stat("/sparse", &st, false), 0);
+    EXPECT_EQ(st.st_size, (1 << 30) + 4096);
+    EXPECT_EQ(st.st_blocks, 8);
+
+    // Writes spanning a hole and an extent fill the hole and overwrite the extent
+    std::string span(8192, 'b');
+    ASSERT_EQ(backend.pwrite(*handle, span.data(), span.size(), (1 << 30) - 4096), 8192);
+    EXPECT_EQ(backend.memory_usage(), 8192u);
+
+    std::string buf(12288, 'x');
+    ASSERT_EQ(backend.pread(*handle, buf.data(), buf.size(), (1 << 30) - 8192), 12288);
+    EXPECT_EQ(buf, std::string(4096, '\0') + std::string(8192, 'b'));
+
+    ASSERT_EQ(backend.ftruncate(*handle, (1 << 30) - 2048), 0);
+    EXPECT_EQ(backend.memory_usage(), 2048u);
+    ASSERT_EQ(backend.release(*handle), 0);
+
+    handle.reset();
+    ASSERT_EQ(backend.unlink("/sparse"), 0);
+    EXPECT_EQ(backend.memory_usage(), 0u);
+}
+
+TEST(MemoryBackendTest, parallel_writers_on_separate_files) {
+    MemoryBackend backend;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 8; i++) {
+        threads.emplace_back([&backend, i] {
+            std::unique_ptr<FileHandle> handle;
+            std::string path = "/file" + std::to_string(i);
+            ASSERT_EQ(backend.open(path, O_RDWR | O_CREAT, 0644, handle), 0);
+
+            std::string chunk(1000, static_cast<char>('a' + i));
+            for (off_t offset = 0; offset < 1000 * 1000; offset += 1000) {
+                ASSERT_EQ(backend.pwrite(*handle, chunk.data(), chunk.size(), offset), 1000);
+            }
+            backend.release(*handle);
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    for (int i = 0; i < 8; i++) {
+        struct stat st {};
+        ASSERT_EQ(backend.stat("/file" + std::to_string(i), &st, false), 0);
+        EXPECT_EQ(st.st_size, 1000 * 1000);
+    }
+    EXPECT_EQ(backend.memory_usage(), 8u * 1000 * 1000);
+}
+
+TEST(MemoryBackendTest, versioning_and_encryption_run_in_process) {
+    Common::TempDirectory mount("memory");
+    auto backend = std::make_shared<MemoryBackend>();
+    {
+        CustomVfs vfs(mount.string(), backend);
+        VersioningVfs versioned(vfs);
+        EncryptionVfs encrypted(versioned);
+
+        struct fuse_file_info fi {};
+        fi.flags = O_RDWR;
+        ASSERT_EQ(encrypted.create("/file.txt", 0644, &fi), 0);
+        std::string content = "Hello World!\n";
+        ASSERT_EQ(encrypted.write("/file.txt", content.data(), content.size(), 0, &fi),
+                  static_cast<int>(content.size()));
+        ASSERT_EQ(encrypted.release("/file.txt", &fi), 0);
+
+        // The version file is stored next to the file but hidden from listings
+        std::vector<std::string> stored;
+        ASSERT_EQ(backend->list("/", stored), 0);
+        EXPECT_EQ(stored.size(), 2u);
+        EXPECT_EQ(versioned.subfiles("/"), std::vector<std::string>{"file.txt"});
+
+        std::string password = "test";
+        std::string lock = EncryptionHookGenerator::lock_pass_hook("/file.txt");
+        ASSERT_EQ(encrypted.write(lock, password.data(), password.size(), 0, nullptr), 0);
+
+        auto input = vfs.get_ifstream("/file.txt", std::ios::binary);
+        std::string locked((std::istreambuf_iterator<char>(*input)), {});
+        EXPECT_EQ(locked, "This file is encrypted\n");
+
+        std::string unlock = EncryptionHookGenerator::unlock_pass_hook("/file.txt");
+        ASSERT_EQ(encrypted.write(unlock, password.data(), password.size(), 0, nullptr), 0);
+
+        input = vfs.get_ifstream("/file.txt", std::ios::binary);
+        std::string unlocked((std::istreambuf_iterator<char>(*input)), {});
+        EXPECT_EQ(unlocked, content);
+    }
+}
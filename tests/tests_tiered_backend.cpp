@@ -0,0 +1,205 @@
+#include <fcntl.h>
+#include <gtest/gtest.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "backend_test_helpers.h"
+#include "memory_backend.h"
+#include "tiered_backend.h"
+
+namespace {
+
+class TieredBackendTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        fast = std::make_shared<MemoryBackend>();
+        capacity = std::make_shared<MemoryBackend>();
+    }
+
+    /// Backend with everything cold, or with nothing cold and files hot after two opens
+    void create(bool cold, uint64_t rate = 0) {
+        backend.reset();
+        TieredBackend::Settings settings;
+        settings.cold_after = cold ? std::chrono::seconds(0) : std::chrono::hours(1);
+        settings.promote_after = 2;
+        settings.rate = rate;
+        backend = std::make_shared<TieredBackend>(fast, capacity, settings);
+    }
+
+    void write_file(const std::string &path, const std::string &content) {
+        BackendTest::write_file(*backend, path, content);
+    }
+
+    std::string read_file(const std::string &path) {
+        return BackendTest::read_file(*backend, path);
+    }
+
+    TieredBackend::Tier tier(const std::string &path) {
+        TieredBackend::Tier tier = TieredBackend::FAST;
+        EXPECT_EQ(backend->tier(path, tier), 0);
+        return tier;
+    }
+
+    bool exists(StorageBackend &store, const std::string &path) {
+        struct stat st {};
+        return store.stat(path, &st, false) == 0;
+    }
+
+    std::shared_ptr<MemoryBackend> fast;
+    std::shared_ptr<MemoryBackend> capacity;
+    std::shared_ptr<TieredBackend> backend;
+};
+
+}  // namespace
+
+TEST_F(TieredBackendTest, versions_and_cold_files_move_to_capacity) {
+    create(false);
+    ASSERT_EQ(backend->mkdir("/dir", 0750), 0);
+    write_file("/dir/file", "current");
+    write_file("/dir/#VERSION-1#file", "old");
+    EXPECT_EQ(tier("/dir/file"), TieredBackend::FAST);
+
+    // Versions are cold as soon as they are written
+    EXPECT_EQ(backend->migrate(), 1u);
+    EXPECT_EQ(tier("/dir/file"), TieredBackend::FAST);
+    EXPECT_EQ(tier("/dir/#VERSION-1#file"), TieredBackend::CAPACITY);
+    EXPECT_FALSE(exists(*fast, "/dir/#VERSION-1#file"));
+    EXPECT_EQ(read_file("/dir/#VERSION-1#file"), "old");
+
+    struct stat st {};
+    ASSERT_EQ(capacity->stat("/dir", &st, false), 0);
+    EXPECT_EQ(st.st_mode & 07777, 0750u);
+    ASSERT_EQ(backend->stat("/dir/#VERSION-1#file", &st, false), 0);
+    EXPECT_EQ(st.st_size, 3);
+    EXPECT_EQ(st.st_mode & 07777, 0644u);
+
+    create(true);
+    EXPECT_EQ(backend->migrate(), 1u);
+    EXPECT_EQ(tier("/dir/file"), TieredBackend::CAPACITY);
+    EXPECT_EQ(read_file("/dir/file"), "current");
+
+    std::vector<std::string> names;
+    ASSERT_EQ(backend->list("/dir", names), 0);
+    std::sort(names.begin(), names.end());
+    EXPECT_EQ(names, (std::vector<std::string>{"#VERSION-1#file", "file"}));
+
+    names.clear();
+    ASSERT_EQ(backend->list("/", names), 0);
+    EXPECT_EQ(names, std::vector<std::string>{"dir"});
+    EXPECT_EQ(backend->rmdir("/dir"), -ENOTEMPTY);
+
+    // Directories only live on the fast tier and are removed from both
+    ASSERT_EQ(backend->unlink("/dir/file"), 0);
+    ASSERT_EQ(backend->unlink("/dir/#VERSION-1#file"), 0);
+    ASSERT_EQ(backend->rmdir("/dir"), 0);
+    EXPECT_FALSE(exists(*capacity, "/dir"));
+}
+
+TEST_F(TieredBackendTest, hot_files_move_back) {
+    create(true);
+    write_file("/file", "content");
+    ASSERT_EQ(backend->migrate(), 1u);
+    ASSERT_EQ(tier("/file"), TieredBackend::CAPACITY);
+
+    create(false);
+    EXPECT_EQ(read_file("/file"), "content");
+    backend->migrate();
+    EXPECT_EQ(tier("/file"), TieredBackend::CAPACITY);
+
+    EXPECT_EQ(read_file("/file"), "content");
+    backend->migrate();
+    EXPECT_EQ(tier("/file"), TieredBackend::FAST);
+    EXPECT_FALSE(exists(*capacity, "/file"));
+    EXPECT_EQ(read_file("/file"), "content");
+}
+
+TEST_F(TieredBackendTest, open_writers_and_changes_keep_files_in_place) {
+    create(true);
+    write_file("/file", "content");
+
+    std::unique_ptr<FileHandle> handle;
+    ASSERT_EQ(backend->open("/file", O_RDWR, 0, handle), 0);
+    EXPECT_EQ(backend->migrate(), 0u);
+    EXPECT_EQ(tier("/file"), TieredBackend::FAST);
+
+    std::string more = "more";
+    ASSERT_EQ(backend->pwrite(*handle, more.data(), more.size(), 7), 4);
+    ASSERT_EQ(backend->release(*handle), 0);
+    EXPECT_EQ(backend->migrate(), 1u);
+    EXPECT_EQ(read_file("/file"), "contentmore");
+
+    // Rewriting a cold file puts the new content on the fast tier
+    write_file("/file", "new");
+    EXPECT_EQ(tier("/file"), TieredBackend::FAST);
+    EXPECT_FALSE(exists(*capacity, "/file"));
+    EXPECT_EQ(read_file("/file"), "new");
+
+    // Hard links would be split up by a move
+    ASSERT_EQ(backend->link("/file", "/alias"), 0);
+    EXPECT_EQ(backend->migrate(), 0u);
+}
+
+TEST_F(TieredBackendTest, names_span_both_tiers) {
+    create(true);
+    ASSERT_EQ(backend->mkdir("/dir", 0755), 0);
+    write_file("/dir/cold", "cold");
+    ASSERT_EQ(backend->symlink("dir/cold", "/link"), 0);
+    ASSERT_EQ(backend->migrate(), 1u);
+
+    create(false);
+    write_file("/hot", "hot");
+    EXPECT_EQ(read_file("/link"), "cold");
+
+    std::unique_ptr<FileHandle> handle;
+    EXPECT_EQ(backend->open("/dir/cold", O_WRONLY | O_CREAT | O_EXCL, 0644, handle), -EEXIST);
+    EXPECT_EQ(backend->mkdir("/dir/cold", 0755), -EEXIST);
+
+    // Replacing a file on the other tier removes it there
+    ASSERT_EQ(backend->rename("/hot", "/dir/cold", 0), 0);
+    EXPECT_EQ(tier("/dir/cold"), TieredBackend::FAST);
+    EXPECT_FALSE(exists(*capacity, "/dir/cold"));
+    EXPECT_EQ(read_file("/dir/cold"), "hot");
+
+    create(true);
+    ASSERT_EQ(backend->migrate(), 1u);
+    ASSERT_EQ(backend->rename("/dir", "/moved", 0), 0);
+    EXPECT_EQ(tier("/moved/cold"), TieredBackend::CAPACITY);
+    EXPECT_EQ(read_file("/moved/cold"), "hot");
+    EXPECT_FALSE(exists(*capacity, "/dir"));
+
+    ASSERT_EQ(backend->copy("/moved/cold", "/moved/copy"), 0);
+    EXPECT_EQ(tier("/moved/copy"), TieredBackend::CAPACITY);
+    EXPECT_EQ(backend->copy("/moved/cold", "/moved/copy"), -EEXIST);
+
+    std::unique_ptr<DirHandle> directory;
+    ASSERT_EQ(backend->opendir("/", directory), 0);
+    class Names : public StorageBackend::DirFiller {
+    public:
+        bool wants_attributes(std::string_view name) override {
+            return true;
+        }
+        int add(std::string_view name, const struct stat *st, off_t next, bool attributes) override {
+            names.emplace_back(name);
+            return 0;
+        }
+        std::vector<std::string> names;
+    } filler;
+    ASSERT_EQ(backend->readdir(*directory, 0, filler), 0);
+    std::sort(filler.names.begin(), filler.names.end());
+    EXPECT_EQ(filler.names, (std::vector<std::string>{".", "..", "link", "moved"}));
+}
+
+TEST_F(TieredBackendTest, migrations_are_rate_limited) {
+    create(true, 100000);
+    write_file("/file", std::string(50000, 'r'));
+
+    auto start = std::chrono::steady_clock::now();
+    ASSERT_EQ(backend->migrate(), 1u);
+    EXPECT_GE(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(400));
+    EXPECT_EQ(read_file("/file"), std::string(50000, 'r'));
+}
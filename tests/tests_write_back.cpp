@@ -0,0 +1,152 @@
+#include <fcntl.h>
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "common.h"
+#include "custom_vfs.h"
+#include "vfs_decorator.h"
+#include "write_back_vfs.h"
+
+namespace {
+
+/// Records the writes which reach the wrapped VFS
+class RecordingVfs : public VfsDecorator {
+public:
+    explicit RecordingVfs(CustomVfs &wrapped_vfs) : VfsDecorator(wrapped_vfs) {}
+
+    int write(std::string_view pathname, const char *buf, size_t count, off_t offset,
+              struct fuse_file_info *fi) override {
+        writes.push_back(count);
+        return get_wrapped().write(pathname, buf, count, offset, fi);
+    }
+
+    std::vector<size_t> writes;
+};
+
+class WriteBackTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        std::filesystem::create_directories(root / "backing");
+        vfs = std::make_unique<CustomVfs>((root / "mount").string(), (root / "backing").string());
+        recording = std::make_unique<RecordingVfs>(*vfs);
+        buffered = std::make_unique<WriteBackVfs>(*recording, 4096);
+    }
+
+    void TearDown() override {
+        buffered.reset();
+        recording.reset();
+        vfs.reset();
+    }
+
+    Common::TempDirectory root{"write_back"};
+    std::unique_ptr<CustomVfs> vfs;
+    std::unique_ptr<RecordingVfs> recording;
+    std::unique_ptr<WriteBackVfs> buffered;
+};
+
+}  // namespace
+
+TEST_F(WriteBackTest, small_writes_are_coalesced) {
+    struct fuse_file_info fi {};
+    fi.flags = O_RDWR;
+    ASSERT_EQ(buffered->create("/file", 0644, &fi), 0);
+
+    std::string chunk(256, 'a');
+    for (int i = 0; i < 8; i++) {
+        ASSERT_EQ(buffered->write("/file", chunk.data(), chunk.size(), i * 256, &fi), 256);
+    }
+    EXPECT_TRUE(recording->writes.empty());
+
+    struct stat st {};
+    ASSERT_EQ(buffered->getattr("/file", &st), 0);
+    EXPECT_EQ(st.st_size, 8 * 256);
+
+    ASSERT_EQ(buffered->flush("/file", &fi), 0);
+    EXPECT_EQ(recording->writes, (std::vector<size_t>{8 * 256}));
+
+    EXPECT_EQ(buffered->release("/file", &fi), 0);
+    EXPECT_EQ(std::filesystem::file_size(root / "backing" / "file"), 8 * 256);
+}
+
+TEST_F(WriteBackTest, full_buffer_and_large_writes_are_passed_on) {
+    struct fuse_file_info fi {};
+    fi.flags = O_RDWR;
+    ASSERT_EQ(buffered->create("/file", 0644, &fi), 0);
+
+    std::string chunk(1024, 'b');
+    for (int i = 0; i < 4; i++) {
+        ASSERT_EQ(buffered->write("/file", chunk.data(), chunk.size(), i * 1024, &fi), 1024);
+    }
+    EXPECT_EQ(recording->writes, (std::vector<size_t>{4096}));
+
+    std::string large(8192, 'c');
+    ASSERT_EQ(buffered->write("/file", large.data(), large.size(), 4096, &fi), 8192);
+    EXPECT_EQ(recording->writes, (std::vector<size_t>{4096, 8192}));
+
+    EXPECT_EQ(buffered->release("/file", &fi), 0);
+}
+
+TEST_F(WriteBackTest, overlapping_read_sees_buffered_data) {
+    struct fuse_file_info writer {};
+    writer.flags = O_RDWR;
+    ASSERT_EQ(buffered->create("/file", 0644, &writer), 0);
+
+    struct fuse_file_info reader {};
+    reader.flags = O_RDONLY;
+    ASSERT_EQ(buffered->open("/file", &reader), 0);
+
+    ASSERT_EQ(buffered->write("/file", "hello", 5, 0, &writer), 5);
+    ASSERT_EQ(buffered->write("/file", " world", 6, 5, &writer), 6);
+
+    char data[16] = {};
+    ASSERT_EQ(buffered->read("/file", data, sizeof(data), 0, &reader), 11);
+    EXPECT_EQ(std::string(data), "hello world");
+    EXPECT_EQ(recording->writes, (std::vector<size_t>{11}));
+
+    EXPECT_EQ(buffered->release("/file", &reader), 0);
+    EXPECT_EQ(buffered->release("/file", &writer), 0);
+}
+
+TEST_F(WriteBackTest, non_adjacent_write_flushes_first) {
+    struct fuse_file_info fi {};
+    fi.flags = O_RDWR;
+    ASSERT_EQ(buffered->create("/file", 0644, &fi), 0);
+
+    ASSERT_EQ(buffered->write("/file", "aaaa", 4, 0, &fi), 4);
+    ASSERT_EQ(buffered->write("/file", "bb", 2, 2, &fi), 2);
+    ASSERT_EQ(buffered->write("/file", "cccc", 4, 100, &fi), 4);
+    EXPECT_EQ(recording->writes, (std::vector<size_t>{4}));
+
+    ASSERT_EQ(buffered->fsync("/file", 1, &fi), 0);
+    EXPECT_EQ(recording->writes, (std::vector<size_t>{4, 4}));
+    EXPECT_EQ(buffered->release("/file", &fi), 0);
+
+    char data[4] = {};
+    int fd = ::open((root / "backing" / "file").c_str(), O_RDONLY);
+    ASSERT_EQ(::pread(fd, data, 4, 0), 4);
+    ::close(fd);
+    EXPECT_EQ(std::string(data, 4), "aabb");
+}
+
+TEST_F(WriteBackTest, rename_flushes_and_moves_the_buffer) {
+    struct fuse_file_info fi {};
+    fi.flags = O_RDWR;
+    ASSERT_EQ(buffered->create("/file", 0644, &fi), 0);
+
+    ASSERT_EQ(buffered->write("/file", "before", 6, 0, &fi), 6);
+    ASSERT_EQ(buffered->rename("/file", "/moved", 0), 0);
+    EXPECT_EQ(recording->writes, (std::vector<size_t>{6}));
+
+    // Data buffered after the rename is found under the new name
+    ASSERT_EQ(buffered->write("/moved", "after", 5, 6, &fi), 5);
+    struct stat st {};
+    ASSERT_EQ(buffered->getattr("/moved", &st), 0);
+    EXPECT_EQ(st.st_size, 11);
+
+    EXPECT_EQ(buffered->release("/moved", &fi), 0);
+    EXPECT_EQ(std::filesystem::file_size(root / "backing" / "moved"), 11);
+}